@@ -0,0 +1,381 @@
+#include "batch.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "pipeline.h"
+#include "socket.h"
+#include "utils.h"
+
+/** State shared by the stages of \ref mtrix_batch_run. */
+struct state {
+    const struct mtrix_batch *b;
+    /** Source of lines. */
+    FILE *f;
+    /** Sockets of all workers, `-1` for those removed by \ref process. */
+    int *fds;
+    size_t n_fds;
+    /** Sockets of the workers not executing a line, see \ref process. */
+    int *idle;
+    size_t n_idle;
+    /** Number of workers which have not been removed. */
+    size_t n_live;
+    pthread_mutex_t mtx;
+    /** Signaled when a worker becomes idle or is removed. */
+    pthread_cond_t cond;
+    /** Cleared if any line fails. */
+    bool ok;
+};
+
+/**
+ * Creates a worker process, see \ref supervise.
+ * \param fds Sockets of the previous workers, closed in the new one.
+ * \param pid Set to the identifier of the process.
+ * \return The socket used to communicate with the worker, or `-1`.
+ */
+static int start_worker(
+    const struct mtrix_batch *b, const int *fds, size_t n, pid_t *pid);
+
+/**
+ * Main function of worker processes.
+ * Lines are executed by a child process (see \ref serve), which is replaced if
+ * it is killed.  Exits when `fd` is closed by the parent.
+ */
+static _Noreturn void supervise(const struct mtrix_batch *b, int fd);
+
+/**
+ * Executes lines received from `fd` until it is closed.
+ * Each request is a line as in \ref mtrix_daemon_send, followed by its
+ * position.  Responses are as in \ref mtrix_daemon_recv.
+ */
+static bool serve(const struct mtrix_batch *b, int fd);
+
+/** Reads the entire contents of `f`, appending them to `b`. */
+static bool read_file(FILE *f, struct mtrix_buffer *b);
+
+/** Reader stage of \ref mtrix_batch_run. */
+static enum mtrix_pipeline_read read_line(
+    void *data, struct mtrix_pipeline_item *item);
+
+/**
+ * Worker stage of \ref mtrix_batch_run, sends the line to a worker.
+ * A worker whose socket fails is removed, since it may have exited or be out
+ * of sync with the protocol.  Its process is replaced by \ref supervise only
+ * if it is killed while executing a line.
+ */
+static bool process(void *data, struct mtrix_pipeline_item *item);
+
+/** Closes the socket of a failed worker, see \ref process. */
+static void remove_worker(struct state *s, int fd);
+
+/** Writer stage of \ref mtrix_batch_run. */
+static bool write_output(void *data, struct mtrix_pipeline_item *item);
+
+bool mtrix_batch_run(const struct mtrix_batch *b, FILE *f) {
+    struct mtrix_batch_workers w;
+    if(!mtrix_batch_start(b, &w))
+        return false;
+    int *const idle = calloc(w.n, sizeof(*idle));
+    bool ret = false;
+    if(!idle)
+        log_errno("calloc");
+    else {
+        memcpy(idle, w.fds, w.n * sizeof(*w.fds));
+        struct state s = {
+            .b = b, .f = f, .fds = w.fds, .n_fds = w.n, .idle = idle,
+            .n_idle = w.n, .n_live = w.n, .ok = true,
+            .mtx = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER,
+        };
+        const struct mtrix_pipeline p = {
+            .n_workers = w.n,
+            .data = &s,
+            .read = read_line,
+            .process = process,
+            .write = write_output,
+        };
+        ret = mtrix_pipeline_run(&p) && s.ok;
+    }
+    free(idle);
+    return mtrix_batch_stop(&w) && ret;
+}
+
+bool mtrix_batch_start(
+    const struct mtrix_batch *b, struct mtrix_batch_workers *w
+) {
+    const size_t n = b->n_workers;
+    *w = (struct mtrix_batch_workers){
+        .fds = calloc(n, sizeof(*w->fds)),
+        .pids = calloc(n, sizeof(*w->pids)),
+    };
+    if(!(w->fds && w->pids)) {
+        log_errno("calloc");
+        return mtrix_batch_stop(w), false;
+    }
+    // Buffered output would be duplicated in each worker.
+    fflush(stdout);
+    fflush(stderr);
+    for(; w->n != n; ++w->n)
+        if((w->fds[w->n] = start_worker(b, w->fds, w->n, w->pids + w->n))
+                == -1)
+            return mtrix_batch_stop(w), false;
+    return true;
+}
+
+bool mtrix_batch_stop(struct mtrix_batch_workers *w) {
+    bool ret = true;
+    // Workers exit once their sockets are closed.
+    for(size_t i = 0; i != w->n; ++i)
+        if(w->fds[i] != -1 && close(w->fds[i]) == -1)
+            log_errno("close");
+    for(size_t i = 0; i != w->n; ++i) {
+        int status = 0;
+        while(waitpid(w->pids[i], &status, 0) == -1)
+            if(errno != EINTR) {
+                log_errno("waitpid");
+                break;
+            }
+        if(!WIFEXITED(status) || WEXITSTATUS(status))
+            ret = false;
+    }
+    free(w->pids);
+    free(w->fds);
+    *w = (struct mtrix_batch_workers){0};
+    return ret;
+}
+
+bool mtrix_batch_send(int fd, const char *line, size_t seq) {
+    const uint64_t seq64 = seq;
+    return mtrix_daemon_send(fd, line)
+        && mtrix_socket_send_all(fd, &seq64, sizeof(seq64));
+}
+
+int start_worker(
+    const struct mtrix_batch *b, const int *fds, size_t n, pid_t *pid
+) {
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        return log_errno("socketpair"), -1;
+    // Commands may spawn processes, which should not hold the sockets.
+    for(int i = 0; i != 2; ++i)
+        if(fcntl(sv[i], F_SETFD, FD_CLOEXEC) == -1)
+            log_errno("fcntl(FD_CLOEXEC)");
+    if((*pid = fork()) == -1) {
+        log_errno("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if(!*pid) {
+        // Otherwise, previous workers would not see their sockets closed.
+        for(size_t i = 0; i != n; ++i)
+            close(fds[i]);
+        close(sv[0]);
+        supervise(b, sv[1]);
+    }
+    close(sv[1]);
+    return sv[0];
+}
+
+void supervise(const struct mtrix_batch *b, int fd) {
+    // Workers never return to the caller, and exit with `_exit` so that they
+    // do not flush or reposition streams shared with the parent.
+    for(;;) {
+        const pid_t pid = fork();
+        if(pid == -1)
+            log_errno("fork"), _exit(1);
+        if(!pid)
+            _exit(!serve(b, fd));
+        int status = 0;
+        while(waitpid(pid, &status, 0) == -1)
+            if(errno != EINTR)
+                log_errno("waitpid"), _exit(1);
+        if(WIFEXITED(status))
+            _exit(WEXITSTATUS(status));
+        // Killed while executing a line, which fails in its place.
+        char msg[128];
+        const int len = snprintf(
+            msg, sizeof(msg), "%s: killed by signal %d\n", PROG_NAME,
+            WTERMSIG(status));
+        const struct mtrix_daemon_resp resp = {
+            .err_len = (uint32_t)len, .status = 1};
+        if(len < 0 || (size_t)len >= sizeof(msg)
+                || !mtrix_socket_send_all(fd, &resp, sizeof(resp))
+                || !mtrix_socket_send_all(fd, msg, (size_t)len))
+            _exit(1);
+    }
+}
+
+bool serve(const struct mtrix_batch *b, int fd) {
+    if(b->init)
+        b->init(b->data);
+    char line[MTRIX_DAEMON_MAX_CMD + 1];
+    for(;;) {
+        struct mtrix_daemon_req req;
+        const ssize_t r = read(fd, &req, MTRIX_DAEMON_REQ_SIZE);
+        if(!r)
+            return true;
+        if(r == -1) {
+            if(errno == EINTR)
+                continue;
+            return log_errno("%s: read", __func__), false;
+        }
+        const size_t n = (size_t)r;
+        if(!read_all(fd, (char*)&req + n, MTRIX_DAEMON_REQ_SIZE - n))
+            return false;
+        if(req.len > MTRIX_DAEMON_MAX_CMD)
+            return log_err("%s: invalid length\n", __func__), false;
+        uint64_t seq = 0;
+        if(!(read_all(fd, line, req.len) && read_all(fd, &seq, sizeof(seq))))
+            return false;
+        line[req.len] = 0;
+        struct mtrix_daemon_output output = {0};
+        bool ret = mtrix_batch_capture(b, line, (size_t)seq, &output);
+        if(ret) {
+            const struct mtrix_daemon_resp resp = {
+                .out_len = (uint32_t)output.out.n,
+                .err_len = (uint32_t)output.err.n,
+                .status = output.status,
+            };
+            ret = mtrix_socket_send_all(fd, &resp, sizeof(resp))
+                && mtrix_socket_send_all(fd, output.out.p, output.out.n)
+                && mtrix_socket_send_all(fd, output.err.p, output.err.n);
+        }
+        free(output.out.p);
+        free(output.err.p);
+        if(!ret)
+            return false;
+    }
+}
+
+bool mtrix_batch_capture(
+    const struct mtrix_batch *b, char *line, size_t seq,
+    struct mtrix_daemon_output *output
+) {
+    FILE *const files[2] = {tmpfile(), tmpfile()};
+    const int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    int saved[2] = {-1, -1};
+    bool ret = false;
+    if(!(files[0] && files[1])) {
+        log_errno("tmpfile");
+        goto end;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    for(int i = 0; i < 2; ++i)
+        if((saved[i] = dup(fds[i])) == -1
+                || dup2(fileno(files[i]), fds[i]) == -1) {
+            log_errno("dup");
+            goto restore;
+        }
+    output->status = !b->run(b->data, line, seq);
+    ret = true;
+restore:
+    fflush(stdout);
+    fflush(stderr);
+    for(int i = 0; i < 2; ++i) {
+        if(saved[i] == -1)
+            continue;
+        if(dup2(saved[i], fds[i]) == -1) {
+            log_errno("dup2");
+            ret = false;
+        }
+        if(close(saved[i]) == -1)
+            log_errno("close");
+    }
+    ret = ret
+        && read_file(files[0], &output->out)
+        && read_file(files[1], &output->err);
+end:
+    for(int i = 0; i < 2; ++i)
+        if(files[i] && fclose(files[i]))
+            log_errno("fclose");
+    return ret;
+}
+
+bool read_file(FILE *f, struct mtrix_buffer *b) {
+    rewind(f);
+    char buffer[4096];
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), f)))
+        mtrix_buffer_append(buffer, 1, n, b);
+    if(ferror(f))
+        return log_errno("%s: fread", __func__), false;
+    return true;
+}
+
+enum mtrix_pipeline_read read_line(
+    void *data, struct mtrix_pipeline_item *item
+) {
+    FILE *const f = ((struct state*)data)->f;
+    if(getline(&item->in.p, &item->in.n, f) != -1)
+        return MTRIX_PIPELINE_ITEM;
+    if(!ferror(f))
+        return MTRIX_PIPELINE_END;
+    log_errno("getline");
+    return MTRIX_PIPELINE_ERR;
+}
+
+bool process(void *data, struct mtrix_pipeline_item *item) {
+    struct state *const s = data;
+    // Rejected before a worker is used, see mtrix_daemon_send.
+    if(strlen(item->in.p) > MTRIX_DAEMON_MAX_CMD)
+        return log_err("command too long\n"), false;
+    // There is a worker for each thread, so one is available unless some
+    // were removed.
+    pthread_mutex_lock(&s->mtx);
+    while(!s->n_idle && s->n_live)
+        pthread_cond_wait(&s->cond, &s->mtx);
+    const int fd = s->n_idle ? s->idle[--s->n_idle] : -1;
+    pthread_mutex_unlock(&s->mtx);
+    if(fd == -1)
+        return log_err("no workers left\n"), false;
+    struct mtrix_daemon_output output = {0};
+    const bool ret = mtrix_batch_send(fd, item->in.p, item->seq)
+        && mtrix_daemon_recv(fd, &output);
+    pthread_mutex_lock(&s->mtx);
+    if(ret)
+        s->idle[s->n_idle++] = fd;
+    else
+        remove_worker(s, fd);
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mtx);
+    item->out = output.out;
+    item->err = output.err;
+    return ret && !output.status;
+}
+
+void remove_worker(struct state *s, int fd) {
+    log_err("removing failed worker\n");
+    for(size_t i = 0; i != s->n_fds; ++i)
+        if(s->fds[i] == fd)
+            s->fds[i] = -1;
+    if(close(fd) == -1)
+        log_errno("close");
+    --s->n_live;
+}
+
+bool write_output(void *data, struct mtrix_pipeline_item *item) {
+    struct state *const s = data;
+    const struct mtrix_batch *const b = s->b;
+    if(!write_all(b->out, item->out.p, item->out.n)
+            || !write_all(b->err, item->err.p, item->err.n))
+        return false;
+    if(item->ok)
+        return true;
+    s->ok = false;
+    char msg[128];
+    const int n = snprintf(
+        msg, sizeof(msg), "%s: line %zu failed\n", PROG_NAME, item->seq + 1);
+    const size_t len = (size_t)n < sizeof(msg) ? (size_t)n : sizeof(msg) - 1;
+    return n < 0 || write_all(b->err, msg, len);
+}
@@ -0,0 +1,93 @@
+#ifndef MACHINATRIX_BATCH_H
+#define MACHINATRIX_BATCH_H
+
+/**
+ * \file
+ * Concurrent execution of the lines of a file, with output in input order.
+ * Lines are executed by a fixed set of worker processes, created before any
+ * thread so that they can run arbitrary code (a process forked by a
+ * multithreaded one may only call async-signal-safe functions).  Workers keep
+ * their state between lines, e.g. the connections kept by \ref request.
+ *
+ * The output and errors of each line are captured by the worker and written
+ * once those of all previous lines are, see \ref mtrix_pipeline.  A worker
+ * which crashes is replaced, only the line it was executing fails.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <sys/types.h>
+
+#include "daemon.h"
+
+/** Parameters of \ref mtrix_batch_run. */
+struct mtrix_batch {
+    /** Number of worker processes (at least one). */
+    size_t n_workers;
+    /** Passed to \ref init and \ref run. */
+    void *data;
+    /** Optional, called in each worker process before it executes lines. */
+    void (*init)(void *data);
+    /**
+     * Executes a line in a worker process, which writes to the standard
+     * streams.
+     * \param seq Position of the line in the input, starting at zero.
+     */
+    bool (*run)(void *data, char *line, size_t seq);
+    /** Descriptors where the output and errors of all lines are written. */
+    int out, err;
+};
+
+/** Worker processes created by \ref mtrix_batch_start. */
+struct mtrix_batch_workers {
+    /** Sockets used to communicate with each worker, `-1` once closed. */
+    int *fds;
+    /** Identifiers of the worker processes. */
+    pid_t *pids;
+    /** Number of workers. */
+    size_t n;
+};
+
+/**
+ * Creates the worker processes of `b`.
+ * Must be called before any thread is created.  Lines are sent with
+ * \ref mtrix_batch_send and their results received with
+ * \ref mtrix_daemon_recv.  A socket which fails should be closed and set to
+ * `-1`, the worker may have exited or be out of sync with the protocol.
+ */
+bool mtrix_batch_start(
+    const struct mtrix_batch *b, struct mtrix_batch_workers *w);
+
+/**
+ * Closes the sockets of all workers and waits for them to exit.
+ * \return `false` if any worker failed.
+ */
+bool mtrix_batch_stop(struct mtrix_batch_workers *w);
+
+/**
+ * Sends a line to be executed by a worker.
+ * \param seq Position of the line, see \ref mtrix_batch::run.
+ */
+bool mtrix_batch_send(int fd, const char *line, size_t seq);
+
+/**
+ * Executes all lines in `f`.
+ * Failed lines are reported after their errors, but do not interrupt the
+ * processing of the remaining lines.
+ * \return `false` if any line failed or could not be executed.
+ */
+bool mtrix_batch_run(const struct mtrix_batch *b, FILE *f);
+
+/**
+ * Executes a line with \ref mtrix_batch::run in the calling process, as the
+ * workers do, capturing its output and errors.
+ * Commands write to the standard streams directly and through child processes,
+ * so the descriptors themselves are redirected.
+ */
+bool mtrix_batch_capture(
+    const struct mtrix_batch *b, char *line, size_t seq,
+    struct mtrix_daemon_output *output);
+
+#endif
@@ -0,0 +1,631 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+
+enum {
+    /** Length of the file names of entries, see \ref mtrix_cache_path. */
+    NAME_LEN = 16,
+    /** Maximum number of URLs locked at once by a process, see \ref locks. */
+    MAX_LOCKS = 64,
+};
+
+/** Prepended to the keys of negative entries, which cannot be a URL. */
+#define NEGATIVE_PREFIX "negative:\n"
+
+/** Identifies cache files. */
+static const char MAGIC[8] = "MTRXHTTP";
+
+/** Header of cache files. */
+struct header {
+    char magic[sizeof(MAGIC)];
+    uint32_t version;
+    uint32_t url_len;
+    uint32_t etag_len;
+    uint32_t last_modified_len;
+    /** \ref mtrix_cache_entry::time */
+    int64_t time;
+    uint64_t body_len;
+};
+
+/** Result of \ref lookup_begin. */
+enum lookup_state {
+    /** The stored response can be used. */
+    LOOKUP_DONE,
+    /** The response must be requested. */
+    LOOKUP_FETCH,
+    /** Another thread or process is requesting the same URL. */
+    LOOKUP_DEFER,
+};
+
+/** State of each URL in \ref mtrix_cache_request_multi. */
+struct lookup {
+    /** Stored response, replaced by the new one if requested. */
+    struct mtrix_cache_entry e;
+    /** Whether \ref e was loaded from the cache. */
+    bool cached;
+    /** Whether the lookup was not deferred. */
+    bool done;
+    /** Held while the request is performed, see \ref lock_url. */
+    off_t lock;
+};
+
+/** Size and last use of a file, used for eviction. */
+struct file {
+    struct timespec mtime;
+    uint64_t size;
+    char name[NAME_LEN + 1];
+};
+
+/**
+ * URLs locked by the threads of this process, see \ref lock_url.
+ * Locks of `fcntl` belong to processes: they do not exclude other threads, and
+ * closing any descriptor of the file releases all of them.  Threads are
+ * excluded here instead, and all locks are taken on a single descriptor.
+ */
+static struct {
+    pthread_mutex_t mtx;
+    /** Signaled when a lock is released. */
+    pthread_cond_t cond;
+    /** Descriptor of the file at \ref path, `-1` if it is not open. */
+    int fd;
+    char path[MTRIX_MAX_PATH];
+    /** Locked bytes of the file. */
+    off_t bytes[MAX_LOCKS];
+    size_t n;
+} locks = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+};
+
+/** Builds the key of a negative entry, which must be freed. */
+static char *negative_key(const char *key);
+
+/**
+ * Checks the stored response for `url` and determines whether it needs to be
+ * requested, locking the URL in that case.
+ * \param wait Whether to wait if the URL is locked by another thread or
+ *             process, in which case the lookup is never deferred.
+ */
+static enum lookup_state lookup_begin(
+    const struct mtrix_cache *c, const char *url, int64_t now, bool wait,
+    struct lookup *l, bool verbose);
+
+/**
+ * Handles the response of a request performed after \ref lookup_begin,
+ * updating the cache.
+ * \param stored Set if a new response is stored.
+ */
+static bool lookup_end(
+    const struct mtrix_cache *c, const char *url, int64_t now,
+    struct lookup *l, struct mtrix_transfer *t, bool *stored);
+
+/**
+ * Takes the place of the thread or process requesting `url`.
+ * \param wait Whether to wait for another one which holds the lock, or fail
+ *             immediately.
+ * \return The locked byte, released with \ref unlock_url, or `-1`.
+ */
+static off_t lock_url(const struct mtrix_cache *c, const char *url, bool wait);
+
+/**
+ * Excludes other threads of this process from a byte of the file at `path`,
+ * see \ref locks.
+ * \return The descriptor where the byte is to be locked, or `-1`.
+ */
+static int lock_thread(const char *path, off_t byte, bool wait);
+
+/** Releases a byte locked by \ref lock_url or \ref lock_thread. */
+static void unlock_url(off_t byte, bool locked);
+
+/** Reads the contents of an entry from `fd`, following the header. */
+static bool read_entry(
+    int fd, const char *path, const struct header *h, const char *url,
+    struct mtrix_cache_entry *e);
+
+/** Reads a header value of length `n` into `dst`. */
+static bool read_header(int fd, const char *path, size_t n, char *dst);
+
+/** Writes an entry to `fd`. */
+static bool write_entry(
+    int fd, const char *url, const struct mtrix_cache_entry *e);
+
+/** Performs the eviction, with the lock held. */
+static bool evict(const struct mtrix_cache *c);
+
+/** Whether `name` has the format used for entries. */
+static bool is_entry_name(const char *name);
+
+/** Orders files by last use, as required by `qsort`. */
+static int cmp_mtime(const void *lhs, const void *rhs);
+
+bool mtrix_cache_request(
+    const struct mtrix_cache *c, const char *url, struct mtrix_buffer *b,
+    long *status, bool verbose
+) {
+    bool ok = false;
+    return mtrix_cache_request_multi(c, 1, &url, b, &ok, status, verbose)
+        && ok;
+}
+
+bool mtrix_cache_request_multi(
+    const struct mtrix_cache *c, size_t n, const char *const *urls,
+    struct mtrix_buffer *bs, bool *ok, long *status, bool verbose
+) {
+    const int64_t now = (int64_t)time(NULL);
+    struct lookup *const v = calloc(n, sizeof(*v));
+    struct mtrix_transfer *const t = calloc(n, sizeof(*t));
+    size_t *const ti = calloc(n, sizeof(*ti));
+    bool ret = false, stored = false;
+    if(!(v && t && ti)) {
+        log_errno("calloc");
+        goto end;
+    }
+    size_t nt = 0;
+    for(size_t i = 0; i != n; ++i) {
+        v[i].lock = -1;
+        ok[i] = false;
+        if(status)
+            status[i] = 200;
+        switch(lookup_begin(c, urls[i], now, n == 1, v + i, verbose)) {
+        case LOOKUP_DONE: ok[i] = true; break;
+        case LOOKUP_FETCH:
+            t[nt] = (struct mtrix_transfer){
+                .url = urls[i],
+                .req = v[i].cached ? &v[i].e.validators : NULL,
+                .body.stop = bs[i].stop,
+            };
+            ti[nt++] = i;
+            break;
+        case LOOKUP_DEFER: break;
+        }
+    }
+    // A single request uses the handle kept for its host.
+    if(nt == 1)
+        request_cond(
+            t->url, &t->body, t->req ? t->req : &(struct mtrix_validators){0},
+            &t->resp, &t->status, verbose);
+    else if(nt)
+        request_multi(nt, t, verbose);
+    for(size_t j = 0; j != nt; ++j) {
+        const size_t i = ti[j];
+        ok[i] = lookup_end(c, urls[i], now, v + i, t + j, &stored);
+        if(status && t[j].status != 304)
+            status[i] = t[j].status;
+        free(t[j].body.p);
+    }
+    // Released before waiting for other requests, which may be waiting for
+    // this one.
+    for(size_t i = 0; i != n; ++i)
+        if(v[i].lock != -1)
+            unlock_url(v[i].lock, true);
+    for(size_t i = 0; i != n; ++i) {
+        if(ok[i])
+            mtrix_buffer_append(v[i].e.body.p, 1, v[i].e.body.n, bs + i);
+        // Busy in another thread or process, wait for it.
+        else if(!v[i].done)
+            ok[i] = mtrix_cache_request(
+                c, urls[i], bs + i, status ? status + i : NULL, verbose);
+        free(v[i].e.body.p);
+    }
+    if(stored)
+        mtrix_cache_evict(c);
+    ret = true;
+end:
+    free(ti);
+    free(t);
+    free(v);
+    return ret;
+}
+
+enum lookup_state lookup_begin(
+    const struct mtrix_cache *c, const char *url, int64_t now, bool wait,
+    struct lookup *l, bool verbose
+) {
+    l->cached = mtrix_cache_load(c, url, &l->e);
+    if(l->cached && now - l->e.time < c->ttl) {
+        if(verbose)
+            printf("Cached: %s\n", url);
+        return l->done = true, LOOKUP_DONE;
+    }
+    // Failing to lock only means the request is not coalesced.
+    if((l->lock = lock_url(c, url, wait)) == -1)
+        return wait ? (l->done = true, LOOKUP_FETCH) : LOOKUP_DEFER;
+    const int64_t prev = l->cached ? l->e.time : INT64_MIN;
+    free(l->e.body.p);
+    l->e = (struct mtrix_cache_entry){0};
+    l->done = true;
+    // Stored while waiting for the lock, by a concurrent request.
+    if(!(l->cached = mtrix_cache_load(c, url, &l->e))
+            || (l->e.time == prev && now - l->e.time >= c->ttl))
+        return LOOKUP_FETCH;
+    if(verbose)
+        printf("Coalesced: %s\n", url);
+    if(c->coalesced) {
+        // Shared by all threads.
+        pthread_mutex_lock(&locks.mtx);
+        ++*c->coalesced;
+        pthread_mutex_unlock(&locks.mtx);
+    }
+    return LOOKUP_DONE;
+}
+
+bool lookup_end(
+    const struct mtrix_cache *c, const char *url, int64_t now,
+    struct lookup *l, struct mtrix_transfer *t, bool *stored
+) {
+    struct mtrix_cache_entry *const e = &l->e;
+    // Failed transfers have already been reported.
+    if(!t->status)
+        return false;
+    if(!http_status_usable(t->status))
+        return log_err("%s: HTTP status %ld\n", url, t->status), false;
+    if(l->cached && t->status == 304) {
+        e->time = now;
+        // Validators are usually repeated, but may also be omitted.
+        const struct mtrix_validators *const v = &t->resp;
+        if(*v->etag)
+            memcpy(e->validators.etag, v->etag, sizeof(v->etag));
+        if(*v->last_modified)
+            memcpy(
+                e->validators.last_modified, v->last_modified,
+                sizeof(v->last_modified));
+        mtrix_cache_store(c, url, e);
+        return true;
+    }
+    free(e->body.p);
+    *e = (struct mtrix_cache_entry){
+        .time = now, .validators = t->resp, .body = t->body};
+    t->body = (struct mtrix_buffer){0};
+    if(t->status == 200 && mtrix_cache_store(c, url, e))
+        *stored = true;
+    return true;
+}
+
+off_t lock_url(const struct mtrix_cache *c, const char *url, bool wait) {
+    char path[MTRIX_MAX_PATH] = {0};
+    if(!(mkdir_p(c->dir, 0700) && join_path(path, 2, c->dir, "/inflight")))
+        return -1;
+    // The file itself remains empty, different URLs may share a byte.
+    const off_t byte = (off_t)(mtrix_hash_str(url) & INT32_MAX);
+    const int fd = lock_thread(path, byte, wait);
+    if(fd == -1)
+        return -1;
+    struct flock l = {
+        .l_type = F_WRLCK,
+        .l_whence = SEEK_SET,
+        .l_start = byte,
+        .l_len = 1,
+    };
+    while(fcntl(fd, wait ? F_SETLKW : F_SETLK, &l) == -1)
+        if(errno != EINTR) {
+            if(wait || (errno != EACCES && errno != EAGAIN))
+                log_errno("fcntl: %s", path);
+            else
+                errno = 0;
+            unlock_url(byte, false);
+            return -1;
+        }
+    return byte;
+}
+
+int lock_thread(const char *path, off_t byte, bool wait) {
+    int ret = -1;
+    pthread_mutex_lock(&locks.mtx);
+    for(;;) {
+        // The file is only replaced once no byte is locked.
+        bool busy = locks.n == MAX_LOCKS
+            || (locks.n && strcmp(locks.path, path));
+        for(size_t i = 0; !busy && i != locks.n; ++i)
+            busy = locks.bytes[i] == byte;
+        if(!busy)
+            break;
+        if(!wait)
+            goto end;
+        pthread_cond_wait(&locks.cond, &locks.mtx);
+    }
+    if(locks.fd == -1 || strcmp(locks.path, path)) {
+        if(locks.fd != -1 && close(locks.fd) == -1)
+            log_errno("close: %s", locks.path);
+        if((locks.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1) {
+            log_errno("open: %s", path);
+            goto end;
+        }
+        strlcpy(locks.path, path, sizeof(locks.path));
+    }
+    locks.bytes[locks.n++] = byte;
+    ret = locks.fd;
+end:
+    pthread_mutex_unlock(&locks.mtx);
+    return ret;
+}
+
+void unlock_url(off_t byte, bool locked) {
+    struct flock l = {
+        .l_type = F_UNLCK,
+        .l_whence = SEEK_SET,
+        .l_start = byte,
+        .l_len = 1,
+    };
+    pthread_mutex_lock(&locks.mtx);
+    if(locked && fcntl(locks.fd, F_SETLK, &l) == -1)
+        log_errno("fcntl: %s", locks.path);
+    for(size_t i = 0; i != locks.n; ++i)
+        if(locks.bytes[i] == byte) {
+            locks.bytes[i] = locks.bytes[--locks.n];
+            break;
+        }
+    pthread_cond_broadcast(&locks.cond);
+    pthread_mutex_unlock(&locks.mtx);
+}
+
+bool mtrix_cache_path(
+    const struct mtrix_cache *c, const char *url,
+    char path[static MTRIX_MAX_PATH]
+) {
+    char name[1 + NAME_LEN + 1];
+    snprintf(name, sizeof(name), "/%016" PRIx64, mtrix_hash_str(url));
+    return join_path(path, 2, c->dir, name);
+}
+
+bool mtrix_cache_load(
+    const struct mtrix_cache *c, const char *url, struct mtrix_cache_entry *e
+) {
+    char path[MTRIX_MAX_PATH] = {0};
+    if(!mtrix_cache_path(c, url, path))
+        return false;
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        if(errno != ENOENT)
+            log_errno("open: %s", path);
+        return false;
+    }
+    bool ret = false;
+    struct header h;
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        log_errno("fstat: %s", path);
+        goto end;
+    }
+    // Files in an older format are silently replaced.
+    if((size_t)st.st_size < sizeof(h) || !read_all(fd, &h, sizeof(h))
+            || memcmp(h.magic, MAGIC, sizeof(MAGIC))
+            || h.version != MTRIX_CACHE_VERSION)
+        goto end;
+    const uint64_t size = (uint64_t)sizeof(h) + h.url_len + h.etag_len
+        + h.last_modified_len + h.body_len;
+    if(size != (uint64_t)st.st_size || h.etag_len >= MTRIX_MAX_HEADER
+            || h.last_modified_len >= MTRIX_MAX_HEADER) {
+        log_err("%s: invalid cache file\n", path);
+        goto end;
+    }
+    if(!read_entry(fd, path, &h, url, e))
+        goto end;
+    // Updates the modification time, which marks the entry as recently used.
+    if(futimens(fd, NULL) == -1)
+        log_errno("futimens: %s", path);
+    ret = true;
+end:
+    if(close(fd) == -1)
+        log_errno("close: %s", path);
+    return ret;
+}
+
+bool read_entry(
+    int fd, const char *path, const struct header *h, const char *url,
+    struct mtrix_cache_entry *e
+) {
+    // Different URLs can have the same hash, only the last one is stored.
+    const size_t url_len = strlen(url);
+    if(h->url_len != url_len)
+        return false;
+    char *const p = malloc(url_len);
+    if(!p)
+        return log_err("%s: malloc\n", __func__), false;
+    const bool same = read_all(fd, p, url_len) && !memcmp(p, url, url_len);
+    free(p);
+    if(!same)
+        return false;
+    if(!(read_header(fd, path, h->etag_len, e->validators.etag)
+            && read_header(
+                fd, path, h->last_modified_len,
+                e->validators.last_modified)))
+        return false;
+    char *const body = malloc(h->body_len + 1);
+    if(!body)
+        return log_err("%s: malloc\n", __func__), false;
+    if(!read_all(fd, body, h->body_len))
+        return log_err("%s: failed to read body\n", path), free(body), false;
+    body[h->body_len] = 0;
+    e->time = h->time;
+    e->body = (struct mtrix_buffer){.p = body, .n = h->body_len};
+    return true;
+}
+
+bool read_header(int fd, const char *path, size_t n, char *dst) {
+    if(!read_all(fd, dst, n))
+        return log_err("%s: failed to read header\n", path), false;
+    dst[n] = 0;
+    return true;
+}
+
+bool mtrix_cache_store(
+    const struct mtrix_cache *c, const char *url,
+    const struct mtrix_cache_entry *e
+) {
+    char path[MTRIX_MAX_PATH] = {0}, tmp[MTRIX_MAX_PATH] = {0};
+    if(!(mtrix_cache_path(c, url, path)
+            && join_path(tmp, 2, path, ".XXXXXX")
+            && mkdir_p(c->dir, 0700)))
+        return false;
+    const int fd = mkstemp(tmp);
+    if(fd == -1)
+        return log_errno("mkstemp: %s", tmp), false;
+    bool ret = write_entry(fd, url, e);
+    if(close(fd) == -1)
+        log_errno("close: %s", tmp), ret = false;
+    // Concurrent readers see either the previous file or the complete new one.
+    if(ret && rename(tmp, path) == -1)
+        log_errno("rename: %s", path), ret = false;
+    if(!ret && unlink(tmp) == -1)
+        log_errno("unlink: %s", tmp);
+    return ret;
+}
+
+bool write_entry(int fd, const char *url, const struct mtrix_cache_entry *e) {
+    const struct mtrix_validators *const v = &e->validators;
+    struct header h = {
+        .version = MTRIX_CACHE_VERSION,
+        .url_len = (uint32_t)strlen(url),
+        .etag_len = (uint32_t)strlen(v->etag),
+        .last_modified_len = (uint32_t)strlen(v->last_modified),
+        .time = e->time,
+        .body_len = e->body.n,
+    };
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    return write_all(fd, &h, sizeof(h))
+        && write_all(fd, url, h.url_len)
+        && write_all(fd, v->etag, h.etag_len)
+        && write_all(fd, v->last_modified, h.last_modified_len)
+        && write_all(fd, e->body.p, e->body.n);
+}
+
+bool mtrix_cache_is_negative(const struct mtrix_cache *c, const char *key) {
+    char *const k = negative_key(key);
+    if(!k)
+        return false;
+    struct mtrix_cache_entry e = {0};
+    const bool ret = mtrix_cache_load(c, k, &e)
+        && (int64_t)time(NULL) - e.time < c->negative_ttl;
+    free(e.body.p);
+    free(k);
+    return ret;
+}
+
+bool mtrix_cache_store_negative(const struct mtrix_cache *c, const char *key) {
+    char *const k = negative_key(key);
+    if(!k)
+        return false;
+    const struct mtrix_cache_entry e = {.time = (int64_t)time(NULL)};
+    const bool ret = mtrix_cache_store(c, k, &e);
+    free(k);
+    return ret && mtrix_cache_evict(c);
+}
+
+char *negative_key(const char *key) {
+    const size_t n = sizeof(NEGATIVE_PREFIX) - 1, len = strlen(key);
+    char *const ret = malloc(n + len + 1);
+    if(!ret)
+        return log_err("%s: malloc\n", __func__), NULL;
+    memcpy(ret, NEGATIVE_PREFIX, n);
+    memcpy(ret + n, key, len + 1);
+    return ret;
+}
+
+bool mtrix_cache_evict(const struct mtrix_cache *c) {
+    if(!c->max_size)
+        return true;
+    char path[MTRIX_MAX_PATH] = {0};
+    if(!join_path(path, 2, c->dir, "/lock"))
+        return false;
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd == -1)
+        return log_errno("open: %s", path), false;
+    bool ret = false;
+    // Eviction is not urgent, it is simply skipped if already in progress.
+    if(flock(fd, LOCK_EX | LOCK_NB) == -1)
+        ret = errno == EWOULDBLOCK || (log_errno("flock: %s", path), false);
+    else
+        ret = evict(c);
+    if(close(fd) == -1)
+        log_errno("close: %s", path);
+    return ret;
+}
+
+bool evict(const struct mtrix_cache *c) {
+    DIR *const dir = opendir(c->dir);
+    if(!dir)
+        return log_errno("opendir: %s", c->dir), false;
+    const int dir_fd = dirfd(dir);
+    struct file *v = NULL;
+    size_t n = 0, cap = 0;
+    uint64_t total = 0;
+    bool ret = false;
+    for(;;) {
+        errno = 0;
+        const struct dirent *const d = readdir(dir);
+        if(!d) {
+            if(errno) {
+                log_errno("readdir: %s", c->dir);
+                goto end;
+            }
+            break;
+        }
+        if(!is_entry_name(d->d_name))
+            continue;
+        struct stat st;
+        if(fstatat(dir_fd, d->d_name, &st, 0) == -1) {
+            // Possibly removed by another process in the meantime.
+            if(errno != ENOENT)
+                log_errno("fstatat: %s/%s", c->dir, d->d_name);
+            continue;
+        }
+        if(n == cap) {
+            cap = cap ? 2 * cap : 64;
+            struct file *const p = realloc(v, cap * sizeof(*v));
+            if(!p) {
+                log_err("%s: realloc\n", __func__);
+                goto end;
+            }
+            v = p;
+        }
+        struct file *const f = v + n++;
+        f->mtime = st.st_mtim;
+        f->size = (uint64_t)st.st_size;
+        memcpy(f->name, d->d_name, sizeof(f->name));
+        total += f->size;
+    }
+    if(total > c->max_size)
+        qsort(v, n, sizeof(*v), cmp_mtime);
+    for(size_t i = 0; i != n && total > c->max_size; ++i) {
+        if(unlinkat(dir_fd, v[i].name, 0) == -1 && errno != ENOENT)
+            log_errno("unlink: %s/%s", c->dir, v[i].name);
+        else
+            total -= v[i].size;
+    }
+    ret = true;
+end:
+    free(v);
+    if(closedir(dir) == -1)
+        log_errno("closedir: %s", c->dir);
+    return ret;
+}
+
+bool is_entry_name(const char *name) {
+    size_t i = 0;
+    for(; name[i]; ++i)
+        if(i == NAME_LEN || !strchr("0123456789abcdef", name[i]))
+            return false;
+    return i == NAME_LEN;
+}
+
+int cmp_mtime(const void *lhs_p, const void *rhs_p) {
+    const struct timespec *const lhs = &((const struct file*)lhs_p)->mtime;
+    const struct timespec *const rhs = &((const struct file*)rhs_p)->mtime;
+    if(lhs->tv_sec != rhs->tv_sec)
+        return lhs->tv_sec < rhs->tv_sec ? -1 : 1;
+    return (lhs->tv_nsec > rhs->tv_nsec) - (lhs->tv_nsec < rhs->tv_nsec);
+}
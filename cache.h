@@ -0,0 +1,136 @@
+#ifndef MACHINATRIX_CACHE_H
+#define MACHINATRIX_CACHE_H
+
+/**
+ * \file
+ * On-disk cache of HTTP responses.
+ * Each response is stored in its own file in the cache directory, named after
+ * the hash of the URL.  Files are replaced atomically, so the cache can be
+ * shared by concurrent processes.  Their contents are:
+ *
+ * - a header: an 8-byte magic string and \ref MTRIX_CACHE_VERSION, followed by
+ *   the lengths of the other fields and the time the response was fetched (all
+ *   integers are in native byte order),
+ * - the URL, used to detect collisions,
+ * - the `ETag` and `Last-Modified` headers,
+ * - the body of the response.
+ *
+ * Responses are used as they are for \ref mtrix_cache::ttl seconds, after which
+ * they are revalidated with a conditional request.  Lookups which produce no
+ * results can also be recorded (see \ref mtrix_cache_store_negative), in the
+ * same format with an empty body, to avoid repeating them for
+ * \ref mtrix_cache::negative_ttl seconds.
+ *
+ * The modification time of each file is updated when it is used, so that the
+ * least recently used ones can be removed once the total size exceeds
+ * \ref mtrix_cache::max_size.
+ *
+ * Concurrent requests for the same URL are coalesced: the first one performs
+ * the request while the others wait for it to finish and then use the stored
+ * response.  Waiting is implemented with a lock on a byte of a shared file,
+ * determined by the hash of the URL, so that it works across processes, and
+ * with a table of locked URLs between the threads of a process.  Only the
+ * response is shared, each request parses its own copy.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/** Version of the file format, incremented on incompatible changes. */
+#define MTRIX_CACHE_VERSION 1
+
+/** Cache parameters. */
+struct mtrix_cache {
+    /** Directory where responses are stored, created if necessary. */
+    char dir[MTRIX_MAX_PATH];
+    /** Number of seconds during which responses are used without checks. */
+    int64_t ttl;
+    /** Number of seconds during which lookups without results are skipped. */
+    int64_t negative_ttl;
+    /** Maximum total size of the stored responses, `0` for no limit. */
+    uint64_t max_size;
+    /** Optional, incremented for each request answered by a concurrent one. */
+    size_t *coalesced;
+};
+
+/** A stored response. */
+struct mtrix_cache_entry {
+    /** Time when the response was fetched or last revalidated. */
+    int64_t time;
+    /** Headers sent when the response is revalidated. */
+    struct mtrix_validators validators;
+    /** Response body. */
+    struct mtrix_buffer body;
+};
+
+/**
+ * Performs a `GET` request, using the cache if possible.
+ * Only successful responses (`200 OK`) are stored.  Failure to update the
+ * cache does not cause the request to fail.  Responses rejected by
+ * \ref http_status_usable do, so that they are not mistaken for missing pages
+ * and recorded as such.
+ *
+ * Responses ended early by \ref mtrix_buffer::stop are stored as they are, so
+ * `url` should identify the part of the resource which is used, e.g. with a
+ * fragment (which is not sent to the server).
+ * \param status Optional, see \ref mtrix_cache_request_multi.
+ */
+bool mtrix_cache_request(
+    const struct mtrix_cache *c, const char *url, struct mtrix_buffer *b,
+    long *status, bool verbose);
+
+/**
+ * Performs several `GET` requests concurrently, using the cache if possible.
+ * Responses are handled as in \ref mtrix_cache_request, see
+ * \ref request_multi.  URLs being requested by other threads or processes are
+ * waited for after all others are finished.
+ * \param bs Output buffers, one for each URL.
+ * \param ok Set to indicate whether each request succeeded.
+ * \param status Optional, set to the HTTP status of each successful request,
+ *               `200` for stored responses.
+ * \return `false` if the requests could not be performed.
+ */
+bool mtrix_cache_request_multi(
+    const struct mtrix_cache *c, size_t n, const char *const *urls,
+    struct mtrix_buffer *bs, bool *ok, long *status, bool verbose);
+
+/** Builds the path of the file where the response for `url` is stored. */
+bool mtrix_cache_path(
+    const struct mtrix_cache *c, const char *url,
+    char path[static MTRIX_MAX_PATH]);
+
+/**
+ * Loads the stored response for `url`, marking it as recently used.
+ * \return `false` if there is none, which is only reported as an error if the
+ *         file exists but cannot be read.
+ */
+bool mtrix_cache_load(
+    const struct mtrix_cache *c, const char *url, struct mtrix_cache_entry *e);
+
+/** Stores (or replaces) the response for `url`. */
+bool mtrix_cache_store(
+    const struct mtrix_cache *c, const char *url,
+    const struct mtrix_cache_entry *e);
+
+/**
+ * Whether the lookup identified by `key` was recorded as having no results
+ * less than \ref mtrix_cache::negative_ttl seconds ago.
+ */
+bool mtrix_cache_is_negative(const struct mtrix_cache *c, const char *key);
+
+/**
+ * Records that the lookup identified by `key` has no results.
+ * Keys are arbitrary strings, distinct from URLs of cached responses.
+ */
+bool mtrix_cache_store_negative(const struct mtrix_cache *c, const char *key);
+
+/**
+ * Removes the least recently used responses until the total size of the cache
+ * does not exceed \ref mtrix_cache::max_size.
+ * Does nothing if another process is doing the same.
+ */
+bool mtrix_cache_evict(const struct mtrix_cache *c);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef MACHINATRIX_DAEMON_H
+#define MACHINATRIX_DAEMON_H
+
+/**
+ * \file
+ * Protocol used to communicate with `machinatrix --listen`.
+ * Each request contains a command line, which is executed as if read from
+ * `stdin`.  Each response contains the exit status, output, and errors.
+ * Any number of requests can be sent on a connection, in sequence.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/** Header of each request packet. */
+struct mtrix_daemon_req {
+    /** Length of the packet's data section. */
+    uint32_t len;
+    /** Command line, not null-terminated.  \see len */
+    char data[];
+};
+
+/** Header of each response packet, followed by the output and errors. */
+struct mtrix_daemon_resp {
+    /** Length of the output (`stdout`) section. */
+    uint32_t out_len;
+    /** Length of the error (`stderr`) section, after the output. */
+    uint32_t err_len;
+    /** `0` if the command succeeded. */
+    uint8_t status;
+    /** Unused, always zero, so that no uninitialized padding is sent. */
+    uint8_t reserved[3];
+};
+
+enum {
+    /** Maximum command line length. */
+    MTRIX_DAEMON_MAX_CMD = 4096,
+    /** Size of the request header. */
+    MTRIX_DAEMON_REQ_SIZE = offsetof(struct mtrix_daemon_req, data),
+};
+
+static_assert(
+    MTRIX_DAEMON_REQ_SIZE == sizeof(((struct mtrix_daemon_req*)0)->len));
+static_assert(
+    sizeof(struct mtrix_daemon_resp) == 3 * sizeof(uint32_t),
+    "struct mtrix_daemon_resp has padding");
+
+/** Result of a command executed by the daemon. */
+struct mtrix_daemon_output {
+    /** Output of the command. */
+    struct mtrix_buffer out;
+    /** Error messages produced by the command. */
+    struct mtrix_buffer err;
+    /** `0` if the command succeeded. */
+    uint8_t status;
+};
+
+/**
+ * Sends a command line (without a trailing new line) to the daemon.
+ * `SIGPIPE` is not raised if the daemon has closed the connection, see
+ * \ref mtrix_socket_send_all.
+ */
+bool mtrix_daemon_send(int fd, const char *cmd);
+
+/**
+ * Receives the result of the last command sent.
+ * Output is appended to the buffers in `output`.
+ */
+bool mtrix_daemon_recv(int fd, struct mtrix_daemon_output *output);
+
+/**
+ * Similar to \ref mtrix_daemon_recv, but gives up after `timeout_ms`.
+ * The timeout applies to the entire response, not to each read.
+ * \param timeout_ms `0` for no limit.
+ * \param timed_out Set if the timeout expired before the end of the response.
+ */
+bool mtrix_daemon_recv_timeout(
+    int fd, struct mtrix_daemon_output *output, int timeout_ms,
+    bool *timed_out);
+
+#endif
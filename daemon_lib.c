@@ -0,0 +1,108 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "socket.h"
+
+/** Time limit of a response, see \ref mtrix_daemon_recv_timeout. */
+struct deadline {
+    /** `0` for no limit. */
+    int timeout_ms;
+    struct timespec start;
+    /** Set if the timeout expires. */
+    bool *timed_out;
+};
+
+/**
+ * Reads `n` bytes from `fd` before the deadline.
+ * \return `false` on errors and if the deadline expires, see
+ *         \ref deadline::timed_out.
+ */
+static bool read_deadline(int fd, void *p, size_t n, struct deadline *d);
+
+/** Reads `n` bytes from `fd`, appending them to `b`. */
+static bool read_buffer(
+    int fd, size_t n, struct mtrix_buffer *b, struct deadline *d);
+
+bool mtrix_daemon_send(int fd, const char *cmd) {
+    const size_t len = strlen(cmd), max = MTRIX_DAEMON_MAX_CMD;
+    if(len > max) {
+        log_err("%s: command too long (%zu > %zu)\n", __func__, len, max);
+        return false;
+    }
+    const struct mtrix_daemon_req req = {.len = (uint32_t)len};
+    return mtrix_socket_send_all(fd, &req, MTRIX_DAEMON_REQ_SIZE)
+        && mtrix_socket_send_all(fd, cmd, len);
+}
+
+bool mtrix_daemon_recv(int fd, struct mtrix_daemon_output *output) {
+    bool timed_out = false;
+    return mtrix_daemon_recv_timeout(fd, output, 0, &timed_out);
+}
+
+bool mtrix_daemon_recv_timeout(
+    int fd, struct mtrix_daemon_output *output, int timeout_ms,
+    bool *timed_out
+) {
+    struct deadline d = {.timeout_ms = timeout_ms, .timed_out = timed_out};
+    clock_gettime(CLOCK_MONOTONIC, &d.start);
+    *timed_out = false;
+    struct mtrix_daemon_resp resp;
+    const bool ret = read_deadline(fd, &resp, sizeof(resp), &d)
+        && (output->status = resp.status, true)
+        && read_buffer(fd, resp.out_len, &output->out, &d)
+        && read_buffer(fd, resp.err_len, &output->err, &d);
+    if(!ret && !*timed_out)
+        log_err("%s: failed to read response\n", __func__);
+    return ret || *timed_out;
+}
+
+bool read_deadline(int fd, void *p, size_t n, struct deadline *d) {
+    while(n) {
+        if(d->timeout_ms) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const int64_t elapsed =
+                (int64_t)(now.tv_sec - d->start.tv_sec) * 1000
+                + (now.tv_nsec - d->start.tv_nsec) / 1000000;
+            if(elapsed >= d->timeout_ms)
+                return *d->timed_out = true, false;
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            const int r = poll(&pfd, 1, d->timeout_ms - (int)elapsed);
+            if(r == -1 && errno != EINTR)
+                return log_errno("%s: poll", __func__), false;
+            if(r != 1)
+                continue;
+        }
+        const ssize_t r = read(fd, p, n);
+        if(r == -1) {
+            if(errno == EINTR)
+                continue;
+            return log_errno("%s: read", __func__), false;
+        }
+        if(!r)
+            return log_err("%s: short read\n", __func__), false;
+        p = (char*)p + r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+bool read_buffer(
+    int fd, size_t n, struct mtrix_buffer *b, struct deadline *d
+) {
+    char buffer[4096];
+    while(n) {
+        const size_t len = n < sizeof(buffer) ? n : sizeof(buffer);
+        if(!read_deadline(fd, buffer, len, d))
+            return false;
+        mtrix_buffer_append(buffer, 1, len, b);
+        n -= len;
+    }
+    return true;
+}
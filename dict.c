@@ -0,0 +1,335 @@
+#include "dict.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+/** Number of entries in \ref mtrix_dict::letters. */
+enum { LETTERS = UCHAR_MAX + 2 };
+
+/** Identifies binary dictionary files. */
+static const char MAGIC[8] = "MTRXDICT";
+
+/** Header of binary dictionary files. */
+struct header {
+    char magic[sizeof(MAGIC)];
+    uint32_t version;
+    /** \ref mtrix_dict::n */
+    uint32_t n;
+    /** \ref mtrix_dict::size */
+    uint32_t size;
+    /** Unused, makes the padding explicit. */
+    uint32_t reserved;
+    /** \ref mtrix_dict::source */
+    struct mtrix_dict_source source;
+};
+
+/** Maps the entire file at `path`, which may be empty. */
+static bool map_file(
+    const char *path, void **p, size_t *size, struct mtrix_dict_source *src);
+
+/** Extracts the identifying information from the result of `stat(2)`. */
+static void source_from_stat(
+    const struct stat *st, struct mtrix_dict_source *src);
+
+/** Sets up the dictionary from a mapped binary file. */
+static bool load_binary(struct mtrix_dict *d, const char *path);
+
+/**
+ * Checks that the index of a binary file refers only to valid words, so that
+ * a corrupted file is rebuilt instead of causing invalid accesses.
+ */
+static bool check_index(const struct mtrix_dict *d);
+
+/** Writes the dictionary in the binary format to `fd`. */
+static bool write_binary(const struct mtrix_dict *d, int fd);
+
+/** Builds the index from a mapped plain word list. */
+static bool build_index(struct mtrix_dict *d);
+
+/** Builds \ref mtrix_dict::letters and \ref mtrix_dict::by_letter. */
+static void build_letters(
+    const struct mtrix_dict *d, uint32_t *letters, uint32_t *by_letter);
+
+/** Case-folded first byte of a non-empty word. */
+static unsigned char first_letter(const struct mtrix_dict *d, size_t i);
+
+/** Scrambles the bits of an index for use in a hash table. */
+static size_t hash(size_t x);
+
+bool mtrix_dict_open(struct mtrix_dict *d, const char *path) {
+    *d = (struct mtrix_dict){0};
+    if(!map_file(path, &d->map, &d->map_size, &d->source))
+        return false;
+    const bool binary = d->map_size >= sizeof(struct header)
+        && !memcmp(d->map, MAGIC, sizeof(MAGIC));
+    if(binary ? load_binary(d, path) : build_index(d))
+        return true;
+    mtrix_dict_close(d);
+    return false;
+}
+
+bool mtrix_dict_open_fresh(
+    struct mtrix_dict *d, const char *path,
+    const struct mtrix_dict_source *src
+) {
+    if(access(path, F_OK) == -1) {
+        if(errno != ENOENT)
+            log_errno("access: %s", path);
+        return false;
+    }
+    if(!mtrix_dict_open(d, path))
+        return false;
+    if(!memcmp(&d->source, src, sizeof(*src)))
+        return true;
+    mtrix_dict_close(d);
+    return false;
+}
+
+bool mtrix_dict_stat(const char *path, struct mtrix_dict_source *src) {
+    struct stat st;
+    if(stat(path, &st) == -1)
+        return log_errno("stat: %s", path), false;
+    source_from_stat(&st, src);
+    return true;
+}
+
+void source_from_stat(const struct stat *st, struct mtrix_dict_source *src) {
+    *src = (struct mtrix_dict_source){
+        .dev = (uint64_t)st->st_dev,
+        .ino = (uint64_t)st->st_ino,
+        .size = (uint64_t)st->st_size,
+        .mtime_s = (uint64_t)st->st_mtim.tv_sec,
+        .mtime_ns = (uint64_t)st->st_mtim.tv_nsec,
+    };
+}
+
+bool mtrix_dict_close(struct mtrix_dict *d) {
+    bool ret = true;
+    if(d->map && munmap(d->map, d->map_size) == -1)
+        log_errno("munmap"), ret = false;
+    free(d->index);
+    *d = (struct mtrix_dict){0};
+    return ret;
+}
+
+bool mtrix_dict_save(const struct mtrix_dict *d, const char *path) {
+    char tmp[MTRIX_MAX_PATH] = {0};
+    if(!join_path(tmp, 2, path, ".XXXXXX"))
+        return false;
+    const int fd = mkstemp(tmp);
+    if(fd == -1)
+        return log_errno("mkstemp: %s", tmp), false;
+    bool ret = fchmod(fd, 0644) != -1 || (log_errno("fchmod: %s", tmp), false);
+    ret = ret && write_binary(d, fd);
+    if(close(fd) == -1)
+        log_errno("close: %s", tmp), ret = false;
+    // Concurrent readers see either the previous file or the complete new one.
+    if(ret && rename(tmp, path) == -1)
+        log_errno("rename: %s", path), ret = false;
+    if(!ret && unlink(tmp) == -1)
+        log_errno("unlink: %s", tmp);
+    return ret;
+}
+
+bool write_binary(const struct mtrix_dict *d, int fd) {
+    struct header h = {
+        .version = MTRIX_DICT_VERSION,
+        .n = (uint32_t)d->n,
+        .size = (uint32_t)d->size,
+        .source = d->source,
+    };
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    return write_all(fd, &h, sizeof(h))
+        && write_all(fd, d->letters, LETTERS * sizeof(*d->letters))
+        && write_all(fd, d->offsets, (d->n + 1) * sizeof(*d->offsets))
+        && write_all(fd, d->by_letter, d->n * sizeof(*d->by_letter))
+        && write_all(fd, d->p, d->size);
+}
+
+bool map_file(
+    const char *path, void **p, size_t *size, struct mtrix_dict_source *src
+) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        return log_errno("open: %s", path), false;
+    bool ret = false;
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        log_errno("fstat: %s", path);
+        goto end;
+    }
+    source_from_stat(&st, src);
+    // Offsets are stored as 32-bit values, see build_index.
+    if((uintmax_t)st.st_size >= UINT32_MAX) {
+        log_err("%s: file too large\n", path);
+        goto end;
+    }
+    // mmap(2) rejects empty mappings.
+    if((*size = (size_t)st.st_size)) {
+        void *const m = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m == MAP_FAILED) {
+            log_errno("mmap: %s", path);
+            goto end;
+        }
+        *p = m;
+    }
+    ret = true;
+end:
+    if(close(fd) == -1)
+        log_errno("close: %s", path), ret = false;
+    return ret;
+}
+
+bool load_binary(struct mtrix_dict *d, const char *path) {
+    struct header h;
+    memcpy(&h, d->map, sizeof(h));
+    if(h.version != MTRIX_DICT_VERSION)
+        return log_err("%s: unsupported version\n", path), false;
+    const uint32_t *const index =
+        (const uint32_t*)((const char*)d->map + sizeof(h));
+    const uint64_t index_len = LETTERS + 2 * (uint64_t)h.n + 1;
+    const uint64_t size =
+        sizeof(h) + index_len * sizeof(*index) + (uint64_t)h.size;
+    if(size != d->map_size)
+        return log_err("%s: invalid size\n", path), false;
+    d->n = h.n;
+    d->size = h.size;
+    d->source = h.source;
+    d->letters = index;
+    d->offsets = d->letters + LETTERS;
+    d->by_letter = d->offsets + d->n + 1;
+    d->p = (const char*)(d->by_letter + d->n);
+    if(!check_index(d))
+        return log_err("%s: invalid index\n", path), false;
+    if(d->size)
+        posix_madvise(d->map, d->map_size, POSIX_MADV_RANDOM);
+    return true;
+}
+
+bool check_index(const struct mtrix_dict *d) {
+    // Each line contains at least the new-line character, which is implicit
+    // for the last one (see build_index).
+    if(d->offsets[0] || d->offsets[d->n] > d->size + 1)
+        return false;
+    for(size_t i = 0; i != d->n; ++i)
+        if(d->offsets[i] >= d->offsets[i + 1])
+            return false;
+    if(d->letters[0] || d->letters[LETTERS - 1] > d->n)
+        return false;
+    for(size_t i = 1; i != LETTERS; ++i)
+        if(d->letters[i - 1] > d->letters[i])
+            return false;
+    for(size_t i = 0; i != d->letters[LETTERS - 1]; ++i)
+        if(d->by_letter[i] >= d->n)
+            return false;
+    return true;
+}
+
+bool build_index(struct mtrix_dict *d) {
+    const char *const b = d->map ? d->map : "", *const e = b + d->map_size;
+    d->p = b;
+    d->size = d->map_size;
+    size_t n = 0;
+    for(const char *p = b; p != e; ++n) {
+        const char *const nl = memchr(p, '\n', (size_t)(e - p));
+        p = nl ? nl + 1 : e;
+    }
+    uint32_t *const index = calloc(LETTERS + 2 * n + 1, sizeof(*index));
+    if(!index)
+        return log_errno("calloc"), false;
+    uint32_t *const letters = index, *const offsets = letters + LETTERS;
+    uint32_t *const by_letter = offsets + n + 1;
+    d->index = index;
+    d->letters = letters;
+    d->offsets = offsets;
+    d->by_letter = by_letter;
+    d->n = n;
+    uint32_t *o = offsets;
+    for(const char *p = b; p != e;) {
+        *o++ = (uint32_t)(p - b);
+        const char *const nl = memchr(p, '\n', (size_t)(e - p));
+        p = nl ? nl + 1 : e;
+    }
+    // Account for a missing new-line character at the end of the file so that
+    // all words can be extracted in the same manner.
+    *o = (uint32_t)d->size + (d->size && e[-1] != '\n');
+    build_letters(d, letters, by_letter);
+    // Subsequent accesses are random lookups of individual words.
+    if(d->size)
+        posix_madvise(d->map, d->map_size, POSIX_MADV_RANDOM);
+    return true;
+}
+
+void build_letters(
+    const struct mtrix_dict *d, uint32_t *letters, uint32_t *by_letter
+) {
+    // Counting sort: count the words in each group, compute the start of each
+    // group, then place the indices.
+    for(size_t i = 0; i != d->n; ++i)
+        if(d->offsets[i + 1] - d->offsets[i] > 1)
+            ++letters[first_letter(d, i) + 1];
+    for(size_t i = 1; i != LETTERS; ++i)
+        letters[i] += letters[i - 1];
+    uint32_t next[LETTERS - 1];
+    memcpy(next, letters, sizeof(next));
+    for(size_t i = 0; i != d->n; ++i)
+        if(d->offsets[i + 1] - d->offsets[i] > 1)
+            by_letter[next[first_letter(d, i)]++] = (uint32_t)i;
+}
+
+unsigned char first_letter(const struct mtrix_dict *d, size_t i) {
+    return (unsigned char)tolower((unsigned char)d->p[d->offsets[i]]);
+}
+
+bool mtrix_dict_sample(
+    const struct mtrix_dict *d, struct mtrix_rng *rng, size_t k, size_t *v
+) {
+    if(!k)
+        return true;
+    // Floyd's algorithm, using an open-addressing hash set (storing `i + 1`,
+    // `0` marks empty slots) to check for repeated values.
+    unsigned bits = 1;
+    while((size_t)1 << bits < 2 * k)
+        ++bits;
+    const size_t mask = ((size_t)1 << bits) - 1;
+    size_t *const set = calloc(mask + 1, sizeof(*set));
+    if(!set)
+        return log_errno("calloc"), false;
+    size_t n = 0;
+    for(size_t j = d->n - k; j != d->n; ++j) {
+        size_t x = (size_t)mtrix_rng_below(rng, j + 1);
+        for(;;) {
+            size_t h = hash(x) & mask;
+            while(set[h] && set[h] != x + 1)
+                h = (h + 1) & mask;
+            if(!set[h]) {
+                set[h] = x + 1;
+                break;
+            }
+            // `j` itself cannot have been selected yet.
+            x = j;
+        }
+        v[n++] = x;
+    }
+    free(set);
+    // Floyd's algorithm selects a uniformly random subset, but the order in
+    // which elements are selected is not uniformly random.
+    for(size_t i = k - 1; i; --i) {
+        const size_t j = (size_t)mtrix_rng_below(rng, i + 1), t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+    }
+    return true;
+}
+
+size_t hash(size_t x) {
+    return (size_t)(((uint64_t)x * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
@@ -0,0 +1,153 @@
+#ifndef MACHINATRIX_DICT_H
+#define MACHINATRIX_DICT_H
+
+/**
+ * \file
+ * Word lists, such as those in `/usr/share/dict`.
+ * The file is mapped into memory and indexed once, after which individual words
+ * can be accessed in constant time without copies.
+ *
+ * The index can also be saved in a binary file (see \ref mtrix_dict_save),
+ * which is then used directly from the mapping without any processing.  Its
+ * contents are:
+ *
+ * - a header: an 8-byte magic string and \ref MTRIX_DICT_VERSION, followed by
+ *   the number of words, the size of the word list, and the
+ *   \ref mtrix_dict_source of the word list (all integers are in native byte
+ *   order, so files from a machine with a different one are rejected as having
+ *   the wrong version),
+ * - \ref mtrix_dict::letters,
+ * - \ref mtrix_dict::offsets,
+ * - \ref mtrix_dict::by_letter,
+ * - the contents of the original word list.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rng.h"
+
+/** Version of the binary format, incremented on incompatible changes. */
+#define MTRIX_DICT_VERSION 2
+
+/**
+ * Identifies the contents of a word list file.
+ * A dictionary built from a file is considered up to date as long as these
+ * values are unchanged.
+ */
+struct mtrix_dict_source {
+    uint64_t dev, ino, size;
+    /** Modification time. */
+    uint64_t mtime_s, mtime_ns;
+};
+
+/** Word list loaded from a file with one word per line. */
+struct mtrix_dict {
+    /** Contents of the word list. */
+    const char *p;
+    /** Size of the data pointed to by \ref p. */
+    size_t size;
+    /** Number of words. */
+    size_t n;
+    /** File from which the word list was read. */
+    struct mtrix_dict_source source;
+    /**
+     * Offset of the start of each line in \ref p.
+     * Contains `n + 1` entries, the last one is the offset one past the
+     * (possibly implicit) new-line character at the end of the last line.
+     */
+    const uint32_t *offsets;
+    /**
+     * Indices of all non-empty words, grouped by their first byte.
+     * Upper- and lower-case letters are grouped together.
+     * \see mtrix_dict_letter
+     */
+    const uint32_t *by_letter;
+    /**
+     * Start of each group in \ref by_letter, followed by a sentinel
+     * (`UCHAR_MAX + 2` entries).
+     */
+    const uint32_t *letters;
+    /** Mapping of the text or binary file, if not empty. */
+    void *map;
+    /** Size of \ref map. */
+    size_t map_size;
+    /** Owning pointer to the index arrays, if built in memory. */
+    uint32_t *index;
+};
+
+/**
+ * Maps and indexes the file at `path`.
+ * The file can be either a plain word list or a binary dictionary.
+ */
+bool mtrix_dict_open(struct mtrix_dict *d, const char *path);
+
+/**
+ * Opens a binary dictionary if it is up to date.
+ * \param src Source of the word list, as determined by \ref mtrix_dict_stat.
+ * \return `false` if the dictionary could not be opened, which is not
+ *         considered an error (i.e. not logged) if `path` does not exist, or
+ *         if it was built from a different version of the word list.
+ */
+bool mtrix_dict_open_fresh(
+    struct mtrix_dict *d, const char *path,
+    const struct mtrix_dict_source *src);
+
+/** Fills `src` with the current information about the file at `path`. */
+bool mtrix_dict_stat(const char *path, struct mtrix_dict_source *src);
+
+/** Releases all resources associated with the dictionary. */
+bool mtrix_dict_close(struct mtrix_dict *d);
+
+/**
+ * Saves the dictionary in the binary format.
+ * The file is written to a temporary location and renamed, so it is replaced
+ * atomically if it exists.
+ */
+bool mtrix_dict_save(const struct mtrix_dict *d, const char *path);
+
+/**
+ * Accesses a word by index.
+ * \return A pointer into the mapping, not null-terminated.
+ */
+static inline const char *mtrix_dict_word(
+    const struct mtrix_dict *d, size_t i, size_t *len);
+
+/**
+ * Accesses the indices of words which start with `c`, ignoring case.
+ * \param v Set to the start of the array of indices.
+ * \return The number of words.
+ */
+static inline size_t mtrix_dict_letter(
+    const struct mtrix_dict *d, char c, const uint32_t **v);
+
+/**
+ * Selects `k` distinct random word indices, in random order.
+ * Runs in `O(k)` (expected) time and space, regardless of the size of the
+ * dictionary.
+ * \param k Number of indices, must not be greater than \ref mtrix_dict::n.
+ * \param v Output array of `k` elements.
+ */
+bool mtrix_dict_sample(
+    const struct mtrix_dict *d, struct mtrix_rng *rng, size_t k, size_t *v);
+
+static inline const char *mtrix_dict_word(
+    const struct mtrix_dict *d, size_t i, size_t *len
+) {
+    const uint32_t b = d->offsets[i], e = d->offsets[i + 1];
+    *len = e - b - 1;
+    return d->p + b;
+}
+
+static inline size_t mtrix_dict_letter(
+    const struct mtrix_dict *d, char c, const uint32_t **v
+) {
+    const unsigned char i = (unsigned char)tolower((unsigned char)c);
+    *v = d->by_letter + d->letters[i];
+    return d->letters[i + 1] - d->letters[i];
+}
+
+#endif
@@ -1,35 +1,134 @@
 #include "dlpo.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <tidybuffio.h>
 
 #include "html.h"
 #include "utils.h"
 
+#define RESULTS "resultados"
 #define DEF "dp-definicao"
 #define ETYM "Origem etimológica:"
 
-TidyNode dlpo_find_definitions(TidyNode node) {
-    return find_node_by_class(node, DEF, true);
+TidyNode dlpo_find_definitions(const struct html_index *x, TidyNode node) {
+    return find_node_by_class(x, node, DEF, true);
+}
+
+/** Arguments of \ref print_section. */
+struct section {
+    FILE *f;
+    TidyDoc doc;
+    TidyBuffer *buf;
+};
+
+/** Prints the etymology in a section of a definition. */
+static void print_section(const struct section *d, TidyNode sec) {
+    TidyNode node;
+    if(!(
+        (node = find_node_by_content(
+            d->doc, tidyGetChild(sec), ETYM "\n", d->buf, true))
+        && (node = tidyGetParent(node))
+        && (node = tidyGetNext(node))
+    ))
+        return;
+    tidyNodeGetText(d->doc, node, d->buf);
+    join_lines(d->buf->bp, d->buf->bp + d->buf->size);
+    fprintf(d->f, "- ");
+    print_unescaped(d->f, d->buf->bp);
+    fputc('\n', d->f);
+    // Text is appended to the buffer, which is also used for the search.
+    tidyBufClear(d->buf);
 }
 
 void dlpo_print_definitions(
     FILE *f, TidyDoc doc, TidyNode def, TidyBuffer *buf
 ) {
-    for(; def; def = find_node_by_class(tidyGetNext(def), DEF, false)) {
-        for(TidyNode sec = tidyGetChild(def); sec; sec = tidyGetNext(sec)) {
-            TidyNode node;
-            if(!(
-                (node = find_node_by_content(
-                    doc, tidyGetChild(sec), ETYM "\n", buf, true))
-                && (node = tidyGetParent(node))
-                && (node = tidyGetNext(node))
-            ))
-                continue;
-            tidyNodeGetText(doc, node, buf);
-            join_lines(buf->bp, buf->bp + buf->size);
-            fprintf(f, "- ");
-            print_unescaped(f, buf->bp);
-            putchar('\n');
+    // Only the definitions which are siblings of the first one: the sections
+    // of a definition can contain other elements with the same class.
+    const struct html_index *const x = html_index_get(doc);
+    struct section d = {.f = f, .doc = doc, .buf = buf};
+    for(; def; def = find_node_by_class(x, tidyGetNext(def), DEF, false))
+        for(TidyNode sec = tidyGetChild(def); sec; sec = tidyGetNext(sec))
+            print_section(&d, sec);
+}
+
+/**
+ * Prints the etymology in a section of a definition, see
+ * \ref dlpo_print_definitions.  The section is consumed.
+ */
+static bool scan_section(
+    FILE *f, struct html_tokenizer *z, const struct html_token *sec,
+    struct mtrix_buffer *b)
+{
+    const size_t d = sec->depth, n = strlen(ETYM);
+    struct html_token t;
+    while(d <= z->depth && html_tokenizer_next(z, &t)) {
+        if(t.type != HTML_TOKEN_TEXT)
+            continue;
+        b->n = 0;
+        if(!html_tokenizer_text(z, &t, b))
+            return false;
+        if(!b->n || n < b->n || strncmp(b->p, ETYM, b->n))
+            continue;
+        // The etymology is the next node after the element which contains
+        // the label.
+        const size_t parent = t.depth - 1;
+        html_tokenizer_skip(z, parent);
+        bool more;
+        while((more = html_tokenizer_next(z, &t))
+                && t.depth == parent && html_token_is_space(&t));
+        if(more && t.depth == parent && t.type != HTML_TOKEN_END) {
+            b->n = 0;
+            if(!html_tokenizer_text(z, &t, b))
+                return false;
+            fprintf(f, "- %s\n", b->n ? b->p : "");
         }
+        break;
     }
+    html_tokenizer_skip(z, d);
+    return true;
+}
+
+/** Prints the etymologies in a definition element, consuming it. */
+static bool scan_definition(
+    FILE *f, struct html_tokenizer *z, const struct html_token *def,
+    struct mtrix_buffer *b)
+{
+    const size_t d = def->depth;
+    bool ret = true;
+    for(struct html_token t;
+            ret && d <= z->depth && html_tokenizer_next(z, &t);)
+        if(t.type == HTML_TOKEN_START && t.depth == d + 1)
+            ret = scan_section(f, z, &t, b);
+    return ret;
+}
+
+bool dlpo_scan_definitions(
+    FILE *f, const char *html, size_t n, bool *found
+) {
+    struct html_tokenizer z;
+    struct html_token t;
+    html_tokenizer_init(&z, html, n);
+    *found = false;
+    if(!html_tokenizer_find(&z, &t, 0, RESULTS, NULL))
+        return log_err("element '#%s' not found\n", RESULTS), false;
+    if(!html_tokenizer_find(&z, &t, 0, NULL, DEF))
+        return true;
+    *found = true;
+    struct mtrix_buffer b = {0};
+    bool ret = true;
+    // Definitions are siblings, like in dlpo_print_definitions.
+    const size_t d = t.depth;
+    do {
+        if(t.type != HTML_TOKEN_START)
+            continue;
+        if(html_token_has_class(&t, DEF))
+            ret = scan_definition(f, &z, &t, &b);
+        else
+            html_tokenizer_skip(&z, d);
+    } while(ret && html_tokenizer_next(&z, &t) && t.depth == d);
+    free(b.p);
+    return ret;
 }
@@ -3,24 +3,43 @@
  * Functions to process and navigate DLPO pages.
  * http://www.priberam.pt/dlpo
  */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
 #include "common.h"
 
 #include <tidy.h>
 
+/** See html.h. */
+struct html_index;
+
 /** Base URL for the service. */
 #define DLPO_BASE "https://dicionario.priberam.org"
 
 /**
  * Finds the element containing the word definitions.
+ * \param x Optional index of the document, see \ref find_node_by_class.
  * \param node The `#resultados` element.
  */
-TidyNode dlpo_find_definitions(TidyNode node);
+TidyNode dlpo_find_definitions(const struct html_index *x, TidyNode node);
 
 /**
  * Prints the definitions in plain text.
+ * The sections of all definitions are found with \ref html_select.
  * \param f Output stream.
  * \param doc The root document.
  * \param node The element returned by \ref dlpo_find_definitions.
  */
 void dlpo_print_definitions(
     FILE *f, TidyDoc doc, TidyNode def, TidyBuffer *buf);
+
+/**
+ * Similar to \ref dlpo_find_definitions and \ref dlpo_print_definitions,
+ * but reads the source of the page with \ref html_tokenizer instead of
+ * creating a document.
+ * \param found Set if the page contains definitions.
+ * \return `false` if the `#resultados` element was not found.
+ */
+bool dlpo_scan_definitions(
+    FILE *f, const char *html, size_t n, bool *found);
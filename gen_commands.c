@@ -0,0 +1,208 @@
+/**
+ * \file
+ * Generates the command table used by `machinatrix`.
+ *
+ * Reads a list of commands from `stdin`, one per line, in the format
+ * `<name> <function> [<flags>]`, where `<flags>` is the remainder of the line.
+ * Empty lines and lines starting with `#` are ignored.
+ *
+ * The output is a header defining `COMMANDS`, a table indexed by a perfect hash
+ * of the command names: the index of each command is given by
+ * `COMMANDS_INDEX(mtrix_hash_str(name))`, and no two commands share an index.
+ * The table has the smallest power-of-two size which fits all commands (the
+ * next one if no hash is found), so some slots are empty.
+ * A multiplicative hash is used, with a multiplier found by trial.  Static
+ * assertions in the output verify, at compile time, both the hash of each name
+ * and its index.
+ */
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+enum {
+    /** Maximum number of commands. */
+    MAX_CMDS = 256,
+    /** Maximum length of each field. */
+    MAX_FIELD = 128,
+    /** Number of multipliers tried for each table size. */
+    MAX_TRIES = 1 << 20,
+};
+
+/** A single entry read from the input. */
+struct cmd {
+    char name[MAX_FIELD];
+    char f[MAX_FIELD];
+    char flags[MAX_FIELD];
+    mtrix_hash hash;
+};
+
+/** Program entry point. */
+int main(void);
+
+/** Reads the list of commands, returns the number read or `-1` on error. */
+static int read_cmds(FILE *f, struct cmd *v);
+
+/**
+ * Searches for a multiplier which maps all hashes to distinct indices.
+ * \param bits Number of bits in the index.
+ * \param slots Filled with the index of the command in each slot, or `-1`.
+ */
+static bool search(
+    const struct cmd *v, int n, unsigned bits, uint64_t *mult, int *slots);
+
+/** Index of a hash in the table. */
+static size_t slot(mtrix_hash h, uint64_t mult, unsigned bits);
+
+/** Writes the header to `f`. */
+static void print(
+    FILE *f, const struct cmd *v, unsigned bits, uint64_t mult,
+    const int *slots);
+
+int main(void) {
+    static struct cmd v[MAX_CMDS];
+    static int slots[2 * MAX_CMDS];
+    const int n = read_cmds(stdin, v);
+    if(n == -1)
+        return 1;
+    if(!n)
+        return fprintf(stderr, "no commands\n"), 1;
+    unsigned bits = 1;
+    while((1 << bits) < n)
+        ++bits;
+    // Fall back to a larger table if necessary.
+    uint64_t mult = 0;
+    if(!search(v, n, bits, &mult, slots)
+            && !search(v, n, ++bits, &mult, slots))
+        return fprintf(stderr, "failed to find a perfect hash\n"), 1;
+    print(stdout, v, bits, mult, slots);
+    return fflush(stdout) == EOF || ferror(stdout);
+}
+
+int read_cmds(FILE *f, struct cmd *v) {
+    char line[3 * MAX_FIELD];
+    int n = 0;
+    for(int l = 1; fgets(line, sizeof(line), f); ++l) {
+        if(!strchr(line, '\n') && !feof(f))
+            return fprintf(stderr, "%d: line too long\n", l), -1;
+        if(*line == '#' || *line == '\n')
+            continue;
+        if(n == MAX_CMDS)
+            return fprintf(stderr, "%d: too many commands\n", l), -1;
+        struct cmd *const c = v + n;
+        if(sscanf(line, "%127s %127s %127[^\n]", c->name, c->f, c->flags) < 2)
+            return fprintf(stderr, "%d: invalid line\n", l), -1;
+        // Names are also written as character literals, see print.
+        for(const char *p = c->name; *p; ++p)
+            if(!isalnum((unsigned char)*p))
+                return fprintf(stderr, "%d: invalid name\n", l), -1;
+        if(!*c->flags)
+            strcpy(c->flags, "0");
+        c->hash = mtrix_hash_str(c->name);
+        for(int i = 0; i != n; ++i)
+            if(v[i].hash == c->hash)
+                return fprintf(
+                    stderr, "%d: hash of %s collides with %s\n",
+                    l, c->name, v[i].name), -1;
+        ++n;
+    }
+    if(ferror(f))
+        return perror("fgets"), -1;
+    return n;
+}
+
+bool search(
+    const struct cmd *v, int n, unsigned bits, uint64_t *mult, int *slots
+) {
+    // Candidates are generated deterministically (SplitMix64), so the output
+    // is stable for a given input.
+    uint64_t x = 0;
+    for(int t = 0; t != MAX_TRIES; ++t) {
+        uint64_t m = (x += UINT64_C(0x9e3779b97f4a7c15));
+        m = (m ^ (m >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        m = (m ^ (m >> 27)) * UINT64_C(0x94d049bb133111eb);
+        m = (m ^ (m >> 31)) | 1;
+        memset(slots, -1, sizeof(*slots) << bits);
+        int i = 0;
+        for(; i != n; ++i) {
+            int *const s = slots + slot(v[i].hash, m, bits);
+            if(*s != -1)
+                break;
+            *s = i;
+        }
+        if(i == n)
+            return *mult = m, true;
+    }
+    return false;
+}
+
+size_t slot(mtrix_hash h, uint64_t mult, unsigned bits) {
+    return (size_t)((h * mult) >> (64 - bits));
+}
+
+void print(
+    FILE *f, const struct cmd *v, unsigned bits, uint64_t mult,
+    const int *slots
+) {
+    fprintf(
+        f,
+        "/**\n"
+        " * \\file\n"
+        " * Command table, generated by gen_commands.  Do not edit.\n"
+        " */\n"
+        "#include <assert.h>\n"
+        "#include <stdint.h>\n"
+        "\n"
+        "/** Number of bits in an index of \\ref COMMANDS. */\n"
+        "#define COMMANDS_BITS %u\n"
+        "\n"
+        "/** Multiplier which maps each command to a distinct index. */\n"
+        "#define COMMANDS_MULT UINT64_C(0x%016" PRIx64 ")\n"
+        "\n"
+        "/** Index in \\ref COMMANDS of the command with hash `h`. */\n"
+        "#define COMMANDS_INDEX(h) \\\n"
+        "    ((size_t)(((h) * COMMANDS_MULT) >> (64 - COMMANDS_BITS)))\n"
+        "\n"
+        "/**\n"
+        " * Maps a command name to the function that handles it.\n"
+        " * Indexed by \\ref COMMANDS_INDEX, unused entries are zero.\n"
+        " */\n"
+        "static const struct mtrix_cmd COMMANDS[1 << COMMANDS_BITS] = {\n",
+        bits, mult);
+    for(size_t i = 0; i != (size_t)1 << bits; ++i) {
+        if(slots[i] == -1)
+            continue;
+        const struct cmd *const c = v + slots[i];
+        fprintf(
+            f, "    [%zu] = {UINT64_C(0x%010" PRIx64 "), \"%s\", %s, %s},\n",
+            i, c->hash, c->name, c->f, c->flags);
+    }
+    fprintf(f, "};\n");
+    for(size_t i = 0; i != (size_t)1 << bits; ++i) {
+        if(slots[i] == -1)
+            continue;
+        const struct cmd *const c = v + slots[i];
+        // The hash, computed from the name by the compiler.
+        fprintf(
+            f, "\nstatic_assert(\n    UINT64_C(0x%010" PRIx64 ") == ",
+            c->hash);
+        const size_t len = strlen(c->name);
+        for(size_t j = 0; j != len; ++j)
+            fputc('(', f);
+        fprintf(f, "UINT64_C(0x%" PRIx64 ")", MTRIX_HASHER_INIT.h);
+        for(const char *p = c->name; *p; ++p)
+            fprintf(f, " * 33 + '%c')", *p);
+        fprintf(f, ",\n    \"hash of %s\");\n", c->name);
+        fprintf(
+            f,
+            "static_assert(\n"
+            "    COMMANDS_INDEX(UINT64_C(0x%010" PRIx64 ")) == %zu,\n"
+            "    \"index of %s\");\n",
+            c->hash, i, c->name);
+    }
+}
@@ -1,21 +1,910 @@
 #include "html.h"
 
+#include <assert.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <strings.h>
+
 #include <tidybuffio.h>
 
+#include "hash.h"
+#include "pipeline.h"
 #include "utils.h"
 
-TidyDoc request_and_parse(const char *url, bool verbose) {
-    struct mtrix_buffer buffer = {0};
-    TidyDoc ret = NULL;
-    if(request(url, &buffer, verbose)) {
-        ret = tidyCreate();
-        tidyOptSetBool(ret, TidyForceOutput, yes);
-        tidyParseString(ret, buffer.p);
+/** Responses and documents of \ref request_and_parse_multi. */
+struct parse_batch {
+    size_t n, next;
+    struct mtrix_buffer *bodies;
+    const bool *ok;
+    /** Optional. */
+    const struct html_region *regions;
+    TidyDoc *docs;
+};
+
+struct html_index_node {
+    TidyNode node;
+    /** Position of the parent, `0` for the root. */
+    size_t parent;
+    /** Position after the last descendant. */
+    size_t end;
+};
+
+struct html_index_addr {
+    TidyNode node;
+    size_t pos;
+};
+
+struct html_index_id {
+    /** Value of the attribute. */
+    const char *id;
+    size_t pos;
+};
+
+struct html_index_class {
+    mtrix_hash hash;
+    /** Points to the value of an attribute, not null-terminated. */
+    const char *name;
+    size_t len;
+    /** Range in \ref html_index::class_nodes. */
+    size_t first, n;
+};
+
+/** Class of an element, collected by \ref html_index_build. */
+struct index_class {
+    mtrix_hash hash;
+    const char *name;
+    size_t len, pos;
+};
+
+/** State of \ref html_index_build. */
+struct index_builder {
+    struct html_index *x;
+    size_t nodes_cap, ids_cap;
+    /** Classes of all elements, grouped by \ref index_finish. */
+    struct index_class *classes;
+    size_t n_classes, classes_cap;
+};
+
+/** Ends a request once the region is complete, see \ref mtrix_stop::f. */
+static bool region_stop(struct mtrix_stop *s, const struct mtrix_buffer *b);
+
+/** Finds the first occurrence of `s` in `[b, e)`. */
+static const char *find(const char *b, const char *e, const char *s);
+
+/**
+ * Similar to \ref find, but continues from \ref html_region::pos, which is
+ * updated so that data are not examined twice.
+ */
+static const char *region_find(
+    struct html_region *r, const char *p, size_t n, const char *s);
+
+/**
+ * Similar to \ref region_find, but skips occurrences outside of tags (e.g. in
+ * text).
+ * \return The start of the tag.
+ */
+static const char *region_find_tag(
+    struct html_region *r, const char *p, size_t n, const char *s);
+
+/**
+ * Continues looking for the end tag of an element region.
+ * \return Whether it was found.
+ */
+static bool region_end_tag(struct html_region *r, const char *p, size_t n);
+
+/**
+ * Parses a response, limited to the region if it is given and found.
+ * The body is modified.
+ */
+static TidyDoc parse_body(
+    struct mtrix_buffer *b, const struct html_region *region);
+
+/** Produces the index of each response, see \ref mtrix_pipeline::read. */
+static enum mtrix_pipeline_read parse_read(
+    void *data, struct mtrix_pipeline_item *item);
+
+/** Parses a response, see \ref mtrix_pipeline::process. */
+static bool parse_process(void *data, struct mtrix_pipeline_item *item);
+
+/** Does nothing, documents are used after the pipeline finishes. */
+static bool parse_write(void *data, struct mtrix_pipeline_item *item);
+
+/**
+ * Returns `v`, reallocated to twice its capacity if it has `n` elements of
+ * `size` bytes and is full.
+ * \return `NULL` if memory could not be allocated.
+ */
+static void *index_grow(void *v, size_t *cap, size_t n, size_t size);
+
+/**
+ * Appends a node to the index, along with its ID and classes.
+ * \param pos Set to its position.
+ */
+static bool index_add(
+    struct index_builder *b, TidyNode node, size_t parent, size_t *pos);
+
+/** Appends the classes in the value of a `class` attribute. */
+static bool index_add_classes(
+    struct index_builder *b, const char *s, size_t pos);
+
+/** Sorts the arrays of the index and groups the classes. */
+static bool index_finish(struct index_builder *b);
+
+/** Orders nodes by address, as required by `qsort`. */
+static int index_cmp_addr(const void *lhs, const void *rhs);
+
+/** Orders elements by ID, then by position, as required by `qsort`. */
+static int index_cmp_id(const void *lhs, const void *rhs);
+
+/** Orders classes by hash, name, and position, as required by `qsort`. */
+static int index_cmp_class(const void *lhs, const void *rhs);
+
+/** Finds the position of a node, `false` if it is not in the index. */
+static bool index_pos(const struct html_index *x, TidyNode node, size_t *pos);
+
+/** Finds an interned class name, `NULL` if no element has it. */
+static const struct html_index_class *index_class(
+    const struct html_index *x, const char *cls);
+
+/** First position in the sorted range `[b, e)` which is not less than `p`. */
+static const size_t *index_lower_bound(
+    const size_t *b, const size_t *e, size_t p);
+
+/** Implements \ref find_node_by_class for a node in the index. */
+static TidyNode index_find_class(
+    const struct html_index *x, size_t pos, const char *cls, bool rec);
+
+/** Implements \ref find_node_by_id for a node in the index. */
+static TidyNode index_find_id(
+    const struct html_index *x, size_t pos, const char *id, bool rec);
+
+/** State of \ref html_select. */
+struct select_state {
+    const struct html_selector *s;
+    html_select_f *f;
+    void *data;
+    /** Optional, see \ref select_index. */
+    const struct html_index *x;
+    /**
+     * Positions of the elements with the first class of each compound, a
+     * range of \ref html_index::class_nodes (empty if it has no classes).
+     */
+    struct { const size_t *b, *e; } classes[HTML_SELECTOR_MAX];
+    /**
+     * Elements with the ID of the first compound, a range of
+     * \ref html_index::ids, used if it has no classes.
+     */
+    const struct html_index_id *ids, *ids_end;
+    /** Whether the elements of the first compound are found in the index. */
+    bool seed;
+};
+
+/** How \ref select_index continues after an element, see \ref select_next. */
+enum select_descent {
+    /** No descendant can match. */
+    SELECT_SKIP,
+    /** Only descendants which match the first compound by themselves. */
+    SELECT_SEED,
+    /** All descendants are examined. */
+    SELECT_CHILDREN,
+};
+
+/** End of the name which starts at `p` (e.g. a class or element name). */
+static const char *selector_name(const char *p);
+
+/**
+ * Copies a string to \ref html_selector::strings.
+ * \param off Set to its offset.
+ */
+static bool selector_string(
+    struct html_selector *s, const char *p, size_t n, size_t *off);
+
+/**
+ * Parses a compound selector.
+ * \return The end of the compound, `NULL` if it is invalid.
+ */
+static const char *selector_compound(
+    struct html_selector *s, const char *p, struct html_compound *c);
+
+/** Parses an attribute selector, after the opening bracket. */
+static const char *selector_attr(
+    struct html_selector *s, const char *p, struct html_compound *c);
+
+/** Checks whether the `class` attribute value `v` has all classes of `c`. */
+static bool compound_has_classes(
+    const struct html_selector *s, const struct html_compound *c,
+    const char *v);
+
+/** Checks whether an element with a given name matches a compound. */
+static bool compound_matches(
+    const struct html_selector *s, const struct html_compound *c,
+    TidyNode node, const char *name);
+
+/**
+ * Finds the compounds matched by an element.
+ * \param parent Compounds matched by the parent of the element.
+ * \param ancestors Compounds matched by any of its ancestors.
+ * \return Set of compounds, one bit for each.
+ */
+static uint32_t select_match(
+    const struct html_selector *s, TidyNode node, const char *name,
+    uint32_t parent, uint32_t ancestors);
+
+/** Implements \ref html_select for a node and its descendants. */
+static bool select_tree(
+    const struct select_state *st, TidyNode node, uint32_t parent,
+    uint32_t ancestors);
+
+/**
+ * Finds the ranges of \ref select_state in the index.
+ * \return `false` if a class or ID of the selector is not in the document, in
+ *         which case nothing can match.
+ */
+static bool select_prepare(struct select_state *st);
+
+/** Implements \ref select_tree for a node in the index. */
+static bool select_index(
+    const struct select_state *st, size_t pos, uint32_t parent,
+    uint32_t ancestors);
+
+/**
+ * Calls \ref select_index for the elements in the range of positions `[b, e)`
+ * which have the class or ID of the first compound, skipping the descendants
+ * of each.
+ */
+static bool select_seeded(const struct select_state *st, size_t b, size_t e);
+
+/**
+ * Determines which descendants of an element can match.
+ * A match inside its subtree continues a chain of compounds matched by the
+ * element or its ancestors (as recorded in `m` and `ancestors`), or starts a
+ * new one.  The compounds not yet matched must all be matched inside the
+ * subtree, so it must contain their classes.
+ */
+static enum select_descent select_next(
+    const struct select_state *st, size_t pos, uint32_t m,
+    uint32_t ancestors);
+
+/** Whether the range of positions `[b, e)` has the class of a compound. */
+static bool select_has_class(
+    const struct select_state *st, size_t i, size_t b, size_t e);
+
+/** Stores the element and ends the search, see \ref html_select_first. */
+static bool select_first(void *data, TidyNode node);
+
+/** Elements which cannot have contents. */
+static const char VOID_ELEMENTS[] =
+    "area base br col embed hr img input link meta param source track wbr";
+
+/** Elements whose contents are text. */
+static const char RAW_ELEMENTS[] = "script style textarea title";
+
+/** Elements laid out as blocks, see \ref html_tokenizer_text. */
+static const char BLOCK_ELEMENTS[] =
+    "address article aside blockquote br dd div dl dt figure footer form h1 "
+    "h2 h3 h4 h5 h6 header hr li main nav ol p pre section table tbody td "
+    "tfoot th thead tr ul";
+
+/** Elements closed implicitly by the start tags of others. */
+static const struct {
+    /** Start tags which close the element. */
+    const char *tags;
+    /** Names of the element, which is closed along with those inside it. */
+    const char *names;
+    /** Elements which end the search for an open element to close. */
+    const char *scope;
+} IMPLIED_END[] = {
+    {"li", "li", "ol ul table td th html"},
+    {"dd dt", "dd dt", "dl table td th html"},
+    {"td th", "td th", "tr table html"},
+    {"tr", "tr", "table html"},
+    {"tbody tfoot thead", "tbody tfoot thead", "table html"},
+    {
+        "address article aside blockquote div dl fieldset figure footer form "
+        "h1 h2 h3 h4 h5 h6 header hr main nav ol p pre section table ul",
+        "p", "button table td th html",
+    },
+};
+
+/** Produces the end tag of the innermost open element. */
+static void tokenizer_pop(struct html_tokenizer *z, struct html_token *t);
+
+/** Opens the element of a start tag, setting its depth. */
+static void tokenizer_push(
+    struct html_tokenizer *z, struct html_token *t, bool empty);
+
+/**
+ * Number of elements closed implicitly by a start tag, see
+ * \ref IMPLIED_END.
+ */
+static size_t tokenizer_implied_end(
+    const struct html_tokenizer *z, const char *name);
+
+/** Reads text, up to the next tag. */
+static void tokenizer_text(struct html_tokenizer *z, struct html_token *t);
+
+/**
+ * Reads the contents of an element in \ref RAW_ELEMENTS, up to its end tag.
+ * \return `false` if they are empty.
+ */
+static bool tokenizer_raw(struct html_tokenizer *z, struct html_token *t);
+
+/** Reads a start tag. */
+static void tokenizer_start(struct html_tokenizer *z, struct html_token *t);
+
+/**
+ * Reads an end tag.
+ * \return `false` if it was ignored.
+ */
+static bool tokenizer_end(struct html_tokenizer *z, struct html_token *t);
+
+/** Skips a comment, declaration, or processing instruction. */
+static void tokenizer_skip_markup(struct html_tokenizer *z);
+
+/** Copies a tag name, see \ref html_token::name. */
+static const char *read_name(
+    const char *p, const char *e, char name[static HTML_TOKENIZER_NAME]);
+
+/**
+ * Reads the attributes of a start tag, up to its end.
+ * \param empty Set if the tag is self-closing.
+ */
+static const char *read_attrs(
+    const char *p, const char *e, struct html_token *t, bool *empty);
+
+/**
+ * Decodes a character reference.
+ * \param c Set to the code point.
+ * \return The end of the reference, `NULL` if it is not valid.
+ */
+static const char *read_ref(const char *p, const char *e, uint32_t *c);
+
+/** Appends a code point, encoded as UTF-8. */
+static bool append_code_point(struct mtrix_buffer *b, uint32_t c);
+
+/** Appends `n` bytes, `false` if memory could not be allocated. */
+static bool append(struct mtrix_buffer *b, const char *p, size_t n);
+
+/** Appends a space, unless `b` is empty or already ends with one. */
+static bool append_space(struct mtrix_buffer *b);
+
+void html_region_init(struct html_region *r) {
+    r->stop = (struct mtrix_stop){.f = region_stop, .skipped = -1};
+    r->begin = r->end = r->pos = r->depth = 0;
+    *r->tag = 0;
+    r->state = HTML_REGION_START;
+}
+
+bool html_region_scan(struct html_region *r, const char *p, size_t n) {
+    const char *q = NULL;
+    switch(r->state) {
+    case HTML_REGION_START:
+        q = region_find_tag(r, p, n, r->element ? r->element : r->after);
+        if(!q)
+            return false;
+        if(!r->element) {
+            r->state = HTML_REGION_UNTIL;
+            return html_region_scan(r, p, n);
+        }
+        size_t len = 0;
+        while(isalnum((unsigned char)q[1 + len]))
+            ++len;
+        if(!len || sizeof(r->tag) <= len)
+            return r->state = HTML_REGION_INVALID, false;
+        memcpy(r->tag, q + 1, len);
+        r->tag[len] = 0;
+        r->begin = (size_t)(q - p);
+        r->depth = 1;
+        r->state = HTML_REGION_ELEMENT;
+        // fallthrough
+    case HTML_REGION_ELEMENT:
+        if(!region_end_tag(r, p, n))
+            return false;
+        return r->state = HTML_REGION_DONE, true;
+    case HTML_REGION_UNTIL:
+        if(!(q = region_find_tag(r, p, n, r->until)))
+            return false;
+        r->end = (size_t)(q - p);
+        return r->state = HTML_REGION_DONE, true;
+    case HTML_REGION_DONE: return true;
+    case HTML_REGION_INVALID: return false;
+    }
+    return false;
+}
+
+bool region_stop(struct mtrix_stop *s, const struct mtrix_buffer *b) {
+    return html_region_scan((struct html_region*)s, b->p, b->n);
+}
+
+const char *find(const char *b, const char *e, const char *s) {
+    const size_t n = strlen(s);
+    for(; (size_t)(e - b) >= n; ++b) {
+        if(!(b = memchr(b, *s, (size_t)(e - b) - n + 1)))
+            return NULL;
+        if(!memcmp(b, s, n))
+            return b;
+    }
+    return NULL;
+}
+
+const char *region_find(
+    struct html_region *r, const char *p, size_t n, const char *s
+) {
+    const size_t len = strlen(s);
+    const char *const ret = find(p + r->pos, p + n, s);
+    if(ret)
+        r->pos = (size_t)(ret - p) + len;
+    // A partial occurrence may be completed by the next data.
+    else if(r->pos + len <= n)
+        r->pos = n - len + 1;
+    return ret;
+}
+
+const char *region_find_tag(
+    struct html_region *r, const char *p, size_t n, const char *s
+) {
+    for(const char *q; (q = region_find(r, p, n, s));) {
+        while(q != p && *q != '<' && *q != '>')
+            --q;
+        if(*q == '<')
+            return q;
     }
+    return NULL;
+}
+
+bool region_end_tag(struct html_region *r, const char *p, size_t n) {
+    const size_t len = strlen(r->tag);
+    const char *const e = p + n;
+    // Each iteration examines one tag, waiting for more data (with `pos` at
+    // its start) if it is incomplete.
+    for(const char *q; (q = memchr(p + r->pos, '<', n - r->pos));) {
+        r->pos = (size_t)(q - p);
+        if(e - q < 4)
+            return false;
+        if(!memcmp(q, "<!--", 4)) {
+            const char *const c = find(q + 4, e, "-->");
+            if(!c)
+                return false;
+            r->pos = (size_t)(c + 3 - p);
+            continue;
+        }
+        const bool close = q[1] == '/';
+        const char *const name = q + 1 + close;
+        if((size_t)(e - name) <= len)
+            return false;
+        ++r->pos;
+        if(strncasecmp(name, r->tag, len) || isalnum((unsigned char)name[len]))
+            continue;
+        if(!close) {
+            ++r->depth;
+            continue;
+        }
+        const char *const gt = memchr(name, '>', (size_t)(e - name));
+        if(!gt)
+            return --r->pos, false;
+        r->pos = (size_t)(gt + 1 - p);
+        if(!--r->depth)
+            return r->end = r->pos, true;
+    }
+    r->pos = n;
+    return false;
+}
+
+TidyDoc request_and_parse(
+    const char *url, const struct mtrix_cache *cache,
+    struct html_region *region, long *status, bool verbose
+) {
+    struct mtrix_buffer buffer = {.stop = region ? &region->stop : NULL};
+    TidyDoc ret = NULL;
+    bool ok = false;
+    if(request_bodies(1, &url, cache, &buffer, &ok, status, verbose) && ok)
+        ret = parse_body(&buffer, region);
     free(buffer.p);
     return ret;
 }
 
+bool request_and_parse_multi(
+    size_t n, const char *const *urls, const struct mtrix_cache *cache,
+    struct html_region *regions, size_t n_workers, TidyDoc *docs,
+    long *status, bool verbose
+) {
+    struct mtrix_buffer *const bodies = calloc(n, sizeof(*bodies));
+    bool *const ok = calloc(n, sizeof(*ok));
+    bool ret = false;
+    for(size_t i = 0; i != n; ++i)
+        docs[i] = NULL;
+    if(!(bodies && ok)) {
+        log_errno("calloc");
+        goto end;
+    }
+    if(regions)
+        for(size_t i = 0; i != n; ++i)
+            bodies[i].stop = &regions[i].stop;
+    if(!request_bodies(n, urls, cache, bodies, ok, status, verbose))
+        goto end;
+    struct parse_batch b = {
+        .n = n, .bodies = bodies, .ok = ok, .regions = regions, .docs = docs,
+    };
+    const struct mtrix_pipeline p = {
+        .n_workers = n_workers,
+        .data = &b,
+        .read = parse_read,
+        .process = parse_process,
+        .write = parse_write,
+    };
+    if(!(ret = mtrix_pipeline_run(&p)))
+        for(size_t i = 0; i != n; ++i)
+            if(docs[i])
+                html_release(docs[i]), docs[i] = NULL;
+end:
+    if(bodies)
+        for(size_t i = 0; i != n; ++i)
+            free(bodies[i].p);
+    free(ok);
+    free(bodies);
+    return ret;
+}
+
+bool request_bodies(
+    size_t n, const char *const *urls, const struct mtrix_cache *cache,
+    struct mtrix_buffer *bodies, bool *ok, long *status, bool verbose
+) {
+    if(*cache->dir)
+        return mtrix_cache_request_multi(
+            cache, n, urls, bodies, ok, status, verbose);
+    struct mtrix_transfer *const t = calloc(n, sizeof(*t));
+    if(!t)
+        return log_errno("calloc"), false;
+    for(size_t i = 0; i != n; ++i) {
+        t[i].url = urls[i];
+        t[i].body.stop = bodies[i].stop;
+    }
+    // A single request uses the handle kept for its host, as in
+    // mtrix_cache_request_multi.  Its failure is indicated by the status.
+    bool ret = true;
+    if(n == 1)
+        request_cond(
+            t->url, &t->body, &(struct mtrix_validators){0}, &t->resp,
+            &t->status, verbose);
+    else
+        ret = request_multi(n, t, verbose);
+    for(size_t i = 0; i != n; ++i) {
+        bodies[i] = t[i].body;
+        if(status)
+            status[i] = t[i].status;
+        // As in mtrix_cache_request, a missing page is left to the caller.
+        if(!(ok[i] = http_status_usable(t[i].status)) && t[i].status)
+            log_err("%s: HTTP status %ld\n", urls[i], t[i].status);
+    }
+    free(t);
+    return ret;
+}
+
+const char *html_region_extract(
+    struct mtrix_buffer *b, const struct html_region *region, size_t *n
+) {
+    *n = b->n;
+    if(!region || !b->p)
+        return b->p;
+    // Cached responses are not scanned while they are received.
+    struct html_region r = *region;
+    html_region_init(&r);
+    if(!html_region_scan(&r, b->p, b->n))
+        return b->p;
+    b->p[r.end] = 0;
+    *n = r.end - r.begin;
+    return b->p + r.begin;
+}
+
+TidyDoc parse_body(struct mtrix_buffer *b, const struct html_region *region) {
+    size_t n = 0;
+    return parse_html(html_region_extract(b, region, &n));
+}
+
+TidyDoc parse_html(const char *s) {
+    const TidyDoc ret = tidyCreate();
+    tidyOptSetBool(ret, TidyForceOutput, yes);
+    tidyParseString(ret, s);
+    // Without an index, searches fall back to walking the tree.
+    tidySetAppData(ret, html_index_build(ret));
+    return ret;
+}
+
+void html_release(TidyDoc doc) {
+    if(!doc)
+        return;
+    html_index_free(tidyGetAppData(doc));
+    tidyRelease(doc);
+}
+
+struct html_index *html_index_build(TidyDoc doc) {
+    struct html_index *const x = calloc(1, sizeof(*x));
+    if(!x)
+        return log_errno("calloc"), NULL;
+    struct index_builder b = {.x = x};
+    size_t i = 0;
+    bool ret = index_add(&b, tidyGetRoot(doc), 0, &i);
+    // Depth-first traversal, the parent of each node is found in the index.
+    while(ret) {
+        const TidyNode child = tidyGetChild(x->nodes[i].node);
+        if(child) {
+            ret = index_add(&b, child, i, &i);
+            continue;
+        }
+        for(;; i = x->nodes[i].parent) {
+            x->nodes[i].end = x->n_nodes;
+            if(!i)
+                break;
+            const TidyNode next = tidyGetNext(x->nodes[i].node);
+            if(next) {
+                ret = index_add(&b, next, x->nodes[i].parent, &i);
+                break;
+            }
+        }
+        if(!i)
+            break;
+    }
+    ret = ret && index_finish(&b);
+    free(b.classes);
+    if(!ret)
+        return html_index_free(x), NULL;
+    return x;
+}
+
+void html_index_free(struct html_index *x) {
+    if(!x)
+        return;
+    free(x->class_nodes);
+    free(x->classes);
+    free(x->ids);
+    free(x->by_addr);
+    free(x->nodes);
+    free(x);
+}
+
+const struct html_index *html_index_get(TidyDoc doc) {
+    return tidyGetAppData(doc);
+}
+
+void *index_grow(void *v, size_t *cap, size_t n, size_t size) {
+    if(n != *cap)
+        return v;
+    const size_t c = *cap ? 2 * *cap : 256;
+    void *const ret = realloc(v, c * size);
+    if(!ret)
+        return log_errno("realloc"), NULL;
+    *cap = c;
+    return ret;
+}
+
+bool index_add(
+    struct index_builder *b, TidyNode node, size_t parent, size_t *pos
+) {
+    struct html_index *const x = b->x;
+    struct html_index_node *const v =
+        index_grow(x->nodes, &b->nodes_cap, x->n_nodes, sizeof(*v));
+    if(!v)
+        return false;
+    x->nodes = v;
+    *pos = x->n_nodes++;
+    v[*pos] = (struct html_index_node){.node = node, .parent = parent};
+    // Only the first of each attribute is used, like in find_attr.
+    bool id = false, cls = false;
+    for(TidyAttr a = tidyAttrFirst(node); a; a = tidyAttrNext(a)) {
+        const char *const name = tidyAttrName(a);
+        const char *const value = tidyAttrValue(a);
+        if(!id && strcmp(name, "id") == 0) {
+            id = true;
+            if(!value)
+                continue;
+            struct html_index_id *const ids =
+                index_grow(x->ids, &b->ids_cap, x->n_ids, sizeof(*ids));
+            if(!ids)
+                return false;
+            x->ids = ids;
+            ids[x->n_ids++] = (struct html_index_id){.id = value, .pos = *pos};
+        } else if(!cls && strcmp(name, "class") == 0) {
+            cls = true;
+            if(value && !index_add_classes(b, value, *pos))
+                return false;
+        }
+    }
+    return true;
+}
+
+bool index_add_classes(struct index_builder *b, const char *s, size_t pos) {
+    // Same separators as list_has_class.
+    while(*(s += strspn(s, " "))) {
+        const size_t n = strcspn(s, " ");
+        struct index_class *const v = index_grow(
+            b->classes, &b->classes_cap, b->n_classes, sizeof(*v));
+        if(!v)
+            return false;
+        b->classes = v;
+        v[b->n_classes++] = (struct index_class){
+            .hash = mtrix_hasher_add_bytes(MTRIX_HASHER_INIT, s, n).h,
+            .name = s, .len = n, .pos = pos,
+        };
+        s += n;
+    }
+    return true;
+}
+
+bool index_finish(struct index_builder *b) {
+    struct html_index *const x = b->x;
+    const size_t n = x->n_nodes, m = b->n_classes;
+    x->by_addr = calloc(n, sizeof(*x->by_addr));
+    x->class_nodes = calloc(m ? m : 1, sizeof(*x->class_nodes));
+    x->classes = calloc(m ? m : 1, sizeof(*x->classes));
+    if(!(x->by_addr && x->class_nodes && x->classes))
+        return log_errno("calloc"), false;
+    for(size_t i = 0; i != n; ++i)
+        x->by_addr[i] = (struct html_index_addr){x->nodes[i].node, i};
+    qsort(x->by_addr, n, sizeof(*x->by_addr), index_cmp_addr);
+    if(x->n_ids)
+        qsort(x->ids, x->n_ids, sizeof(*x->ids), index_cmp_id);
+    if(!m)
+        return true;
+    // Each class is interned once, with its elements in document order.
+    struct index_class *const v = b->classes;
+    qsort(v, m, sizeof(*v), index_cmp_class);
+    for(size_t i = 0; i != m; ++i) {
+        struct html_index_class *c =
+            x->n_classes ? x->classes + x->n_classes - 1 : NULL;
+        if(!c || c->hash != v[i].hash || c->len != v[i].len
+                || memcmp(c->name, v[i].name, v[i].len)) {
+            c = x->classes + x->n_classes++;
+            *c = (struct html_index_class){
+                .hash = v[i].hash, .name = v[i].name, .len = v[i].len,
+                .first = x->n_class_nodes,
+            };
+        }
+        // Repeated classes in the same attribute are stored once.
+        if(!c->n || x->class_nodes[x->n_class_nodes - 1] != v[i].pos) {
+            x->class_nodes[x->n_class_nodes++] = v[i].pos;
+            ++c->n;
+        }
+    }
+    return true;
+}
+
+int index_cmp_addr(const void *lhs, const void *rhs) {
+    const uintptr_t l = (uintptr_t)((const struct html_index_addr*)lhs)->node;
+    const uintptr_t r = (uintptr_t)((const struct html_index_addr*)rhs)->node;
+    return (l > r) - (l < r);
+}
+
+int index_cmp_id(const void *lhs, const void *rhs) {
+    const struct html_index_id *const l = lhs, *const r = rhs;
+    const int c = strcmp(l->id, r->id);
+    return c ? c : (l->pos > r->pos) - (l->pos < r->pos);
+}
+
+int index_cmp_class(const void *lhs, const void *rhs) {
+    const struct index_class *const l = lhs, *const r = rhs;
+    if(l->hash != r->hash)
+        return l->hash < r->hash ? -1 : 1;
+    if(l->len != r->len)
+        return l->len < r->len ? -1 : 1;
+    const int c = memcmp(l->name, r->name, l->len);
+    return c ? c : (l->pos > r->pos) - (l->pos < r->pos);
+}
+
+bool index_pos(const struct html_index *x, TidyNode node, size_t *pos) {
+    const uintptr_t p = (uintptr_t)node;
+    size_t b = 0, e = x->n_nodes;
+    while(b != e) {
+        const size_t m = b + (e - b) / 2;
+        const uintptr_t q = (uintptr_t)x->by_addr[m].node;
+        if(q < p)
+            b = m + 1;
+        else if(p < q)
+            e = m;
+        else
+            return *pos = x->by_addr[m].pos, true;
+    }
+    return false;
+}
+
+const struct html_index_class *index_class(
+    const struct html_index *x, const char *cls
+) {
+    const mtrix_hash h = mtrix_hash_str(cls);
+    const size_t n = strlen(cls);
+    size_t b = 0, e = x->n_classes;
+    while(b != e) {
+        const size_t m = b + (e - b) / 2;
+        if(x->classes[m].hash < h)
+            b = m + 1;
+        else
+            e = m;
+    }
+    // Names with the same hash are adjacent.
+    for(; b != x->n_classes && x->classes[b].hash == h; ++b)
+        if(x->classes[b].len == n && !memcmp(x->classes[b].name, cls, n))
+            return x->classes + b;
+    return NULL;
+}
+
+const size_t *index_lower_bound(const size_t *b, const size_t *e, size_t p) {
+    while(b != e) {
+        const size_t *const m = b + (e - b) / 2;
+        if(*m < p)
+            b = m + 1;
+        else
+            e = m;
+    }
+    return b;
+}
+
+TidyNode index_find_class(
+    const struct html_index *x, size_t pos, const char *cls, bool rec
+) {
+    const struct html_index_class *const c = index_class(x, cls);
+    if(!c)
+        return NULL;
+    // The node and its siblings after it, along with their descendants, are
+    // the range up to the end of the parent.  The root has no siblings.
+    const size_t parent = x->nodes[pos].parent;
+    const size_t end = pos ? x->nodes[parent].end : rec ? x->n_nodes : 1;
+    const size_t *const e = x->class_nodes + c->first + c->n;
+    const size_t *v = index_lower_bound(x->class_nodes + c->first, e, pos);
+    while(v != e && *v < end) {
+        if(rec || *v == pos || x->nodes[*v].parent == parent)
+            return x->nodes[*v].node;
+        // Skips the rest of the sibling which contains the element.
+        size_t s = *v;
+        while(x->nodes[s].parent != parent)
+            s = x->nodes[s].parent;
+        v = index_lower_bound(v, e, x->nodes[s].end);
+    }
+    return NULL;
+}
+
+TidyNode index_find_id(
+    const struct html_index *x, size_t pos, const char *id, bool rec
+) {
+    const size_t end = x->nodes[pos].end;
+    size_t b = 0, e = x->n_ids;
+    while(b != e) {
+        const size_t m = b + (e - b) / 2;
+        const int c = strcmp(x->ids[m].id, id);
+        if(c < 0 || (!c && x->ids[m].pos <= pos))
+            b = m + 1;
+        else
+            e = m;
+    }
+    for(; b != x->n_ids && x->ids[b].pos < end; ++b) {
+        if(strcmp(x->ids[b].id, id))
+            break;
+        if(rec || x->nodes[x->ids[b].pos].parent == pos)
+            return x->nodes[x->ids[b].pos].node;
+    }
+    return NULL;
+}
+
+enum mtrix_pipeline_read parse_read(
+    void *data, struct mtrix_pipeline_item *item
+) {
+    (void)item;
+    struct parse_batch *const b = data;
+    return b->next++ == b->n ? MTRIX_PIPELINE_END : MTRIX_PIPELINE_ITEM;
+}
+
+bool parse_process(void *data, struct mtrix_pipeline_item *item) {
+    const struct parse_batch *const b = data;
+    const size_t i = item->seq;
+    const struct html_region *const r = b->regions ? b->regions + i : NULL;
+    b->docs[i] = b->ok[i] ? parse_body(b->bodies + i, r) : NULL;
+    return true;
+}
+
+bool parse_write(void *data, struct mtrix_pipeline_item *item) {
+    (void)data;
+    (void)item;
+    return true;
+}
+
 bool list_has_class(const char *s, const char *cls) {
     const size_t n = strlen(cls);
     while(*(s += strspn(s, " "))) {
@@ -52,20 +941,31 @@ TidyNode find_node_by_name_prefix(TidyNode node, const char *name) {
     return node;
 }
 
-TidyNode find_node_by_class(TidyNode node, const char *cls, bool rec) {
+TidyNode find_node_by_class(
+    const struct html_index *x, TidyNode node, const char *cls, bool rec
+) {
+    size_t pos = 0;
+    if(x && node && index_pos(x, node, &pos))
+        return index_find_class(x, pos, cls, rec);
     for(; node; node = tidyGetNext(node)) {
         if(node_has_class(node, cls))
             break;
         if(!rec)
             continue;
-        TidyNode const ret = find_node_by_class(tidyGetChild(node), cls, rec);
+        TidyNode const ret =
+            find_node_by_class(NULL, tidyGetChild(node), cls, rec);
         if(ret)
             return ret;
     }
     return node;
 }
 
-TidyNode find_node_by_id(TidyNode node, const char *id, bool rec) {
+TidyNode find_node_by_id(
+    const struct html_index *x, TidyNode node, const char *id, bool rec
+) {
+    size_t pos = 0;
+    if(x && node && index_pos(x, node, &pos))
+        return index_find_id(x, pos, id, rec);
     TidyNode child;
     for(child = tidyGetChild(node); child; child = tidyGetNext(child)) {
         for(TidyAttr a = tidyAttrFirst(child); a; a = tidyAttrNext(a)) {
@@ -78,7 +978,7 @@ TidyNode find_node_by_id(TidyNode node, const char *id, bool rec) {
         }
         if(!rec)
             continue;
-        TidyNode ret = find_node_by_id(child, id, rec);
+        TidyNode ret = find_node_by_id(NULL, child, id, rec);
         if(ret)
             return ret;
     }
@@ -177,3 +1077,744 @@ const unsigned char *copy_text(FILE *f, const unsigned char *s) {
     fprintf(f, "%.*s", (int)(s - p), p);
     return s;
 }
+
+bool html_selector_compile(struct html_selector *s, const char *src) {
+    *s = (struct html_selector){.strings_len = 1};
+    const char *p = src;
+    for(bool child = false;;) {
+        p += strspn(p, " \t\n");
+        if(*p == '>') {
+            // A combinator must follow a compound.
+            if(!s->n || child)
+                break;
+            child = true;
+            ++p;
+            continue;
+        }
+        if(!*p) {
+            if(!s->n || child)
+                break;
+            return true;
+        }
+        if(s->n == HTML_SELECTOR_MAX)
+            break;
+        struct html_compound *const c = s->v + s->n++;
+        c->child = child;
+        child = false;
+        if(!(p = selector_compound(s, p, c)) || (*p && !strchr(" \t\n>", *p)))
+            break;
+    }
+    return log_err("invalid selector: %s\n", src), false;
+}
+
+bool html_select(
+    const struct html_index *x, const struct html_selector *s, TidyNode node,
+    html_select_f *f, void *data
+) {
+    if(!node || !s->n)
+        return true;
+    struct select_state st = {.s = s, .f = f, .data = data};
+    size_t pos = 0;
+    if(!(x && index_pos(x, node, &pos)))
+        return select_tree(&st, node, 0, 0);
+    st.x = x;
+    if(!select_prepare(&st))
+        return true;
+    if(st.seed)
+        return select_seeded(&st, pos, x->nodes[pos].end);
+    return select_index(&st, pos, 0, 0);
+}
+
+TidyNode html_select_first(
+    const struct html_index *x, const struct html_selector *s, TidyNode node
+) {
+    TidyNode ret = NULL;
+    html_select(x, s, node, select_first, &ret);
+    return ret;
+}
+
+const char *selector_name(const char *p) {
+    for(unsigned char c; (c = (unsigned char)*p); ++p)
+        if(!(isalnum(c) || c == '-' || c == '_' || 0x80 <= c))
+            break;
+    return p;
+}
+
+bool selector_string(
+    struct html_selector *s, const char *p, size_t n, size_t *off
+) {
+    if(sizeof(s->strings) - s->strings_len <= n)
+        return false;
+    char *const dst = s->strings + s->strings_len;
+    memcpy(dst, p, n);
+    dst[n] = 0;
+    *off = s->strings_len;
+    s->strings_len += n + 1;
+    return true;
+}
+
+const char *selector_compound(
+    struct html_selector *s, const char *p, struct html_compound *c
+) {
+    const char *const b = p, *e = selector_name(p);
+    if(*p == '*')
+        ++p;
+    else if(e != p) {
+        if(!selector_string(s, p, (size_t)(e - p), &c->name))
+            return NULL;
+        for(char *n = s->strings + c->name; *n; ++n)
+            *n = (char)tolower((unsigned char)*n);
+        p = e;
+    }
+    for(;; p = e) {
+        switch(*p) {
+        case '#':
+            ++p;
+            if(c->id || (e = selector_name(p)) == p)
+                return NULL;
+            if(!selector_string(s, p, (size_t)(e - p), &c->id))
+                return NULL;
+            break;
+        case '.':
+            ++p;
+            if(c->n_classes == HTML_SELECTOR_CLASSES)
+                return NULL;
+            if((e = selector_name(p)) == p)
+                return NULL;
+            if(!selector_string(
+                    s, p, (size_t)(e - p), c->class_names + c->n_classes))
+                return NULL;
+            // Same hash as the classes in html_index.
+            c->classes[c->n_classes++] = mtrix_hasher_add_bytes(
+                MTRIX_HASHER_INIT, p, (size_t)(e - p)).h;
+            break;
+        case '[':
+            if(!(e = selector_attr(s, p + 1, c)))
+                return NULL;
+            break;
+        default:
+            return p == b ? NULL : p;
+        }
+    }
+}
+
+const char *selector_attr(
+    struct html_selector *s, const char *p, struct html_compound *c
+) {
+    if(c->n_attrs == HTML_SELECTOR_ATTRS)
+        return NULL;
+    const char *e = selector_name(p);
+    if(e == p || strncmp(e, "^=", 2))
+        return NULL;
+    if(!selector_string(s, p, (size_t)(e - p), &c->attrs[c->n_attrs].name))
+        return NULL;
+    p = e + 2;
+    const bool quoted = *p == '"' || *p == '\'';
+    if(quoted) {
+        if(!(e = strchr(p + 1, *p)))
+            return NULL;
+        ++p;
+    } else if((e = selector_name(p)) == p)
+        return NULL;
+    if(!selector_string(s, p, (size_t)(e - p), &c->attrs[c->n_attrs].prefix))
+        return NULL;
+    e += quoted;
+    if(*e != ']')
+        return NULL;
+    ++c->n_attrs;
+    return e + 1;
+}
+
+bool compound_has_classes(
+    const struct html_selector *s, const struct html_compound *c,
+    const char *v
+) {
+    // Each class of the element is hashed once and compared to all of the
+    // compound, names are only compared to confirm a match.
+    uint32_t found = 0;
+    while(*(v += strspn(v, " "))) {
+        const size_t n = strcspn(v, " ");
+        const mtrix_hash h = mtrix_hasher_add_bytes(MTRIX_HASHER_INIT, v, n).h;
+        for(size_t i = 0; i != c->n_classes; ++i) {
+            const char *const name = s->strings + c->class_names[i];
+            if(c->classes[i] == h && !strncmp(name, v, n) && !name[n])
+                found |= (uint32_t)1 << i;
+        }
+        v += n;
+    }
+    return found == ((uint32_t)1 << c->n_classes) - 1;
+}
+
+bool compound_matches(
+    const struct html_selector *s, const struct html_compound *c,
+    TidyNode node, const char *name
+) {
+    const char *const str = s->strings;
+    if(c->name && strcmp(name, str + c->name))
+        return false;
+    TidyAttr a;
+    ctmbstr v;
+    if(c->id && !(
+        (a = find_attr(node, "id")) && (v = tidyAttrValue(a))
+        && !strcmp(v, str + c->id)
+    ))
+        return false;
+    if(c->n_classes && !(
+        (a = find_attr(node, "class")) && (v = tidyAttrValue(a))
+        && compound_has_classes(s, c, v)
+    ))
+        return false;
+    for(size_t i = 0; i != c->n_attrs; ++i) {
+        const char *const prefix = str + c->attrs[i].prefix;
+        if(!(
+            (a = find_attr(node, str + c->attrs[i].name))
+            && (v = tidyAttrValue(a))
+            && !strncmp(v, prefix, strlen(prefix))
+        ))
+            return false;
+    }
+    return true;
+}
+
+uint32_t select_match(
+    const struct html_selector *s, TidyNode node, const char *name,
+    uint32_t parent, uint32_t ancestors
+) {
+    static_assert(HTML_SELECTOR_MAX <= 32, "one bit for each compound");
+    uint32_t ret = 0;
+    for(size_t i = 0; i != s->n; ++i) {
+        const struct html_compound *const c = s->v + i;
+        // Only compounds whose predecessor was matched are examined.
+        if(i && !((c->child ? parent : ancestors) >> (i - 1) & 1))
+            continue;
+        if(compound_matches(s, c, node, name))
+            ret |= (uint32_t)1 << i;
+    }
+    return ret;
+}
+
+bool select_tree(
+    const struct select_state *st, TidyNode node, uint32_t parent,
+    uint32_t ancestors
+) {
+    const struct html_selector *const s = st->s;
+    const char *const name = tidyNodeGetName(node);
+    uint32_t m = 0;
+    if(name) {
+        m = select_match(s, node, name, parent, ancestors);
+        if(m >> (s->n - 1) & 1 && !st->f(st->data, node))
+            return false;
+    }
+    for(TidyNode child = tidyGetChild(node); child; child = tidyGetNext(child))
+        if(!select_tree(st, child, m, ancestors | m))
+            return false;
+    return true;
+}
+
+bool select_first(void *data, TidyNode node) {
+    *(TidyNode*)data = node;
+    return false;
+}
+
+bool select_prepare(struct select_state *st) {
+    const struct html_selector *const s = st->s;
+    const struct html_index *const x = st->x;
+    for(size_t i = 0; i != s->n; ++i) {
+        const struct html_compound *const c = s->v + i;
+        if(!c->n_classes)
+            continue;
+        const struct html_index_class *const cls =
+            index_class(x, s->strings + c->class_names[0]);
+        if(!cls)
+            return false;
+        const size_t *const b = x->class_nodes + cls->first;
+        st->classes[i].b = b;
+        st->classes[i].e = b + cls->n;
+    }
+    const struct html_compound *const c = s->v;
+    if(c->n_classes)
+        return st->seed = true;
+    if(!c->id)
+        return true;
+    // Elements with the same ID are adjacent, in document order.
+    const char *const id = s->strings + c->id;
+    size_t b = 0, e = x->n_ids;
+    while(b != e) {
+        const size_t m = b + (e - b) / 2;
+        if(strcmp(x->ids[m].id, id) < 0)
+            b = m + 1;
+        else
+            e = m;
+    }
+    for(e = b; e != x->n_ids && !strcmp(x->ids[e].id, id); ++e);
+    st->ids = x->ids + b;
+    st->ids_end = x->ids + e;
+    return st->seed = b != e;
+}
+
+bool select_index(
+    const struct select_state *st, size_t pos, uint32_t parent,
+    uint32_t ancestors
+) {
+    const struct html_selector *const s = st->s;
+    const struct html_index_node *const v = st->x->nodes;
+    const TidyNode node = v[pos].node;
+    const char *const name = tidyNodeGetName(node);
+    uint32_t m = 0;
+    if(name) {
+        m = select_match(s, node, name, parent, ancestors);
+        if(m >> (s->n - 1) & 1 && !st->f(st->data, node))
+            return false;
+    }
+    switch(select_next(st, pos, m, ancestors | m)) {
+    case SELECT_SKIP: return true;
+    case SELECT_SEED: return select_seeded(st, pos + 1, v[pos].end);
+    case SELECT_CHILDREN: break;
+    }
+    for(size_t i = pos + 1; i != v[pos].end; i = v[i].end)
+        if(!select_index(st, i, m, ancestors | m))
+            return false;
+    return true;
+}
+
+bool select_seeded(const struct select_state *st, size_t b, size_t e) {
+    const struct html_index_node *const v = st->x->nodes;
+    const size_t *p = st->classes[0].b;
+    const struct html_index_id *id = st->ids;
+    for(;;) {
+        size_t pos = e;
+        if(st->classes[0].b) {
+            p = index_lower_bound(p, st->classes[0].e, b);
+            if(p != st->classes[0].e)
+                pos = *p;
+        } else {
+            // IDs are expected to be unique, so the range is short.
+            for(; id != st->ids_end && id->pos < b; ++id);
+            if(id != st->ids_end)
+                pos = id->pos;
+        }
+        if(e <= pos)
+            return true;
+        // Descendants are examined by select_index, which also finds those
+        // which match the first compound.
+        if(!select_index(st, pos, 0, 0))
+            return false;
+        b = v[pos].end;
+    }
+}
+
+enum select_descent select_next(
+    const struct select_state *st, size_t pos, uint32_t m,
+    uint32_t ancestors
+) {
+    const struct html_compound *const v = st->s->v;
+    const size_t b = pos + 1, e = st->x->nodes[pos].end;
+    if(b == e)
+        return SELECT_SKIP;
+    // A chain which continues after compound `i - 1` needs compounds `i` and
+    // later in the subtree.  Later chains need fewer of them, so they are
+    // examined first.
+    for(size_t i = st->s->n; i--;) {
+        if(!select_has_class(st, i, b, e))
+            return SELECT_SKIP;
+        if(!i)
+            break;
+        // The previous compound must be matched by the element itself if the
+        // combinator is `>`.
+        if((v[i].child ? m : ancestors) >> (i - 1) & 1)
+            return SELECT_CHILDREN;
+    }
+    // No chain continues into the subtree, new ones start at the elements
+    // which match the first compound.
+    return st->seed ? SELECT_SEED : SELECT_CHILDREN;
+}
+
+bool select_has_class(
+    const struct select_state *st, size_t i, size_t b, size_t e
+) {
+    const size_t *const end = st->classes[i].e;
+    if(!st->classes[i].b)
+        return true;
+    const size_t *const p = index_lower_bound(st->classes[i].b, end, b);
+    return p != end && *p < e;
+}
+
+void html_tokenizer_init(struct html_tokenizer *z, const char *p, size_t n) {
+    z->p = p;
+    z->e = p + n;
+    z->depth = z->close = 0;
+    z->has_next = z->next_empty = z->raw = false;
+}
+
+bool html_tokenizer_next(struct html_tokenizer *z, struct html_token *t) {
+    if(z->close)
+        return --z->close, tokenizer_pop(z, t), true;
+    if(z->has_next) {
+        *t = z->next;
+        z->has_next = false;
+        return tokenizer_push(z, t, z->next_empty), true;
+    }
+    if(z->raw && (z->raw = false, tokenizer_raw(z, t)))
+        return true;
+    while(z->p != z->e) {
+        const char *const p = z->p;
+        // Shorter tags are not valid.
+        const unsigned char c =
+            *p != '<' || z->e - p < 3 ? 0 : (unsigned char)p[1];
+        if(c == '!' || c == '?')
+            tokenizer_skip_markup(z);
+        else if(isalpha(c))
+            return tokenizer_start(z, t), true;
+        else if(c != '/')
+            return tokenizer_text(z, t), true;
+        else if(!isalpha((unsigned char)p[2]))
+            tokenizer_skip_markup(z);
+        else if(tokenizer_end(z, t))
+            return true;
+    }
+    if(!z->depth)
+        return false;
+    z->close = z->depth - 1;
+    return tokenizer_pop(z, t), true;
+}
+
+void html_tokenizer_skip(struct html_tokenizer *z, size_t depth) {
+    struct html_token t;
+    while(depth <= z->depth && html_tokenizer_next(z, &t));
+}
+
+bool html_tokenizer_find(
+    struct html_tokenizer *z, struct html_token *t, size_t depth,
+    const char *id, const char *cls
+) {
+    while(depth <= z->depth && html_tokenizer_next(z, t))
+        if(t->type == HTML_TOKEN_START
+                && (!id || html_token_has_id(t, id))
+                && (!cls || html_token_has_class(t, cls)))
+            return true;
+    return false;
+}
+
+bool html_tokenizer_text(
+    struct html_tokenizer *z, const struct html_token *t,
+    struct mtrix_buffer *b
+) {
+    bool ret = true;
+    if(t->type == HTML_TOKEN_TEXT)
+        ret = html_append_text(b, t->text, t->text_len);
+    else if(t->type == HTML_TOKEN_START)
+        for(struct html_token x;
+                ret && t->depth <= z->depth && html_tokenizer_next(z, &x);)
+            ret = x.type == HTML_TOKEN_TEXT
+                ? html_append_text(b, x.text, x.text_len)
+                : !list_has_class(BLOCK_ELEMENTS, x.name) || append_space(b);
+    while(b->n && b->p[b->n - 1] == ' ')
+        b->p[--b->n] = 0;
+    return ret;
+}
+
+bool html_token_has_id(const struct html_token *t, const char *id) {
+    const size_t n = strlen(id);
+    return t->id && t->id_len == n && !memcmp(t->id, id, n);
+}
+
+bool html_token_has_id_prefix(const struct html_token *t, const char *prefix) {
+    const size_t n = strlen(prefix);
+    return t->id && n <= t->id_len && !memcmp(t->id, prefix, n);
+}
+
+bool html_token_is_space(const struct html_token *t) {
+    if(t->type != HTML_TOKEN_TEXT)
+        return false;
+    for(size_t i = 0; i != t->text_len; ++i)
+        if(!isspace((unsigned char)t->text[i]))
+            return false;
+    return true;
+}
+
+bool html_token_has_class(const struct html_token *t, const char *cls) {
+    if(!t->cls)
+        return false;
+    const size_t n = strlen(cls);
+    for(const char *p = t->cls, *const e = p + t->cls_len; p != e;) {
+        while(p != e && isspace((unsigned char)*p))
+            ++p;
+        const char *const w = p;
+        while(p != e && !isspace((unsigned char)*p))
+            ++p;
+        if((size_t)(p - w) == n && !memcmp(w, cls, n))
+            return true;
+    }
+    return false;
+}
+
+bool html_append_text(struct mtrix_buffer *b, const char *p, size_t n) {
+    for(const char *const e = p + n; p != e;) {
+        const char *q = p;
+        uint32_t c = 0;
+        if(*p == '&' && (q = read_ref(p, e, &c))) {
+            p = q;
+        } else if((unsigned char)*p == 0xc2 && e - p > 1
+                && (unsigned char)p[1] == 0xa0) {
+            c = 0xa0;
+            p += 2;
+        } else if(isspace((unsigned char)*p)) {
+            c = ' ';
+            ++p;
+        } else {
+            for(q = p + 1; q != e; ++q)
+                if(*q == '&' || *q == (char)0xc2 || isspace((unsigned char)*q))
+                    break;
+            if(!append(b, p, (size_t)(q - p)))
+                return false;
+            p = q;
+            continue;
+        }
+        const bool ok = c == 0xa0 || (c < 0x80 && isspace((int)c))
+            ? append_space(b) : append_code_point(b, c);
+        if(!ok)
+            return false;
+    }
+    return true;
+}
+
+void tokenizer_pop(struct html_tokenizer *z, struct html_token *t) {
+    *t = (struct html_token){.type = HTML_TOKEN_END, .depth = z->depth--};
+    if(t->depth <= HTML_TOKENIZER_DEPTH)
+        memcpy(t->name, z->stack[t->depth - 1], sizeof(t->name));
+}
+
+void tokenizer_push(
+    struct html_tokenizer *z, struct html_token *t, bool empty
+) {
+    t->depth = ++z->depth;
+    if(t->depth <= HTML_TOKENIZER_DEPTH)
+        memcpy(z->stack[t->depth - 1], t->name, sizeof(t->name));
+    if(empty)
+        z->close = 1;
+    else if(t->depth <= HTML_TOKENIZER_DEPTH)
+        z->raw = list_has_class(RAW_ELEMENTS, t->name);
+}
+
+size_t tokenizer_implied_end(
+    const struct html_tokenizer *z, const char *name
+) {
+    // Elements whose names are not known are not closed.
+    if(HTML_TOKENIZER_DEPTH < z->depth)
+        return 0;
+    for(size_t i = 0; i != sizeof(IMPLIED_END) / sizeof(*IMPLIED_END); ++i) {
+        if(!list_has_class(IMPLIED_END[i].tags, name))
+            continue;
+        for(size_t d = z->depth; d; --d) {
+            const char *const open = z->stack[d - 1];
+            if(list_has_class(IMPLIED_END[i].names, open))
+                return z->depth - d + 1;
+            if(list_has_class(IMPLIED_END[i].scope, open))
+                break;
+        }
+    }
+    return 0;
+}
+
+void tokenizer_text(struct html_tokenizer *z, struct html_token *t) {
+    const char *const p = z->p;
+    const char *const q = memchr(p + 1, '<', (size_t)(z->e - p - 1));
+    z->p = q ? q : z->e;
+    *t = (struct html_token){
+        .type = HTML_TOKEN_TEXT,
+        .depth = z->depth + 1,
+        .text = p,
+        .text_len = (size_t)(z->p - p),
+    };
+}
+
+bool tokenizer_raw(struct html_tokenizer *z, struct html_token *t) {
+    const char *const name = z->stack[z->depth - 1];
+    const size_t n = strlen(name);
+    const char *q = z->p;
+    for(; (q = memchr(q, '<', (size_t)(z->e - q))); ++q)
+        if((size_t)(z->e - q) > n + 2 && q[1] == '/'
+                && !strncasecmp(q + 2, name, n)
+                && !isalnum((unsigned char)q[n + 2]))
+            break;
+    const char *const p = z->p;
+    z->p = q ? q : z->e;
+    if(z->p == p)
+        return false;
+    *t = (struct html_token){
+        .type = HTML_TOKEN_TEXT,
+        .depth = z->depth + 1,
+        .text = p,
+        .text_len = (size_t)(z->p - p),
+    };
+    return true;
+}
+
+void tokenizer_start(struct html_tokenizer *z, struct html_token *t) {
+    *t = (struct html_token){.type = HTML_TOKEN_START};
+    bool empty = false;
+    const char *const p = read_name(z->p + 1, z->e, t->name);
+    z->p = read_attrs(p, z->e, t, &empty);
+    empty = empty || list_has_class(VOID_ELEMENTS, t->name);
+    const size_t n = tokenizer_implied_end(z, t->name);
+    if(!n) {
+        tokenizer_push(z, t, empty);
+        return;
+    }
+    z->next = *t;
+    z->has_next = true;
+    z->next_empty = empty;
+    z->close = n - 1;
+    tokenizer_pop(z, t);
+}
+
+bool tokenizer_end(struct html_tokenizer *z, struct html_token *t) {
+    char name[HTML_TOKENIZER_NAME];
+    const char *const p = read_name(z->p + 2, z->e, name);
+    const char *const gt = memchr(p, '>', (size_t)(z->e - p));
+    z->p = gt ? gt + 1 : z->e;
+    size_t d = z->depth;
+    // Elements whose names are not known are assumed to match.
+    if(d <= HTML_TOKENIZER_DEPTH)
+        while(d && strcmp(z->stack[d - 1], name))
+            --d;
+    if(!d)
+        return false;
+    z->close = z->depth - d;
+    tokenizer_pop(z, t);
+    return true;
+}
+
+void tokenizer_skip_markup(struct html_tokenizer *z) {
+    const char *const p = z->p;
+    const char *q = NULL;
+    if(z->e - p >= 4 && !memcmp(p, "<!--", 4))
+        q = (q = find(p + 4, z->e, "-->")) ? q + 3 : NULL;
+    else
+        q = (q = memchr(p, '>', (size_t)(z->e - p))) ? q + 1 : NULL;
+    z->p = q ? q : z->e;
+}
+
+const char *read_name(
+    const char *p, const char *e, char name[static HTML_TOKENIZER_NAME]
+) {
+    size_t n = 0;
+    for(; p != e && !isspace((unsigned char)*p) && *p != '/' && *p != '>'; ++p)
+        if(n != HTML_TOKENIZER_NAME - 1)
+            name[n++] = (char)tolower((unsigned char)*p);
+    name[n] = 0;
+    return p;
+}
+
+const char *read_attrs(
+    const char *p, const char *e, struct html_token *t, bool *empty
+) {
+    for(;;) {
+        while(p != e && isspace((unsigned char)*p))
+            ++p;
+        if(p == e)
+            return p;
+        if(*p == '>')
+            return p + 1;
+        if(*p == '/') {
+            if(++p != e && *p == '>')
+                return *empty = true, p + 1;
+            continue;
+        }
+        const char *const name = p;
+        do
+            ++p;
+        while(p != e && !isspace((unsigned char)*p)
+            && *p != '=' && *p != '>' && *p != '/');
+        const size_t name_len = (size_t)(p - name);
+        while(p != e && isspace((unsigned char)*p))
+            ++p;
+        const char *v = p;
+        size_t len = 0;
+        if(p != e && *p == '=') {
+            do
+                ++p;
+            while(p != e && isspace((unsigned char)*p));
+            if(p != e && (*p == '"' || *p == '\'')) {
+                v = p + 1;
+                const char *const q = memchr(v, *p, (size_t)(e - v));
+                p = q ? q + 1 : e;
+                len = (size_t)((q ? q : e) - v);
+            } else {
+                for(v = p; p != e && !isspace((unsigned char)*p) && *p != '>';)
+                    ++p;
+                len = (size_t)(p - v);
+            }
+        }
+        // Repeated attributes are ignored.
+        if(name_len == 2 && !strncasecmp(name, "id", 2) && !t->id)
+            t->id = v, t->id_len = len;
+        else if(name_len == 5 && !strncasecmp(name, "class", 5) && !t->cls)
+            t->cls = v, t->cls_len = len;
+    }
+}
+
+const char *read_ref(const char *p, const char *e, uint32_t *c) {
+    static const struct { const char *name; uint32_t c; } names[] = {
+        {"amp;", '&'}, {"apos;", '\''}, {"gt;", '>'}, {"lt;", '<'},
+        {"nbsp;", 0xa0}, {"quot;", '"'},
+    };
+    if(++p == e)
+        return NULL;
+    if(*p != '#') {
+        for(size_t i = 0; i != sizeof(names) / sizeof(*names); ++i) {
+            const size_t n = strlen(names[i].name);
+            if((size_t)(e - p) >= n && !memcmp(p, names[i].name, n))
+                return *c = names[i].c, p + n;
+        }
+        return NULL;
+    }
+    const bool hex = ++p != e && (*p == 'x' || *p == 'X');
+    p += hex;
+    uint32_t x = 0;
+    const char *q = p;
+    for(; q != e; ++q) {
+        const unsigned char d = (unsigned char)*q;
+        if(!(hex ? isxdigit(d) : isdigit(d)))
+            break;
+        const int v = isdigit(d) ? d - '0' : tolower(d) - 'a' + 10;
+        if(x <= 0x10ffff)
+            x = x * (hex ? 16 : 10) + (uint32_t)v;
+    }
+    if(q == p)
+        return NULL;
+    const bool valid = x && x <= 0x10ffff && !(0xd800 <= x && x <= 0xdfff);
+    *c = valid ? x : 0xfffd;
+    return q != e && *q == ';' ? q + 1 : q;
+}
+
+bool append_code_point(struct mtrix_buffer *b, uint32_t c) {
+    char s[4];
+    size_t n = 0;
+    if(c < 0x80) {
+        s[n++] = (char)c;
+    } else if(c < 0x800) {
+        s[n++] = (char)(0xc0 | c >> 6);
+        s[n++] = (char)(0x80 | (c & 0x3f));
+    } else if(c < 0x10000) {
+        s[n++] = (char)(0xe0 | c >> 12);
+        s[n++] = (char)(0x80 | (c >> 6 & 0x3f));
+        s[n++] = (char)(0x80 | (c & 0x3f));
+    } else {
+        s[n++] = (char)(0xf0 | c >> 18);
+        s[n++] = (char)(0x80 | (c >> 12 & 0x3f));
+        s[n++] = (char)(0x80 | (c >> 6 & 0x3f));
+        s[n++] = (char)(0x80 | (c & 0x3f));
+    }
+    return append(b, s, n);
+}
+
+bool append(struct mtrix_buffer *b, const char *p, size_t n) {
+    if(!n || mtrix_buffer_append(p, 1, n, b) == n)
+        return true;
+    return log_err("%s: failed to allocate memory\n", __func__), false;
+}
+
+bool append_space(struct mtrix_buffer *b) {
+    return !b->n || b->p[b->n - 1] == ' ' || append(b, " ", 1);
+}
@@ -5,12 +5,182 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#include "cache.h"
 #include "common.h"
+#include "hash.h"
 
 #include <tidy.h>
 
-/** Similar to \ref request, but parses the response as HTML. */
-TidyDoc request_and_parse(const char *url, bool verbose);
+/**
+ * Part of a document which is sufficient for a lookup.
+ * Requests for which one is given end once it has been received (see
+ * \ref mtrix_stop), and only it is parsed.  It is either:
+ *
+ * - an element, from its start tag (identified by a string it contains, e.g.
+ *   `id="resultados"`) to the matching end tag, or
+ * - the beginning of the document, up to the tag which contains the first
+ *   occurrence of a string after another one.
+ *
+ * The entire document is used if the region is not found.  Initialized with
+ * \ref html_region_init.
+ */
+struct html_region {
+    /** Must be the first member, see \ref html_region_init. */
+    struct mtrix_stop stop;
+    /** Identifies the start tag of the element, if not `NULL`. */
+    const char *element;
+    /** Otherwise, the region ends before the first `until` after `after`. */
+    const char *after, *until;
+    /**
+     * Optional name of the region, appended to URLs as a fragment so that
+     * responses are stored separately in the cache (see
+     * \ref mtrix_cache_request).
+     */
+    const char *name;
+    /** Offsets of the region, set once it is complete. */
+    size_t begin, end;
+    /** Offset where the next call to \ref html_region_scan continues. */
+    size_t pos;
+    /** Number of open elements with the same name as the region. */
+    size_t depth;
+    /** Name of the element, as it appears in the start tag. */
+    char tag[16];
+    /** Progress of the scan. */
+    enum {
+        HTML_REGION_START, HTML_REGION_UNTIL, HTML_REGION_ELEMENT,
+        HTML_REGION_DONE, HTML_REGION_INVALID,
+    } state;
+};
+
+/**
+ * Resets the state of the scan and \ref html_region::stop, which is set to
+ * end requests once \ref html_region_scan succeeds.
+ */
+void html_region_init(struct html_region *r);
+
+/**
+ * Continues looking for the end of the region.
+ * Data are processed incrementally: `p` is the entire document received so
+ * far, and each call continues where the previous one stopped.
+ * \return Whether the region is complete.
+ */
+bool html_region_scan(struct html_region *r, const char *p, size_t n);
+
+/**
+ * Limits a response to a region, if it is given and found.
+ * The region is null-terminated in place.
+ * \param n Set to the size of the result.
+ * \return The start of the region, or of the entire response.
+ */
+const char *html_region_extract(
+    struct mtrix_buffer *b, const struct html_region *region, size_t *n);
+
+/**
+ * Similar to \ref request, but parses the response as HTML.
+ * \param cache Used as described in \ref mtrix_cache_request, unless its
+ *              directory is empty.
+ * \param region Optional, see \ref html_region.  Must have been initialized.
+ * \param status Optional, see \ref request_bodies.
+ */
+TidyDoc request_and_parse(
+    const char *url, const struct mtrix_cache *cache,
+    struct html_region *region, long *status, bool verbose);
+
+/**
+ * Similar to \ref request_and_parse, but for several URLs.
+ * All requests are performed concurrently (see \ref request_multi and
+ * \ref mtrix_cache_request_multi), then the responses are parsed by
+ * `n_workers` threads.
+ * \param regions Optional, one for each URL.
+ * \param docs Filled with the parsed documents, `NULL` for failed requests,
+ *             which are released by the caller.
+ * \param status Optional, see \ref request_bodies.
+ * \return `false` if the requests could not be performed, in which case no
+ *         documents are created.
+ */
+bool request_and_parse_multi(
+    size_t n, const char *const *urls, const struct mtrix_cache *cache,
+    struct html_region *regions, size_t n_workers, TidyDoc *docs,
+    long *status, bool verbose);
+
+/**
+ * Performs the requests of \ref request_and_parse_multi, without parsing the
+ * responses.
+ * \param bodies Filled with the responses, released by the caller even if the
+ *               function fails.  \ref mtrix_buffer::stop is used for each
+ *               request.
+ * \param ok Set to indicate whether each request succeeded, see
+ *           \ref http_status_usable.
+ * \param status Optional, set to the HTTP status of each successful request
+ *               (e.g. to distinguish missing pages), see
+ *               \ref mtrix_cache_request_multi.
+ * \return `false` if the requests could not be performed.
+ */
+bool request_bodies(
+    size_t n, const char *const *urls, const struct mtrix_cache *cache,
+    struct mtrix_buffer *bodies, bool *ok, long *status, bool verbose);
+
+/**
+ * Creates a document from an HTML string.
+ * An index of its elements is built (see \ref html_index_build), so it must be
+ * released with \ref html_release.
+ */
+TidyDoc parse_html(const char *s);
+
+/** Releases a document created by \ref parse_html and its index. */
+void html_release(TidyDoc doc);
+
+/** Node of a document in \ref html_index::nodes. */
+struct html_index_node;
+
+/** Node of a document in \ref html_index::by_addr. */
+struct html_index_addr;
+
+/** Element with an ID in \ref html_index::ids. */
+struct html_index_id;
+
+/** Interned class name in \ref html_index::classes. */
+struct html_index_class;
+
+/**
+ * Index of the elements of a document, used by \ref find_node_by_id,
+ * \ref find_node_by_class, and \ref html_select instead of searching the
+ * tree.
+ *
+ * Nodes are numbered in document order, so the descendants of a node are the
+ * range of nodes which follow it.  Searches become binary searches in sorted
+ * arrays: nodes are found by address, elements by ID, and classes by the hash
+ * of their names, each with a list of its elements in document order.
+ */
+struct html_index {
+    struct html_index_node *nodes;
+    size_t n_nodes;
+    /** Sorted by address. */
+    struct html_index_addr *by_addr;
+    /** Sorted by ID, then by position. */
+    struct html_index_id *ids;
+    size_t n_ids;
+    /** Sorted by hash, then by name. */
+    struct html_index_class *classes;
+    size_t n_classes;
+    /** Positions of the elements of each class, see \ref classes. */
+    size_t *class_nodes;
+    size_t n_class_nodes;
+};
+
+/**
+ * Builds the index of a document in a single traversal.
+ * The index refers to the nodes and attributes of the document, so it is only
+ * valid until the document is modified or released.
+ * \return `NULL` if memory could not be allocated.
+ */
+struct html_index *html_index_build(TidyDoc doc);
+
+/** Releases an index created by \ref html_index_build. */
+void html_index_free(struct html_index *x);
+
+/** Index of a document created by \ref parse_html, `NULL` if it has none. */
+const struct html_index *html_index_get(TidyDoc doc);
 
 /** Checks if space-separated list \p l contains the class \p c. */
 bool list_has_class(const char *s, const char *cls);
@@ -24,11 +194,24 @@ TidyNode find_node_by_name(TidyNode node, const char *name);
 /** Searches a list for a given name prefix. */
 TidyNode find_node_by_name_prefix(TidyNode node, const char *name);
 
-/** Searches a list or tree for an element with a given lcass. */
-TidyNode find_node_by_class(TidyNode node, const char *cls, bool rec);
+/**
+ * Searches a list or tree for an element with a given class.
+ * \param x Optional index of the document, which makes the search take
+ *          `O(log n)` time.  Without one, or for a node which is not in the
+ *          index, the tree is searched.
+ * \param rec Whether the descendants of the nodes in the list are searched,
+ *            otherwise the index skips over them (one binary search for each
+ *            element in the list which contains the class).
+ */
+TidyNode find_node_by_class(
+    const struct html_index *x, TidyNode node, const char *cls, bool rec);
 
-/** Searches a list or tree for a given ID. */
-TidyNode find_node_by_id(TidyNode node, const char *id, bool rec);
+/**
+ * Searches the children or descendants of a node for a given ID.
+ * \param x Optional, see \ref find_node_by_class.
+ */
+TidyNode find_node_by_id(
+    const struct html_index *x, TidyNode node, const char *id, bool rec);
 
 /** Searches a list or tree for an element containing a text (substring). */
 TidyNode find_node_by_content(
@@ -42,3 +225,199 @@ void trim_tag(const unsigned char **b, const unsigned char **e);
 
 /** Writes the HTML string without tags. */
 void print_unescaped(FILE *f, const unsigned char *s);
+
+enum {
+    /** Maximum number of compound selectors in \ref html_selector. */
+    HTML_SELECTOR_MAX = 8,
+    /** Maximum number of classes in \ref html_compound. */
+    HTML_SELECTOR_CLASSES = 4,
+    /** Maximum number of attribute conditions in \ref html_compound. */
+    HTML_SELECTOR_ATTRS = 2,
+    /** Size of \ref html_selector::strings. */
+    HTML_SELECTOR_STRINGS = 256,
+};
+
+/**
+ * Conditions on a single element, e.g. `table.translations`.
+ * Strings are offsets in \ref html_selector::strings, `0` if absent.
+ */
+struct html_compound {
+    /** Element name, in lower case. */
+    size_t name;
+    /** Value of the `id` attribute. */
+    size_t id;
+    /** Classes, interned as the hashes of their names. */
+    mtrix_hash classes[HTML_SELECTOR_CLASSES];
+    /** Names of the classes, compared when the hashes are equal. */
+    size_t class_names[HTML_SELECTOR_CLASSES];
+    size_t n_classes;
+    /** Attributes whose values start with a prefix (`[name^=prefix]`). */
+    struct { size_t name, prefix; } attrs[HTML_SELECTOR_ATTRS];
+    size_t n_attrs;
+    /**
+     * Whether the element is a child of that matched by the previous
+     * compound (`>`), instead of any descendant.
+     */
+    bool child;
+};
+
+/**
+ * Compiled form of a small subset of CSS selectors.
+ * A selector is a sequence of compounds separated by the descendant (space)
+ * and child (`>`) combinators.  A compound is an element name (or `*`)
+ * followed by any of `#id`, `.class`, and `[attr^=prefix]`, e.g.
+ * `table.translations > tbody .translations-cell`.  Created by
+ * \ref html_selector_compile and used by \ref html_select.
+ */
+struct html_selector {
+    struct html_compound v[HTML_SELECTOR_MAX];
+    size_t n;
+    /** Null-terminated strings, the first one is empty. */
+    char strings[HTML_SELECTOR_STRINGS];
+    size_t strings_len;
+};
+
+/**
+ * Compiles a selector, see \ref html_selector.
+ * \return `false` if the selector is invalid or exceeds the limits.
+ */
+bool html_selector_compile(struct html_selector *s, const char *src);
+
+/**
+ * Called by \ref html_select for each matching element.
+ * \return Whether the search continues.
+ */
+typedef bool html_select_f(void *data, TidyNode node);
+
+/**
+ * Finds the elements in a tree which match a selector.
+ * All compounds are matched in a single traversal of `node` and its
+ * descendants: the state of each element is the set of compounds which match
+ * it, from which that of its children is derived.  Elements are found in
+ * document order.  Combinators only consider the elements in the tree, so
+ * `node` itself can only match the first compound.
+ * \param x Optional index of the document.  The traversal then starts at the
+ *          elements with the first class (or ID) of the first compound, and
+ *          skips subtrees which lack a class required by the compounds which
+ *          remain to be matched.  Without one, or for a node which is not in
+ *          the index, the entire tree is traversed.
+ * \return `false` if the search was ended by `f`.
+ */
+bool html_select(
+    const struct html_index *x, const struct html_selector *s, TidyNode node,
+    html_select_f *f, void *data);
+
+/** First element found by \ref html_select, `NULL` if there is none. */
+TidyNode html_select_first(
+    const struct html_index *x, const struct html_selector *s, TidyNode node);
+
+enum {
+    /** Maximum depth of the elements tracked by \ref html_tokenizer. */
+    HTML_TOKENIZER_DEPTH = 256,
+    /** Size of \ref html_token::name, longer names are truncated. */
+    HTML_TOKENIZER_NAME = 16,
+};
+
+/** Token produced by \ref html_tokenizer_next. */
+struct html_token {
+    enum { HTML_TOKEN_START, HTML_TOKEN_END, HTML_TOKEN_TEXT } type;
+    /**
+     * Depth of the element or text, where those at the top level of the
+     * document have depth `1`.
+     */
+    size_t depth;
+    /** Name of the element, in lower case. */
+    char name[HTML_TOKENIZER_NAME];
+    /** Values of the `id` and `class` attributes of a start tag, if present. */
+    const char *id, *cls;
+    size_t id_len, cls_len;
+    /** Text, character references are not decoded. */
+    const char *text;
+    size_t text_len;
+};
+
+/**
+ * Streaming HTML tokenizer, an alternative to parsing pages with Tidy.
+ * Only the stack of open elements is kept, and only `id` and `class`
+ * attributes are extracted.  No memory is allocated: values in tokens point
+ * to the source.
+ *
+ * Every start tag produces a matching end tag, including those of void
+ * elements.  Some of the recovery rules of HTML are applied: misnested end
+ * tags close the elements inside them, end tags without an open element are
+ * ignored, and some elements are closed implicitly (e.g. `li` and `p`).  The
+ * remaining elements are closed at the end of the source.
+ */
+struct html_tokenizer {
+    /** Position in the source. */
+    const char *p, *e;
+    /** Number of open elements. */
+    size_t depth;
+    /** Names of the open elements, up to \ref HTML_TOKENIZER_DEPTH. */
+    char stack[HTML_TOKENIZER_DEPTH][HTML_TOKENIZER_NAME];
+    /** Number of end tags produced before the next token is read. */
+    size_t close;
+    /** Start tag produced after those in \ref close, if set. */
+    struct html_token next;
+    bool has_next;
+    /** Whether \ref next has no contents (a void or self-closing element). */
+    bool next_empty;
+    /** Whether the contents of the last element are text (e.g. `script`). */
+    bool raw;
+};
+
+/** Prepares to tokenize the `n` bytes at `p`. */
+void html_tokenizer_init(struct html_tokenizer *z, const char *p, size_t n);
+
+/**
+ * Reads the next token.
+ * \return `false` at the end of the source.
+ */
+bool html_tokenizer_next(struct html_tokenizer *z, struct html_token *t);
+
+/**
+ * Consumes the tokens up to the end tag of the open element at `depth`, or
+ * up to the end of the source if it is `0`.
+ */
+void html_tokenizer_skip(struct html_tokenizer *z, size_t depth);
+
+/**
+ * Advances to the next start tag with the given ID and/or class.
+ * \param depth Only tokens in the open element at this depth are examined,
+ *              `0` for the entire document.
+ * \return `false` if the end of the element was reached instead.
+ */
+bool html_tokenizer_find(
+    struct html_tokenizer *z, struct html_token *t, size_t depth,
+    const char *id, const char *cls);
+
+/**
+ * Appends the text of a token to `b`, see \ref html_append_text.
+ * For a start tag, it is the text of the entire element, whose tokens are
+ * consumed.  Elements which are laid out as blocks (e.g. `p` or `li`) are
+ * separated by spaces.  Trailing whitespace is removed.
+ */
+bool html_tokenizer_text(
+    struct html_tokenizer *z, const struct html_token *t,
+    struct mtrix_buffer *b);
+
+/** Checks whether the ID of a start tag is `id`. */
+bool html_token_has_id(const struct html_token *t, const char *id);
+
+/** Checks whether the ID of a start tag starts with `prefix`. */
+bool html_token_has_id_prefix(const struct html_token *t, const char *prefix);
+
+/** Checks whether a token is text which only contains whitespace. */
+bool html_token_is_space(const struct html_token *t);
+
+/** Checks whether `cls` is one of the classes of a start tag. */
+bool html_token_has_class(const struct html_token *t, const char *cls);
+
+/**
+ * Appends text from the source of a document.
+ * Character references are decoded, and consecutive whitespace characters
+ * (including at the start of `b`) are replaced with a single space, so the
+ * result is similar to that of \ref print_unescaped for the same text in a
+ * Tidy document.
+ */
+bool html_append_text(struct mtrix_buffer *b, const char *p, size_t n);
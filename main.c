@@ -12,6 +12,11 @@
 
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -19,26 +24,57 @@
 
 #include <tidybuffio.h>
 
+#include "batch.h"
+#include "cache.h"
 #include "config.h"
+#include "daemon.h"
+#include "dict.h"
 #include "dlpo.h"
 #include "hash.h"
 #include "html.h"
 #include "numeraria.h"
+#include "rng.h"
+#include "socket.h"
 #include "utils.h"
 #include "wikt.h"
+#include "wiktidx.h"
 
 #define ARRAY_SIZE(v) (sizeof(v) / sizeof(*v))
-#define RND_LIST_ITEM(v) (rnd_list_item((v), ARRAY_SIZE(v)))
+#define RND_LIST_ITEM(c, v) (rnd_list_item((c), (v), ARRAY_SIZE(v)))
 
 enum {
     MAX_PATH = MTRIX_MAX_PATH,
     MAX_UNIX_PATH = MTRIX_MAX_UNIX_PATH,
     STATS_WIKT = 0,
     STATS_DLPO = 1,
+    STATS_NEGATIVE = 2,
+    STATS_COALESCED = 3,
     /** Whether a command requires a random number generator. */
     NEEDS_RNG = 1 << 0,
+    /** Whether a command requires \ref DICT_FILE to be loaded. */
+    NEEDS_DICT = 1 << 1,
+    /** Whether a command uses \ref config::wikt_index, if one was given. */
+    NEEDS_WIKT_INDEX = 1 << 2,
     /** Whether the random number generator has been initialized. */
     RND_INITIALIZED = 1 << 0,
+    /** Whether \ref config::dict has been loaded. */
+    DICT_LOADED = 1 << 1,
+    /** Whether \ref config::wikt_index has been loaded. */
+    WIKT_INDEX_LOADED = 1 << 2,
+    /** Maximum number of client connections in daemon mode. */
+    MAX_CONN = 16,
+    /** Time allowed for clients to send a request/receive a response. */
+    CLIENT_TIMEOUT_S = 5,
+    /** Default value of \ref mtrix_cache::ttl. */
+    HTTP_CACHE_TTL_S = 24 * 60 * 60,
+    /** Default value of \ref mtrix_cache::negative_ttl. */
+    HTTP_CACHE_NEGATIVE_TTL_S = 60 * 60,
+    /** Default value of \ref mtrix_cache::max_size. */
+    HTTP_CACHE_MAX_SIZE = 64 << 20,
+    /** Maximum number of terms in a single lookup command, see \ref lookup. */
+    MAX_LOOKUP_TERMS = 16,
+    /** Default value of \ref config::input::warm_delay. */
+    WARM_DELAY_MS = 1000,
 };
 
 /** `machinatrix`-specific configuration. */
@@ -47,6 +83,22 @@ struct config {
     struct mtrix_config c;
     /** Socket to communicate with `numeraria`, if enabled. */
     int numeraria_fd;
+    /**
+     * Random number generator, initialized on first use.
+     * Accessed through a pointer so that commands, which receive a constant
+     * configuration, can advance it.
+     */
+    struct mtrix_rng *rng;
+    /** Storage for \ref rng. */
+    struct mtrix_rng rng_storage;
+    /** Contents of \ref DICT_FILE, loaded on first use. */
+    struct mtrix_dict dict;
+    /** Offline Wiktionary index, loaded on first use if selected. */
+    struct mtrix_wiktidx wikt_index;
+    /** Cache of pages used by lookup commands. */
+    struct mtrix_cache http_cache;
+    /** Storage for \ref mtrix_cache::coalesced. */
+    size_t coalesced;
     /** Runtime flags. */
     uint8_t flags;
     /** Fields read from the command line. */
@@ -57,9 +109,44 @@ struct config {
         char numeraria_socket[MAX_PATH];
         /** Optional path of the numeraria server Unix socket. */
         char numeraria_unix[MAX_UNIX_PATH];
+        /** Address where commands are accepted in daemon mode. */
+        char listen_socket[MAX_PATH];
+        /** Unix socket path where commands are accepted in daemon mode. */
+        char listen_unix[MAX_UNIX_PATH];
+        /** Address of a daemon which executes the command. */
+        char connect_socket[MAX_PATH];
+        /** Unix socket path of a daemon which executes the command. */
+        char connect_unix[MAX_UNIX_PATH];
+        /** Directory where indices are cached, caching is disabled if empty. */
+        char cache_dir[MAX_PATH];
+        /** Optional index used by `wikt` and `tr` instead of requests. */
+        char wikt_index[MAX_PATH];
+        /** Whether `wikt` and `tr` request only the sections they need. */
+        bool wikt_sections;
+        /** Whether lookups stop requests once they receive what they need. */
+        bool stream;
+        /** Whether lookups use \ref html_tokenizer instead of Tidy. */
+        bool tokenizer;
+        /** Seed for the random number generator, `-1` if not set. */
+        int64_t seed;
+        /**
+         * Number of commands executed concurrently by \ref handle_file and
+         * \ref handle_listen, or of concurrent requests made by
+         * \ref handle_warm.
+         */
+        size_t jobs;
+        /** Number of lookups prefetched by \ref handle_warm, if not `0`. */
+        size_t warm;
+        /** Optional list of lookups used by \ref handle_warm. */
+        char warm_file[MAX_PATH];
+        /** Milliseconds between batches of requests in \ref handle_warm. */
+        int64_t warm_delay;
     } input;
 };
 
+/** Self-pipe FD for interruptions in daemon mode. */
+static int signal_fd = -1;
+
 /** To be filled by `argv[0]` later, for logging. */
 const char *PROG_NAME = NULL;
 
@@ -69,6 +156,14 @@ const char *CMD_NAME = NULL;
 /** Dictionary file used for commands that require a list of words. */
 #define DICT_FILE "/usr/share/dict/words"
 
+/**
+ * Suffix of precompiled dictionaries.
+ * If present and up to date, `path` \ref DICT_SUFFIX is used in place of the
+ * word list at `path`.  These can be generated with `mkdict`.  Otherwise, a
+ * copy is generated automatically in the cache directory.
+ */
+#define DICT_SUFFIX ".mtrixdict"
+
 /** Function that handles a command. */
 typedef bool mtrix_cmd_f(const struct config*, const char *const*);
 
@@ -84,12 +179,142 @@ struct mtrix_cmd {
     uint8_t flags;
 };
 
+/** A term in a lookup command, see \ref lookup. */
+struct lookup_term {
+    const char *term;
+    /** Page requested for the term. */
+    char url[MTRIX_MAX_URL_LEN];
+    /** See \ref negative_key. */
+    char key[MTRIX_MAX_URL_LEN];
+    /** Whether the lookup is known to have no results. */
+    bool negative;
+};
+
+/** A page requested by a lookup, see \ref config::input::tokenizer. */
+struct page {
+    /** Document, if the page was parsed by Tidy. */
+    TidyDoc doc;
+    /** Otherwise, the source of the page (or of its region). */
+    const char *html;
+    size_t len;
+    /** HTTP status of the response, see \ref negative_page. */
+    long status;
+};
+
+/**
+ * Extracts and prints the result of a lookup from its page.
+ * \param lang Optional language argument of the command.
+ * \param key Used to record that the lookup has no results.
+ */
+typedef bool lookup_print(
+    const struct config *config, const struct page *page, const char *lang,
+    const char *key);
+
+/**
+ * Prints the result of a lookup from its entries in \ref config::wikt_index.
+ * \param lang Optional language argument of the command.
+ */
+typedef bool index_print(
+    const struct config *config, const struct mtrix_wiktidx_entry *v,
+    size_t n, const char *lang);
+
+/**
+ * Prints the result of a lookup from the sections of its page.
+ * \param lang Optional language argument of the command.
+ */
+typedef bool section_print(
+    const struct config *config, const wikt_section *v, size_t n,
+    const char *lang);
+
+/** Sections requested by a lookup, see \ref wikt_request_sections. */
+struct section_lookup {
+    const char *prefix;
+    unsigned level;
+    /** Whether the language argument of the command selects sections. */
+    bool by_lang;
+    section_print *print;
+};
+
+/** A page prefetched by \ref handle_warm. */
+struct warm_page {
+    char url[MTRIX_MAX_URL_LEN];
+    /** Part of the page used by the lookup, see \ref lookup_region. */
+    const struct html_region *region;
+};
+
+/** A lookup of sections prefetched by \ref handle_warm. */
+struct warm_sections {
+    /** See \ref lookup_section_params. */
+    const struct section_lookup *l;
+    char term[MTRIX_MAX_URL_LEN];
+    /** Empty if the lookup has no language. */
+    char lang[WIKT_MAX_LANG];
+};
+
+/** Lookups prefetched by \ref handle_warm. */
+struct warm {
+    /** Distinct pages, in order of popularity. */
+    struct warm_page *pages;
+    size_t n, cap;
+    /**
+     * Distinct lookups of sections.  The list of sections of each page is in
+     * \ref pages, the sections themselves are only known once it is received.
+     */
+    struct warm_sections *sections;
+    size_t n_sections, cap_sections;
+    /** Number of lookups which are invalid or request no pages. */
+    size_t skipped;
+};
+
+/** Results of \ref warm_fetch. */
+struct warm_stats {
+    size_t fresh, requested, failed;
+};
+
+/** Position of the descriptors polled by \ref handle_listen. */
+enum listen_fd {
+    /** Self-pipe used for signal handling. */
+    LISTEN_SIGNAL,
+    /** Listening socket. */
+    LISTEN_SOCKET,
+    /** Worker sockets, followed by client connections. */
+    LISTEN_WORKERS,
+};
+
+/** State of \ref handle_listen. */
+struct listen_state {
+    struct config *config;
+    /** Processes which execute the commands, see batch.h. */
+    struct mtrix_batch_workers w;
+    /**
+     * Client whose command each worker is executing, as an index in
+     * \ref clients, or `-1` if the worker is idle.
+     */
+    int *served;
+    /** Client connections, `-1` for unused entries. */
+    int clients[MAX_CONN];
+    /** Whether each client is waiting for the result of a command. */
+    bool waiting[MAX_CONN];
+    /** Number of requests received, passed to \ref batch_run. */
+    size_t seq;
+};
+
 /** Accumulates lookup statistics. */
 struct stats {
     /** Number of Wiktionary lookups. */
     int wikt;
     /** Number of DLPO lookups. */
     int dlpo;
+    /** Number of lookups skipped because they were known to fail. */
+    int negative;
+    /** Number of pages shared with a concurrent lookup. */
+    int coalesced;
+    /** Number of requests ended early, see \ref html_region. */
+    int streamed;
+    /** Bytes not received because of it, when known. */
+    int64_t stream_bytes;
+    /** Estimate of the time saved, in microseconds. */
+    int64_t stream_us;
 };
 
 /** Program entry point. */
@@ -104,6 +329,16 @@ static void rnd_init(struct config *config);
 /** Parses command-line arguments and fills `config`. */
 static bool parse_args(int argc, char *const **argv, struct config *config);
 
+/** Sets the default cache directory, if one was not selected. */
+static bool default_cache_dir(struct config *config);
+
+/**
+ * Copies a `[unix:]addr` argument to `tcp_addr` or `unix_path`.
+ * Both are expected to have the sizes of the fields in \ref config::input.
+ */
+static bool copy_addr_arg(
+    const char *name, const char *arg, char *tcp_addr, char *unix_path);
+
 /** Prints a usage message. */
 static void usage(FILE *f);
 
@@ -113,6 +348,20 @@ static void config_init(struct config *config);
 /** Initializes values in `config`. */
 static bool config_init_numeraria(struct config *config);
 
+/** Loads the dictionary used by word commands. */
+static bool config_init_dict(struct config *config);
+
+/** Maps the index used by Wiktionary commands, if one was selected. */
+static bool config_init_wikt_index(struct config *config);
+
+/**
+ * Loads a dictionary, using a precompiled version if one is up to date.
+ * The precompiled version is searched next to the word list and in the cache
+ * directory, where it is created/replaced if necessary.
+ */
+static bool open_dict(
+    const struct config *config, struct mtrix_dict *d, const char *path);
+
 /** Destructs `config`. */
 static bool config_destroy(struct config *config);
 
@@ -123,9 +372,149 @@ static bool config_record_command(
 /** Handles a command passed via the command line. */
 static bool handle_cmd(struct config *config, const char *const *argv);
 
-/** Handles commands read as lines from a file. */
+/**
+ * Handles commands read as lines from a file.
+ * Failed commands are reported, but do not interrupt the processing of the
+ * remaining lines.
+ */
 static bool handle_file(struct config *config, FILE *f);
 
+/**
+ * Executes commands from a file concurrently, see \ref config::input::jobs.
+ * Lines are executed by worker processes and their output is written in input
+ * order, see batch.h.
+ */
+static bool handle_file_parallel(struct config *config, FILE *f);
+
+/**
+ * Initializes each worker process of \ref handle_file_parallel.
+ * The generator state is inherited from the parent, so all workers would
+ * otherwise produce the same sequence.
+ */
+static void batch_init(void *data);
+
+/**
+ * Executes a line in a worker process of \ref handle_file_parallel.
+ * \param seq Position of the line in the input, used to derive the seed of
+ *            the random number generator if one was given.
+ */
+static bool batch_run(void *data, char *line, size_t seq);
+
+/** Executes the mode selected by the command-line arguments. */
+static bool handle_input(struct config *config, const char *const *argv);
+
+/** Handles a single command line. */
+static bool handle_line(struct config *config, char *line);
+
+/**
+ * Serves commands received from clients, see daemon.h.
+ * Commands are executed by \ref config::input::jobs worker processes, as in
+ * \ref handle_file_parallel, so that the daemon keeps accepting connections
+ * and handling signals while they run.  Requests are only read from clients
+ * while a worker is idle, and connections only accepted while there is room
+ * for them, otherwise they are left pending.
+ */
+static bool handle_listen(struct config *config);
+
+/**
+ * Creates the self-pipe and the listening socket.
+ * \param fds Set to the read end of the pipe and to the socket, in the order
+ *            of \ref listen_fd.
+ */
+static bool listen_setup(const struct config *config, int fds[static 2]);
+
+/** Sets the descriptors and events polled by \ref handle_listen. */
+static void listen_events(
+    const struct listen_state *s, const int fixed[static 2],
+    struct pollfd *fds);
+
+/** Whether worker `i` can execute a command. */
+static bool listen_idle(const struct listen_state *s, size_t i);
+
+/** Accepts new connections, while there is room for them. */
+static void listen_accept(struct listen_state *s, int fd);
+
+/**
+ * Reads a request from a client.
+ * \return `false` if the connection should be closed.
+ */
+static bool listen_read(
+    const struct config *config, int fd,
+    char line[static MTRIX_DAEMON_MAX_CMD + 1]);
+
+/**
+ * Reads a request from client `c` and sends it to an idle worker.
+ * \return `false` if the connection should be closed.
+ */
+static bool listen_dispatch(struct listen_state *s, size_t c);
+
+/** Sends the result of the command executed by worker `i` to its client. */
+static void listen_reply(struct listen_state *s, size_t i);
+
+/** Closes the connection of client `c`. */
+static void listen_close(struct listen_state *s, size_t c);
+
+/**
+ * Closes the socket of a failed worker, see \ref mtrix_batch_start.
+ * Its process is replaced by the worker itself only if it is killed while
+ * executing a command.
+ */
+static void listen_remove_worker(struct listen_state *s, size_t i);
+
+/**
+ * Prefetches the pages of popular lookups into the cache.
+ * Lookups are read from \ref config::input::warm_file if set, or else from the
+ * command statistics recorded by numeraria.  Pages are requested in batches of
+ * \ref config::input::jobs, separated by \ref config::input::warm_delay, so
+ * that servers are not flooded.  Pages which are still fresh are skipped.
+ */
+static bool handle_warm(struct config *config);
+
+/** Reads the first \ref config::input::warm lookups in a file of commands. */
+static bool warm_read_file(const struct config *config, struct warm *w);
+
+/** Reads the \ref config::input::warm most frequent lookups from numeraria. */
+static bool warm_read_numeraria(const struct config *config, struct warm *w);
+
+/**
+ * Adds the pages requested by a lookup command to `w`, as derived by
+ * \ref lookup and \ref lookup_sections.
+ * Invalid lookups, and those which request no pages (e.g. with
+ * \ref config::wikt_index), are reported and counted in \ref warm::skipped.
+ * \param lang Optional, the second argument of the command.
+ */
+static bool warm_add(
+    const struct config *config, struct warm *w, const char *cmd,
+    const char *terms, const char *lang);
+
+/** Adds a page to `w`, unless it is already present. */
+static bool warm_add_page(
+    struct warm *w, const char *url, const struct html_region *region);
+
+/**
+ * Requests the pages in `w`, see \ref handle_warm.
+ * \param st Incremented with the number of pages of each kind.
+ */
+static bool warm_fetch(
+    const struct config *config, const struct warm *w, struct warm_stats *st);
+
+/**
+ * Adds the sections selected by the lookups in `w->sections` to `pages`, from
+ * the lists of sections already in the cache, see \ref wikt_section_urls.
+ */
+static bool warm_select_sections(
+    const struct config *config, struct warm *w, struct warm *pages);
+
+/** Sends a command to a daemon and prints its output. */
+static bool handle_remote(
+    const struct config *config, const char *const *argv);
+
+/** Signal handler used in daemon mode. */
+static void handle_signal(int s);
+
+/** Whether `cmd` is a lookup command, see \ref lookup_base. */
+static bool lookup_cmd(const char *cmd);
+
 /**
  * Breaks string into space-separated parts.
  * \param str Input string, modified to include null terminators.
@@ -136,11 +525,142 @@ static bool handle_file(struct config *config, FILE *f);
 static bool str_to_args(char *str, size_t max_args, char **argv);
 
 /** Chooses an item randomly from a list of strings. */
-static const char *rnd_list_item(const char **v, size_t n);
+static const char *rnd_list_item(
+    const struct config *config, const char **v, size_t n);
 
 /** Parses \p i as an index (1-based) into \p v. */
 static const char *list_item(const char **v, size_t n, const char *i);
 
+/**
+ * Builds the key used to record that a lookup has no results.
+ * \param lang Optional.
+ */
+static bool negative_key(
+    char key[static MTRIX_MAX_URL_LEN], const char *cmd, const char *term,
+    const char *lang);
+
+/**
+ * Checks whether a lookup is known to have no results, see
+ * \ref mtrix_cache_is_negative.
+ */
+static bool is_negative(const struct config *config, const char *key);
+
+/** Records that a lookup has no results, if caching is enabled. */
+static void store_negative(const struct config *config, const char *key);
+
+/**
+ * Handles a page which contains no results for a lookup.
+ * Only `200 OK` and `404 Not Found` responses are conclusive and recorded with
+ * \ref store_negative, others (e.g. redirections) may not be the page of the
+ * term.
+ * \return `false`, the result of the \ref lookup_print function.
+ */
+static bool negative_page(
+    const struct config *config, const struct page *page, const char *key);
+
+/**
+ * Requests and parses a page, see \ref request_and_parse.
+ * Records in the statistics file whether the request was coalesced.
+ */
+static TidyDoc fetch_page(
+    const struct config *config, const char *url, struct html_region *region,
+    long *status);
+
+/** Similar to \ref fetch_page, see \ref request_and_parse_multi. */
+static bool fetch_pages(
+    const struct config *config, size_t n, const char *const *urls,
+    struct html_region *regions, TidyDoc *docs, long *status);
+
+/**
+ * Similar to \ref fetch_pages, but the responses are not parsed, see
+ * \ref request_bodies.
+ */
+static bool fetch_bodies(
+    const struct config *config, size_t n, const char *const *urls,
+    struct html_region *regions, struct mtrix_buffer *bodies, bool *ok,
+    long *status);
+
+/**
+ * Prefix of the URLs of the pages requested by a lookup command.
+ * \return `NULL` if `cmd` is not a lookup command, or if it does not request
+ *         pages (see \ref config::wikt_index and
+ *         \ref config::input::wikt_sections).
+ */
+static const char *lookup_base(const struct config *config, const char *cmd);
+
+/**
+ * Part of the pages of a lookup command used by its output, requested alone
+ * if \ref config::input::stream is set.
+ * \return `NULL` if entire pages are requested.
+ */
+static const struct html_region *lookup_region(
+    const struct config *config, const char *cmd, const char *lang);
+
+/**
+ * Builds the URL of the page requested by \ref lookup for a term.
+ * The name of the region, if any, is added as a fragment, so that the part of
+ * the page is cached separately, see \ref mtrix_cache_request.
+ */
+static bool lookup_url(
+    char url[static MTRIX_MAX_URL_LEN], const char *base, const char *term,
+    const struct html_region *region);
+
+/**
+ * Sections requested by a lookup command under
+ * \ref config::input::wikt_sections.
+ * \return `NULL` if `cmd` does not request sections.
+ */
+static const struct section_lookup *lookup_section_params(
+    const struct config *config, const char *cmd);
+
+/**
+ * Splits a comma-separated list of terms.
+ * `\,` and `\\` stand for a comma and a backslash inside a term.
+ * \param v Receives a copy of `terms`, unescaped and modified to include null
+ *          terminators.
+ * \param t Populated with pointers to the terms in `v`.
+ * \param n Set to the number of terms.
+ */
+static bool split_terms(
+    const char *terms, char v[static MTRIX_MAX_URL_LEN],
+    const char *t[static MAX_LOOKUP_TERMS], size_t *n);
+
+/**
+ * Common implementation of lookup commands.
+ * `terms` can also be a comma-separated list, in which case all pages are
+ * requested concurrently and the results are printed in order, each preceded
+ * by its term.
+ * \param cmd Command name, see \ref negative_key, \ref lookup_base, and
+ *            \ref lookup_region.
+ * \param lang Optional, passed to `print`.
+ */
+static bool lookup(
+    const struct config *config, const char *cmd, const char *terms,
+    const char *lang, lookup_print *print);
+
+/**
+ * Implements lookup commands using \ref config::wikt_index.
+ * `terms` is interpreted as in \ref lookup.
+ */
+static bool lookup_index(
+    const struct config *config, const char *terms, const char *lang,
+    index_print *print);
+
+/**
+ * Implements lookup commands using \ref wikt_request_sections.
+ * `terms` is interpreted as in \ref lookup, but each term is looked up in
+ * turn.
+ * \param cmd Command name, see \ref negative_key and
+ *            \ref lookup_section_params.
+ */
+static bool lookup_sections(
+    const struct config *config, const char *cmd, const char *terms,
+    const char *lang);
+
+/** Prints `k` distinct random words from the dictionary, separated by `sep`. */
+static bool print_words(
+    const struct config *config, size_t k, const char *sep);
+
 /** Implements the `help` command. */
 static bool cmd_help(const struct config *config, const char *const *argv);
 
@@ -165,14 +685,37 @@ static bool cmd_bard(const struct config *config, const char *const *argv);
 /** Implements the `dlpo` command. */
 static bool cmd_dlpo(const struct config *config, const char *const *argv);
 
+/** Prints the result of the `dlpo` command, see \ref lookup_print. */
+static lookup_print print_dlpo;
+
 /** Implements the `wikt` command. */
 static bool cmd_wikt(const struct config *config, const char *const *argv);
 
+/** Prints the result of the `wikt` command, see \ref lookup_print. */
+static lookup_print print_wikt;
+
+/** Prints the result of the `wikt` command, see \ref index_print. */
+static index_print print_wikt_index;
+
+/** Prints the result of the `wikt` command, see \ref section_print. */
+static section_print print_wikt_sections;
+
 /** Implements the `tr` command. */
 static bool cmd_tr(const struct config *config, const char *const *argv);
 
+/** Prints the result of the `tr` command, see \ref lookup_print. */
+static lookup_print print_tr;
+
+/** Prints the result of the `tr` command, see \ref index_print. */
+static index_print print_tr_index;
+
+/** Prints the result of the `tr` command, see \ref section_print. */
+static section_print print_tr_sections;
+
 /** Common implementation of AoE commands. */
-static bool cmd_aoe(const char **v, size_t n, const char *const *argv);
+static bool cmd_aoe(
+    const struct config *config, const char **v, size_t n,
+    const char *const *argv);
 
 /** Implements the `aoe1` command. */
 static bool cmd_aoe1(const struct config *config, const char *const *argv);
@@ -186,32 +729,24 @@ static bool cmd_stats(const struct config *config, const char *const *argv);
 /** Increments the count on wikt and dlpo lookups. */
 static bool stats_increment(const struct config *config, uint8_t opt);
 
+/** Adds each field of `d` to the statistics file. */
+static bool stats_add(const struct config *config, const struct stats *d);
+
+/**
+ * Records the savings of a request ended early, see \ref html_region.
+ * Does nothing if the request was not ended early.
+ */
+static bool stats_stream(
+    const struct config *config, const char *url, const struct mtrix_stop *s);
+
 /** Print stats from local file. */
 static bool stats_file(const struct config *config);
 
 /** Print stats from numeraria. */
 static bool stats_numeraria(const struct config *config);
 
-/**
- * Maps a command name to the function that handles it.
- * Terminated by a `{NULL, NULL}` entry.
- */
-const struct mtrix_cmd COMMANDS[] = {
-    {0x00005979ab, "tr",    cmd_tr,    0},
-    {0x017c93ee3c, "abbr",  cmd_abbr,  0},
-    {0x017c9425ab, "aoe1",  cmd_aoe1,  NEEDS_RNG},
-    {0x017c9425ac, "aoe2",  cmd_aoe2,  NEEDS_RNG},
-    {0x017c94785e, "bard",  cmd_bard,  NEEDS_RNG},
-    {0x017c959085, "damn",  cmd_damn,  0},
-    {0x017c95bfb4, "dlpo",  cmd_dlpo,  0},
-    {0x017c97d2ee, "help",  cmd_help,  0},
-    {0x017c9c25b4, "parl",  cmd_parl,  NEEDS_RNG},
-    {0x017c9c4733, "ping",  cmd_ping,  0},
-    {0x017ca01d84, "wikt",  cmd_wikt,  0},
-    {0x017ca037e1, "word",  cmd_word,  0},
-    {0x3110614a14, "stats", cmd_stats, 0},
-    {0},
-};
+// Defines COMMANDS, generated from commands.txt.
+#include "commands.h"
 
 int main(int argc, const char *const *argv) {
     init();
@@ -224,27 +759,28 @@ int main(int argc, const char *const *argv) {
         return usage(stdout), 0;
     return !(
         config_init_numeraria(&config)
-        && (*argv ? handle_cmd(&config, argv) : handle_file(&config, stdin))
+        && handle_input(&config, argv)
         && config_destroy(&config));
 }
 
 void init(void) {
     log_set(stderr);
-#ifndef NDEBUG
-    for(const struct mtrix_cmd *p = COMMANDS; p->name; ++p)
-        assert(mtrix_hash_str(p->name) == p->name_hash);
-    for(const struct mtrix_cmd *p = COMMANDS + 1; p->name; ++p)
-        assert(p[-1].name_hash < p->name_hash);
-#endif
 }
 
 void rnd_init(struct config *config) {
-    srand((unsigned)time(NULL));
+    if(config->input.seed == -1)
+        mtrix_rng_init(config->rng);
+    else
+        mtrix_rng_seed(config->rng, (uint64_t)config->input.seed);
     config->flags |= RND_INITIALIZED;
 }
 
 bool parse_args(int argc, char *const **argv, struct config *config) {
-    enum { STATS_FILE, NUMERARIA_SOCKET };
+    enum {
+        STATS_FILE, NUMERARIA_SOCKET, LISTEN, CONNECT, CACHE_DIR, CACHE_TTL,
+        CACHE_NEGATIVE_TTL, CACHE_SIZE, SEED, JOBS, WIKT_INDEX, WIKT_SECTIONS,
+        WARM, WARM_FILE, WARM_DELAY, STREAM, TOKENIZER,
+    };
     static const char *short_opts = "hvn";
     static const struct option long_opts[] = {
         {"help", no_argument, 0, 'h'},
@@ -252,6 +788,21 @@ bool parse_args(int argc, char *const **argv, struct config *config) {
         {"dry-run", no_argument, 0, 'n'},
         {"stats-file", required_argument, 0, STATS_FILE},
         {"numeraria-socket", required_argument, 0, NUMERARIA_SOCKET},
+        {"listen", required_argument, 0, LISTEN},
+        {"connect", required_argument, 0, CONNECT},
+        {"cache-dir", required_argument, 0, CACHE_DIR},
+        {"cache-ttl", required_argument, 0, CACHE_TTL},
+        {"cache-negative-ttl", required_argument, 0, CACHE_NEGATIVE_TTL},
+        {"cache-size", required_argument, 0, CACHE_SIZE},
+        {"seed", required_argument, 0, SEED},
+        {"jobs", required_argument, 0, JOBS},
+        {"wikt-index", required_argument, 0, WIKT_INDEX},
+        {"wikt-sections", no_argument, 0, WIKT_SECTIONS},
+        {"warm", required_argument, 0, WARM},
+        {"warm-file", required_argument, 0, WARM_FILE},
+        {"warm-delay", required_argument, 0, WARM_DELAY},
+        {"stream", no_argument, 0, STREAM},
+        {"tokenizer", no_argument, 0, TOKENIZER},
         {0, 0, 0, 0},
     };
     for(;;) {
@@ -272,30 +823,156 @@ bool parse_args(int argc, char *const **argv, struct config *config) {
                 return false;
             break;
         }
-        case NUMERARIA_SOCKET: {
-            const char prefix[] = "unix:";
-            char *src = optarg, *dst = config->input.numeraria_socket;
-            if(strncmp(src, prefix, sizeof(prefix) - 1) == 0) {
-                src += sizeof(prefix) - 1;
-                dst = config->input.numeraria_unix;
-            }
-            struct mtrix_buffer b = {.p = dst, .n = MAX_PATH};
-            if(!copy_arg("numeraria socket", b, src))
+        case NUMERARIA_SOCKET:
+            if(!copy_addr_arg(
+                    "numeraria socket", optarg,
+                    config->input.numeraria_socket,
+                    config->input.numeraria_unix))
+                return false;
+            break;
+        case LISTEN:
+            if(!copy_addr_arg(
+                    "listen address", optarg,
+                    config->input.listen_socket, config->input.listen_unix))
+                return false;
+            break;
+        case CONNECT:
+            if(!copy_addr_arg(
+                    "connect address", optarg,
+                    config->input.connect_socket, config->input.connect_unix))
+                return false;
+            break;
+        case CACHE_DIR: {
+            struct mtrix_buffer b = {
+                .p = config->input.cache_dir,
+                .n = MAX_PATH,
+            };
+            if(!copy_arg("cache directory", b, optarg))
+                return false;
+            break;
+        }
+        case CACHE_TTL:
+            if((config->http_cache.ttl = parse_i64(optarg)) == -1)
+                return false;
+            break;
+        case CACHE_NEGATIVE_TTL:
+            if((config->http_cache.negative_ttl = parse_i64(optarg)) == -1)
+                return false;
+            break;
+        case CACHE_SIZE: {
+            const int64_t n = parse_i64(optarg);
+            if(n == -1)
+                return false;
+            config->http_cache.max_size = (uint64_t)n;
+            break;
+        }
+        case SEED:
+            if((config->input.seed = parse_i64(optarg)) == -1)
+                return false;
+            break;
+        case JOBS: {
+            const int64_t n = parse_i64(optarg);
+            if(n == -1)
+                return false;
+            if(!n)
+                return log_err("invalid number of jobs: 0\n"), false;
+            config->input.jobs = (size_t)n;
+            break;
+        }
+        case WIKT_INDEX: {
+            struct mtrix_buffer b = {
+                .p = config->input.wikt_index,
+                .n = MAX_PATH,
+            };
+            if(!copy_arg("Wiktionary index", b, optarg))
+                return false;
+            break;
+        }
+        case WIKT_SECTIONS: config->input.wikt_sections = true; break;
+        case WARM: {
+            const int64_t n = parse_i64(optarg);
+            if(n == -1)
+                return false;
+            if(!n)
+                return log_err("invalid number of lookups: 0\n"), false;
+            config->input.warm = (size_t)n;
+            break;
+        }
+        case WARM_FILE: {
+            struct mtrix_buffer b = {
+                .p = config->input.warm_file,
+                .n = MAX_PATH,
+            };
+            if(!copy_arg("warm file", b, optarg))
                 return false;
             break;
         }
+        case WARM_DELAY:
+            if((config->input.warm_delay = parse_i64(optarg)) == -1)
+                return false;
+            break;
+        case STREAM: config->input.stream = true; break;
+        case TOKENIZER: config->input.tokenizer = true; break;
         default: return false;
         }
     }
+    const bool listening =
+        *config->input.listen_socket || *config->input.listen_unix;
+    const bool remote =
+        *config->input.connect_socket || *config->input.connect_unix;
+    if(listening && remote)
+        return log_err("--listen and --connect are mutually exclusive\n"),
+            false;
+    if(listening && (*argv)[optind])
+        return log_err("--listen does not accept a command\n"), false;
+    if(remote && !(*argv)[optind])
+        return log_err("--connect requires a command\n"), false;
+    const bool warm = config->input.warm;
+    if(warm && listening)
+        return log_err("--listen and --warm are mutually exclusive\n"), false;
+    if(warm && (*argv)[optind])
+        return log_err("--warm does not accept a command\n"), false;
+    if(!warm && *config->input.warm_file)
+        return log_err("--warm-file requires --warm\n"), false;
     if(*config->input.numeraria_socket && *config->input.numeraria_unix) {
         log_err(
             "--numeraria-socket and --numeraria-unix are mutually exclusive");
         return false;
     }
     *argv += optind;
+    if(!default_cache_dir(config))
+        return false;
+    const char *const dir = config->input.cache_dir;
+    if(warm && !*dir)
+        return log_err("--warm requires a cache directory\n"), false;
+    return !*dir || join_path(config->http_cache.dir, 2, dir, "/http");
+}
+
+bool default_cache_dir(struct config *config) {
+    char *const dir = config->input.cache_dir;
+    if(*dir)
+        return true;
+    const char *const xdg = getenv("XDG_CACHE_HOME");
+    if(xdg && *xdg)
+        return join_path(dir, 2, xdg, "/machinatrix");
+    const char *const home = getenv("HOME");
+    if(home && *home)
+        return join_path(dir, 2, home, "/.cache/machinatrix");
     return true;
 }
 
+bool copy_addr_arg(
+    const char *name, const char *arg, char *tcp_addr, char *unix_path
+) {
+    const char prefix[] = "unix:";
+    struct mtrix_buffer b = {.p = tcp_addr, .n = MAX_PATH};
+    if(strncmp(arg, prefix, sizeof(prefix) - 1) == 0) {
+        arg += sizeof(prefix) - 1;
+        b = (struct mtrix_buffer){.p = unix_path, .n = MAX_UNIX_PATH};
+    }
+    return copy_arg(name, b, arg);
+}
+
 void usage(FILE *f) {
     fprintf(
         f,
@@ -308,6 +985,42 @@ void usage(FILE *f) {
         "    --numeraria-socket address\n"
         "                           address to connect to numeraria\n"
         "    --numeraria-unix path  path to connect to numeraria\n"
+        "    --listen address       execute commands received on `address`,\n"
+        "                           prefix path with `unix:` to use a Unix\n"
+        "                           domain socket\n"
+        "    --connect address      execute the command using a daemon\n"
+        "                           started with `--listen`\n"
+        "    --cache-dir path       directory where indices are cached\n"
+        "                           (default: $XDG_CACHE_HOME/machinatrix)\n"
+        "    --cache-ttl n          seconds during which cached pages are\n"
+        "                           used without revalidation (default: 1d)\n"
+        "    --cache-negative-ttl n\n"
+        "                           seconds during which lookups without\n"
+        "                           results are not repeated (default: 1h)\n"
+        "    --cache-size n         maximum size of cached pages in bytes\n"
+        "                           (default: 64MiB, 0: no limit)\n"
+        "    --seed n               seed for the random number generator, for\n"
+        "                           reproducible output\n"
+        "    --jobs n               number of commands read from `stdin` or\n"
+        "                           received by --listen executed\n"
+        "                           concurrently, or of concurrent requests\n"
+        "                           made by --warm\n"
+        "    --wikt-index path      answer wikt and tr from an index built\n"
+        "                           with mkwiktidx instead of Wiktionary\n"
+        "    --wikt-sections        request only the sections of Wiktionary\n"
+        "                           pages used by wikt and tr\n"
+        "    --warm n               prefetch the pages of the n most frequent\n"
+        "                           lookups recorded by numeraria into the\n"
+        "                           cache\n"
+        "    --warm-file path       read the lookups for --warm from a file\n"
+        "                           of commands, most frequent first\n"
+        "    --warm-delay ms        delay between batches of requests made\n"
+        "                           by --warm (default: 1000)\n"
+        "    --stream               stop downloading pages once the part\n"
+        "                           used by dlpo and tr <lang> is received\n"
+        "    --tokenizer            extract the results of dlpo, wikt, and tr\n"
+        "                           with a streaming tokenizer instead of\n"
+        "                           parsing pages with Tidy\n"
         "\n"
         "Commands:\n"
         "    help:                  this help\n"
@@ -322,12 +1035,23 @@ void usage(FILE *f) {
         "    parl:                  use unparliamentary language\n"
         "    tr <term> [<lang>]:    lookup translation (Wiktionary)\n"
         "    aoe1|aoe2 [<n>]        Age of Empires I/II taunt\n"
-        "    stats:                 print statistics\n",
+        "    stats:                 print statistics\n"
+        "\n"
+        "<term> can be a comma-separated list in dlpo, wikt, and tr, use\n"
+        "`\\,` for a comma inside a term.\n",
         PROG_NAME);
 }
 
 void config_init(struct config *config) {
     config->numeraria_fd = -1;
+    config->rng = &config->rng_storage;
+    config->http_cache.coalesced = &config->coalesced;
+    config->input.seed = -1;
+    config->input.jobs = 1;
+    config->input.warm_delay = WARM_DELAY_MS;
+    config->http_cache.ttl = HTTP_CACHE_TTL_S;
+    config->http_cache.negative_ttl = HTTP_CACHE_NEGATIVE_TTL_S;
+    config->http_cache.max_size = HTTP_CACHE_MAX_SIZE;
 }
 
 bool config_init_numeraria(struct config *config) {
@@ -343,8 +1067,63 @@ bool config_init_numeraria(struct config *config) {
     return true;
 }
 
+bool config_init_dict(struct config *config) {
+    if(!open_dict(config, &config->dict, DICT_FILE))
+        return false;
+    config->flags |= DICT_LOADED;
+    return true;
+}
+
+bool config_init_wikt_index(struct config *config) {
+    const char *const path = config->input.wikt_index;
+    if(!*path)
+        return true;
+    if(!mtrix_wiktidx_open(&config->wikt_index, path))
+        return false;
+    config->flags |= WIKT_INDEX_LOADED;
+    return true;
+}
+
+bool open_dict(
+    const struct config *config, struct mtrix_dict *d, const char *path
+) {
+    struct mtrix_dict_source src;
+    if(!mtrix_dict_stat(path, &src))
+        return false;
+    char bin[MAX_PATH] = {0};
+    if(join_path(bin, 2, path, DICT_SUFFIX)
+            && mtrix_dict_open_fresh(d, bin, &src))
+        return true;
+    const char *const dir = config->input.cache_dir;
+    char cache[MAX_PATH] = {0};
+    if(*dir) {
+        // One file per word list, identified by the hash of its path.
+        char name[sizeof("/dict-") + 16 + sizeof(DICT_SUFFIX)];
+        snprintf(
+            name, sizeof(name), "/dict-%016" PRIx64 DICT_SUFFIX,
+            mtrix_hash_str(path));
+        if(!join_path(cache, 2, dir, name))
+            *cache = 0;
+    }
+    if(*cache && mtrix_dict_open_fresh(d, cache, &src))
+        return true;
+    if(!mtrix_dict_open(d, path))
+        return false;
+    // Failing to update the cache is not fatal, the dictionary is usable.
+    // Concurrent writers each replace the file atomically, see
+    // mtrix_dict_save.
+    if(*cache && mkdir_p(dir, 0700))
+        mtrix_dict_save(d, cache);
+    return true;
+}
+
 bool config_destroy(struct config *config) {
     bool ret = true;
+    if((config->flags & DICT_LOADED) && !mtrix_dict_close(&config->dict))
+        ret = false;
+    if((config->flags & WIKT_INDEX_LOADED)
+            && !mtrix_wiktidx_close(&config->wikt_index))
+        ret = false;
     if(config->numeraria_fd != -1 && close(config->numeraria_fd) == -1) {
         log_errno("%s: close numeraria_fd", __func__);
         ret = false;
@@ -355,47 +1134,682 @@ bool config_destroy(struct config *config) {
 bool handle_cmd(struct config *config, const char *const *argv) {
     const char *const name = *argv;
     const mtrix_hash arg_hash = mtrix_hash_str(name);
-    static_assert(!offsetof(struct mtrix_cmd, name_hash));
-    struct mtrix_cmd *const cmd = bsearch(
-        &arg_hash, COMMANDS,
-        sizeof(COMMANDS) / sizeof(*COMMANDS) - 1, sizeof(*COMMANDS),
-        mtrix_hash_cmp);
-    if(!cmd) {
+    const struct mtrix_cmd *const cmd = COMMANDS + COMMANDS_INDEX(arg_hash);
+    // Other names can map to the same entry, or to an unused one.
+    if(!cmd->name || cmd->name_hash != arg_hash || strcmp(cmd->name, name)) {
         log_err("unknown command: %s\n", name);
         usage(stderr);
         return false;
     }
-    if((cmd->flags & NEEDS_RNG) && (!config->flags & RND_INITIALIZED))
+    if((cmd->flags & NEEDS_RNG) && !(config->flags & RND_INITIALIZED))
         rnd_init(config);
     CMD_NAME = name;
+    if((cmd->flags & NEEDS_DICT) && !(config->flags & DICT_LOADED)
+            && !config_init_dict(config))
+        return false;
+    if((cmd->flags & NEEDS_WIKT_INDEX) && !(config->flags & WIKT_INDEX_LOADED)
+            && !config_init_wikt_index(config))
+        return false;
     return cmd->f(config, argv + 1)
         && config_record_command(config, argv);
 }
 
 bool handle_file(struct config *config, FILE *f) {
+    if(config->input.jobs > 1)
+        return handle_file_parallel(config, f);
     bool ret = true;
     char *buffer = NULL;
     size_t len = 0;
-    for(;;) {
-        if(getline(&buffer, &len, f) == -1)
+    for(size_t i = 1; getline(&buffer, &len, f) != -1; ++i)
+        if(!handle_line(config, buffer)) {
+            log_err("line %zu failed\n", i);
+            ret = false;
+        }
+    if(ferror(f)) {
+        log_errno("getline");
+        ret = false;
+    }
+    free(buffer);
+    return ret;
+}
+
+bool handle_file_parallel(struct config *config, FILE *f) {
+    const struct mtrix_batch b = {
+        .n_workers = config->input.jobs,
+        .data = config,
+        .init = batch_init,
+        .run = batch_run,
+        .out = STDOUT_FILENO,
+        .err = STDERR_FILENO,
+    };
+    return mtrix_batch_run(&b, f);
+}
+
+void batch_init(void *data) {
+    struct config *const config = data;
+    if(config->input.seed == -1)
+        rnd_init(config);
+}
+
+bool batch_run(void *data, char *line, size_t seq) {
+    struct config *const config = data;
+    if(config->input.seed != -1) {
+        mtrix_rng_seed(config->rng, (uint64_t)config->input.seed + seq);
+        config->flags |= RND_INITIALIZED;
+    }
+    return handle_line(config, line);
+}
+
+bool handle_input(struct config *config, const char *const *argv) {
+    if(config->input.warm)
+        return handle_warm(config);
+    if(*config->input.listen_socket || *config->input.listen_unix)
+        return handle_listen(config);
+    if(*config->input.connect_socket || *config->input.connect_unix)
+        return handle_remote(config, argv);
+    return *argv ? handle_cmd(config, argv) : handle_file(config, stdin);
+}
+
+bool handle_line(struct config *config, char *line) {
+    enum { CMD = 1, TERM = 1, ARGV_LEN = CMD + MTRIX_MAX_ARGS + TERM };
+    char *argv[ARGV_LEN] = {0};
+    if(!str_to_args(line, CMD + MTRIX_MAX_ARGS, argv))
+        return log_err("%s: too many arguments\n", argv[0]), false;
+    if(!*argv)
+        return log_err("empty command\n"), false;
+    const bool ret = handle_cmd(config, (const char * const*)argv);
+    CMD_NAME = NULL;
+    return ret;
+}
+
+bool handle_listen(struct config *config) {
+    const struct mtrix_batch b = {
+        .n_workers = config->input.jobs,
+        .data = config,
+        .init = batch_init,
+        .run = batch_run,
+    };
+    struct listen_state s = {.config = config};
+    for(size_t c = 0; c != MAX_CONN; ++c)
+        s.clients[c] = -1;
+    // Started first, so that workers do not inherit the listening socket.
+    if(!mtrix_batch_start(&b, &s.w))
+        return false;
+    const size_t n_fds = LISTEN_WORKERS + s.w.n + MAX_CONN;
+    struct pollfd *const fds = calloc(n_fds, sizeof(*fds));
+    s.served = calloc(s.w.n, sizeof(*s.served));
+    int fixed[2] = {-1, -1};
+    bool ret = fds && s.served;
+    if(!ret)
+        log_errno("calloc");
+    else
+        ret = listen_setup(config, fixed);
+    const bool set_up = ret;
+    for(size_t i = 0; ret && i != s.w.n; ++i)
+        s.served[i] = -1;
+    while(ret) {
+        listen_events(&s, fixed, fds);
+        if(poll(fds, n_fds, -1) == -1) {
+            if(errno == EINTR)
+                continue;
+            log_errno("poll");
+            ret = false;
             break;
-        enum { CMD = 1, TERM = 1, ARGV_LEN = CMD + MTRIX_MAX_ARGS + TERM };
-        char *argv[ARGV_LEN] = {0};
-        if(!str_to_args(buffer, CMD + MTRIX_MAX_ARGS, argv)) {
-            log_err("%s: too many arguments\n", argv[0]);
+        }
+        if(fds[LISTEN_SIGNAL].revents)
+            break;
+        if(fds[LISTEN_SOCKET].revents & POLLIN)
+            listen_accept(&s, fixed[LISTEN_SOCKET]);
+        const struct pollfd *const workers = fds + LISTEN_WORKERS;
+        const struct pollfd *const clients = workers + s.w.n;
+        for(size_t i = 0; i != s.w.n; ++i)
+            if(workers[i].revents)
+                listen_reply(&s, i);
+        for(size_t c = 0; c != MAX_CONN; ++c)
+            if(clients[c].revents && !listen_dispatch(&s, c))
+                listen_close(&s, c);
+        size_t live = 0;
+        for(size_t i = 0; i != s.w.n; ++i)
+            live += s.w.fds[i] != -1;
+        if(!live) {
+            log_err("no workers left\n");
+            ret = false;
+        }
+    }
+    for(size_t c = 0; c != MAX_CONN; ++c)
+        if(s.clients[c] != -1)
+            listen_close(&s, c);
+    for(size_t i = 0; i != 2; ++i)
+        if(fixed[i] != -1 && close(fixed[i]) == -1) {
+            log_errno("close");
             ret = false;
+        }
+    if(set_up && close(signal_fd) == -1) {
+        log_errno("close");
+        ret = false;
+    }
+    const char *const path = config->input.listen_unix;
+    if(set_up && *path && unlink(path) == -1) {
+        log_errno("failed to unlink unix socket %s", path);
+        ret = false;
+    }
+    // Not an error: workers are usually killed by the same signal that
+    // stopped the daemon.
+    mtrix_batch_stop(&s.w);
+    free(s.served);
+    free(fds);
+    return ret;
+}
+
+bool listen_setup(const struct config *config, int fds[static 2]) {
+    int pipe_fds[2];
+    if(pipe(pipe_fds) == -1)
+        return log_errno("pipe"), false;
+    for(int i = 0; i < 2; ++i)
+        if(fcntl(pipe_fds[i], F_SETFL, O_NONBLOCK) == -1
+                || fcntl(pipe_fds[i], F_SETFD, FD_CLOEXEC) == -1) {
+            log_errno("failed to set up pipe");
+            goto err;
+        }
+    const char *const addr = config->input.listen_socket;
+    const int fd = *addr
+        ? mtrix_socket_listen(addr, MAX_CONN)
+        : mtrix_socket_listen_unix(config->input.listen_unix, MAX_CONN);
+    if(fd == -1)
+        goto err;
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+        log_errno("fcntl(FD_CLOEXEC)");
+    fds[LISTEN_SIGNAL] = pipe_fds[0];
+    fds[LISTEN_SOCKET] = fd;
+    signal_fd = pipe_fds[1];
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    return true;
+err:
+    for(int i = 0; i < 2; ++i)
+        if(close(pipe_fds[i]) == -1)
+            log_errno("failed to close pipe");
+    return false;
+}
+
+void listen_events(
+    const struct listen_state *s, const int fixed[static 2],
+    struct pollfd *fds
+) {
+    bool room = false, idle = false;
+    for(size_t c = 0; c != MAX_CONN; ++c)
+        room = room || s->clients[c] == -1;
+    for(size_t i = 0; i != s->w.n; ++i)
+        idle = idle || listen_idle(s, i);
+    // Negative descriptors are ignored by `poll`.  A pending connection
+    // would otherwise be reported continuously while there is no room for it.
+    fds[LISTEN_SIGNAL] = (struct pollfd){
+        .fd = fixed[LISTEN_SIGNAL], .events = POLLIN};
+    fds[LISTEN_SOCKET] = (struct pollfd){
+        .fd = room ? fixed[LISTEN_SOCKET] : -1, .events = POLLIN};
+    struct pollfd *const workers = fds + LISTEN_WORKERS;
+    struct pollfd *const clients = workers + s->w.n;
+    for(size_t i = 0; i != s->w.n; ++i)
+        workers[i] = (struct pollfd){
+            .fd = s->served[i] == -1 ? -1 : s->w.fds[i], .events = POLLIN};
+    for(size_t c = 0; c != MAX_CONN; ++c)
+        clients[c] = (struct pollfd){
+            .fd = idle && !s->waiting[c] ? s->clients[c] : -1,
+            .events = POLLIN};
+}
+
+bool listen_idle(const struct listen_state *s, size_t i) {
+    return s->w.fds[i] != -1 && s->served[i] == -1;
+}
+
+void listen_accept(struct listen_state *s, int fd) {
+    const struct timeval t = {.tv_sec = CLIENT_TIMEOUT_S};
+    for(size_t c = 0; c != MAX_CONN; ++c) {
+        if(s->clients[c] != -1)
+            continue;
+        const int new_fd = accept(fd, NULL, NULL);
+        if(new_fd == -1) {
+            if(errno != EWOULDBLOCK && errno != EAGAIN)
+                log_errno("accept");
+            return;
+        }
+        // Commands may spawn processes, which should not hold connections.
+        if(fcntl(new_fd, F_SETFD, FD_CLOEXEC) == -1)
+            log_errno("fcntl(FD_CLOEXEC)");
+        // Clients must not be able to block the daemon indefinitely.
+        if(setsockopt(new_fd, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t)) == -1
+                || setsockopt(
+                    new_fd, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t)) == -1) {
+            log_errno("setsockopt");
+            if(close(new_fd) == -1)
+                log_errno("close");
+            continue;
+        }
+        s->clients[c] = new_fd;
+    }
+}
+
+bool listen_read(
+    const struct config *config, int fd,
+    char line[static MTRIX_DAEMON_MAX_CMD + 1]
+) {
+    struct mtrix_daemon_req req;
+    const ssize_t r = read(fd, &req, MTRIX_DAEMON_REQ_SIZE);
+    if(!r)
+        return false;
+    if(r == -1)
+        return log_errno("%s: read", __func__), false;
+    const size_t n = (size_t)r;
+    if(n < MTRIX_DAEMON_REQ_SIZE
+            && !read_all(fd, (char*)&req + n, MTRIX_DAEMON_REQ_SIZE - n))
+        return false;
+    const size_t len = req.len, max = MTRIX_DAEMON_MAX_CMD;
+    if(len > max) {
+        log_err("%s: invalid length (%zu > %zu)\n", __func__, len, max);
+        return false;
+    }
+    if(!read_all(fd, line, len))
+        return false;
+    line[len] = 0;
+    if(mtrix_config_verbose(&config->c))
+        log_err("%s: %s\n", __func__, line);
+    return true;
+}
+
+bool listen_dispatch(struct listen_state *s, size_t c) {
+    size_t i = 0;
+    while(i != s->w.n && !listen_idle(s, i))
+        ++i;
+    // Taken by another client since the descriptors were polled.
+    if(i == s->w.n)
+        return true;
+    char line[MTRIX_DAEMON_MAX_CMD + 1];
+    if(!listen_read(s->config, s->clients[c], line))
+        return false;
+    if(!mtrix_batch_send(s->w.fds[i], line, s->seq++)) {
+        listen_remove_worker(s, i);
+        return false;
+    }
+    s->served[i] = (int)c;
+    s->waiting[c] = true;
+    return true;
+}
+
+void listen_reply(struct listen_state *s, size_t i) {
+    const size_t c = (size_t)s->served[i];
+    s->served[i] = -1;
+    s->waiting[c] = false;
+    struct mtrix_daemon_output output = {0};
+    bool ret = mtrix_daemon_recv(s->w.fds[i], &output);
+    if(!ret)
+        listen_remove_worker(s, i);
+    else {
+        const int fd = s->clients[c];
+        const struct mtrix_daemon_resp resp = {
+            .out_len = (uint32_t)output.out.n,
+            .err_len = (uint32_t)output.err.n,
+            .status = output.status,
+        };
+        ret = mtrix_socket_send_all(fd, &resp, sizeof(resp))
+            && mtrix_socket_send_all(fd, output.out.p, output.out.n)
+            && mtrix_socket_send_all(fd, output.err.p, output.err.n);
+    }
+    free(output.out.p);
+    free(output.err.p);
+    if(!ret)
+        listen_close(s, c);
+}
+
+void listen_close(struct listen_state *s, size_t c) {
+    if(close(s->clients[c]) == -1)
+        log_errno("failed to close client fd");
+    s->clients[c] = -1;
+    s->waiting[c] = false;
+}
+
+void listen_remove_worker(struct listen_state *s, size_t i) {
+    log_err("removing failed worker\n");
+    if(close(s->w.fds[i]) == -1)
+        log_errno("close");
+    s->w.fds[i] = -1;
+    s->served[i] = -1;
+}
+
+bool handle_warm(struct config *config) {
+    struct warm w = {0}, sections = {0};
+    bool ret = *config->input.warm_file
+        ? warm_read_file(config, &w)
+        : warm_read_numeraria(config, &w);
+    if(ret && mtrix_config_dry(&config->c))
+        for(size_t i = 0; i != w.n; ++i)
+            printf("%s\n", w.pages[i].url);
+    else if(ret) {
+        // Lists of sections are fetched with the pages, then the sections
+        // they select.
+        struct warm_stats st = {0};
+        ret = warm_fetch(config, &w, &st)
+            && warm_select_sections(config, &w, &sections)
+            && warm_fetch(config, &sections, &st);
+        printf(
+            "pages: %zu, fresh: %zu, requested: %zu, failed: %zu,"
+            " skipped lookups: %zu\n",
+            w.n + sections.n, st.fresh, st.requested, st.failed, w.skipped);
+        ret = ret && !st.failed;
+    }
+    free(sections.pages);
+    free(w.sections);
+    free(w.pages);
+    return ret;
+}
+
+bool warm_read_file(const struct config *config, struct warm *w) {
+    enum { CMD = 1, TERM = 1, ARGV_LEN = CMD + MTRIX_MAX_ARGS + TERM };
+    const char *const path = config->input.warm_file;
+    FILE *const f = fopen(path, "r");
+    if(!f)
+        return log_errno("fopen: %s", path), false;
+    bool ret = true;
+    char *line = NULL;
+    size_t len = 0;
+    for(size_t i = 1, n = 0; ret && n != config->input.warm; ++i) {
+        if(getline(&line, &len, f) == -1) {
+            if(ferror(f))
+                log_errno("getline: %s", path), ret = false;
+            break;
+        }
+        char *argv[ARGV_LEN] = {0};
+        if(!str_to_args(line, CMD + MTRIX_MAX_ARGS, argv)) {
+            log_err("%s:%zu: too many arguments\n", path, i);
+            continue;
+        }
+        // Other commands can be present, e.g. in a log of all commands.
+        if(!*argv || !lookup_cmd(*argv))
+            continue;
+        if(!argv[1]) {
+            log_err("%s:%zu: missing term\n", path, i);
+            continue;
+        }
+        ret = warm_add(config, w, argv[0], argv[1], argv[2]);
+        ++n;
+    }
+    free(line);
+    if(fclose(f) == EOF)
+        log_errno("fclose: %s", path), ret = false;
+    return ret;
+}
+
+bool warm_read_numeraria(const struct config *config, struct warm *w) {
+    enum { COLS = 3 };
+    const int fd = config->numeraria_fd;
+    if(fd == -1)
+        return log_err("--warm requires --warm-file or numeraria\n"), false;
+    union {
+        struct mtrix_numeraria_cmd h;
+        char buffer[MTRIX_NUMERARIA_MAX_PACKET];
+    } header = {.h.cmd = MTRIX_NUMERARIA_CMD_SQL};
+    const int len = snprintf(
+        header.h.data, MTRIX_NUMERARIA_MAX_CMD,
+        "select cmd, arg0, arg1 from machinatrix_stats_cmd"
+        " where cmd in ('dlpo', 'tr', 'wikt') and arg0 is not null"
+        " order by count desc limit %zu;", config->input.warm);
+    if(len < 0 || MTRIX_NUMERARIA_MAX_CMD <= len)
+        return log_err("%s: snprintf\n", __func__), false;
+    header.h.len = (uint32_t)len;
+    if(!write_all(fd, &header, MTRIX_NUMERARIA_CMD_SIZE + header.h.len))
+        return log_err("failed to send numeraria command\n"), false;
+    bool ret = true;
+    for(;;) {
+        size_t n_cols = 0;
+        if(!read_all(fd, &n_cols, sizeof(n_cols)))
+            return log_err("failed to read numeraria columns\n"), false;
+        if(!n_cols)
+            break;
+        if(n_cols != COLS)
+            return log_err("invalid numeraria result\n"), false;
+        char v[COLS][MTRIX_NUMERARIA_MAX_CMD + 1];
+        for(size_t i = 0; i != COLS; ++i) {
+            size_t n = 0;
+            if(!read_all(fd, &n, sizeof(n)) || MTRIX_NUMERARIA_MAX_CMD < n)
+                return log_err("invalid numeraria result length\n"), false;
+            if(n && !read_all(fd, v[i], n))
+                return log_err("failed to read numeraria result\n"), false;
+            v[i][n] = 0;
+        }
+        // All rows are read even after a failure, the protocol has no other
+        // way of skipping them.  `null` is returned as an empty string.
+        ret = ret && warm_add(config, w, v[0], v[1], *v[2] ? v[2] : NULL);
+    }
+    return ret;
+}
+
+bool warm_add(
+    const struct config *config, struct warm *w, const char *cmd,
+    const char *terms, const char *lang
+) {
+    const char *const base = lookup_base(config, cmd);
+    const struct section_lookup *const l = lookup_section_params(config, cmd);
+    char v[MTRIX_MAX_URL_LEN];
+    const char *t[MAX_LOOKUP_TERMS];
+    size_t n = 0;
+    const char *reason = NULL;
+    if(!base && !l)
+        reason = "no pages requested";
+    else if(l && lang && strlen(lang) >= WIKT_MAX_LANG)
+        reason = "language too long";
+    else if(!split_terms(terms, v, t, &n))
+        reason = "invalid terms";
+    if(reason) {
+        log_err(
+            "not warmed (%s): %s %s%s%s\n", reason, cmd, terms,
+            lang ? " " : "", lang ? lang : "");
+        ++w->skipped;
+        return true;
+    }
+    const struct html_region *const region = lookup_region(config, cmd, lang);
+    for(size_t i = 0; i != n; ++i) {
+        char url[MTRIX_MAX_URL_LEN];
+        if(!(l ? wikt_sections_url(WIKTIONARY_API, t[i], url)
+                : lookup_url(url, base, t[i], region))) {
+            ++w->skipped;
+            continue;
+        }
+        if(!warm_add_page(w, url, l ? NULL : region))
+            return false;
+        if(!l)
+            continue;
+        struct warm_sections x = {.l = l};
+        snprintf(x.term, sizeof(x.term), "%s", t[i]);
+        snprintf(x.lang, sizeof(x.lang), "%s", lang ? lang : "");
+        // Lists are short and this is insignificant next to the requests.
+        size_t j = 0;
+        while(j != w->n_sections && !(
+            w->sections[j].l == l
+            && !strcmp(w->sections[j].term, x.term)
+            && !strcmp(w->sections[j].lang, x.lang)
+        ))
+            ++j;
+        if(j != w->n_sections)
+            continue;
+        if(w->n_sections == w->cap_sections) {
+            const size_t cap = w->cap_sections ? 2 * w->cap_sections : 16;
+            struct warm_sections *const p =
+                realloc(w->sections, cap * sizeof(*p));
+            if(!p)
+                return log_errno("realloc"), false;
+            w->sections = p;
+            w->cap_sections = cap;
+        }
+        w->sections[w->n_sections++] = x;
+    }
+    return true;
+}
+
+bool warm_add_page(
+    struct warm *w, const char *url, const struct html_region *region
+) {
+    // Lists are short and this is insignificant next to the requests.
+    for(size_t i = 0; i != w->n; ++i)
+        if(!strcmp(w->pages[i].url, url))
+            return true;
+    if(w->n == w->cap) {
+        const size_t cap = w->cap ? 2 * w->cap : 64;
+        struct warm_page *const p = realloc(w->pages, cap * sizeof(*p));
+        if(!p)
+            return log_errno("realloc"), false;
+        w->pages = p;
+        w->cap = cap;
+    }
+    struct warm_page *const p = w->pages + w->n++;
+    snprintf(p->url, sizeof(p->url), "%s", url);
+    p->region = region;
+    return true;
+}
+
+bool warm_fetch(
+    const struct config *config, const struct warm *w, struct warm_stats *st
+) {
+    const struct mtrix_cache *const c = &config->http_cache;
+    const bool verbose = mtrix_config_verbose(&config->c);
+    const size_t k = config->input.jobs;
+    const int64_t delay = config->input.warm_delay;
+    const char **const urls = calloc(k, sizeof(*urls));
+    struct html_region *const regions = calloc(k, sizeof(*regions));
+    struct mtrix_buffer *const bs = calloc(k, sizeof(*bs));
+    bool *const ok = calloc(k, sizeof(*ok));
+    bool ret = true;
+    if(!(urls && regions && bs && ok)) {
+        log_errno("calloc");
+        ret = false;
+        goto end;
+    }
+    bool requested = false;
+    const int64_t now = (int64_t)time(NULL);
+    for(size_t i = 0; i != w->n;) {
+        // Fresh pages would not be requested anyway: checking them here keeps
+        // them out of the batches, which are followed by a delay.  Loading
+        // them also marks them as recently used.
+        size_t n = 0;
+        for(; i != w->n && n != k; ++i) {
+            const struct warm_page *const p = w->pages + i;
+            struct mtrix_cache_entry e = {0};
+            const bool cached = mtrix_cache_load(c, p->url, &e);
+            free(e.body.p);
+            if(cached && now - e.time < c->ttl) {
+                if(++st->fresh, verbose)
+                    printf("Cached: %s\n", p->url);
+                continue;
+            }
+            // The same part of the page is stored as by the lookup.
+            if(p->region) {
+                regions[n] = *p->region;
+                html_region_init(regions + n);
+                bs[n].stop = &regions[n].stop;
+            }
+            urls[n++] = p->url;
+        }
+        if(!n)
             break;
+        if(requested && delay) {
+            struct timespec t = {
+                .tv_sec = delay / 1000,
+                .tv_nsec = delay % 1000 * 1000000,
+            };
+            while(nanosleep(&t, &t) == -1 && errno == EINTR);
+        }
+        requested = true;
+        ret = mtrix_cache_request_multi(c, n, urls, bs, ok, NULL, verbose);
+        for(size_t j = 0; ret && j != n; ++j)
+            if(!ok[j])
+                log_err("request failed: %s\n", urls[j]), ++st->failed;
+        for(size_t j = 0; j != n; ++j) {
+            free(bs[j].p);
+            bs[j] = (struct mtrix_buffer){0};
         }
-        const bool ret = handle_cmd(config, (const char * const*)argv);
-        CMD_NAME = NULL;
         if(!ret)
             break;
+        st->requested += n;
+    }
+end:
+    free(ok);
+    free(bs);
+    free(regions);
+    free(urls);
+    return ret;
+}
+
+bool warm_select_sections(
+    const struct config *config, struct warm *w, struct warm *pages
+) {
+    const struct mtrix_cache *const c = &config->http_cache;
+    for(size_t i = 0; i != w->n_sections; ++i) {
+        const struct warm_sections *const x = w->sections + i;
+        const char *const lang = x->l->by_lang && *x->lang ? x->lang : NULL;
+        char url[MTRIX_MAX_URL_LEN];
+        struct mtrix_cache_entry e = {0};
+        wikt_section v[WIKT_MAX_SECTIONS];
+        char urls[WIKT_MAX_SECTIONS][MTRIX_MAX_URL_LEN];
+        size_t n = 0;
+        bool missing = false;
+        const bool ok = wikt_sections_url(WIKTIONARY_API, x->term, url)
+            && mtrix_cache_load(c, url, &e)
+            && wikt_section_urls(
+                WIKTIONARY_API, x->term, e.body.p, lang, x->l->prefix,
+                x->l->level, v, urls, &n, &missing);
+        free(e.body.p);
+        if(!ok) {
+            log_err("sections not warmed: %s\n", x->term);
+            ++w->skipped;
+            continue;
+        }
+        for(size_t j = 0; j != n; ++j)
+            if(!warm_add_page(pages, urls[j], NULL))
+                return false;
+    }
+    return true;
+}
+
+bool handle_remote(
+    const struct config *config, const char *const *argv
+) {
+    char line[MTRIX_DAEMON_MAX_CMD + 1], *p = line;
+    for(; *argv; ++argv) {
+        const size_t len = strlen(*argv);
+        if(len + 1 >= (size_t)(line + sizeof(line) - p))
+            return log_err("%s: command too long\n", __func__), false;
+        if(p != line)
+            *p++ = ' ';
+        memcpy(p, *argv, len);
+        p += len;
     }
-    if(buffer)
-        free(buffer);
+    *p = 0;
+    const char *const addr = config->input.connect_socket;
+    const int fd = *addr
+        ? mtrix_socket_connect(addr)
+        : mtrix_socket_connect_unix(config->input.connect_unix);
+    if(fd == -1)
+        return false;
+    struct mtrix_daemon_output output = {0};
+    bool ret = mtrix_daemon_send(fd, line) && mtrix_daemon_recv(fd, &output);
+    if(close(fd) == -1)
+        log_errno("close");
+    if(ret) {
+        fwrite(output.out.p, 1, output.out.n, stdout);
+        fwrite(output.err.p, 1, output.err.n, stderr);
+        ret = !output.status;
+    }
+    free(output.out.p);
+    free(output.err.p);
     return ret;
 }
 
+void handle_signal(int s) {
+    (void)s;
+    const int e = errno;
+    if(write(signal_fd, "", 1) != 1)
+        log_errno("handle_signal: write");
+    errno = e;
+}
+
 bool str_to_args(char *str, size_t max_args, char **argv) {
     const char *d = " \n";
     size_t n = 0;
@@ -407,8 +1821,10 @@ bool str_to_args(char *str, size_t max_args, char **argv) {
     return n < max_args || !arg;
 }
 
-const char *rnd_list_item(const char **v, size_t n) {
-    return v[(size_t)rand() % n];
+const char *rnd_list_item(
+    const struct config *config, const char **v, size_t n
+) {
+    return v[mtrix_rng_below(config->rng, n)];
 }
 
 const char *list_item(const char **v, size_t n, const char *i_str) {
@@ -463,6 +1879,347 @@ bool config_record_command(
         && ret == 0;
 }
 
+bool negative_key(
+    char key[static MTRIX_MAX_URL_LEN], const char *cmd, const char *term,
+    const char *lang
+) {
+    // New lines cannot be part of arguments, see str_to_args.
+    return BUILD_URL(key, cmd, "\n", term, "\n", lang ? lang : "");
+}
+
+bool is_negative(const struct config *config, const char *key) {
+    const struct mtrix_cache *const c = &config->http_cache;
+    if(!*c->dir || !mtrix_cache_is_negative(c, key))
+        return false;
+    log_err("no results (cached)\n");
+    stats_increment(config, STATS_NEGATIVE);
+    return true;
+}
+
+void store_negative(const struct config *config, const char *key) {
+    const struct mtrix_cache *const c = &config->http_cache;
+    if(*c->dir)
+        mtrix_cache_store_negative(c, key);
+}
+
+bool negative_page(
+    const struct config *config, const struct page *page, const char *key
+) {
+    if(page->status == 200 || page->status == 404)
+        store_negative(config, key);
+    return false;
+}
+
+TidyDoc fetch_page(
+    const struct config *config, const char *url, struct html_region *region,
+    long *status
+) {
+    const size_t coalesced = config->coalesced;
+    const TidyDoc ret = request_and_parse(
+        url, &config->http_cache, region, status,
+        mtrix_config_verbose(&config->c));
+    if(config->coalesced != coalesced)
+        stats_increment(config, STATS_COALESCED);
+    return ret;
+}
+
+bool fetch_pages(
+    const struct config *config, size_t n, const char *const *urls,
+    struct html_region *regions, TidyDoc *docs, long *status
+) {
+    // Parsing is CPU-bound, unlike the requests.
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t n_workers = 0 < cpus && (size_t)cpus < n ? (size_t)cpus : n;
+    const size_t coalesced = config->coalesced;
+    const bool ret = request_and_parse_multi(
+        n, urls, &config->http_cache, regions, n_workers, docs, status,
+        mtrix_config_verbose(&config->c));
+    for(size_t i = coalesced; i != config->coalesced; ++i)
+        stats_increment(config, STATS_COALESCED);
+    return ret;
+}
+
+bool fetch_bodies(
+    const struct config *config, size_t n, const char *const *urls,
+    struct html_region *regions, struct mtrix_buffer *bodies, bool *ok,
+    long *status
+) {
+    if(regions)
+        for(size_t i = 0; i != n; ++i)
+            bodies[i].stop = &regions[i].stop;
+    const size_t coalesced = config->coalesced;
+    const bool ret = request_bodies(
+        n, urls, &config->http_cache, bodies, ok, status,
+        mtrix_config_verbose(&config->c));
+    for(size_t i = coalesced; i != config->coalesced; ++i)
+        stats_increment(config, STATS_COALESCED);
+    return ret;
+}
+
+bool lookup_cmd(const char *cmd) {
+    return !strcmp(cmd, "dlpo") || !strcmp(cmd, "wikt") || !strcmp(cmd, "tr");
+}
+
+const char *lookup_base(const struct config *config, const char *cmd) {
+    if(strcmp(cmd, "dlpo") == 0)
+        return DLPO_BASE "/";
+    if(strcmp(cmd, "wikt") && strcmp(cmd, "tr"))
+        return NULL;
+    if(*config->input.wikt_index || config->input.wikt_sections)
+        return NULL;
+    return WIKTIONARY_BASE "/";
+}
+
+const struct html_region *lookup_region(
+    const struct config *config, const char *cmd, const char *lang
+) {
+    // Everything used by print_dlpo.
+    static const struct html_region dlpo = {.element = "id=\"resultados\""};
+    // Translations are only given in English entries.  Lookups limited to one
+    // language, the most frequent, skip the rest of the page.
+    static const struct html_region tr = {
+        .after = "id=\"English\"",
+        .until = "class=\"" WIKTIONARY_HEADER " " WIKTIONARY_H2 "\"",
+        .name = "English",
+    };
+    if(!config->input.stream)
+        return NULL;
+    if(strcmp(cmd, "dlpo") == 0)
+        return &dlpo;
+    if(strcmp(cmd, "tr") == 0 && lang)
+        return &tr;
+    return NULL;
+}
+
+bool lookup_url(
+    char url[static MTRIX_MAX_URL_LEN], const char *base, const char *term,
+    const struct html_region *region
+) {
+    const char *const name = region ? region->name : NULL;
+    return BUILD_URL(url, base, term, name ? "#" : "", name ? name : "");
+}
+
+const struct section_lookup *lookup_section_params(
+    const struct config *config, const char *cmd
+) {
+    static const struct section_lookup wikt = {
+        .prefix = "Etymology", .level = 3, .by_lang = true,
+        .print = print_wikt_sections,
+    };
+    static const struct section_lookup tr = {
+        .prefix = "Translations", .print = print_tr_sections,
+    };
+    if(*config->input.wikt_index || !config->input.wikt_sections)
+        return NULL;
+    if(strcmp(cmd, "wikt") == 0)
+        return &wikt;
+    if(strcmp(cmd, "tr") == 0)
+        return &tr;
+    return NULL;
+}
+
+bool split_terms(
+    const char *terms, char v[static MTRIX_MAX_URL_LEN],
+    const char *t[static MAX_LOOKUP_TERMS], size_t *n
+) {
+    const struct mtrix_buffer b = {.p = v, .n = MTRIX_MAX_URL_LEN};
+    if(!copy_arg("term", b, terms))
+        return false;
+    *n = 0;
+    // Terms are unescaped in place, they are never longer than their source.
+    for(char *p = v, *dst = v;; ++p) {
+        char *const term = dst;
+        for(; *p && *p != ','; *dst++ = *p++)
+            if(*p == '\\' && (p[1] == ',' || p[1] == '\\'))
+                ++p;
+        const char c = *p;
+        *dst++ = 0;
+        if(!*term)
+            return log_err("empty term\n"), false;
+        if(*n == MAX_LOOKUP_TERMS)
+            return log_err("too many terms (> %d)\n", MAX_LOOKUP_TERMS),
+                false;
+        t[(*n)++] = term;
+        if(!c)
+            return true;
+    }
+}
+
+bool lookup(
+    const struct config *config, const char *cmd, const char *terms,
+    const char *lang, lookup_print *print
+) {
+    char v[MTRIX_MAX_URL_LEN];
+    const char *split[MAX_LOOKUP_TERMS];
+    size_t n = 0;
+    if(!split_terms(terms, v, split, &n))
+        return false;
+    const char *const base = lookup_base(config, cmd);
+    const struct html_region *const region = lookup_region(config, cmd, lang);
+    struct lookup_term t[MAX_LOOKUP_TERMS];
+    for(size_t i = 0; i != n; ++i) {
+        struct lookup_term *const x = t + i;
+        const char *const p = x->term = split[i];
+        const bool ok = lookup_url(x->url, base, p, region)
+            && negative_key(x->key, cmd, p, lang);
+        if(!ok)
+            return false;
+        if(mtrix_config_verbose(&config->c))
+            printf("Looking up term: %s\n", x->url);
+    }
+    if(mtrix_config_dry(&config->c))
+        return true;
+    const char *urls[MAX_LOOKUP_TERMS];
+    struct html_region rv[MAX_LOOKUP_TERMS];
+    struct html_region *const regions = region ? rv : NULL;
+    TidyDoc docs[MAX_LOOKUP_TERMS] = {0};
+    struct mtrix_buffer bodies[MAX_LOOKUP_TERMS] = {0};
+    bool ok[MAX_LOOKUP_TERMS] = {0};
+    long status[MAX_LOOKUP_TERMS] = {0};
+    const bool tokenizer = config->input.tokenizer;
+    size_t n_urls = 0;
+    for(size_t i = 0; i != n; ++i) {
+        if((t[i].negative = is_negative(config, t[i].key)))
+            continue;
+        if(regions) {
+            regions[n_urls] = *region;
+            html_region_init(regions + n_urls);
+        }
+        urls[n_urls++] = t[i].url;
+    }
+    bool fetched = true;
+    if(tokenizer)
+        fetched = !n_urls
+            || fetch_bodies(
+                config, n_urls, urls, regions, bodies, ok, status);
+    else if(n == 1 && n_urls == 1)
+        *docs = fetch_page(config, *urls, regions, status);
+    else
+        fetched = !n_urls
+            || fetch_pages(config, n_urls, urls, regions, docs, status);
+    for(size_t i = 0; fetched && regions && i != n_urls; ++i)
+        stats_stream(config, urls[i], &regions[i].stop);
+    bool ret = fetched;
+    for(size_t i = 0, j = 0; fetched && i != n; ++i) {
+        if(n != 1)
+            printf("%s:\n", t[i].term);
+        if(t[i].negative) {
+            ret = false;
+            continue;
+        }
+        struct page page = {.doc = docs[j], .status = status[j]};
+        if(tokenizer && ok[j]) {
+            page.html = html_region_extract(
+                bodies + j, regions ? regions + j : NULL, &page.len);
+            if(!page.html)
+                page.html = "";
+        }
+        ++j;
+        if(!page.doc && !page.html) {
+            ret = false;
+            continue;
+        }
+        ret = print(config, &page, lang, t[i].key) && ret;
+        html_release(page.doc);
+    }
+    for(size_t i = 0; i != n_urls; ++i)
+        free(bodies[i].p);
+    return ret;
+}
+
+bool lookup_index(
+    const struct config *config, const char *terms, const char *lang,
+    index_print *print
+) {
+    char v[MTRIX_MAX_URL_LEN];
+    const char *t[MAX_LOOKUP_TERMS];
+    size_t n = 0;
+    if(!split_terms(terms, v, t, &n))
+        return false;
+    bool ret = true;
+    for(size_t i = 0; i != n; ++i) {
+        if(mtrix_config_verbose(&config->c))
+            printf("Looking up term: %s\n", t[i]);
+        if(n != 1)
+            printf("%s:\n", t[i]);
+        const struct mtrix_wiktidx_entry *e = NULL;
+        const size_t k = mtrix_wiktidx_find(&config->wikt_index, t[i], &e);
+        if(!k) {
+            log_err("term not found: %s\n", t[i]);
+            ret = false;
+            continue;
+        }
+        ret = print(config, e, k, lang) && ret;
+    }
+    return ret;
+}
+
+bool lookup_sections(
+    const struct config *config, const char *cmd, const char *terms,
+    const char *lang
+) {
+    const struct section_lookup *const l = lookup_section_params(config, cmd);
+    char v[MTRIX_MAX_URL_LEN];
+    const char *t[MAX_LOOKUP_TERMS];
+    size_t n = 0;
+    if(!split_terms(terms, v, t, &n))
+        return false;
+    const bool verbose = mtrix_config_verbose(&config->c);
+    if(verbose)
+        for(size_t i = 0; i != n; ++i)
+            printf("Looking up term: %s\n", t[i]);
+    if(mtrix_config_dry(&config->c))
+        return true;
+    bool ret = true;
+    for(size_t i = 0; i != n; ++i) {
+        if(n != 1)
+            printf("%s:\n", t[i]);
+        char key[MTRIX_MAX_URL_LEN];
+        if(!negative_key(key, cmd, t[i], lang) || is_negative(config, key)) {
+            ret = false;
+            continue;
+        }
+        wikt_section s[WIKT_MAX_SECTIONS];
+        size_t k = 0;
+        bool missing = false;
+        const size_t coalesced = config->coalesced;
+        const bool ok = wikt_request_sections(
+            WIKTIONARY_API, t[i], l->by_lang ? lang : NULL, l->prefix,
+            l->level, &config->http_cache, s, &k, &missing, verbose);
+        for(size_t j = coalesced; j != config->coalesced; ++j)
+            stats_increment(config, STATS_COALESCED);
+        if(missing) {
+            log_err("page not found: %s\n", t[i]);
+            store_negative(config, key);
+        }
+        ret = ok && !missing && l->print(config, s, k, lang) && ret;
+        for(size_t j = 0; j != k; ++j)
+            html_release(s[j].doc);
+    }
+    return ret;
+}
+
+bool print_words(const struct config *config, size_t k, const char *sep) {
+    const struct mtrix_dict *const d = &config->dict;
+    if(!d->n)
+        return log_err("empty dictionary: %s\n", DICT_FILE), false;
+    // Like shuf(1), print each word at most once.
+    if(k > d->n)
+        k = d->n;
+    size_t *const v = malloc(k * sizeof(*v));
+    if(k && !v)
+        return log_errno("malloc"), false;
+    const bool ret = mtrix_dict_sample(d, config->rng, k, v);
+    if(ret)
+        for(size_t i = 0; i != k; ++i) {
+            size_t len = 0;
+            const char *const w = mtrix_dict_word(d, v[i], &len);
+            printf("%s%.*s", sep, (int)len, w);
+        }
+    free(v);
+    return ret;
+}
+
 bool cmd_help(const struct config *config, const char *const *argv) {
     (void)config;
     if(argv[0])
@@ -480,27 +2237,19 @@ bool cmd_ping(const struct config *config, const char *const *argv) {
 }
 
 bool cmd_word(const struct config *config, const char *const *argv) {
-    (void)config;
     if(argv[0])
         return log_err("command accepts no arguments\n"), false;
-    pid_t pid = fork();
-    if(pid == -1) {
-        log_errno("fork");
+    if(!print_words(config, 1, ""))
         return false;
-    }
-    if(!pid)
-        return exec(
-            (const char *[]){"shuf", "-n", "1", DICT_FILE, 0},
-            -1, -1, -1);
-    return wait_n(1, &pid);
+    printf("\n");
+    return true;
 }
 
 bool cmd_abbr(const struct config *config, const char *const *argv) {
-    (void)config;
     const char *const abbr = *argv++;
     if(!abbr)
         return log_err("command takes at least one argument\n"), false;
-    char dict_buf[MAX_PATH];
+    char dict_buf[MAX_PATH] = {0};
     const char *dict = *argv++;
     if(dict) {
         if(!(dict = join_path(dict_buf, 2, "/usr/share/dict/", dict)))
@@ -508,108 +2257,49 @@ bool cmd_abbr(const struct config *config, const char *const *argv) {
         if(*argv)
             return log_err("command takes at most two arguments\n"), false;
     }
-    char *buffer = NULL;
-    size_t buffer_len = 0;
-    for(const char *c = abbr; *c; ++c) {
-        int fds[2][2];
-        if(pipe(fds[0]) == -1) {
-            log_errno("pipe");
-            return false;
-        }
-        pid_t pids[2] = {0};
-        pids[0] = fork();
-        if(pids[0] == -1) {
-            log_errno("fork");
-            return false;
-        }
-        if(!pids[0]) {
-            close(fds[0][0]);
-            return exec(
-                (const char*[]){
-                    "look", "--ignore-case", (char[]){*c, '\0'}, dict, 0,
-                },
-                -1, fds[0][1], -1);
-        }
-        close(fds[0][1]);
-        if(pipe(fds[1]) == -1) {
-            log_errno("pipe");
-            return false;
-        }
-        pids[1] = fork();
-        if(!pids[1]) {
-            close(fds[1][0]);
-            return exec(
-                (const char*[]){"shuf", "-n", "1", 0},
-                fds[0][0], fds[1][1], -1);
-        }
-        close(fds[0][0]);
-        close(fds[1][1]);
-        FILE *child = fdopen(fds[1][0], "r");
-        if(!child) {
-            log_errno("fdopen");
+    const struct mtrix_dict *d = &config->dict;
+    struct mtrix_dict tmp = {0};
+    if(dict || !(config->flags & DICT_LOADED)) {
+        if(!open_dict(config, &tmp, dict ? dict : DICT_FILE))
             return false;
-        }
-        ssize_t len = 0;
-        if((len = getline(&buffer, &buffer_len, child)) == -1)
+        d = &tmp;
+    }
+    for(const char *c = abbr; *c; ++c) {
+        const uint32_t *v = NULL;
+        const size_t n = mtrix_dict_letter(d, *c, &v);
+        // Stop at the first letter without matches, as look(1) would.
+        if(!n)
             break;
-        if(buffer[len - 1] == '\n')
-            buffer[len - 1] = '\0';
-        printf("%s%s", c != abbr ? " " : "", buffer);
-        if(!wait_n(2, pids))
-            return false;
+        size_t len = 0;
+        const char *const w =
+            mtrix_dict_word(d, v[mtrix_rng_below(config->rng, n)], &len);
+        printf("%s%.*s", c != abbr ? " " : "", (int)len, w);
     }
     printf("\n");
-    return true;
+    return d != &tmp || mtrix_dict_close(&tmp);
 }
 
 bool cmd_damn(const struct config *config, const char *const *argv) {
-    (void)config;
     if(argv[0] && argv[1])
         return log_err("command accepts at most one argument\n"), false;
-    int fds[2];
-    if(pipe(fds) == -1) {
-        log_errno("pipe");
-        return false;
-    }
-    pid_t pid = fork();
-    if(pid == -1) {
-        log_errno("fork");
-        return false;
-    }
-    if(!pid) {
-        close(fds[0]);
-        return exec(
-            (const char *[]){"shuf", DICT_FILE, "-n", *argv ? *argv : "3", 0},
-            -1, fds[1], -1);
-    }
-    close(fds[1]);
-    FILE *child = fdopen(fds[0], "r");
-    if(!child) {
-        log_errno("fdopen");
-        return false;
+    size_t k = 3;
+    if(argv[0]) {
+        const int64_t n = parse_i64(argv[0]);
+        if(n == -1)
+            return false;
+        k = (size_t)n;
     }
     printf("You");
-    char *buffer = 0;
-    size_t buffer_len = 0;
-    for(;;) {
-        ssize_t len = 0;
-        if((len = getline(&buffer, &buffer_len, child)) == -1)
-            break;
-        if(buffer[len - 1] == '\n')
-            buffer[len - 1] = '\0';
-        printf(" %s", buffer);
-    }
+    if(!print_words(config, k, " "))
+        return false;
     printf("!\n");
-    if(buffer)
-        free(buffer);
-    return wait_n(1, &pid);
+    return true;
 }
 
 bool cmd_parl(const struct config *config, const char *const *argv) {
-    (void)config;
     if(argv[0])
         return log_err("command accepts no arguments\n"), false;
-    printf("%s", RND_LIST_ITEM(((const char*[]){
+    printf("%s", RND_LIST_ITEM(config, ((const char*[]){
         "A terminological inexactitude [citation needed].\n",
         "Liar.\n-- Australia, 1997\n",
         "Dumbo.\n-- Australia, 1997\n",
@@ -726,10 +2416,9 @@ bool cmd_parl(const struct config *config, const char *const *argv) {
 }
 
 bool cmd_bard(const struct config *config, const char *const *argv) {
-    (void)config;
     if(argv[0])
         return log_err("command accepts no argument\n"), false;
-    printf("%s", RND_LIST_ITEM(((const char*[]){
+    printf("%s", RND_LIST_ITEM(config, ((const char*[]){
         "A most notable coward, an infinite and endless liar, an hourly"
         " promise breaker, the owner of no one good quality.\n"
         "-- All’s Well That Ends Well (Act 3, Scene 6)\n",
@@ -857,35 +2546,36 @@ bool cmd_bard(const struct config *config, const char *const *argv) {
 bool cmd_dlpo(const struct config *config, const char *const *argv) {
     if(!argv[0] || argv[1])
         return log_err("command takes one argument\n"), false;
-    char url[MTRIX_MAX_URL_LEN];
-    if(!BUILD_URL(url, DLPO_BASE "/", *argv))
-        return false;
-    if(mtrix_config_verbose(&config->c))
-        printf("Looking up term: %s\n", url);
-    if(mtrix_config_dry(&config->c))
-        return true;
-    TidyDoc tidy_doc = request_and_parse(url, mtrix_config_verbose(&config->c));
-    if(!tidy_doc)
+    return lookup(config, "dlpo", *argv, NULL, print_dlpo);
+}
+
+bool print_dlpo(
+    const struct config *config, const struct page *page, const char *lang,
+    const char *key
+) {
+    (void)lang;
+    bool found = false;
+    if(page->doc) {
+        const char *id = "resultados";
+        const TidyDoc doc = page->doc;
+        const struct html_index *const x = html_index_get(doc);
+        TidyNode res = find_node_by_id(x, tidyGetRoot(doc), id, true);
+        if(!res)
+            return log_err("element '#%s' not found\n", id), false;
+        TidyNode def = dlpo_find_definitions(x, res);
+        if((found = def != NULL)) {
+            TidyBuffer buf = {0};
+            dlpo_print_definitions(stdout, doc, def, &buf);
+            if(buf.bp)
+                tidyBufFree(&buf);
+        }
+    } else if(!dlpo_scan_definitions(stdout, page->html, page->len, &found)) {
         return false;
-    const char *id = "resultados";
-    TidyNode res = find_node_by_id(tidyGetRoot(tidy_doc), id, true);
-    bool ret = false;
-    if(!res) {
-        log_err("element '#%s' not found\n", id);
-        goto cleanup;
     }
-    TidyNode def = dlpo_find_definitions(res);
-    if(!def)
-        goto cleanup;
-    TidyBuffer buf = {0};
-    dlpo_print_definitions(stdout, tidy_doc, def, &buf);
-    if(buf.bp)
-        tidyBufFree(&buf);
-    ret = true;
+    if(!found)
+        return negative_page(config, page, key);
     stats_increment(config, STATS_DLPO);
-cleanup:
-    tidyRelease(tidy_doc);
-    return ret;
+    return true;
 }
 
 bool cmd_wikt(const struct config *config, const char *const *argv) {
@@ -895,58 +2585,72 @@ bool cmd_wikt(const struct config *config, const char *const *argv) {
     const char *const lang = *argv++;
     if(lang && *argv)
         return log_err("command takes at most two arguments\n"), false;
-    char url[MTRIX_MAX_URL_LEN];
-    if(!BUILD_URL(url, WIKTIONARY_BASE "/", term))
-        return false;
-    if(mtrix_config_verbose(&config->c))
-        printf("Looking up term: %s\n", url);
-    if(mtrix_config_dry(&config->c))
-        return true;
-    TidyDoc tidy_doc = request_and_parse(url, mtrix_config_verbose(&config->c));
-    if(!tidy_doc)
-        return false;
-    bool ret = false;
-    wikt_page page;
-    if(!wikt_parse_page(tidy_doc, &page))
-        goto cleanup;
+    if(config->flags & WIKT_INDEX_LOADED)
+        return lookup_index(config, term, lang, print_wikt_index);
+    if(config->input.wikt_sections)
+        return lookup_sections(config, "wikt", term, lang);
+    return lookup(config, "wikt", term, lang, print_wikt);
+}
+
+bool print_wikt(
+    const struct config *config, const struct page *page, const char *lang,
+    const char *key
+) {
+    const bool ok = page->doc
+        ? wikt_print_etymologies(stdout, page->doc, lang)
+        : wikt_scan_etymologies(stdout, page->html, page->len, lang);
+    if(!ok)
+        return negative_page(config, page, key);
+    stats_increment(config, STATS_WIKT);
+    return true;
+}
+
+bool print_wikt_sections(
+    const struct config *config, const wikt_section *v, size_t n,
+    const char *lang
+) {
+    // Sections were already selected by language.
+    (void)lang;
     TidyBuffer buf = {0};
-    TidyNode lang_sect = find_node_by_class(page.contents, WIKTIONARY_H2, true);
-    while(lang_sect) {
-        TidyNode sect = lang_sect;
-        TidyAttr lang_id = find_attr(tidyGetChild(lang_sect), "id");
-        const char *lang_text = lang_id ? tidyAttrValue(lang_id) : "?";
-        if(lang && strcasecmp(lang, lang_text) != 0) {
-            wikt_next_section(WIKTIONARY_H2, "", &lang_sect);
+    const char *prev = NULL;
+    bool ret = true;
+    for(size_t i = 0; i != n; ++i) {
+        wikt_page page;
+        if(!wikt_parse_section(v[i].doc, &page)) {
+            ret = false;
             continue;
         }
-        while(wikt_next_section(WIKTIONARY_H3, "Etymology", &sect)) {
-            if(lang_text) {
-                printf("%s\n", lang_text);
-                lang_text = NULL;
-            }
-            for(TidyNode etym = sect; (etym = tidyGetNext(etym));) {
-                if(node_has_class(etym, WIKTIONARY_HEADER))
-                    break;
-                tidyNodeGetText(tidy_doc, etym, &buf);
-                join_lines(buf.bp, buf.bp + buf.size);
-                printf("  ");
-                print_unescaped(stdout, buf.bp);
-                printf("\n");
-                tidyBufClear(&buf);
-            }
-        }
-        if((lang_sect = sect))
-            wikt_next_section(WIKTIONARY_H2, "", &lang_sect);
+        if(!prev || strcmp(prev, v[i].lang) != 0)
+            printf("%s\n", prev = v[i].lang);
+        wikt_print_etymology(stdout, v[i].doc, page.contents, &buf);
     }
-    ret = true;
     if(buf.bp)
         tidyBufFree(&buf);
     stats_increment(config, STATS_WIKT);
-cleanup:
-    tidyRelease(tidy_doc);
     return ret;
 }
 
+bool print_wikt_index(
+    const struct config *config, const struct mtrix_wiktidx_entry *v,
+    size_t n, const char *lang
+) {
+    const struct mtrix_wiktidx *const x = &config->wikt_index;
+    for(size_t i = 0; i != n; ++i) {
+        const char *const lang_text = mtrix_wiktidx_str(x, v[i].lang);
+        if(!v[i].etym.len || (lang && strcasecmp(lang, lang_text) != 0))
+            continue;
+        printf("%s\n", lang_text);
+        // Index files may omit the last new-line character.
+        for(const char *p = mtrix_wiktidx_str(x, v[i].etym); *p;) {
+            const size_t n = strcspn(p, "\n");
+            printf("  %.*s\n", (int)n, p);
+            p += n + !!p[n];
+        }
+    }
+    stats_increment(config, STATS_WIKT);
+    return true;
+}
+
 bool cmd_tr(const struct config *config, const char *const *argv) {
     const char *const term = *argv++;
     if(!term)
@@ -954,71 +2658,84 @@ bool cmd_tr(const struct config *config, const char *const *argv) {
     const char *const lang = *argv++;
     if(lang && *argv)
         return log_err("command takes at most one argument\n"), false;
-    char url[MTRIX_MAX_URL_LEN];
-    if(!BUILD_URL(url, WIKTIONARY_BASE "/", term))
-        return false;
-    if(mtrix_config_verbose(&config->c))
-        printf("Looking up term: %s\n", url);
-    if(mtrix_config_dry(&config->c))
-        return true;
-    TidyDoc tidy_doc = request_and_parse(url, mtrix_config_verbose(&config->c));
-    if(!tidy_doc)
-        return false;
-    bool ret = false;
-    wikt_page page;
-    if(!wikt_parse_page(tidy_doc, &page))
-        goto cleanup;
+    if(config->flags & WIKT_INDEX_LOADED)
+        return lookup_index(config, term, lang, print_tr_index);
+    if(config->input.wikt_sections)
+        return lookup_sections(config, "tr", term, lang);
+    return lookup(config, "tr", term, lang, print_tr);
+}
+
+bool print_tr(
+    const struct config *config, const struct page *page, const char *lang,
+    const char *key
+) {
+    const bool ok = page->doc
+        ? wikt_print_translations(stdout, page->doc, lang)
+        : wikt_scan_translations(stdout, page->html, page->len, lang);
+    if(!ok)
+        return negative_page(config, page, key);
+    return true;
+}
+
+bool print_tr_sections(
+    const struct config *config, const wikt_section *v, size_t n,
+    const char *lang
+) {
+    (void)config;
     TidyBuffer buf = {0};
-    for(TidyNode lang_sect = page.contents; lang_sect;) {
-        TidyNode sect = lang_sect;
-        TidyAttr lang_id = find_attr(tidyGetChild(lang_sect), "id");
-        const char *lang_text = lang_id ? tidyAttrValue(lang_id) : "?";
-        while(wikt_next_subsection(NULL, "Translations-", &sect)) {
-            if(lang_text) {
-                printf("%s\n", lang_text);
-                lang_text = NULL;
-            }
-            const TidyNode head = wikt_translation_head(sect);
-            if(!head)
-                continue;
-            tidyNodeGetText(tidy_doc, head, &buf);
-            join_lines(buf.bp, buf.bp + buf.size);
-            printf("  %s\n", buf.bp);
-            tidyBufClear(&buf);
-            const TidyNode body = wikt_translation_body(sect);
-            if(!body)
-                continue;
-            TidyNode td = body, li;
-            while((td = wikt_next_translation_block(td, &li))) {
-                for(; li; li = tidyGetNext(li)) {
-                    tidyNodeGetText(tidy_doc, li, &buf);
-                    join_lines(buf.bp, buf.bp + buf.size);
-                    if(!lang || wikt_translation_is_language(buf, lang)) {
-                        printf("    ");
-                        print_unescaped(stdout, buf.bp);
-                        printf("\n");
-                    }
-                    tidyBufClear(&buf);
-                }
-                td = tidyGetNext(td);
-            }
+    const char *prev = NULL;
+    bool ret = true;
+    for(size_t i = 0; i != n; ++i) {
+        wikt_page page;
+        if(!wikt_parse_section(v[i].doc, &page)) {
+            ret = false;
+            continue;
+        }
+        for(TidyNode sect = page.contents;
+                wikt_next_subsection(NULL, "Translations-", &sect);) {
+            if(!prev || strcmp(prev, v[i].lang) != 0)
+                printf("%s\n", prev = v[i].lang);
+            wikt_print_translation(stdout, v[i].doc, sect, lang, &buf);
         }
-        lang_sect = sect;
     }
-    ret = true;
     if(buf.bp)
         tidyBufFree(&buf);
-cleanup:
-    tidyRelease(tidy_doc);
     return ret;
 }
 
-bool cmd_aoe(const char **v, size_t n, const char *const *argv) {
+bool print_tr_index(
+    const struct config *config, const struct mtrix_wiktidx_entry *v,
+    size_t n, const char *lang
+) {
+    const struct mtrix_wiktidx *const x = &config->wikt_index;
+    const size_t lang_len = lang ? strlen(lang) : 0;
+    for(size_t i = 0; i != n; ++i) {
+        if(!v[i].tr.len)
+            continue;
+        printf("%s\n", mtrix_wiktidx_str(x, v[i].lang));
+        for(const char *p = mtrix_wiktidx_str(x, v[i].tr); *p;) {
+            const size_t n = strcspn(p, "\n");
+            const int len = (int)n;
+            if(*p != '\t')
+                printf("  %.*s\n", len, p);
+            else if(!lang || (strncasecmp(lang, p + 1, lang_len) == 0
+                    && p[1 + lang_len] == ':'))
+                printf("    %.*s\n", len - 1, p + 1);
+            p += n + !!p[n];
+        }
+    }
+    return true;
+}
+
+bool cmd_aoe(
+    const struct config *config, const char **v, size_t n,
+    const char *const *argv
+) {
     const char *const i = *argv;
     if(i && argv[1])
         return log_err("command accepts at most one argument\n"), false;
     if(!i) {
-        printf("%s", rnd_list_item(v, n));
+        printf("%s", rnd_list_item(config, v, n));
         return true;
     }
     const char *const s = list_item(v, n, i);
@@ -1029,7 +2746,6 @@ bool cmd_aoe(const char **v, size_t n, const char *const *argv) {
 }
 
 bool cmd_aoe1(const struct config *config, const char *const *argv) {
-    (void)config;
     static const char *v[] = {
         "Yes.\n",
         "No.\n",
@@ -1057,11 +2773,10 @@ bool cmd_aoe1(const struct config *config, const char *const *argv) {
         "Dad gum!\n",
         "Aw, yeah!\n",
     };
-    return cmd_aoe(v, ARRAY_SIZE(v), argv);
+    return cmd_aoe(config, v, ARRAY_SIZE(v), argv);
 }
 
 bool cmd_aoe2(const struct config *config, const char *const *argv) {
-    (void)config;
     static const char *v[] = {
         "Yes.\n",
         "No.\n",
@@ -1170,28 +2885,68 @@ bool cmd_aoe2(const struct config *config, const char *const *argv) {
         "Don't resign!\n",
         "You can resign again.\n",
     };
-    return cmd_aoe(v, ARRAY_SIZE(v), argv);
+    return cmd_aoe(config, v, ARRAY_SIZE(v), argv);
 }
 
 bool stats_increment(const struct config *config, uint8_t opt) {
+    struct stats d = {0};
+    switch(opt) {
+    case STATS_WIKT: d.wikt = 1; break;
+    case STATS_DLPO: d.dlpo = 1; break;
+    case STATS_NEGATIVE: d.negative = 1; break;
+    case STATS_COALESCED: d.coalesced = 1; break;
+    default: assert(!"invalid option");
+    }
+    return stats_add(config, &d);
+}
+
+bool stats_stream(
+    const struct config *config, const char *url, const struct mtrix_stop *s
+) {
+    if(!s->stopped)
+        return true;
+    if(mtrix_config_verbose(&config->c)) {
+        printf("Stopped early: %s: ", url);
+        if(s->skipped == -1)
+            printf("unknown size\n");
+        else
+            printf(
+                "%" PRId64 " bytes, ~%" PRId64 "ms saved\n",
+                s->skipped, s->skipped_us / 1000);
+    }
+    return stats_add(config, &(struct stats){
+        .streamed = 1,
+        .stream_bytes = s->skipped == -1 ? 0 : s->skipped,
+        .stream_us = s->skipped_us,
+    });
+}
+
+bool stats_add(const struct config *config, const struct stats *d) {
     const char *const path = config->input.stats_file;
     if(!*path)
         return true;
     FILE *const f = open_or_create(path, "r+");
     if(!f)
         return false;
+    bool ret = false;
+    // Commands can be executed concurrently, see handle_file_parallel.
+    if(flock(fileno(f), LOCK_EX) == -1) {
+        log_errno("%s: flock", __func__);
+        goto end;
+    }
     struct stats s = {0};
     fread(&s, sizeof(s), 1, f);
-    bool ret = false;
     if(ferror(f)) {
         log_errno("%s: fread", __func__);
         goto end;
     }
-    switch(opt) {
-    case STATS_WIKT: s.wikt++; break;
-    case STATS_DLPO: s.dlpo++; break;
-    default: assert(!"invalid option");
-    }
+    s.wikt += d->wikt;
+    s.dlpo += d->dlpo;
+    s.negative += d->negative;
+    s.coalesced += d->coalesced;
+    s.streamed += d->streamed;
+    s.stream_bytes += d->stream_bytes;
+    s.stream_us += d->stream_us;
     rewind(f);
     if(fwrite(&s, sizeof(s), 1, f) != 1) {
         log_errno("%s: fwrite", __func__);
@@ -1222,12 +2977,19 @@ bool stats_file(const struct config *config) {
         if(errno != ENOENT)
             return log_errno("%s: fopen(%s)", __func__, path), false;
     } else {
-        if(fread(&s, sizeof(s), 1, f) != 1)
+        // Files written by older versions may not contain all fields.
+        fread(&s, sizeof(s), 1, f);
+        if(ferror(f))
             return log_errno("%s: fread", __func__), false;
         if(fclose(f) == -1)
             return log_errno("%s: close", __func__), false;
     }
-    printf("file\n  wikt: %d\n  dlpo: %d\n", s.wikt, s.dlpo);
+    printf(
+        "file\n  wikt: %d\n  dlpo: %d\n  negative: %d\n  coalesced: %d\n"
+        "  streamed: %d\n  stream bytes saved: %" PRId64 "\n"
+        "  stream ms saved: %" PRId64 "\n",
+        s.wikt, s.dlpo, s.negative, s.coalesced, s.streamed, s.stream_bytes,
+        s.stream_us / 1000);
     return true;
 }
 
@@ -5,19 +5,29 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <cjson/cJSON.h>
 
 #include "config.h"
+#include "daemon.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "rng.h"
+#include "socket.h"
 #include "utils.h"
 
 /** Root URL for the Matrix API. */
@@ -26,8 +36,26 @@
 /** URL for the synchronization endpoint. */
 #define SYNC_URL API_URL "/sync"
 
-/** Limits the number of synchronization events to one. */
-#define ROOM_FILTER "filter={\"room\":{\"timeline\":{\"limit\":1}}}"
+/**
+ * Excludes all room, presence, and account data from the initial request.
+ * Only `next_batch` is used from its response.  URL-encoded form of:
+ * `{"room":{"rooms":[]},"presence":{"types":[]},"account_data":{"types":[]}}`.
+ */
+#define INIT_FILTER \
+    "filter=%7B%22room%22%3A%7B%22rooms%22%3A%5B%5D%7D%2C" \
+    "%22presence%22%3A%7B%22types%22%3A%5B%5D%7D%2C" \
+    "%22account_data%22%3A%7B%22types%22%3A%5B%5D%7D%7D"
+
+/** Number of events requested per page when paginating a timeline. */
+#define PAGE_LIMIT_STR "10"
+
+/**
+ * Limits the number of timeline events to \ref PAGE_LIMIT_STR.
+ * URL-encoded form of `{"room":{"timeline":{"limit":10}}}`.
+ */
+#define PAGE_FILTER \
+    "filter=%7B%22room%22%3A%7B%22timeline%22%3A%7B%22limit%22%3A" \
+    PAGE_LIMIT_STR "%7D%7D%7D"
 
 /** URL for the rooms endpoint. */
 #define ROOMS_URL API_URL "/rooms"
@@ -35,6 +63,9 @@
 /** URL fragment for the send-message enpoint for a room. */
 #define SEND_URL "/send/m.room.message"
 
+/** URL fragment for the messages (pagination) enpoint for a room. */
+#define MESSAGES_URL "/messages"
+
 /** Polling interval for the synchronization request. */
 #define SYNC_INTERVAL_MS_STR "30000"
 
@@ -55,6 +86,33 @@
 enum {
     /** Filter mode was chosen. */
     FILTER_FLAG = 1 << 0,
+    /** Delay after the first failed synchronization request. */
+    BACKOFF_BASE_MS = 1000,
+    /** Maximum delay between failed synchronization requests. */
+    BACKOFF_MAX_MS = 5 * 60 * 1000,
+    /** Default value for \ref config::max_sync. */
+    DEFAULT_MAX_SYNC = 8 * 1024 * 1024,
+    /** Backlog of the metrics socket. */
+    METRICS_BACKLOG = 4,
+    /**
+     * Maximum length of a room identifier (including null terminator).
+     * https://spec.matrix.org/latest/appendices/#room-ids
+     */
+    MAX_ROOM = 256,
+    /** Maximum number of timeline gaps waiting to be backfilled. */
+    BACKFILL_MAX_JOBS = 32,
+    /**
+     * Maximum number of pages fetched to fill a single gap.
+     * Events beyond `BACKFILL_MAX_PAGES * PAGE_LIMIT_STR` are skipped.
+     */
+    BACKFILL_MAX_PAGES = 20,
+    /**
+     * Number of consecutive failed requests after which a backfill job is
+     * abandoned.
+     */
+    BACKFILL_MAX_FAILURES = 5,
+    /** Delay after the first failed backfill request, doubled after each. */
+    BACKFILL_RETRY_MS = 1000,
 };
 
 struct config {
@@ -63,6 +121,178 @@ struct config {
     const char **args;
     /** Filter, etc. */
     uint8_t flags;
+    /**
+     * Maximum size of a response from the server, `0` for no limit.
+     * Larger synchronization responses are requested again in pages.
+     */
+    size_t max_sync;
+    /** Number of worker threads used in filter mode. */
+    size_t jobs;
+    /** Time allowed for each command, in milliseconds, `0` for no limit. */
+    int cmd_timeout_ms;
+    /** TCP address (`host:port`) where metrics are served, if not empty. */
+    char metrics_socket[MTRIX_MAX_PATH];
+    /** Unix socket path where metrics are served, if not empty. */
+    char metrics_unix[MTRIX_MAX_PATH];
+    /** TCP address of a `machinatrix --listen` daemon, if not empty. */
+    char daemon_socket[MTRIX_MAX_PATH];
+    /** Unix socket path of a `machinatrix --listen` daemon, if not empty. */
+    char daemon_unix[MTRIX_MAX_PATH];
+};
+
+/**
+ * Function used to deliver the output of a command to a room.
+ * \param data Opaque value passed to \ref handle_request.
+ */
+typedef bool send_msg_f(
+    const struct config *config, void *data, const char *room,
+    const char *msg);
+
+/**
+ * Error tracking for the synchronization loop.
+ * Consecutive failures form a burst, which ends when a request succeeds.
+ * Totals are kept in \ref metrics.
+ */
+struct backoff {
+    /** Number of consecutive failures in the current burst. */
+    unsigned failures;
+    /** Start of the current burst. */
+    struct timespec burst_start;
+    /** Source of jitter for retry delays. */
+    struct mtrix_rng rng;
+};
+
+/** Result of \ref sync_once. */
+enum sync_result {
+    SYNC_OK,
+    /** The request failed and is retried with the same `since` token. */
+    SYNC_RETRY,
+};
+
+/** Range of events of a room missing from a `/sync` response. */
+struct backfill_job {
+    char room[MAX_ROOM];
+    /** Pagination token of the next page. */
+    char from[MAX_BATCH];
+    /** End of the range, the `prev_batch` token of the timeline. */
+    char to[MAX_BATCH];
+    /** Number of pages fetched so far. */
+    unsigned pages;
+    /** Number of consecutive failed requests. */
+    unsigned failures;
+    /**
+     * Time before which the job is not served, after a failed request
+     * (`CLOCK_REALTIME`, as used by `pthread_cond_timedwait`).
+     */
+    struct timespec due;
+};
+
+/** Result of \ref backfill_page. */
+enum backfill_result {
+    /** The gap has been filled or cannot be filled. */
+    BACKFILL_DONE,
+    /** The page was handled, the gap has more. */
+    BACKFILL_MORE,
+    /** The request failed and can be retried. */
+    BACKFILL_RETRY,
+};
+
+/**
+ * Queue of timeline gaps, filled by a background thread.
+ * Jobs are served one page at a time in round-robin order, so that a busy
+ * room cannot delay the others, and are abandoned after
+ * \ref BACKFILL_MAX_PAGES.  Failed requests are retried with an increasing
+ * delay, up to \ref BACKFILL_MAX_FAILURES times, during which other jobs are
+ * served.
+ */
+struct backfill {
+    const struct config *config;
+    size_t user_len;
+    /** Ring buffer of \ref BACKFILL_MAX_JOBS entries. */
+    struct backfill_job *jobs;
+    /** Index of the first job and number of queued jobs in \ref jobs. */
+    size_t head, n;
+    /** Set to terminate the thread. */
+    bool stop;
+    pthread_mutex_t mtx;
+    /** Signaled when a job is added or \ref stop is set. */
+    pthread_cond_t cond;
+    /** Signaled when a job is removed. */
+    pthread_cond_t space;
+    pthread_t thread;
+};
+
+/** Values exposed by the metrics server, see `--metrics`. */
+static struct {
+    struct mtrix_counter syncs, sync_errors, sync_bursts, events, mentions,
+        cmds, cmd_failures, cmd_timeouts, sends, send_failures,
+        backfill_pages, backfill_truncated, sync_skipped,
+        peak_size, last_recovery_ms, max_recovery_ms;
+    struct mtrix_histogram sync_time, send_time;
+} metrics = {
+    .syncs = {
+        "machinatrix_sync_total", "Synchronization requests."},
+    .sync_errors = {
+        "machinatrix_sync_errors_total",
+        "Failed synchronization requests."},
+    .sync_bursts = {
+        "machinatrix_sync_error_bursts_total",
+        "Sequences of consecutive failed synchronization requests."},
+    .events = {
+        "machinatrix_events_total", "Timeline events received."},
+    .mentions = {
+        "machinatrix_mentions_total", "Messages which mention the user."},
+    .cmds = {
+        "machinatrix_commands_total", "Commands executed."},
+    .cmd_failures = {
+        "machinatrix_command_failures_total",
+        "Commands which could not be executed or exited with an error."},
+    .cmd_timeouts = {
+        "machinatrix_command_timeouts_total",
+        "Commands killed after exceeding the time limit."},
+    .sends = {
+        "machinatrix_send_total", "Messages sent."},
+    .send_failures = {
+        "machinatrix_send_failures_total", "Messages which failed to send."},
+    .backfill_pages = {
+        "machinatrix_backfill_pages_total",
+        "Pages requested to fill timeline gaps."},
+    .backfill_truncated = {
+        "machinatrix_backfill_truncated_total",
+        "Timeline gaps which could not be filled completely."},
+    .sync_skipped = {
+        "machinatrix_sync_skipped_total",
+        "Synchronization responses skipped for exceeding the size limit."},
+    .peak_size = {
+        "machinatrix_sync_peak_bytes", "Largest response received.", true},
+    .last_recovery_ms = {
+        "machinatrix_sync_last_recovery_milliseconds",
+        "Duration of the last error burst.", true},
+    .max_recovery_ms = {
+        "machinatrix_sync_max_recovery_milliseconds",
+        "Duration of the longest error burst.", true},
+    .sync_time = {
+        "machinatrix_sync_duration_seconds",
+        "Duration of synchronization requests."},
+    .send_time = {
+        "machinatrix_send_duration_seconds", "Duration of send requests."},
+};
+
+/** All counters in \ref metrics. */
+static struct mtrix_counter *const metrics_counters[] = {
+    &metrics.syncs, &metrics.sync_errors, &metrics.sync_bursts,
+    &metrics.events, &metrics.mentions,
+    &metrics.cmds, &metrics.cmd_failures, &metrics.cmd_timeouts,
+    &metrics.sends, &metrics.send_failures,
+    &metrics.backfill_pages, &metrics.backfill_truncated,
+    &metrics.sync_skipped,
+    &metrics.peak_size, &metrics.last_recovery_ms, &metrics.max_recovery_ms,
+    NULL,
+};
+
+/** All histograms in \ref metrics. */
+static struct mtrix_histogram *const metrics_histograms[] = {
+    &metrics.sync_time, &metrics.send_time, NULL,
 };
 
 /** To be filled by `argv[0]` later, for logging. */
@@ -71,6 +301,13 @@ const char *PROG_NAME = NULL;
 /** Always null. */
 const char *CMD_NAME = NULL;
 
+/**
+ * Serializes pipe creation and `fork` in \ref process_input.
+ * Prevents children spawned by one thread from inheriting the pipes created by
+ * another.
+ */
+static pthread_mutex_t fork_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /** Program entry point. */
 int main(int argc, const char *const *argv);
 
@@ -81,6 +318,14 @@ static bool parse_args(
 /** Prints a usage message. */
 static void usage(FILE *f);
 
+/** Parses a `[unix:]addr` argument into `socket` or `unix`. */
+static bool parse_addr_arg(
+    const char *name, const char *arg, char *socket, char *unix);
+
+/** Creates the metrics socket and starts the server, if requested. */
+static bool start_metrics(
+    const struct config *config, struct mtrix_metrics_server *s);
+
 /** Extracts the short user name from a `@user:server` string. */
 static bool short_username(const char *user, char *out);
 
@@ -113,16 +358,134 @@ static bool get_next_batch(cJSON *j, char *batch);
 /** Main request/response loop in filter mode. */
 static bool filter(const struct config *config, char *batch);
 
+/** Handles a single line in filter mode, writing responses to `out`. */
+static bool filter_line(
+    const struct config *config, const char *line, char *batch,
+    size_t user_len, FILE *out);
+
+/**
+ * Filter mode using \ref config::jobs worker threads.
+ * Output is identical to that of \ref filter.
+ */
+static bool filter_parallel(const struct config *config);
+
+/** Reader stage for \ref filter_parallel. */
+static enum mtrix_pipeline_read filter_read(
+    void *data, struct mtrix_pipeline_item *item);
+
+/** Worker stage for \ref filter_parallel. */
+static bool filter_process(void *data, struct mtrix_pipeline_item *item);
+
+/** Writer stage for \ref filter_parallel. */
+static bool filter_write(void *data, struct mtrix_pipeline_item *item);
+
 /** Main request/response loop. */
 static bool loop(const struct config *config, char *batch);
 
+/** Performs one synchronization request and handles its events. */
+static enum sync_result sync_once(
+    const struct config *config, struct mtrix_request *r, const char *url,
+    struct mtrix_buffer *buffer, char *batch, size_t user_len,
+    struct backfill *bf);
+
+/**
+ * Synchronizes using a limited timeline, backfilling the gaps.
+ * Used when the regular response exceeds \ref config::max_sync.  Skips the
+ * events with \ref sync_skip if the limited response does too, since the same
+ * request would otherwise be repeated forever.
+ */
+static enum sync_result sync_paged(
+    const struct config *config, struct mtrix_request *r,
+    struct mtrix_buffer *buffer, char *batch, size_t user_len,
+    struct backfill *bf);
+
+/**
+ * Advances `batch` without handling the events received since it.
+ * Only the next token is requested, as in \ref init_batch.  The skipped range
+ * is logged and counted in \ref metrics.
+ */
+static enum sync_result sync_skip(
+    const struct config *config, struct mtrix_request *r,
+    struct mtrix_buffer *buffer, char *batch);
+
+/**
+ * Handles a `/sync` response and updates `batch`.
+ * Rooms whose timelines were limited are queued in `bf`.  `batch` is only
+ * updated once all rooms have been handled.
+ */
+static bool handle_sync(
+    const struct config *config, const char *s, char *batch, size_t user_len,
+    struct backfill *bf);
+
+/** Queues the gaps between `since` and limited timelines in `root`. */
+static void queue_gaps(
+    struct backfill *bf, const cJSON *root, const char *since);
+
+/** Initializes the queue and starts the backfill thread. */
+static bool backfill_start(
+    struct backfill *bf, const struct config *config, size_t user_len);
+
+/** Stops the backfill thread, abandoning pending jobs. */
+static void backfill_stop(struct backfill *bf);
+
+/**
+ * Queues a gap to be backfilled.
+ * Waits for the backfill thread if the queue is full, so that no gap is
+ * dropped.
+ */
+static void backfill_push(
+    struct backfill *bf, const char *room, const char *from, const char *to);
+
+/** Main function of the backfill thread. */
+static void *backfill_thread(void *data);
+
+/**
+ * Fetches and handles one page of events of a backfill job.
+ * Events are requested in pages of \ref PAGE_LIMIT_STR, oldest first.
+ */
+static enum backfill_result backfill_page(
+    struct backfill *bf, struct mtrix_request *r,
+    struct mtrix_buffer *buffer, struct backfill_job *job);
+
+/**
+ * Moves the first job which is due to the head of the queue.
+ * Jobs before it go to the back.  Called with the mutex locked.
+ * \param wait Set to the earliest time a job is due if none is.
+ * \return Whether a job is due.
+ */
+static bool backfill_next(struct backfill *bf, struct timespec *wait);
+
+/**
+ * Delays a job after a failed request, see \ref BACKFILL_RETRY_MS and
+ * \ref backfill_job::due.
+ */
+static void backfill_retry(const struct backfill *bf, struct backfill_job *job);
+
+/** Updates the peak response size. */
+static void track_peak(const struct config *config, size_t n);
+
+/** Records a failure and sleeps for a jittered, exponential delay. */
+static void backoff_wait(const struct config *config, struct backoff *b);
+
+/** Ends the current error burst, if any, recording its duration. */
+static void backoff_reset(const struct config *config, struct backoff *b);
+
+/** Milliseconds elapsed since \p t (monotonic). */
+static long elapsed_ms(const struct timespec *t);
+
 /** Parses a string as JSON. */
 static cJSON *parse_json(const char *s);
 
 /** Handles a single request. */
 static bool handle_request(
     const struct config *config, cJSON *root, size_t user_len,
-    bool (*send_msg)(const struct config*, const char*, const char*));
+    send_msg_f *send_msg, void *data);
+
+/** Handles the timeline events of a single room. */
+static bool handle_events(
+    const struct config *config, const char *room, const cJSON *events,
+    size_t user_len,
+    send_msg_f *send_msg, void *data);
 
 /** Checks that an event has the expected type. */
 static bool check_event_type(const cJSON *event, const char *value);
@@ -136,28 +499,45 @@ static const char *event_sender(const cJSON *event);
 /** Checks if the a user was mentioned. */
 static bool check_mention(const char *text, const char *user);
 
+/** Creates a pipe with `FD_CLOEXEC` set on both ends. */
+static bool make_pipe(int fds[2]);
+
 /** Invokes the main program. */
 static bool process_input(
     const struct config *config,
     const char *input, struct mtrix_buffer *output);
 
-/** Prints a message to stdout. */
-static bool print_msg(
-    const struct config *config, const char *room, const char *msg);
+/** Similar to \ref process_input, but uses the daemon in `--connect`. */
+static bool process_remote(
+    const struct config *config,
+    const char *input, struct mtrix_buffer *output);
+
+/** Prints a message to the `FILE*` in `data`. */
+static send_msg_f print_msg;
 
 /** Sends a message to the room. */
-static bool send_msg(
-    const struct config *config, const char *room, const char *msg);
+static send_msg_f send_msg;
 
 /** Consumes all output from `f`, appending it to `buf`. */
 static bool read_output(FILE *f, struct mtrix_buffer *buf);
 
+/**
+ * Similar to \ref read_output, but gives up after `timeout_ms`.
+ * \param timed_out Set if the timeout expired before the end of the output.
+ */
+static bool read_output_timeout(
+    int fd, int timeout_ms, struct mtrix_buffer *buf, bool *timed_out);
+
 int main(int argc, const char *const *argv) {
     log_set(stderr);
     PROG_NAME = argv[0];
-    struct config config = {0};
+    struct config config = {
+        .max_sync = DEFAULT_MAX_SYNC,
+        .jobs = 1,
+    };
     if(!parse_args(&argc, &argv, &config))
         return 1;
+    struct mtrix_metrics_server metrics_server = {.fd = -1};
     bool ret = false;
     if(config.c.flags & MTRIX_CONFIG_HELP) {
         usage(stdout);
@@ -180,6 +560,8 @@ int main(int argc, const char *const *argv) {
         log_err("using server: %s\n", config.c.server);
         log_err("using user: %s\n", config.c.user);
     }
+    if(!start_metrics(&config, &metrics_server))
+        goto end;
     char batch[MAX_BATCH];
     if(*config.c.batch) {
         assert(strlen(config.c.batch) < sizeof(batch));
@@ -194,12 +576,22 @@ int main(int argc, const char *const *argv) {
         goto end;
     ret = true;
 end:
+    if(metrics_server.fd != -1) {
+        ret = mtrix_metrics_server_stop(&metrics_server) && ret;
+        if(*config.metrics_unix && unlink(config.metrics_unix) == -1) {
+            log_errno("unlink: %s", config.metrics_unix);
+            ret = false;
+        }
+    }
     config_destroy(&config);
     return !ret;
 }
 
 bool parse_args(int *argc, const char *const **argv, struct config *config) {
-    enum { HELP, VERBOSE, DRY, SERVER, USER, TOKEN, BATCH, FILTER };
+    enum {
+        HELP, VERBOSE, DRY, SERVER, USER, TOKEN, BATCH, FILTER, MAX_SYNC,
+        JOBS, CMD_TIMEOUT, METRICS, CONNECT,
+    };
     static const char *short_opts = "hvn";
     static const struct option long_opts[] = {
         [HELP] = {"help", no_argument, 0, 'h'},
@@ -210,6 +602,11 @@ bool parse_args(int *argc, const char *const **argv, struct config *config) {
         [TOKEN] = {"token", required_argument, 0, 0},
         [BATCH] = {"batch", required_argument, 0, 0},
         [FILTER] = {"filter", no_argument, 0, 0},
+        [MAX_SYNC] = {"max-sync-size", required_argument, 0, 0},
+        [JOBS] = {"jobs", required_argument, 0, 0},
+        [CMD_TIMEOUT] = {"timeout", required_argument, 0, 0},
+        [METRICS] = {"metrics", required_argument, 0, 0},
+        [CONNECT] = {"connect", required_argument, 0, 0},
         {0},
     };
     for(;;) {
@@ -253,6 +650,43 @@ bool parse_args(int *argc, const char *const **argv, struct config *config) {
             break;
         }
         case FILTER: config->flags |= FILTER_FLAG; break;
+        case MAX_SYNC: {
+            const int64_t n = parse_i64(optarg);
+            if(n == -1)
+                return false;
+            config->max_sync = (size_t)n;
+            break;
+        }
+        case JOBS: {
+            const int64_t n = parse_i64(optarg);
+            if(n == -1)
+                return false;
+            if(!n)
+                return log_err("invalid number of jobs: 0\n"), false;
+            config->jobs = (size_t)n;
+            break;
+        }
+        case CMD_TIMEOUT: {
+            const int64_t n = parse_i64(optarg);
+            if(n == -1)
+                return false;
+            if(n > INT_MAX / 1000)
+                return log_err("timeout too large: %s\n", optarg), false;
+            config->cmd_timeout_ms = (int)n * 1000;
+            break;
+        }
+        case METRICS:
+            if(!parse_addr_arg(
+                    "metrics socket", optarg,
+                    config->metrics_socket, config->metrics_unix))
+                return false;
+            break;
+        case CONNECT:
+            if(!parse_addr_arg(
+                    "daemon socket", optarg,
+                    config->daemon_socket, config->daemon_unix))
+                return false;
+            break;
         default: return false;
         }
     }
@@ -277,11 +711,58 @@ void usage(FILE *f) {
         "        --batch  <arg>     matrix batch file\n"
         "        --filter           read message lines from stdin, write\n"
         "                           responses to stdout\n"
+        "        --max-sync-size <bytes>\n"
+        "                           maximum response size, larger updates\n"
+        "                           are paginated, and skipped if still\n"
+        "                           too large (default: 8MiB, 0: none)\n"
+        "        --jobs <n>         number of worker threads in filter mode\n"
+        "        --timeout <s>      time limit for each command (default:\n"
+        "                           0: none)\n"
+        "        --metrics <addr>   serve metrics on `addr` (`host:port`),\n"
+        "                           prefix path with `unix:` to use a Unix\n"
+        "                           domain socket\n"
+        "        --connect <addr>   execute commands using a daemon started\n"
+        "                           with `machinatrix --listen <addr>`\n"
         "\n"
         "Additional positional arguments are forwarded to `machinatrix`.\n",
         PROG_NAME);
 }
 
+bool parse_addr_arg(
+    const char *name, const char *arg, char *socket, char *unix
+) {
+    const char prefix[] = "unix:";
+    char *dst = socket;
+    if(strncmp(arg, prefix, sizeof(prefix) - 1) == 0) {
+        arg += sizeof(prefix) - 1;
+        dst = unix;
+    }
+    *socket = *unix = 0;
+    struct mtrix_buffer b = {.p = dst, .n = MTRIX_MAX_PATH};
+    return copy_arg(name, b, arg);
+}
+
+bool start_metrics(
+    const struct config *config, struct mtrix_metrics_server *s
+) {
+    static const struct mtrix_metrics m = {
+        .counters = metrics_counters,
+        .histograms = metrics_histograms,
+    };
+    int fd = -1;
+    if(*config->metrics_socket)
+        fd = mtrix_socket_listen(config->metrics_socket, METRICS_BACKLOG);
+    else if(*config->metrics_unix)
+        fd = mtrix_socket_listen_unix(config->metrics_unix, METRICS_BACKLOG);
+    else
+        return true;
+    if(fd == -1 || !mtrix_metrics_server_start(s, &m, fd)) {
+        s->fd = -1;
+        return false;
+    }
+    return true;
+}
+
 inline cJSON *get_item(const cJSON *j, const char *k) {
     return cJSON_GetObjectItemCaseSensitive(j, k);
 }
@@ -365,9 +846,9 @@ void config_verbose(const struct config *config, const char *fmt, ...) {
 bool init_batch(const struct config *config, char *batch) {
     char url[MTRIX_MAX_URL_LEN];
     // TODO use Authorization header
-    if(!BUILD_MATRIX_URL(&config->c, url, SYNC_URL "?" ROOM_FILTER "&"))
+    if(!BUILD_MATRIX_URL(&config->c, url, SYNC_URL "?" INIT_FILTER "&"))
         return false;
-    struct mtrix_buffer buffer = {NULL, 0};
+    struct mtrix_buffer buffer = {.max = config->max_sync};
     if(!request(url, &buffer, mtrix_config_verbose(&config->c))) {
         free(buffer.p);
         return false;
@@ -406,9 +887,10 @@ bool get_next_batch(cJSON *j, char *batch) {
 }
 
 bool filter(const struct config *config, char *batch) {
+    if(config->jobs > 1)
+        return filter_parallel(config);
     const size_t user_len = strlen(config->c.short_user);
     struct mtrix_buffer buffer = {0};
-    cJSON *req = NULL;
     bool ret = false;
     for(;;) {
         if(getline(&buffer.p, &buffer.n, stdin) == -1) {
@@ -418,92 +900,510 @@ bool filter(const struct config *config, char *batch) {
                 ret = true;
             break;
         }
-        if(!(req = parse_json(buffer.p)))
-            break;
-        if(!get_next_batch(req, batch))
-            break;
-        if(!handle_request(config, req, user_len, print_msg))
+        if(!filter_line(config, buffer.p, batch, user_len, stdout))
             break;
     }
     free(buffer.p);
+    return ret;
+}
+
+bool filter_line(
+    const struct config *config, const char *line, char *batch,
+    size_t user_len, FILE *out
+) {
+    cJSON *const req = parse_json(line);
+    if(!req)
+        return false;
+    const bool ret = get_next_batch(req, batch)
+        && handle_request(config, req, user_len, print_msg, out);
     cJSON_Delete(req);
     return ret;
 }
 
+bool filter_parallel(const struct config *config) {
+    const struct mtrix_pipeline p = {
+        .n_workers = config->jobs,
+        // Only used in the worker stage, which does not modify it.
+        .data = (void*)config,
+        .read = filter_read,
+        .process = filter_process,
+        .write = filter_write,
+    };
+    return mtrix_pipeline_run(&p);
+}
+
+enum mtrix_pipeline_read filter_read(
+    void *data, struct mtrix_pipeline_item *item
+) {
+    (void)data;
+    if(getline(&item->in.p, &item->in.n, stdin) != -1)
+        return MTRIX_PIPELINE_ITEM;
+    if(!ferror(stdin))
+        return MTRIX_PIPELINE_END;
+    log_errno("getline");
+    return MTRIX_PIPELINE_ERR;
+}
+
+bool filter_process(void *data, struct mtrix_pipeline_item *item) {
+    const struct config *const config = data;
+    FILE *const out = open_memstream(&item->out.p, &item->out.n);
+    if(!out)
+        return log_errno("open_memstream"), false;
+    // Each line carries its own batch, which is only validated here.
+    char batch[MAX_BATCH];
+    const size_t user_len = strlen(config->c.short_user);
+    bool ret = filter_line(config, item->in.p, batch, user_len, out);
+    if(fclose(out) == EOF) {
+        log_errno("fclose");
+        ret = false;
+    }
+    return ret;
+}
+
+bool filter_write(void *data, struct mtrix_pipeline_item *item) {
+    (void)data;
+    const size_t n = item->out.n;
+    if(n && fwrite(item->out.p, 1, n, stdout) != n)
+        return log_errno("fwrite"), false;
+    return item->ok;
+}
+
 bool loop(const struct config *config, char *batch) {
     char url[MTRIX_MAX_URL_LEN];
     const char *const root = SYNC_URL "?" TIMEOUT_PARAM "&since=";
     const char *const url_parts[] =
         {URL_PARTS(&config->c, root, batch, "&"), NULL};
-    if(!build_url(url, url_parts))
-        return false;
     const size_t user_len = strlen(config->c.short_user);
-    struct mtrix_buffer buffer = {0};
-    cJSON *req = NULL;
+    struct mtrix_request r = {0};
+    struct mtrix_buffer buffer = {.max = config->max_sync};
+    struct backoff backoff = {0};
+    struct backfill bf;
+    if(!backfill_start(&bf, config, user_len))
+        return false;
+    mtrix_rng_init(&backoff.rng);
     for(;;) {
         const time_t start = time(NULL);
+        // `batch` is only updated on success, failed requests are retried
+        // with the same `since` token.
         if(!build_url(url, url_parts))
-            return false;
-        buffer.n = 0;
-        if(!request(url, &buffer, mtrix_config_verbose(&config->c)))
-            break;
-        if(!(req = parse_json(buffer.p)))
-            break;
-        if(!get_next_batch(req, batch))
-            break;
-        if(!handle_request(config, req, user_len, send_msg))
             break;
+        const enum sync_result s =
+            sync_once(config, &r, url, &buffer, batch, user_len, &bf);
+        if(s == SYNC_RETRY) {
+            backoff_wait(config, &backoff);
+            continue;
+        }
+        backoff_reset(config, &backoff);
         const time_t dt = time(NULL) - start;
         config_verbose(config, "elapsed: %lds\n", dt);
     }
+    backfill_stop(&bf);
     free(buffer.p);
-    cJSON_Delete(req);
+    mtrix_request_destroy(&r);
     return false;
 }
 
+enum sync_result sync_once(
+    const struct config *config, struct mtrix_request *r, const char *url,
+    struct mtrix_buffer *buffer, char *batch, size_t user_len,
+    struct backfill *bf
+) {
+    buffer->n = 0;
+    const bool verbose = mtrix_config_verbose(&config->c);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const bool ok = request_keep(r, url, buffer, verbose);
+    mtrix_histogram_observe(
+        &metrics.sync_time, (unsigned long)elapsed_ms(&start));
+    mtrix_counter_inc(&metrics.syncs);
+    track_peak(config, buffer->n);
+    if(!ok) {
+        if(!mtrix_buffer_full(buffer))
+            return SYNC_RETRY;
+        log_err("synchronization response too large, paginating\n");
+        return sync_paged(config, r, buffer, batch, user_len, bf);
+    }
+    return handle_sync(config, buffer->p, batch, user_len, bf)
+        ? SYNC_OK : SYNC_RETRY;
+}
+
+enum sync_result sync_paged(
+    const struct config *config, struct mtrix_request *r,
+    struct mtrix_buffer *buffer, char *batch, size_t user_len,
+    struct backfill *bf
+) {
+    const bool verbose = mtrix_config_verbose(&config->c);
+    char url[MTRIX_MAX_URL_LEN];
+    if(!BUILD_MATRIX_URL(
+        &config->c, url, SYNC_URL "?" PAGE_FILTER "&since=", batch, "&"
+    ))
+        return SYNC_RETRY;
+    buffer->n = 0;
+    const bool ok = request_keep(r, url, buffer, verbose);
+    track_peak(config, buffer->n);
+    if(!ok) {
+        if(!mtrix_buffer_full(buffer))
+            return SYNC_RETRY;
+        log_err(
+            "limited synchronization response exceeds --max-sync-size "
+            "(%zu bytes)\n", config->max_sync);
+        return sync_skip(config, r, buffer, batch);
+    }
+    return handle_sync(config, buffer->p, batch, user_len, bf)
+        ? SYNC_OK : SYNC_RETRY;
+}
+
+enum sync_result sync_skip(
+    const struct config *config, struct mtrix_request *r,
+    struct mtrix_buffer *buffer, char *batch
+) {
+    char url[MTRIX_MAX_URL_LEN];
+    if(!BUILD_MATRIX_URL(
+        &config->c, url, SYNC_URL "?" INIT_FILTER "&since=", batch, "&"
+    ))
+        return SYNC_RETRY;
+    buffer->n = 0;
+    if(!request_keep(r, url, buffer, mtrix_config_verbose(&config->c)))
+        return SYNC_RETRY;
+    cJSON *const root = parse_json(buffer->p);
+    if(!root)
+        return SYNC_RETRY;
+    char next[MAX_BATCH];
+    const bool ret = get_next_batch(root, next);
+    cJSON_Delete(root);
+    if(!ret)
+        return SYNC_RETRY;
+    log_err("skipping events from %s to %s\n", batch, next);
+    mtrix_counter_inc(&metrics.sync_skipped);
+    strcpy(batch, next);
+    return SYNC_OK;
+}
+
+bool handle_sync(
+    const struct config *config, const char *s, char *batch, size_t user_len,
+    struct backfill *bf
+) {
+    cJSON *const root = parse_json(s);
+    if(!root)
+        return false;
+    char next[MAX_BATCH];
+    const bool ret = get_next_batch(root, next);
+    if(ret) {
+        queue_gaps(bf, root, batch);
+        handle_request(config, root, user_len, send_msg, NULL);
+        strcpy(batch, next);
+    }
+    cJSON_Delete(root);
+    return ret;
+}
+
+void queue_gaps(struct backfill *bf, const cJSON *root, const char *since) {
+    const cJSON *const join = get_item(get_item(root, "rooms"), "join");
+    const cJSON *room = NULL;
+    cJSON_ArrayForEach(room, join) {
+        const cJSON *const timeline = get_item(room, "timeline");
+        if(!cJSON_IsTrue(get_item(timeline, "limited")))
+            continue;
+        const cJSON *const prev = get_item(timeline, "prev_batch");
+        if(!cJSON_IsString(prev))
+            continue;
+        config_verbose(bf->config, "timeline limited: %s\n", room->string);
+        backfill_push(bf, room->string, since, prev->valuestring);
+    }
+}
+
+bool backfill_start(
+    struct backfill *bf, const struct config *config, size_t user_len
+) {
+    *bf = (struct backfill){
+        .config = config,
+        .user_len = user_len,
+        .jobs = calloc(BACKFILL_MAX_JOBS, sizeof(*bf->jobs)),
+        .mtx = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .space = PTHREAD_COND_INITIALIZER,
+    };
+    if(!bf->jobs)
+        return log_err("%s: calloc\n", __func__), false;
+    const int e = pthread_create(&bf->thread, NULL, backfill_thread, bf);
+    if(e) {
+        log_err("%s: pthread_create: %s\n", __func__, strerror(e));
+        free(bf->jobs);
+        return false;
+    }
+    return true;
+}
+
+void backfill_stop(struct backfill *bf) {
+    pthread_mutex_lock(&bf->mtx);
+    bf->stop = true;
+    pthread_cond_signal(&bf->cond);
+    pthread_mutex_unlock(&bf->mtx);
+    pthread_join(bf->thread, NULL);
+    free(bf->jobs);
+}
+
+void backfill_push(
+    struct backfill *bf, const char *room, const char *from, const char *to
+) {
+    struct backfill_job job = {0};
+    if(strlen(room) >= sizeof(job.room)
+            || strlen(from) >= sizeof(job.from)
+            || strlen(to) >= sizeof(job.to)) {
+        log_err("%s: identifier too long, skipping: %s\n", __func__, room);
+        mtrix_counter_inc(&metrics.backfill_truncated);
+        return;
+    }
+    strcpy(job.room, room);
+    strcpy(job.from, from);
+    strcpy(job.to, to);
+    pthread_mutex_lock(&bf->mtx);
+    if(bf->n == BACKFILL_MAX_JOBS)
+        config_verbose(bf->config, "backfill queue full, waiting\n");
+    while(bf->n == BACKFILL_MAX_JOBS)
+        pthread_cond_wait(&bf->space, &bf->mtx);
+    bf->jobs[(bf->head + bf->n++) % BACKFILL_MAX_JOBS] = job;
+    pthread_cond_signal(&bf->cond);
+    pthread_mutex_unlock(&bf->mtx);
+}
+
+void *backfill_thread(void *data) {
+    struct backfill *const bf = data;
+    struct mtrix_request r = {0};
+    struct mtrix_buffer buffer = {.max = bf->config->max_sync};
+    struct backfill_job job;
+    pthread_mutex_lock(&bf->mtx);
+    for(;;) {
+        while(!bf->stop && !bf->n)
+            pthread_cond_wait(&bf->cond, &bf->mtx);
+        if(bf->stop)
+            break;
+        struct timespec t;
+        if(!backfill_next(bf, &t)) {
+            // Also woken up by new jobs, which are due immediately.
+            pthread_cond_timedwait(&bf->cond, &bf->mtx, &t);
+            continue;
+        }
+        // The job keeps its place while it is served, so that it can always
+        // be put back.
+        job = bf->jobs[bf->head];
+        pthread_mutex_unlock(&bf->mtx);
+        enum backfill_result result = backfill_page(bf, &r, &buffer, &job);
+        if(result == BACKFILL_MORE) {
+            job.failures = 0;
+            job.due = (struct timespec){0};
+        } else if(
+            result == BACKFILL_RETRY
+            && ++job.failures == BACKFILL_MAX_FAILURES
+        ) {
+            log_err(
+                "backfill failed %u times, abandoning gap in %s\n",
+                job.failures, job.room);
+            mtrix_counter_inc(&metrics.backfill_truncated);
+            result = BACKFILL_DONE;
+        } else if(result == BACKFILL_RETRY)
+            backfill_retry(bf, &job);
+        pthread_mutex_lock(&bf->mtx);
+        // Unfinished jobs go to the back of the queue, one page at a time.
+        if(result != BACKFILL_DONE)
+            bf->jobs[(bf->head + bf->n) % BACKFILL_MAX_JOBS] = job;
+        else {
+            --bf->n;
+            pthread_cond_signal(&bf->space);
+        }
+        bf->head = (bf->head + 1) % BACKFILL_MAX_JOBS;
+    }
+    pthread_mutex_unlock(&bf->mtx);
+    free(buffer.p);
+    mtrix_request_destroy(&r);
+    return NULL;
+}
+
+enum backfill_result backfill_page(
+    struct backfill *bf, struct mtrix_request *r,
+    struct mtrix_buffer *buffer, struct backfill_job *job
+) {
+    const struct config *const config = bf->config;
+    char url[MTRIX_MAX_URL_LEN];
+    if(!BUILD_MATRIX_URL(
+        &config->c, url, ROOMS_URL "/", job->room,
+        MESSAGES_URL "?dir=f&limit=" PAGE_LIMIT_STR "&from=", job->from,
+        "&to=", job->to, "&"
+    )) {
+        mtrix_counter_inc(&metrics.backfill_truncated);
+        return BACKFILL_DONE;
+    }
+    buffer->n = 0;
+    if(!request_keep(r, url, buffer, mtrix_config_verbose(&config->c))) {
+        log_err("failed to backfill room %s\n", job->room);
+        return BACKFILL_RETRY;
+    }
+    mtrix_counter_inc(&metrics.backfill_pages);
+    cJSON *const root = parse_json(buffer->p);
+    if(!root)
+        return BACKFILL_RETRY;
+    const cJSON *const chunk = get_item(root, "chunk");
+    const cJSON *const end = get_item(root, "end");
+    handle_events(config, job->room, chunk, bf->user_len, send_msg, NULL);
+    bool more = cJSON_GetArraySize(chunk)
+        && cJSON_IsString(end)
+        && strcmp(end->valuestring, job->to) != 0;
+    if(more) {
+        if(strlen(end->valuestring) >= sizeof(job->from)) {
+            log_err("len(end) >= MAX_BATCH\n");
+            mtrix_counter_inc(&metrics.backfill_truncated);
+            more = false;
+        } else
+            strcpy(job->from, end->valuestring);
+    }
+    cJSON_Delete(root);
+    if(more && ++job->pages == BACKFILL_MAX_PAGES) {
+        log_err("backfill limit reached, abandoning gap in %s\n", job->room);
+        mtrix_counter_inc(&metrics.backfill_truncated);
+        more = false;
+    }
+    return more ? BACKFILL_MORE : BACKFILL_DONE;
+}
+
+bool backfill_next(struct backfill *bf, struct timespec *wait) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for(size_t i = 0; i != bf->n; ++i) {
+        const struct timespec *const t =
+            &bf->jobs[(bf->head + i) % BACKFILL_MAX_JOBS].due;
+        const bool due = t->tv_sec < now.tv_sec
+            || (t->tv_sec == now.tv_sec && t->tv_nsec <= now.tv_nsec);
+        if(due) {
+            for(; i; --i) {
+                bf->jobs[(bf->head + bf->n) % BACKFILL_MAX_JOBS] =
+                    bf->jobs[bf->head];
+                bf->head = (bf->head + 1) % BACKFILL_MAX_JOBS;
+            }
+            return true;
+        }
+        if(!i || t->tv_sec < wait->tv_sec
+                || (t->tv_sec == wait->tv_sec && t->tv_nsec < wait->tv_nsec))
+            *wait = *t;
+    }
+    return false;
+}
+
+void backfill_retry(const struct backfill *bf, struct backfill_job *job) {
+    const long ms = BACKFILL_RETRY_MS << (job->failures - 1);
+    config_verbose(
+        bf->config, "retrying backfill of %s in %ldms\n", job->room, ms);
+    struct timespec *const t = &job->due;
+    clock_gettime(CLOCK_REALTIME, t);
+    t->tv_sec += ms / 1000 + (t->tv_nsec + ms % 1000 * 1000000) / 1000000000;
+    t->tv_nsec = (t->tv_nsec + ms % 1000 * 1000000) % 1000000000;
+}
+
+void track_peak(const struct config *config, size_t n) {
+    if(mtrix_counter_max(&metrics.peak_size, n))
+        config_verbose(config, "peak response size: %zu\n", n);
+}
+
+void backoff_wait(const struct config *config, struct backoff *b) {
+    mtrix_counter_inc(&metrics.sync_errors);
+    if(!b->failures++) {
+        mtrix_counter_inc(&metrics.sync_bursts);
+        clock_gettime(CLOCK_MONOTONIC, &b->burst_start);
+    }
+    const unsigned shift = b->failures - 1;
+    long max = BACKOFF_MAX_MS;
+    if(shift < 16 && (BACKOFF_BASE_MS << shift) < BACKOFF_MAX_MS)
+        max = BACKOFF_BASE_MS << shift;
+    // "Equal jitter": half of the delay is fixed, the other half random.
+    const long ms =
+        max / 2 + (long)mtrix_rng_below(&b->rng, (uint64_t)(max / 2 + 1));
+    log_err(
+        "synchronization failed (%u consecutive), retrying in %ldms\n",
+        b->failures, ms);
+    struct timespec t = {.tv_sec = ms / 1000, .tv_nsec = ms % 1000 * 1000000};
+    while(nanosleep(&t, &t) == -1 && errno == EINTR);
+    config_verbose(
+        config, "sync errors: %lu, bursts: %lu\n",
+        mtrix_counter_get(&metrics.sync_errors),
+        mtrix_counter_get(&metrics.sync_bursts));
+}
+
+void backoff_reset(const struct config *config, struct backoff *b) {
+    if(!b->failures)
+        return;
+    const long ms = elapsed_ms(&b->burst_start);
+    mtrix_counter_set(&metrics.last_recovery_ms, (unsigned long)ms);
+    mtrix_counter_max(&metrics.max_recovery_ms, (unsigned long)ms);
+    log_err(
+        "synchronization recovered after %u failure(s) in %ldms\n",
+        b->failures, ms);
+    config_verbose(
+        config, "max recovery time: %lums\n",
+        mtrix_counter_get(&metrics.max_recovery_ms));
+    b->failures = 0;
+}
+
+long elapsed_ms(const struct timespec *t) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - t->tv_sec) * 1000
+        + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
 bool handle_request(
     const struct config *config, cJSON *root, size_t user_len,
-    bool (*send_msg)(const struct config*, const char*, const char*)
+    send_msg_f *send_msg, void *data
 ) {
-    bool ret = true;
     const cJSON *const join = get_item(get_item(root, "rooms"), "join");
     const cJSON *room = NULL;
     cJSON_ArrayForEach(room, join) {
         const cJSON *events = get_item(get_item(room, "timeline"), "events");
-        const cJSON *event = NULL;
-        cJSON_ArrayForEach(event, events) {
-            if(!check_event_type(event, "m.room.message"))
-                continue;
-            const char *const text = event_body(event);
-            if(!text)
-                continue;
-            const char *const sender = event_sender(event);
-            if(!sender) {
-                config_verbose(
-                    config, "skipping message without sender: %s\n", text);
-                continue;
-            }
-            config_verbose(config, "message (from %s): %s\n", sender, text);
-            if(strcmp(sender, config->c.user) == 0) {
-                config_verbose(config, "skipping message from self\n");
-                continue;
-            }
-            if(!check_mention(text, config->c.short_user)) {
-                config_verbose(config, "skipping message: not mentioned\n");
-                continue;
-            }
-            struct mtrix_buffer output = {0};
-            if(!process_input(config, text + user_len + 1, &output)) {
-                ret = false;
-                continue;
-            }
-            ret = send_msg(config, room->string, output.p) && ret;
-            free(output.p);
-        }
+        handle_events(
+            config, room->string, events, user_len, send_msg, data);
     }
     return true;
 }
 
+bool handle_events(
+    const struct config *config, const char *room, const cJSON *events,
+    size_t user_len,
+    send_msg_f *send_msg, void *data
+) {
+    bool ret = true;
+    const cJSON *event = NULL;
+    cJSON_ArrayForEach(event, events) {
+        mtrix_counter_inc(&metrics.events);
+        if(!check_event_type(event, "m.room.message"))
+            continue;
+        const char *const text = event_body(event);
+        if(!text)
+            continue;
+        const char *const sender = event_sender(event);
+        if(!sender) {
+            config_verbose(
+                config, "skipping message without sender: %s\n", text);
+            continue;
+        }
+        config_verbose(config, "message (from %s): %s\n", sender, text);
+        if(strcmp(sender, config->c.user) == 0) {
+            config_verbose(config, "skipping message from self\n");
+            continue;
+        }
+        if(!check_mention(text, config->c.short_user)) {
+            config_verbose(config, "skipping message: not mentioned\n");
+            continue;
+        }
+        mtrix_counter_inc(&metrics.mentions);
+        struct mtrix_buffer output = {0};
+        if(!process_input(config, text + user_len + 1, &output)) {
+            ret = false;
+            continue;
+        }
+        ret = send_msg(config, data, room, output.p) && ret;
+        free(output.p);
+    }
+    return ret;
+}
+
 cJSON *parse_json(const char *s) {
     cJSON *const j = cJSON_Parse(s);
     if(!j) {
@@ -540,21 +1440,36 @@ bool check_mention(const char *text, const char *user) {
     return colon && *colon == ':';
 }
 
+bool make_pipe(int fds[2]) {
+    if(pipe(fds) == -1)
+        return log_errno("pipe"), false;
+    for(int i = 0; i < 2; ++i)
+        if(fcntl(fds[i], F_SETFD, FD_CLOEXEC) == -1)
+            return log_errno("fcntl(FD_CLOEXEC)"), false;
+    return true;
+}
+
 bool process_input(
     const struct config *config, const char *input, struct mtrix_buffer *output
 ) {
+    if(*config->daemon_socket || *config->daemon_unix)
+        return process_remote(config, input, output);
     int in[2] = {-1, -1}, out[2] = {-1, -1}, err[2] = {-1, -1};
     FILE *child_in = NULL, *child_out = NULL, *child_err = NULL;
     struct mtrix_buffer msg = {0};
-    bool ret = false;
-    if(pipe(in) == -1) { log_errno("pipe"); goto cleanup; }
-    if(pipe(out) == -1) { log_errno("pipe"); goto cleanup; }
-    if(pipe(err) == -1) { log_errno("pipe"); goto cleanup; }
-    pid_t pid = fork();
+    // Counted once, whether the command fails or cannot be executed.
+    bool ret = false, failed = false;
+    pthread_mutex_lock(&fork_lock);
+    const bool pipes = make_pipe(in) && make_pipe(out) && make_pipe(err);
+    pid_t pid = pipes ? fork() : -1;
+    pthread_mutex_unlock(&fork_lock);
+    if(!pipes)
+        goto cleanup;
     if(pid == -1) {
         log_errno("fork");
         goto cleanup;
     }
+    mtrix_counter_inc(&metrics.cmds);
     if(!pid) {
         close(in[1]);
         close(out[0]);
@@ -586,9 +1501,22 @@ bool process_input(
     }
     child_in = 0;
     in[1] = -1;
-    if(!read_output(child_out, &msg))
+    bool timed_out = false;
+    if(!read_output_timeout(
+            out[0], config->cmd_timeout_ms, &msg, &timed_out))
         goto cleanup;
-    if(!wait_n(1, &pid)) {
+    if(timed_out) {
+        log_err("command timed out: %s\n", input);
+        mtrix_counter_inc(&metrics.cmd_timeouts);
+        if(kill(pid, SIGKILL) == -1)
+            log_errno("kill");
+        wait_n(1, &pid);
+        free(msg.p);
+        msg = (struct mtrix_buffer){0};
+        const char err[] = "error: command timed out\n";
+        mtrix_buffer_append(err, 1, sizeof(err) - 1, &msg);
+    } else if(!wait_n(1, &pid)) {
+        failed = true;
         free(msg.p);
         msg = (struct mtrix_buffer){0};
         const char err[] = "error: ";
@@ -625,17 +1553,67 @@ cleanup:
         log_errno("close");
         ret = false;
     }
+    if((failed || !ret) && pid > 0)
+        mtrix_counter_inc(&metrics.cmd_failures);
     *output = msg;
     return ret;
 }
 
-bool print_msg(const struct config *config, const char *room, const char *msg) {
+bool process_remote(
+    const struct config *config, const char *input, struct mtrix_buffer *output
+) {
+    const int fd = *config->daemon_socket
+        ? mtrix_socket_connect(config->daemon_socket)
+        : mtrix_socket_connect_unix(config->daemon_unix);
+    if(fd == -1)
+        return mtrix_counter_inc(&metrics.cmd_failures), false;
+    struct mtrix_daemon_output o = {0};
+    bool ret = false;
+    if(!mtrix_daemon_send(fd, input))
+        goto end;
+    mtrix_counter_inc(&metrics.cmds);
+    // The timeout covers the entire response, which may arrive slowly.
+    bool timed_out = false;
+    if(!mtrix_daemon_recv_timeout(fd, &o, config->cmd_timeout_ms, &timed_out))
+        goto end;
+    if(timed_out) {
+        log_err("command timed out: %s\n", input);
+        mtrix_counter_inc(&metrics.cmd_timeouts);
+        const char err[] = "error: command timed out\n";
+        mtrix_buffer_append(err, 1, sizeof(err) - 1, output);
+        ret = true;
+        goto end;
+    }
+    if(o.status) {
+        mtrix_counter_inc(&metrics.cmd_failures);
+        const char err[] = "error: ";
+        mtrix_buffer_append(err, 1, sizeof(err) - 1, output);
+        mtrix_buffer_append(o.err.p, 1, o.err.n, output);
+    } else
+        *output = o.out, o.out = (struct mtrix_buffer){0};
+    ret = true;
+end:
+    if(!ret)
+        mtrix_counter_inc(&metrics.cmd_failures);
+    if(close(fd) == -1)
+        log_errno("close");
+    free(o.out.p);
+    free(o.err.p);
+    return ret;
+}
+
+bool print_msg(
+    const struct config *config, void *data, const char *room, const char *msg
+) {
     (void)config;
-    printf("%s: %s", room, msg);
+    fprintf(data, "%s: %s", room, msg);
     return true;
 }
 
-bool send_msg(const struct config *config, const char *room, const char *msg) {
+bool send_msg(
+    const struct config *config, void *p, const char *room, const char *msg
+) {
+    (void)p;
     char url[MTRIX_MAX_URL_LEN];
     if(!BUILD_MATRIX_URL(&config->c, url, ROOMS_URL "/", room, SEND_URL "?"))
         return false;
@@ -646,7 +1624,12 @@ bool send_msg(const struct config *config, const char *room, const char *msg) {
     free(msg_json);
     struct mtrix_buffer resp = {0};
     const post_request r = {.url = url, .data_len = strlen(data), .data = data};
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     const bool ret = post(r, mtrix_config_verbose(&config->c), &resp);
+    mtrix_histogram_observe(
+        &metrics.send_time, (unsigned long)elapsed_ms(&start));
+    mtrix_counter_inc(ret ? &metrics.sends : &metrics.send_failures);
     free(data);
     free(resp.p);
     return ret;
@@ -662,3 +1645,34 @@ bool read_output(FILE *f, struct mtrix_buffer *buf) {
     }
     return true;
 }
+
+bool read_output_timeout(
+    int fd, int timeout_ms, struct mtrix_buffer *buf, bool *timed_out
+) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char buffer[1024];
+    for(;;) {
+        int t = -1;
+        if(timeout_ms && (t = timeout_ms - (int)elapsed_ms(&start)) <= 0)
+            return *timed_out = true, true;
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        const int n = poll(&p, 1, t);
+        if(n == -1) {
+            if(errno == EINTR)
+                continue;
+            return log_errno("%s: poll", __func__), false;
+        }
+        if(!n)
+            continue;
+        const ssize_t r = read(fd, buffer, sizeof(buffer));
+        if(r == -1) {
+            if(errno == EINTR)
+                continue;
+            return log_errno("%s: read", __func__), false;
+        }
+        if(!r)
+            return true;
+        mtrix_buffer_append(buffer, 1, (size_t)r, buf);
+    }
+}
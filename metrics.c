@@ -0,0 +1,205 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "socket.h"
+#include "utils.h"
+
+/** Upper bounds (inclusive) of the histogram buckets, in milliseconds. */
+static const unsigned long BUCKETS_MS[MTRIX_METRICS_BUCKETS] = {
+    5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000,
+};
+
+/** Send/receive timeout for client connections, in seconds. */
+enum { CLIENT_TIMEOUT_S = 1 };
+
+/** Main function of the server thread. */
+static void *server_thread(void *data);
+
+/** Accepts and answers a single connection. */
+static void serve(const struct mtrix_metrics_server *s);
+
+/** Writes the response to a client connection. */
+static bool serve_client(const struct mtrix_metrics *m, int fd);
+
+/** Prints a single histogram. */
+static void print_histogram(const struct mtrix_histogram *h, FILE *f);
+
+bool mtrix_counter_max(struct mtrix_counter *c, unsigned long n) {
+    unsigned long cur = mtrix_counter_get(c);
+    while(cur < n)
+        if(atomic_compare_exchange_weak_explicit(
+                &c->value, &cur, n,
+                memory_order_relaxed, memory_order_relaxed))
+            return true;
+    return false;
+}
+
+void mtrix_histogram_observe(struct mtrix_histogram *h, unsigned long ms) {
+    size_t i = 0;
+    while(i < MTRIX_METRICS_BUCKETS && BUCKETS_MS[i] < ms)
+        ++i;
+    atomic_fetch_add_explicit(h->buckets + i, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ms, ms, memory_order_relaxed);
+}
+
+bool mtrix_metrics_print(const struct mtrix_metrics *m, FILE *f) {
+    for(struct mtrix_counter *const *p = m->counters; *p; ++p) {
+        struct mtrix_counter *const c = *p;
+        fprintf(
+            f, "# HELP %s %s\n# TYPE %s %s\n%s %lu\n",
+            c->name, c->help, c->name, c->gauge ? "gauge" : "counter",
+            c->name, mtrix_counter_get(c));
+    }
+    for(struct mtrix_histogram *const *p = m->histograms; *p; ++p)
+        print_histogram(*p, f);
+    return !ferror(f);
+}
+
+void print_histogram(const struct mtrix_histogram *h, FILE *f) {
+    fprintf(
+        f, "# HELP %s %s\n# TYPE %s histogram\n",
+        h->name, h->help, h->name);
+    // Buckets are updated independently, so a concurrent observation may make
+    // the total differ from the sum, which is acceptable for this purpose.
+    unsigned long total = 0;
+    for(size_t i = 0; i < MTRIX_METRICS_BUCKETS; ++i) {
+        total += atomic_load_explicit(h->buckets + i, memory_order_relaxed);
+        fprintf(
+            f, "%s_bucket{le=\"%g\"} %lu\n",
+            h->name, (double)BUCKETS_MS[i] / 1000, total);
+    }
+    total += atomic_load_explicit(
+        h->buckets + MTRIX_METRICS_BUCKETS, memory_order_relaxed);
+    const unsigned long sum =
+        atomic_load_explicit(&h->sum_ms, memory_order_relaxed);
+    fprintf(
+        f, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %.3f\n%s_count %lu\n",
+        h->name, total, h->name, (double)sum / 1000, h->name, total);
+}
+
+bool mtrix_metrics_server_start(
+    struct mtrix_metrics_server *s, const struct mtrix_metrics *m, int fd
+) {
+    *s = (struct mtrix_metrics_server){
+        .metrics = m, .fd = fd, .pipe = {-1, -1}};
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        log_errno("fcntl(FD_CLOEXEC)");
+        goto err;
+    }
+    if(pipe(s->pipe) == -1) {
+        log_errno("pipe");
+        goto err;
+    }
+    for(int i = 0; i < 2; ++i)
+        if(fcntl(s->pipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+            log_errno("fcntl(FD_CLOEXEC)");
+            goto err;
+        }
+    const int e = pthread_create(&s->thread, NULL, server_thread, s);
+    if(e) {
+        log_err("%s: pthread_create: %s\n", __func__, strerror(e));
+        goto err;
+    }
+    return true;
+err:
+    for(int i = 0; i < 2; ++i)
+        if(s->pipe[i] != -1 && close(s->pipe[i]) == -1)
+            log_errno("close");
+    if(close(fd) == -1)
+        log_errno("close");
+    return false;
+}
+
+bool mtrix_metrics_server_stop(struct mtrix_metrics_server *s) {
+    bool ret = true;
+    if(write(s->pipe[1], "", 1) != 1) {
+        log_errno("%s: write", __func__);
+        // Not much else can be done, the thread is left running.
+        return false;
+    }
+    pthread_join(s->thread, NULL);
+    for(int i = 0; i < 2; ++i)
+        if(close(s->pipe[i]) == -1)
+            log_errno("close"), ret = false;
+    if(close(s->fd) == -1)
+        log_errno("close"), ret = false;
+    return ret;
+}
+
+void *server_thread(void *data) {
+    const struct mtrix_metrics_server *const s = data;
+    struct pollfd fds[] = {
+        {.fd = s->pipe[0], .events = POLLIN},
+        {.fd = s->fd, .events = POLLIN},
+    };
+    for(;;) {
+        if(poll(fds, 2, -1) == -1) {
+            if(errno == EINTR)
+                continue;
+            log_errno("poll");
+            break;
+        }
+        if(fds[0].revents)
+            break;
+        if(fds[1].revents & POLLIN)
+            serve(s);
+    }
+    return NULL;
+}
+
+void serve(const struct mtrix_metrics_server *s) {
+    const int fd = accept(s->fd, NULL, NULL);
+    if(fd == -1) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            log_errno("accept");
+        return;
+    }
+    if(fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+        log_errno("fcntl(FD_CLOEXEC)");
+    // Slow clients must not be able to hold the thread indefinitely.
+    const struct timeval t = {.tv_sec = CLIENT_TIMEOUT_S};
+    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t)) == -1
+            || setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t)) == -1)
+        log_errno("setsockopt");
+    else if(serve_client(s->metrics, fd)) {
+        // Wait for the client to close its end so the response is not
+        // discarded if its request has not been read.
+        char buffer[1024];
+        while(recv(fd, buffer, sizeof(buffer), 0) > 0);
+    }
+    if(close(fd) == -1)
+        log_errno("close");
+}
+
+bool serve_client(const struct mtrix_metrics *m, int fd) {
+    char *body = NULL, header[128];
+    size_t len = 0;
+    FILE *const f = open_memstream(&body, &len);
+    if(!f)
+        return log_errno("open_memstream"), false;
+    const bool printed = mtrix_metrics_print(m, f);
+    if(fclose(f) || !printed) {
+        log_errno("failed to print metrics");
+        free(body);
+        return false;
+    }
+    const int n = snprintf(
+        header, sizeof(header),
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n\r\n", len);
+    const bool ret = mtrix_socket_send_all(fd, header, (size_t)n)
+        && mtrix_socket_send_all(fd, body, len)
+        && (shutdown(fd, SHUT_WR) != -1 || (log_errno("shutdown"), false));
+    free(body);
+    return ret;
+}
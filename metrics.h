@@ -0,0 +1,111 @@
+#ifndef MACHINATRIX_METRICS_H
+#define MACHINATRIX_METRICS_H
+
+/**
+ * \file
+ * Counters and latency histograms, exposed in the Prometheus text format.
+ * Updates are relaxed atomic operations and can be performed from any thread.
+ * Values are served by a separate thread, see \ref mtrix_metrics_server.
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <pthread.h>
+
+/** Number of finite buckets in a \ref mtrix_histogram. */
+#define MTRIX_METRICS_BUCKETS 13
+
+/** Monotonic counter or, if \ref gauge is set, an arbitrary value. */
+struct mtrix_counter {
+    /** Exposed name, should follow the Prometheus conventions. */
+    const char *name;
+    /** Description, exposed in the `HELP` line. */
+    const char *help;
+    /** Exposed as a gauge instead of a counter. */
+    bool gauge;
+    atomic_ulong value;
+};
+
+/**
+ * Distribution of durations.
+ * Bucket bounds range from 5ms to 60s, the last entry in \ref buckets counts
+ * observations above that.  Values are exposed in seconds.
+ */
+struct mtrix_histogram {
+    /** Exposed name, should follow the Prometheus conventions. */
+    const char *name;
+    /** Description, exposed in the `HELP` line. */
+    const char *help;
+    /** Non-cumulative count of observations in each bucket. */
+    atomic_ulong buckets[MTRIX_METRICS_BUCKETS + 1];
+    /** Sum of all observations, in milliseconds. */
+    atomic_ulong sum_ms;
+};
+
+/** Set of values exposed together, both arrays are null-terminated. */
+struct mtrix_metrics {
+    struct mtrix_counter *const *counters;
+    struct mtrix_histogram *const *histograms;
+};
+
+/** Serves metrics on a listening socket from a background thread. */
+struct mtrix_metrics_server {
+    const struct mtrix_metrics *metrics;
+    /** Listening socket, owned by the server. */
+    int fd;
+    /** Used to interrupt the server thread. */
+    int pipe[2];
+    pthread_t thread;
+};
+
+/** Increments a counter by `n`. */
+static inline void mtrix_counter_add(
+    struct mtrix_counter *c, unsigned long n
+) {
+    atomic_fetch_add_explicit(&c->value, n, memory_order_relaxed);
+}
+
+/** Increments a counter by one. */
+static inline void mtrix_counter_inc(struct mtrix_counter *c) {
+    mtrix_counter_add(c, 1);
+}
+
+/** Sets the value of a gauge. */
+static inline void mtrix_counter_set(
+    struct mtrix_counter *c, unsigned long n
+) {
+    atomic_store_explicit(&c->value, n, memory_order_relaxed);
+}
+
+/** Current value of a counter. */
+static inline unsigned long mtrix_counter_get(struct mtrix_counter *c) {
+    return atomic_load_explicit(&c->value, memory_order_relaxed);
+}
+
+/**
+ * Sets the value of a gauge if `n` is larger than the current value.
+ * \return Whether the value was updated.
+ */
+bool mtrix_counter_max(struct mtrix_counter *c, unsigned long n);
+
+/** Records an observation of `ms` milliseconds. */
+void mtrix_histogram_observe(struct mtrix_histogram *h, unsigned long ms);
+
+/** Writes all values in the text exposition format. */
+bool mtrix_metrics_print(const struct mtrix_metrics *m, FILE *f);
+
+/**
+ * Starts the server thread.
+ * Each connection on `fd` receives an HTTP response containing the output of
+ * \ref mtrix_metrics_print and is closed.  `fd` is closed when the server is
+ * stopped, or immediately if this function fails.
+ */
+bool mtrix_metrics_server_start(
+    struct mtrix_metrics_server *s, const struct mtrix_metrics *m, int fd);
+
+/** Stops the server thread and releases its resources. */
+bool mtrix_metrics_server_stop(struct mtrix_metrics_server *s);
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * \file
+ * Converts word lists into binary dictionaries, see \ref dict.h.
+ */
+#include <stdio.h>
+
+#include "dict.h"
+#include "utils.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+/** Program entry point. */
+int main(int argc, const char *const *argv);
+
+/** Prints a usage message. */
+static void usage(FILE *f);
+
+int main(int argc, const char *const *argv) {
+    log_set(stderr);
+    PROG_NAME = argv[0];
+    if(argc != 3)
+        return usage(stderr), 1;
+    struct mtrix_dict d;
+    if(!mtrix_dict_open(&d, argv[1]))
+        return 1;
+    const bool ret = mtrix_dict_save(&d, argv[2]);
+    return !(mtrix_dict_close(&d) && ret);
+}
+
+void usage(FILE *f) {
+    fprintf(
+        f,
+        "usage: %s <input> <output>\n\n"
+        "Converts the word list in <input> into a binary dictionary.\n",
+        PROG_NAME);
+}
@@ -0,0 +1,249 @@
+/**
+ * \file
+ * Builds an offline Wiktionary index, see \ref wiktidx.h.
+ *
+ * The input is an extract of Wiktionary in the JSON lines format produced by
+ * Wiktextract: one object per line for each word, language, and part of
+ * speech.  The following fields are used:
+ *
+ * - `word` and `lang`: the term and the name of its language,
+ * - `etymology_text`: optional,
+ * - `translations`: optional list of objects with the fields `lang`, `word`,
+ *   and (optionally) `sense`.  Lists in each element of `senses` are also
+ *   used.
+ *
+ * Other lines are reported and ignored.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cjson/cJSON.h>
+
+#include "utils.h"
+#include "wiktidx.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+/** A translation read from the input. */
+struct translation {
+    const char *sense, *lang, *word;
+    /** Position of the first translation with the same sense. */
+    size_t sense_pos;
+    /** Position of the first translation with the same sense and language. */
+    size_t lang_pos;
+    /** Position in the input. */
+    size_t pos;
+};
+
+/** Translations of an entry, reused for all lines. */
+struct translations {
+    struct translation *v;
+    size_t n, cap;
+};
+
+/** Program entry point. */
+int main(int argc, const char *const *argv);
+
+/** Prints a usage message. */
+static void usage(FILE *f);
+
+/** Adds the entries of all lines in `f`. */
+static bool read_file(FILE *f, struct mtrix_wiktidx_builder *b);
+
+/**
+ * Adds the entry in a single line of the input.
+ * \return `false` if the entry could not be added, invalid lines are only
+ *         reported.
+ */
+static bool add_line(
+    struct mtrix_wiktidx_builder *b, struct translations *t,
+    struct mtrix_buffer *tr, const char *line, size_t i);
+
+/** Shortcut for `cJSON_GetObjectItemCaseSensitive`. */
+static const cJSON *get_item(const cJSON *j, const char *k);
+
+/** Value of a string field, `NULL` if it does not exist. */
+static const char *get_str(const cJSON *j, const char *k);
+
+/** Appends the valid translations in the array `j` to `t`. */
+static bool collect(const cJSON *j, struct translations *t);
+
+/** Orders translations for \ref format, as required by `qsort`. */
+static int cmp_translation(const void *lhs, const void *rhs);
+
+/**
+ * Formats translations as described in \ref mtrix_wiktidx_entry::tr.
+ * Senses and languages are kept in the order they first appear.
+ */
+static bool format(struct translations *t, struct mtrix_buffer *b);
+
+/** Appends a string. */
+static bool append(struct mtrix_buffer *b, const char *s);
+
+/**
+ * Appends a string from the input, replacing control characters with spaces.
+ * This ensures the separators in the formatted translations are unambiguous.
+ */
+static bool append_text(struct mtrix_buffer *b, const char *s);
+
+int main(int argc, const char *const *argv) {
+    log_set(stderr);
+    PROG_NAME = argv[0];
+    if(argc != 3)
+        return usage(stderr), 1;
+    FILE *const f = fopen(argv[1], "r");
+    if(!f)
+        return log_errno("fopen: %s", argv[1]), 1;
+    struct mtrix_wiktidx_builder b = {0};
+    bool ret = read_file(f, &b);
+    if(fclose(f) == EOF)
+        log_errno("fclose: %s", argv[1]), ret = false;
+    ret = ret && mtrix_wiktidx_save(&b, argv[2]);
+    mtrix_wiktidx_builder_destroy(&b);
+    return !ret;
+}
+
+void usage(FILE *f) {
+    fprintf(
+        f,
+        "usage: %s <input> <output>\n\n"
+        "Converts the Wiktextract JSON lines file <input> into an index.\n",
+        PROG_NAME);
+}
+
+bool read_file(FILE *f, struct mtrix_wiktidx_builder *b) {
+    struct translations t = {0};
+    struct mtrix_buffer tr = {0};
+    char *line = NULL;
+    size_t len = 0;
+    bool ret = true;
+    for(size_t i = 1; ret && getline(&line, &len, f) != -1; ++i)
+        ret = add_line(b, &t, &tr, line, i);
+    if(ret && ferror(f))
+        log_errno("getline"), ret = false;
+    free(line);
+    free(tr.p);
+    free(t.v);
+    return ret;
+}
+
+bool add_line(
+    struct mtrix_wiktidx_builder *b, struct translations *t,
+    struct mtrix_buffer *tr, const char *line, size_t i
+) {
+    cJSON *const j = cJSON_Parse(line);
+    if(!j)
+        return log_err("%zu: invalid JSON\n", i), true;
+    const char *const word = get_str(j, "word");
+    const char *const lang = get_str(j, "lang");
+    const char *const etym = get_str(j, "etymology_text");
+    bool ret = true;
+    if(!word || !lang) {
+        log_err("%zu: missing word or language\n", i);
+        goto end;
+    }
+    t->n = 0;
+    tr->n = 0;
+    const cJSON *sense = NULL;
+    cJSON_ArrayForEach(sense, get_item(j, "senses"))
+        if(!(ret = collect(get_item(sense, "translations"), t)))
+            goto end;
+    ret = collect(get_item(j, "translations"), t) && format(t, tr)
+        && mtrix_wiktidx_add(
+            b, word, lang, etym ? etym : "", tr->n ? tr->p : "");
+end:
+    cJSON_Delete(j);
+    return ret;
+}
+
+const cJSON *get_item(const cJSON *j, const char *k) {
+    return cJSON_GetObjectItemCaseSensitive(j, k);
+}
+
+const char *get_str(const cJSON *j, const char *k) {
+    const cJSON *const s = get_item(j, k);
+    return cJSON_IsString(s) ? s->valuestring : NULL;
+}
+
+bool collect(const cJSON *j, struct translations *t) {
+    const cJSON *x = NULL;
+    cJSON_ArrayForEach(x, j) {
+        const char *const lang = get_str(x, "lang");
+        const char *const word = get_str(x, "word");
+        const char *const sense = get_str(x, "sense");
+        if(!lang || !word)
+            continue;
+        if(t->n == t->cap) {
+            const size_t cap = t->cap ? 2 * t->cap : 64;
+            struct translation *const v = realloc(t->v, cap * sizeof(*v));
+            if(!v)
+                return log_errno("realloc"), false;
+            t->v = v;
+            t->cap = cap;
+        }
+        t->v[t->n] = (struct translation){
+            .sense = sense ? sense : "?", .lang = lang, .word = word,
+            .pos = t->n,
+        };
+        ++t->n;
+    }
+    return true;
+}
+
+int cmp_translation(const void *lhs, const void *rhs) {
+    const struct translation *const l = lhs, *const r = rhs;
+    if(l->sense_pos != r->sense_pos)
+        return l->sense_pos < r->sense_pos ? -1 : 1;
+    if(l->lang_pos != r->lang_pos)
+        return l->lang_pos < r->lang_pos ? -1 : 1;
+    return (l->pos > r->pos) - (l->pos < r->pos);
+}
+
+bool format(struct translations *t, struct mtrix_buffer *b) {
+    struct translation *const v = t->v;
+    const size_t n = t->n;
+    for(size_t i = 0; i != n; ++i) {
+        size_t j = 0;
+        while(strcmp(v[j].sense, v[i].sense))
+            ++j;
+        v[i].sense_pos = j;
+        while(strcmp(v[j].sense, v[i].sense) || strcmp(v[j].lang, v[i].lang))
+            ++j;
+        v[i].lang_pos = j;
+    }
+    if(n)
+        qsort(v, n, sizeof(*v), cmp_translation);
+    for(size_t i = 0; i != n; ++i) {
+        const bool new_sense = !i || v[i].sense_pos != v[i - 1].sense_pos;
+        const bool new_lang = new_sense || v[i].lang_pos != v[i - 1].lang_pos;
+        if(i && new_lang && !append(b, "\n"))
+            return false;
+        if(new_sense && !(append_text(b, v[i].sense) && append(b, "\n")))
+            return false;
+        const bool ok = new_lang
+            ? append(b, "\t") && append_text(b, v[i].lang) && append(b, ": ")
+            : append(b, ", ");
+        if(!(ok && append_text(b, v[i].word)))
+            return false;
+    }
+    return !n || append(b, "\n");
+}
+
+bool append(struct mtrix_buffer *b, const char *s) {
+    const size_t n = strlen(s);
+    if(!n || mtrix_buffer_append(s, 1, n, b) == n)
+        return true;
+    return log_err("%s: failed to allocate memory\n", __func__), false;
+}
+
+bool append_text(struct mtrix_buffer *b, const char *s) {
+    const size_t prev = b->n;
+    if(!append(b, s))
+        return false;
+    for(size_t i = prev; i != b->n; ++i)
+        if((unsigned char)b->p[i] < ' ')
+            b->p[i] = ' ';
+    return true;
+}
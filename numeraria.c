@@ -8,12 +8,10 @@
 
 #include <fcntl.h>
 #include <getopt.h>
-#include <netdb.h>
 #include <netinet/in.h>
 #include <poll.h>
 #include <signal.h>
 #include <sys/socket.h>
-#include <sys/un.h>
 #include <unistd.h>
 
 #include <sqlite3.h>
@@ -129,10 +127,6 @@ static bool config_record_command(
 /** Signal handler. */
 static void handle_signal(int s);
 
-/** Sets up a listening socket for a given address. */
-static bool setup_socket(
-    int fd, const struct sockaddr *addr, socklen_t addr_len);
-
 /** Initializes the SQLite database. */
 static bool setup_db(const char *path, sqlite3 **sqlite);
 
@@ -278,32 +272,14 @@ bool config_setup(struct config *config) {
     const char *const socket_path = config->input.socket_path;
     const char *const unix_path = config->input.unix_path;
     if(*socket_path) {
-        struct addrinfo *const addr = mtrix_socket_addr(socket_path);
-        if(!addr) {
-            log_err("%s: failed to determine address\n", __func__);
-            return false;
-        }
-        const int fd = socket(AF_INET, SOCK_STREAM, 0);
-        if(fd == -1) {
-            log_errno("failed to create TCP socket");
-            freeaddrinfo(addr);
-            return false;
-        }
-        const bool ret = setup_socket(fd, addr->ai_addr, addr->ai_addrlen);
-        freeaddrinfo(addr);
-        if(!ret)
+        const int fd = mtrix_socket_listen(socket_path, MAX_CONN);
+        if(fd == -1)
             return false;
         config->fds[config->n_fds++].fd = config->socket_fd = fd;
     }
     if(*unix_path) {
-        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        const int fd = mtrix_socket_listen_unix(unix_path, MAX_CONN);
         if(fd == -1)
-            return log_errno("failed to create unix socket"), false;
-        struct sockaddr_un addr = {0};
-        addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, unix_path, MAX_UNIX_PATH);
-        addr.sun_path[MAX_UNIX_PATH - 1] = 0;
-        if(!setup_socket(fd, (const struct sockaddr*)&addr, sizeof(addr)))
             return false;
         config->fds[config->n_fds++].fd = config->unix_fd = fd;
     }
@@ -561,28 +537,6 @@ void handle_signal(int s) {
     errno = e;
 }
 
-bool setup_socket(
-    int fd, const struct sockaddr *addr, socklen_t addr_len
-) {
-    if(bind(fd, addr, addr_len) == -1) {
-        log_errno("%s: bind", __func__);
-        goto err;
-    }
-    if(listen(fd, MAX_CONN) == -1) {
-        log_errno("%s: listen", __func__);
-        goto err;
-    }
-    if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
-        log_errno("%s: fcntl(F_SETFL, O_NONBLOCK)", __func__);
-        goto err;
-    }
-    return true;
-err:
-    if(close(fd) == -1)
-        log_errno("%s: close", __func__);
-    return false;
-}
-
 static bool setup_db(const char *path, sqlite3 **sqlite) {
     sqlite3 *p = NULL;
     if(sqlite3_open(path, &p) != 0)
@@ -0,0 +1,181 @@
+#include "pipeline.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+/** State of each slot in the ring of items. */
+enum slot_state { FREE, READ, BUSY, DONE };
+
+/** Shared state between all stages. */
+struct state {
+    const struct mtrix_pipeline *p;
+    /** Ring of `n` items, indexed by sequence number modulo `n`. */
+    struct mtrix_pipeline_item *items;
+    /** State of each item in \ref items. */
+    enum slot_state *states;
+    size_t n;
+    /** Sequence number of the next item to be read/processed/written. */
+    size_t next_read, next_process, next_write;
+    /** Set when the reader reaches the end of the input. */
+    bool end;
+    /** Set when any stage requests the pipeline to stop. */
+    bool stop;
+    /** Set if the reader stage failed. */
+    bool err;
+    pthread_mutex_t mtx;
+    /** Signaled when a slot becomes free. */
+    pthread_cond_t free_cond;
+    /** Signaled when an item is read. */
+    pthread_cond_t read_cond;
+    /** Signaled when an item is processed. */
+    pthread_cond_t done_cond;
+};
+
+static void *reader(void *data) {
+    struct state *const s = data;
+    const struct mtrix_pipeline *const p = s->p;
+    // Only the read operation itself can be cancelled, see below.
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_mutex_lock(&s->mtx);
+    for(;;) {
+        while(!s->stop && s->next_read - s->next_write == s->n)
+            pthread_cond_wait(&s->free_cond, &s->mtx);
+        if(s->stop)
+            break;
+        const size_t i = s->next_read % s->n;
+        assert(s->states[i] == FREE);
+        pthread_mutex_unlock(&s->mtx);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        const enum mtrix_pipeline_read r = p->read(p->data, s->items + i);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        pthread_mutex_lock(&s->mtx);
+        if(r != MTRIX_PIPELINE_ITEM) {
+            s->end = true;
+            if(r == MTRIX_PIPELINE_ERR)
+                s->err = s->stop = true;
+            break;
+        }
+        s->states[i] = READ;
+        s->items[i].seq = s->next_read++;
+        pthread_cond_signal(&s->read_cond);
+    }
+    pthread_cond_broadcast(&s->read_cond);
+    pthread_cond_broadcast(&s->done_cond);
+    pthread_mutex_unlock(&s->mtx);
+    return NULL;
+}
+
+static void *worker(void *data) {
+    struct state *const s = data;
+    const struct mtrix_pipeline *const p = s->p;
+    pthread_mutex_lock(&s->mtx);
+    for(;;) {
+        while(!s->stop && !s->end && s->next_process == s->next_read)
+            pthread_cond_wait(&s->read_cond, &s->mtx);
+        if(s->stop || s->next_process == s->next_read)
+            break;
+        const size_t i = s->next_process++ % s->n;
+        assert(s->states[i] == READ);
+        s->states[i] = BUSY;
+        pthread_mutex_unlock(&s->mtx);
+        struct mtrix_pipeline_item *const item = s->items + i;
+        item->ok = p->process(p->data, item);
+        pthread_mutex_lock(&s->mtx);
+        s->states[i] = DONE;
+        pthread_cond_broadcast(&s->done_cond);
+    }
+    pthread_mutex_unlock(&s->mtx);
+    return NULL;
+}
+
+static bool writer(struct state *s) {
+    const struct mtrix_pipeline *const p = s->p;
+    bool ret = true;
+    pthread_mutex_lock(&s->mtx);
+    for(;;) {
+        const size_t i = s->next_write % s->n;
+        while(!s->stop && s->states[i] != DONE
+                && !(s->end && s->next_write == s->next_read))
+            pthread_cond_wait(&s->done_cond, &s->mtx);
+        if(s->stop || s->states[i] != DONE)
+            break;
+        pthread_mutex_unlock(&s->mtx);
+        struct mtrix_pipeline_item *const item = s->items + i;
+        ret = p->write(p->data, item);
+        free(item->out.p);
+        free(item->err.p);
+        item->out = item->err = (struct mtrix_buffer){0};
+        pthread_mutex_lock(&s->mtx);
+        s->states[i] = FREE;
+        ++s->next_write;
+        if(!ret) {
+            s->stop = true;
+            pthread_cond_broadcast(&s->read_cond);
+        }
+        pthread_cond_signal(&s->free_cond);
+    }
+    ret = ret && !s->err;
+    pthread_mutex_unlock(&s->mtx);
+    return ret;
+}
+
+bool mtrix_pipeline_run(const struct mtrix_pipeline *p) {
+    assert(p->n_workers);
+    const size_t n = 2 * p->n_workers;
+    struct state s = {
+        .p = p,
+        .items = calloc(n, sizeof(*s.items)),
+        .states = calloc(n, sizeof(*s.states)),
+        .n = n,
+        .mtx = PTHREAD_MUTEX_INITIALIZER,
+        .free_cond = PTHREAD_COND_INITIALIZER,
+        .read_cond = PTHREAD_COND_INITIALIZER,
+        .done_cond = PTHREAD_COND_INITIALIZER,
+    };
+    pthread_t *const workers = calloc(p->n_workers, sizeof(*workers));
+    pthread_t reader_thread;
+    size_t n_workers = 0;
+    bool ret = false;
+    if(!(s.items && s.states && workers)) {
+        log_err("%s: calloc\n", __func__);
+        goto end;
+    }
+    int err = pthread_create(&reader_thread, NULL, reader, &s);
+    if(err) {
+        log_err("%s: pthread_create: %s\n", __func__, strerror(err));
+        goto end;
+    }
+    for(; n_workers < p->n_workers; ++n_workers)
+        if((err = pthread_create(workers + n_workers, NULL, worker, &s))) {
+            log_err("%s: pthread_create: %s\n", __func__, strerror(err));
+            break;
+        }
+    if(n_workers == p->n_workers)
+        ret = writer(&s);
+    pthread_mutex_lock(&s.mtx);
+    const bool cancel = !s.end;
+    s.stop = true;
+    pthread_cond_broadcast(&s.free_cond);
+    pthread_cond_broadcast(&s.read_cond);
+    pthread_mutex_unlock(&s.mtx);
+    // The reader may be blocked waiting for input which will never be used.
+    if(cancel)
+        pthread_cancel(reader_thread);
+    pthread_join(reader_thread, NULL);
+    for(size_t i = 0; i < n_workers; ++i)
+        pthread_join(workers[i], NULL);
+end:
+    if(s.items)
+        for(size_t i = 0; i < n; ++i) {
+            free(s.items[i].in.p);
+            free(s.items[i].out.p);
+            free(s.items[i].err.p);
+        }
+    free(s.items);
+    free(s.states);
+    free(workers);
+    return ret;
+}
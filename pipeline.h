@@ -0,0 +1,74 @@
+#ifndef MACHINATRIX_PIPELINE_H
+#define MACHINATRIX_PIPELINE_H
+
+/**
+ * \file
+ * Ordered, parallel processing of a sequence of items.
+ * Items are produced by a reader stage, processed concurrently by a number of
+ * worker threads, and consumed by a writer stage in their original order.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "utils.h"
+
+/** Result of the reader stage. */
+enum mtrix_pipeline_read {
+    /** An item was produced. */
+    MTRIX_PIPELINE_ITEM,
+    /** End of the input. */
+    MTRIX_PIPELINE_END,
+    /** Error, the pipeline is stopped. */
+    MTRIX_PIPELINE_ERR,
+};
+
+/**
+ * Unit of work passed through the stages.
+ * Buffers are owned by the pipeline: \ref in is reused between items (and can
+ * be used by `getline`-style functions), \ref out and \ref err are released
+ * after the writer stage.
+ */
+struct mtrix_pipeline_item {
+    /** Position of the item in the input, starting at zero. */
+    size_t seq;
+    /** Input data, filled by the reader stage. */
+    struct mtrix_buffer in;
+    /** Output data, filled by the worker stage. */
+    struct mtrix_buffer out;
+    /** Error output, optionally filled by the worker stage. */
+    struct mtrix_buffer err;
+    /** Result of the worker stage. */
+    bool ok;
+};
+
+/** Stage functions and parameters for \ref mtrix_pipeline_run. */
+struct mtrix_pipeline {
+    /** Number of worker threads (at least one). */
+    size_t n_workers;
+    /** Passed to all stage functions. */
+    void *data;
+    /**
+     * Produces the next item, executed in a dedicated thread.
+     * The thread may be cancelled while this function is executing if the
+     * pipeline is stopped, so it should be a simple read.
+     */
+    enum mtrix_pipeline_read (*read)(
+        void *data, struct mtrix_pipeline_item *item);
+    /** Processes an item, executed concurrently by the worker threads. */
+    bool (*process)(void *data, struct mtrix_pipeline_item *item);
+    /**
+     * Consumes an item, executed by the calling thread in input order.
+     * \return Whether processing should continue.
+     */
+    bool (*write)(void *data, struct mtrix_pipeline_item *item);
+};
+
+/**
+ * Executes all stages until the input is exhausted.
+ * \return `false` if any stage failed to start, the reader failed, or the
+ *         writer requested a stop.
+ */
+bool mtrix_pipeline_run(const struct mtrix_pipeline *p);
+
+#endif
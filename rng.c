@@ -0,0 +1,99 @@
+#include "rng.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/random.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+/** Rotates the bits of `x` left by `k`. */
+static uint64_t rotl(uint64_t x, int k);
+
+/** Step of the SplitMix64 generator, used to expand seeds. */
+static uint64_t splitmix64(uint64_t *x);
+
+/** Full 128-bit product of `x` and `y`, in `*hi` and the return value. */
+static uint64_t mul128(uint64_t x, uint64_t y, uint64_t *hi);
+
+void mtrix_rng_init(struct mtrix_rng *r) {
+    char *p = (char*)r->s;
+    size_t n = sizeof(r->s);
+    while(n) {
+        const ssize_t nr = getrandom(p, n, 0);
+        if(nr == -1) {
+            if(errno == EINTR)
+                continue;
+            log_errno("getrandom");
+            struct timespec t = {0};
+            clock_gettime(CLOCK_REALTIME, &t);
+            mtrix_rng_seed(
+                r,
+                ((uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec)
+                    ^ (uint64_t)getpid() << 32);
+            return;
+        }
+        p += nr;
+        n -= (size_t)nr;
+    }
+    // The only invalid state, all other values are equally likely.
+    if(!(r->s[0] | r->s[1] | r->s[2] | r->s[3]))
+        mtrix_rng_seed(r, 0);
+}
+
+void mtrix_rng_seed(struct mtrix_rng *r, uint64_t seed) {
+    for(size_t i = 0; i != 4; ++i)
+        r->s[i] = splitmix64(&seed);
+}
+
+uint64_t mtrix_rng_next(struct mtrix_rng *r) {
+    uint64_t *const s = r->s;
+    const uint64_t ret = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return ret;
+}
+
+uint64_t mtrix_rng_below(struct mtrix_rng *r, uint64_t n) {
+    assert(n);
+    // The high half of the product `x * n` is in the desired range.  Some
+    // values would be produced once more than others, which is detected by
+    // checking the low half and corrected by rejecting those cases.  The
+    // (relatively expensive) threshold is only computed if the low half is
+    // small enough that rejection is possible.
+    uint64_t hi;
+    uint64_t lo = mul128(mtrix_rng_next(r), n, &hi);
+    if(lo < n) {
+        const uint64_t threshold = -n % n;
+        while(lo < threshold)
+            lo = mul128(mtrix_rng_next(r), n, &hi);
+    }
+    return hi;
+}
+
+uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+uint64_t mul128(uint64_t x, uint64_t y, uint64_t *hi) {
+    const uint64_t mask = UINT32_MAX;
+    const uint64_t x0 = x & mask, x1 = x >> 32, y0 = y & mask, y1 = y >> 32;
+    const uint64_t p00 = x0 * y0, p01 = x0 * y1, p10 = x1 * y0, p11 = x1 * y1;
+    const uint64_t mid = (p00 >> 32) + (p01 & mask) + (p10 & mask);
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return x * y;
+}
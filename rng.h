@@ -0,0 +1,38 @@
+#ifndef MACHINATRIX_RNG_H
+#define MACHINATRIX_RNG_H
+
+/**
+ * \file
+ * Pseudo-random number generation.
+ * Uses the xoshiro256** generator, which is fast and has a small state.
+ * Values in a range are generated without bias using Lemire's method.  This
+ * module is not suitable for cryptographic purposes.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Generator state, each thread should use its own. */
+struct mtrix_rng {
+    uint64_t s[4];
+};
+
+/**
+ * Seeds the generator from the system's random source.
+ * If that is not available, the current time and process ID are used instead.
+ */
+void mtrix_rng_init(struct mtrix_rng *r);
+
+/** Seeds the generator deterministically, for reproducible sequences. */
+void mtrix_rng_seed(struct mtrix_rng *r, uint64_t seed);
+
+/** Generates a uniformly-distributed 64-bit value. */
+uint64_t mtrix_rng_next(struct mtrix_rng *r);
+
+/**
+ * Generates a uniformly-distributed value in the range `[0, n)`.
+ * \param n Upper bound, must not be zero.
+ */
+uint64_t mtrix_rng_below(struct mtrix_rng *r, uint64_t n);
+
+#endif
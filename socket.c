@@ -1,10 +1,14 @@
 #include "socket.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 
+#include <fcntl.h>
 #include <netdb.h>
+#include <sys/socket.h>
 #include <sys/un.h>
+#include <unistd.h>
 
 #include "utils.h"
 
@@ -12,6 +16,16 @@ static_assert(
     sizeof(((struct sockaddr_un*)0)->sun_path)
     <= MTRIX_MAX_UNIX_PATH);
 
+/** Similar to \ref mtrix_socket_addr, but does not modify `addr`. */
+static struct addrinfo *resolve(const char *addr);
+
+/** Binds `fd` to `addr` and starts listening, closes `fd` on failure. */
+static bool setup_socket(
+    int fd, const struct sockaddr *addr, socklen_t addr_len, int backlog);
+
+/** Fills `addr` with `path`, which is validated. */
+static bool unix_addr(const char *path, struct sockaddr_un *addr);
+
 struct addrinfo *mtrix_socket_addr(const char *addr) {
     struct addrinfo hints = {
         .ai_family = AF_INET,
@@ -30,3 +44,129 @@ struct addrinfo *mtrix_socket_addr(const char *addr) {
     }
     return ret;
 }
+
+struct addrinfo *resolve(const char *addr) {
+    char buffer[MTRIX_MAX_PATH];
+    if(strlcpy(buffer, addr, sizeof(buffer)) == sizeof(buffer)
+            && buffer[sizeof(buffer) - 1]) {
+        log_err("%s: address too long\n", __func__);
+        return NULL;
+    }
+    struct addrinfo *const ret = mtrix_socket_addr(buffer);
+    if(!ret)
+        log_err("%s: failed to determine address\n", __func__);
+    return ret;
+}
+
+bool unix_addr(const char *path, struct sockaddr_un *addr) {
+    const size_t len = strlen(path), max_len = MTRIX_MAX_UNIX_PATH;
+    if(len >= max_len) {
+        log_err("%s: path too long (%zu >= %zu)\n", __func__, len, max_len);
+        return false;
+    }
+    *addr = (struct sockaddr_un){.sun_family = AF_UNIX};
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+bool setup_socket(
+    int fd, const struct sockaddr *addr, socklen_t addr_len, int backlog
+) {
+    if(bind(fd, addr, addr_len) == -1) {
+        log_errno("%s: bind", __func__);
+        goto err;
+    }
+    if(listen(fd, backlog) == -1) {
+        log_errno("%s: listen", __func__);
+        goto err;
+    }
+    if(fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        log_errno("%s: fcntl(F_SETFL, O_NONBLOCK)", __func__);
+        goto err;
+    }
+    return true;
+err:
+    if(close(fd) == -1)
+        log_errno("%s: close", __func__);
+    return false;
+}
+
+int mtrix_socket_listen(const char *addr, int backlog) {
+    struct addrinfo *const info = resolve(addr);
+    if(!info)
+        return -1;
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1) {
+        log_errno("failed to create TCP socket");
+        freeaddrinfo(info);
+        return -1;
+    }
+    const bool ret = setup_socket(fd, info->ai_addr, info->ai_addrlen, backlog);
+    freeaddrinfo(info);
+    return ret ? fd : -1;
+}
+
+int mtrix_socket_listen_unix(const char *path, int backlog) {
+    struct sockaddr_un addr;
+    if(!unix_addr(path, &addr))
+        return -1;
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return log_errno("failed to create unix socket"), -1;
+    const socklen_t addr_len = sizeof(addr);
+    if(!setup_socket(fd, (const struct sockaddr*)&addr, addr_len, backlog))
+        return -1;
+    return fd;
+}
+
+int mtrix_socket_connect(const char *addr) {
+    struct addrinfo *const info = resolve(addr);
+    if(!info)
+        return -1;
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1) {
+        log_errno("%s: failed to create socket", __func__);
+        goto err;
+    }
+    if(connect(fd, info->ai_addr, info->ai_addrlen) == -1) {
+        log_errno("%s: failed to connect", __func__);
+        goto err;
+    }
+    freeaddrinfo(info);
+    return fd;
+err:
+    freeaddrinfo(info);
+    if(fd != -1 && close(fd) == -1)
+        log_errno("%s: failed to close socket", __func__);
+    return -1;
+}
+
+int mtrix_socket_connect_unix(const char *path) {
+    struct sockaddr_un addr;
+    if(!unix_addr(path, &addr))
+        return -1;
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return log_errno("%s: socket", __func__), -1;
+    if(connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        log_errno("%s: connect", __func__);
+        if(close(fd) == -1)
+            log_errno("%s: close", __func__);
+        return -1;
+    }
+    return fd;
+}
+
+bool mtrix_socket_send_all(int fd, const void *p, size_t n) {
+    while(n) {
+        const ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if(w == -1) {
+            if(errno == EINTR)
+                continue;
+            return log_errno("send"), false;
+        }
+        p = (const char*)p + w;
+        n -= (size_t)w;
+    }
+    return true;
+}
@@ -1,6 +1,39 @@
 #ifndef MTRIX_SOCKET_H
 #define MTRIX_SOCKET_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 struct addrinfo *mtrix_socket_addr(const char *addr);
 
+/**
+ * Creates a non-blocking TCP socket listening on \p addr (`host:port`).
+ * \returns: fd or -1.
+ */
+int mtrix_socket_listen(const char *addr, int backlog);
+
+/**
+ * Creates a non-blocking Unix socket listening on \p path.
+ * \returns: fd or -1.
+ */
+int mtrix_socket_listen_unix(const char *path, int backlog);
+
+/**
+ * Creates a TCP socket connected to \p addr (`host:port`).
+ * \returns: fd or -1.
+ */
+int mtrix_socket_connect(const char *addr);
+
+/**
+ * Creates a Unix socket connected to \p path.
+ * \returns: fd or -1.
+ */
+int mtrix_socket_connect_unix(const char *path);
+
+/**
+ * Repeatedly calls \c send(2) until all data are written.
+ * Similar to \ref write_all, but does not raise `SIGPIPE`.
+ */
+bool mtrix_socket_send_all(int fd, const void *p, size_t n);
+
 #endif
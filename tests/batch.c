@@ -0,0 +1,165 @@
+#include "batch.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = "batch";
+const char *CMD_NAME = NULL;
+
+/** Resets the number of lines executed by a worker. */
+static void init_worker(void *data) {
+    *(size_t*)data = 0;
+}
+
+/**
+ * Executes a line of the form `delay action`, where `delay` is in
+ * milliseconds.
+ */
+static bool run_line(void *data, char *line, size_t seq) {
+    size_t *const count = data;
+    ++*count;
+    long delay = 0;
+    char action[16] = {0};
+    if(sscanf(line, "%ld %15s", &delay, action) != 2)
+        return fprintf(stderr, "invalid line: %s", line), false;
+    nanosleep(&(struct timespec){.tv_nsec = delay * 1000000}, NULL);
+    if(!strcmp(action, "fail"))
+        return fprintf(stderr, "error %zu\n", seq), false;
+    if(!strcmp(action, "kill"))
+        raise(SIGKILL);
+    // Also ends the worker, see supervise.
+    if(!strcmp(action, "exit"))
+        _exit(1);
+    if(!strcmp(action, "count"))
+        printf("%zu\n", *count);
+    else
+        printf("%zu\n", seq);
+    return true;
+}
+
+/** Executes `lines` with `n` workers. */
+static bool run_batch(
+    size_t n, const char *lines, FILE *out, FILE *err, size_t *count)
+{
+    FILE *const f = fmemopen((void*)lines, strlen(lines), "r");
+    if(!ASSERT(f))
+        return false;
+    const struct mtrix_batch b = {
+        .n_workers = n,
+        .data = count,
+        .init = init_worker,
+        .run = run_line,
+        .out = fileno(out),
+        .err = fileno(err),
+    };
+    const bool ret = mtrix_batch_run(&b, f);
+    fclose(f);
+    return ret;
+}
+
+static bool test_batch_order(void) {
+    FILE *const out = tmpfile(), *const err = tmpfile();
+    size_t count = 0;
+    // Later lines finish first.
+    const bool ret = ASSERT(run_batch(
+            4, "80 print\n70 print\n60 print\n50 print\n"
+            "40 print\n30 print\n20 print\n10 print\n", out, err, &count))
+        && CHECK_TEXT(out, "0\n1\n2\n3\n4\n5\n6\n7\n")
+        && CHECK_TEXT(err, "");
+    fclose(out);
+    fclose(err);
+    return ret;
+}
+
+static bool test_batch_failure(void) {
+    FILE *const out = tmpfile(), *const err = tmpfile();
+    size_t count = 0;
+    const bool ret = ASSERT(!run_batch(
+            2, "0 print\n10 fail\n0 kill\n0 print\n", out, err, &count))
+        && CHECK_TEXT(out, "0\n3\n")
+        && CHECK_TEXT(
+            err,
+            "error 1\nbatch: line 2 failed\n"
+            "batch: killed by signal 9\nbatch: line 3 failed\n");
+    fclose(out);
+    fclose(err);
+    return ret;
+}
+
+static bool test_batch_exit(void) {
+    FILE *const out = tmpfile(), *const err = tmpfile(), *const log = tmpfile();
+    size_t count = 0;
+    log_set(log);
+    // The remaining worker executes the other lines.
+    const bool ret = ASSERT(!run_batch(
+            2, "0 exit\n10 print\n0 print\n0 print\n", out, err, &count))
+        && CHECK_TEXT(out, "1\n2\n3\n")
+        && CHECK_TEXT(err, "batch: line 1 failed\n");
+    log_set(stderr);
+    fclose(log);
+    fclose(out);
+    fclose(err);
+    return ret;
+}
+
+static bool test_batch_exit_all(void) {
+    FILE *const out = tmpfile(), *const err = tmpfile(), *const log = tmpfile();
+    size_t count = 0;
+    log_set(log);
+    const bool ret = ASSERT(!run_batch(
+            1, "0 exit\n0 print\n", out, err, &count))
+        && CHECK_TEXT(out, "")
+        && CHECK_TEXT(err, "batch: line 1 failed\nbatch: line 2 failed\n");
+    log_set(stderr);
+    fclose(log);
+    fclose(out);
+    fclose(err);
+    return ret;
+}
+
+static bool test_batch_state(void) {
+    FILE *const out = tmpfile(), *const err = tmpfile();
+    // Set to zero in the worker, which executes all lines.
+    size_t count = 100;
+    const bool ret = ASSERT(run_batch(
+            1, "0 count\n0 count\n0 count\n", out, err, &count))
+        && CHECK_TEXT(out, "1\n2\n3\n")
+        && ASSERT_EQ(count, 100);
+    fclose(out);
+    fclose(err);
+    return ret;
+}
+
+static bool test_batch_capture(void) {
+    size_t count = 0;
+    const struct mtrix_batch b = {.data = &count, .run = run_line};
+    char line[] = "0 fail\n";
+    struct mtrix_daemon_output output = {0};
+    const bool ret = ASSERT(mtrix_batch_capture(&b, line, 2, &output))
+        && ASSERT_EQ(output.status, 1)
+        && ASSERT_EQ(output.out.n, 0)
+        && ASSERT_EQ(output.err.n, 8)
+        && ASSERT_STR_EQ(output.err.p, "error 2\n")
+        && ASSERT_EQ(count, 1);
+    free(output.out.p);
+    free(output.err.p);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_batch_order) && ret;
+    ret = RUN(test_batch_failure) && ret;
+    ret = RUN(test_batch_exit) && ret;
+    ret = RUN(test_batch_exit_all) && ret;
+    ret = RUN(test_batch_state) && ret;
+    ret = RUN(test_batch_capture) && ret;
+    return !ret;
+}
@@ -0,0 +1,427 @@
+#include "cache.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+static bool make_cache(struct mtrix_cache *c) {
+    char dir[] = "/tmp/machinatrix_test_cache_XXXXXX";
+    if(!ASSERT(mkdtemp(dir)))
+        return false;
+    *c = (struct mtrix_cache){.ttl = 60};
+    return ASSERT(join_path(c->dir, 2, dir, "/http"));
+}
+
+static void remove_cache(const struct mtrix_cache *c) {
+    DIR *const d = opendir(c->dir);
+    if(d) {
+        for(const struct dirent *e; (e = readdir(d));)
+            unlinkat(dirfd(d), e->d_name, 0);
+        closedir(d);
+    }
+    rmdir(c->dir);
+    char parent[MTRIX_MAX_PATH] = {0};
+    strlcpy(parent, c->dir, sizeof(parent));
+    *strrchr(parent, '/') = 0;
+    rmdir(parent);
+}
+
+static bool store(
+    const struct mtrix_cache *c, const char *url, int64_t time,
+    const char *body)
+{
+    struct mtrix_cache_entry e = {
+        .time = time,
+        .validators = {.etag = "\"abc\"", .last_modified = "yesterday"},
+        .body = {.p = (char*)body, .n = strlen(body)},
+    };
+    return ASSERT(mtrix_cache_store(c, url, &e));
+}
+
+/** Sets the time of the last use of the entry for `url`. */
+static bool set_mtime(const struct mtrix_cache *c, const char *url, time_t t) {
+    char path[MTRIX_MAX_PATH] = {0};
+    const struct timespec ts[2] = {{.tv_sec = t}, {.tv_sec = t}};
+    return ASSERT(mtrix_cache_path(c, url, path))
+        && ASSERT_EQ(utimensat(AT_FDCWD, path, ts, 0), 0);
+}
+
+static bool exists(const struct mtrix_cache *c, const char *url) {
+    char path[MTRIX_MAX_PATH] = {0};
+    return mtrix_cache_path(c, url, path) && !access(path, F_OK);
+}
+
+static bool test_cache_missing(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    FILE *const log = tmpfile();
+    log_set(log);
+    struct mtrix_cache_entry e = {0};
+    const bool ret = ASSERT(!mtrix_cache_load(&c, "http://example.com", &e))
+        && ASSERT_EQ(ftell(log), 0);
+    log_set(stderr);
+    fclose(log);
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_store_load(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    const char *const url = "http://example.com/a";
+    struct mtrix_cache_entry e = {0};
+    const bool ret = store(&c, url, 42, "body")
+        && ASSERT(mtrix_cache_load(&c, url, &e))
+        && ASSERT_EQ(e.time, 42)
+        && ASSERT_STR_EQ(e.validators.etag, "\"abc\"")
+        && ASSERT_STR_EQ(e.validators.last_modified, "yesterday")
+        && ASSERT_EQ(e.body.n, 4)
+        && ASSERT_STR_EQ(e.body.p, "body")
+        // Replaced by later stores.
+        && store(&c, url, 43, "")
+        && (free(e.body.p), e.body.p = NULL, true)
+        && ASSERT(mtrix_cache_load(&c, url, &e))
+        && ASSERT_EQ(e.time, 43)
+        && ASSERT_EQ(e.body.n, 0);
+    free(e.body.p);
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_invalid(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    const char *const url = "http://example.com/a";
+    char path[MTRIX_MAX_PATH] = {0};
+    FILE *const log = tmpfile();
+    struct mtrix_cache_entry e = {0};
+    bool ret = store(&c, url, 42, "body")
+        && ASSERT(mtrix_cache_path(&c, url, path))
+        && ASSERT_EQ(truncate(path, 80), 0);
+    log_set(log);
+    ret = ret
+        && ASSERT(!mtrix_cache_load(&c, url, &e))
+        // Reported, unlike a missing file.
+        && ASSERT_NE(ftell(log), 0);
+    log_set(stderr);
+    fclose(log);
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_evict(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    const char *const urls[] = {"http://a", "http://b", "http://c"};
+    bool ret = true;
+    for(size_t i = 0; ret && i != 3; ++i)
+        ret = store(&c, urls[i], 0, "0123456789")
+            // Least recently used first: b, c, a.
+            && set_mtime(&c, urls[i], i ? (time_t)i : 10);
+    char path[MTRIX_MAX_PATH] = {0};
+    struct stat st;
+    ret = ret
+        && ASSERT(mtrix_cache_path(&c, *urls, path))
+        && ASSERT_EQ(stat(path, &st), 0);
+    // Room for two entries.
+    c.max_size = 2 * (uint64_t)st.st_size;
+    ret = ret
+        && ASSERT(mtrix_cache_evict(&c))
+        && ASSERT(exists(&c, urls[0]))
+        && ASSERT(!exists(&c, urls[1]))
+        && ASSERT(exists(&c, urls[2]));
+    c.max_size = 1;
+    ret = ret
+        && ASSERT(mtrix_cache_evict(&c))
+        && ASSERT(!exists(&c, urls[0]))
+        && ASSERT(!exists(&c, urls[2]));
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_load_marks_used(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    const char *const urls[] = {"http://a", "http://b"};
+    struct mtrix_cache_entry e = {0};
+    bool ret = store(&c, urls[0], 0, "0123456789")
+        && store(&c, urls[1], 0, "0123456789")
+        && set_mtime(&c, urls[0], 1)
+        && set_mtime(&c, urls[1], 2)
+        && ASSERT(mtrix_cache_load(&c, urls[0], &e));
+    free(e.body.p);
+    char path[MTRIX_MAX_PATH] = {0};
+    struct stat st;
+    ret = ret
+        && ASSERT(mtrix_cache_path(&c, *urls, path))
+        && ASSERT_EQ(stat(path, &st), 0);
+    c.max_size = (uint64_t)st.st_size;
+    ret = ret
+        && ASSERT(mtrix_cache_evict(&c))
+        && ASSERT(exists(&c, urls[0]))
+        && ASSERT(!exists(&c, urls[1]));
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_negative(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    c.negative_ttl = 60;
+    const char *const key = "wikt\nterm\n";
+    const bool ret = ASSERT(!mtrix_cache_is_negative(&c, key))
+        && ASSERT(mtrix_cache_store_negative(&c, key))
+        && ASSERT(mtrix_cache_is_negative(&c, key))
+        && ASSERT(!mtrix_cache_is_negative(&c, "wikt\nterm\nen"))
+        // Does not shadow a response stored for the same string.
+        && store(&c, key, 0, "body")
+        && ASSERT(mtrix_cache_is_negative(&c, key))
+        && (c.negative_ttl = 0, true)
+        && ASSERT(!mtrix_cache_is_negative(&c, key));
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_request_multi(void) {
+    struct mtrix_cache c;
+    if(!make_cache(&c))
+        return false;
+    // Nothing listens on port 1, the request fails immediately.
+    const char *const urls[] = {
+        "http://127.0.0.1:1/a", "http://127.0.0.1:1/b", "http://127.0.0.1:1/c"};
+    struct mtrix_buffer bs[3] = {0};
+    bool ok[3] = {0};
+    FILE *const log = tmpfile();
+    bool ret = store(&c, urls[0], time(NULL), "a")
+        && store(&c, urls[2], time(NULL), "c");
+    log_set(log);
+    ret = ret
+        && ASSERT(mtrix_cache_request_multi(&c, 3, urls, bs, ok, NULL, false))
+        && ASSERT(ok[0]) && ASSERT_STR_EQ(bs[0].p, "a")
+        && ASSERT(!ok[1]) && ASSERT_EQ(bs[1].p, NULL)
+        && ASSERT(ok[2]) && ASSERT_STR_EQ(bs[2].p, "c")
+        && ASSERT_NE(ftell(log), 0);
+    log_set(stderr);
+    fclose(log);
+    for(size_t i = 0; i != 3; ++i)
+        free(bs[i].p);
+    remove_cache(&c);
+    return ret;
+}
+
+/**
+ * Test HTTP server, running in a child process, which replies to every request
+ * with "page" and reports it through a pipe.
+ */
+struct server {
+    /** Status line of the responses, `200 OK` if not set. */
+    const char *status;
+    /** Delay before each response. */
+    bool delay;
+    pid_t pid;
+    /** Receives a byte for each request. */
+    int count;
+    char url[64];
+};
+
+static void server_respond(const struct server *s, int fd, int count) {
+    char buf[1024];
+    size_t n = 0;
+    for(ssize_t r; n < sizeof(buf) - 1
+            && (r = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0;) {
+        buf[n += (size_t)r] = 0;
+        if(strstr(buf, "\r\n\r\n"))
+            break;
+    }
+    write_all(count, "", 1);
+    // Long enough for concurrent requests to start in a later second.
+    if(s->delay)
+        nanosleep(
+            &(struct timespec){.tv_sec = 1, .tv_nsec = 500000000}, NULL);
+    n = (size_t)snprintf(
+        buf, sizeof(buf),
+        "HTTP/1.1 %s\r\nContent-Length: 4\r\nConnection: close\r\n\r\n"
+        "page", s->status ? s->status : "200 OK");
+    write_all(fd, buf, n);
+}
+
+static bool server_start(struct server *s) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int p[2];
+    if(!(ASSERT_NE(fd, -1) && ASSERT_EQ(pipe(p), 0)))
+        return false;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    const bool ok =
+        ASSERT_NE(bind(fd, (const struct sockaddr*)&addr, sizeof(addr)), -1)
+        && ASSERT_NE(listen(fd, 16), -1)
+        && ASSERT_NE(getsockname(fd, (struct sockaddr*)&addr, &len), -1)
+        && ASSERT_NE(s->pid = fork(), -1);
+    if(ok && !s->pid) {
+        close(p[0]);
+        for(int c; (c = accept(fd, NULL, NULL)) != -1; close(c))
+            server_respond(s, c, p[1]);
+        _exit(1);
+    }
+    close(fd);
+    close(p[1]);
+    s->count = p[0];
+    snprintf(
+        s->url, sizeof(s->url), "http://127.0.0.1:%d/page",
+        ntohs(addr.sin_port));
+    return ok;
+}
+
+/** Stops the server. \return The number of requests received. */
+static size_t server_stop(struct server *s) {
+    kill(s->pid, SIGTERM);
+    waitpid(s->pid, NULL, 0);
+    size_t ret = 0;
+    char buf[16];
+    for(ssize_t r; (r = read(s->count, buf, sizeof(buf))) > 0;)
+        ret += (size_t)r;
+    close(s->count);
+    return ret;
+}
+
+/** Arguments of \ref request_page. */
+struct page_request {
+    const struct mtrix_cache *c;
+    const char *url;
+    bool ok;
+};
+
+/** Requests a page of the test server, see \ref server_start. */
+static void *request_page(void *data) {
+    struct page_request *const r = data;
+    struct mtrix_buffer b = {0};
+    r->ok = mtrix_cache_request(r->c, r->url, &b, NULL, false)
+        && b.n == 4 && !memcmp(b.p, "page", 4);
+    free(b.p);
+    return NULL;
+}
+
+static bool test_cache_request_status(void) {
+    struct mtrix_cache c;
+    struct server s = {.status = "429 Too Many Requests"};
+    if(!(make_cache(&c) && server_start(&s)))
+        return false;
+    struct mtrix_buffer b = {0};
+    struct mtrix_cache_entry e = {0};
+    long status = 0;
+    FILE *const log = tmpfile();
+    log_set(log);
+    // Not mistaken for a missing page.
+    bool ret = ASSERT(!mtrix_cache_request(&c, s.url, &b, &status, false))
+        && ASSERT_NE(ftell(log), 0)
+        && ASSERT(!mtrix_cache_load(&c, s.url, &e));
+    log_set(stderr);
+    fclose(log);
+    ret = ASSERT_EQ(server_stop(&s), 1) && ret;
+    free(b.p);
+    b = (struct mtrix_buffer){0};
+    s = (struct server){.status = "404 Not Found"};
+    ret = ret && server_start(&s);
+    if(ret) {
+        ret = ASSERT(mtrix_cache_request(&c, s.url, &b, &status, false))
+            && ASSERT_EQ(status, 404)
+            && ASSERT_EQ(b.n, 4) && ASSERT(!memcmp(b.p, "page", 4))
+            && ASSERT(!mtrix_cache_load(&c, s.url, &e));
+        ret = ASSERT_EQ(server_stop(&s), 1) && ret;
+    }
+    free(b.p);
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_coalesce_processes(void) {
+    struct mtrix_cache c;
+    struct server s = {.delay = true};
+    if(!(make_cache(&c) && server_start(&s)))
+        return false;
+    pid_t pids[2] = {0};
+    for(size_t i = 0; i != 2; ++i) {
+        if(i)
+            nanosleep(&(struct timespec){.tv_sec = 1}, NULL);
+        if(!(pids[i] = fork())) {
+            struct page_request r = {.c = &c, .url = s.url};
+            request_page(&r);
+            _exit(!r.ok);
+        }
+    }
+    int status[2] = {-1, -1};
+    for(size_t i = 0; i != 2; ++i)
+        if(pids[i] != -1)
+            waitpid(pids[i], status + i, 0);
+    const bool ret = ASSERT_NE(pids[0], -1) && ASSERT_NE(pids[1], -1)
+        && ASSERT_EQ(status[0], 0) && ASSERT_EQ(status[1], 0)
+        && ASSERT_EQ(server_stop(&s), 1);
+    remove_cache(&c);
+    return ret;
+}
+
+static bool test_cache_coalesce_threads(void) {
+    struct mtrix_cache c;
+    struct server s = {.delay = true};
+    if(!(make_cache(&c) && server_start(&s)))
+        return false;
+    size_t coalesced = 0;
+    c.coalesced = &coalesced;
+    struct page_request r[2] = {
+        {.c = &c, .url = s.url}, {.c = &c, .url = s.url}};
+    pthread_t t[2];
+    bool ret = ASSERT_EQ(pthread_create(t, NULL, request_page, r), 0);
+    if(ret) {
+        nanosleep(&(struct timespec){.tv_nsec = 200000000}, NULL);
+        ret = ASSERT_EQ(pthread_create(t + 1, NULL, request_page, r + 1), 0);
+        if(ret)
+            pthread_join(t[1], NULL);
+        pthread_join(t[0], NULL);
+    }
+    ret = ret && ASSERT(r[0].ok) && ASSERT(r[1].ok)
+        && ASSERT_EQ(coalesced, 1);
+    ret = ASSERT_EQ(server_stop(&s), 1) && ret;
+    remove_cache(&c);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_cache_missing) && ret;
+    ret = RUN(test_cache_store_load) && ret;
+    ret = RUN(test_cache_invalid) && ret;
+    ret = RUN(test_cache_evict) && ret;
+    ret = RUN(test_cache_load_marks_used) && ret;
+    ret = RUN(test_cache_negative) && ret;
+    ret = RUN(test_cache_request_multi) && ret;
+    ret = RUN(test_cache_request_status) && ret;
+    ret = RUN(test_cache_coalesce_processes) && ret;
+    ret = RUN(test_cache_coalesce_threads) && ret;
+    return !ret;
+}
@@ -16,6 +16,7 @@
     ((strncmp((x), (y), (n)) == 0) || FAIL((int)(n), (x), (y)))
 #define CHECK_LOG(x) check_log(LOC(), (x), 0)
 #define CHECK_LOG_N(x, n) check_log(LOC(), (x), (n))
+#define CHECK_TEXT(f, x) check_text(LOC(), (f), (x))
 
 struct loc {
     const char *file, *func;
@@ -71,3 +72,54 @@ static inline bool check_log(struct loc loc, const char *s, size_t len) {
     free(text);
     return ret;
 }
+
+/** Reads an entire file, `NULL` on error. */
+static inline char *read_file(const char *path, size_t *n) {
+    FILE *const f = fopen(path, "r");
+    if(!f)
+        return fprintf(stderr, "failed to open %s\n", path), NULL;
+    assert(fseek(f, 0, SEEK_END) >= 0);
+    const long len = ftell(f);
+    assert(len >= 0);
+    assert(fseek(f, 0, SEEK_SET) >= 0);
+    char *const ret = malloc((size_t)len + 1);
+    assert(ret);
+    *n = fread(ret, 1, (size_t)len, f);
+    ret[*n] = 0;
+    assert(!ferror(f));
+    fclose(f);
+    return ret;
+}
+
+/**
+ * Compares the text written to `f` with `s`, ignoring differences in
+ * whitespace: runs of spaces which do not indent a line are treated as one,
+ * and spaces at the end of lines are ignored.
+ */
+static inline bool check_text(struct loc loc, FILE *f, const char *s) {
+    assert(fflush(f) != EOF);
+    const long len = ftell(f);
+    assert(len >= 0);
+    assert(fseek(f, 0, SEEK_SET) >= 0);
+    char *const text = malloc((size_t)len + 1);
+    assert(text);
+    assert(fread(text, 1, (size_t)len, f) == (size_t)len);
+    size_t n = 0;
+    for(long i = 0; i != len; ++i) {
+        const char c = text[i];
+        if(c == ' ' && n > 1 && text[n - 1] == ' '
+                && text[n - 2] != ' ' && text[n - 2] != '\n')
+            continue;
+        while(c == '\n' && n && text[n - 1] == ' ')
+            --n;
+        text[n++] = c;
+    }
+    text[n] = 0;
+    const bool ret = strcmp(text, s) == 0;
+    if(!ret) {
+        print_loc(loc);
+        fprintf(stderr, "unexpected output:\n%s\nexpected:\n%s", text, s);
+    }
+    free(text);
+    return ret;
+}
@@ -0,0 +1,73 @@
+#include "daemon.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+static bool test_daemon_recv(void) {
+    int fds[2];
+    if(!ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0))
+        return false;
+    const struct mtrix_daemon_resp resp = {
+        .out_len = 3, .err_len = 4, .status = 1};
+    struct mtrix_daemon_output o = {0};
+    const bool ret = ASSERT(write_all(fds[1], &resp, sizeof(resp)))
+        && ASSERT(write_all(fds[1], "outerr\n", 7))
+        && ASSERT(mtrix_daemon_recv(fds[0], &o))
+        && ASSERT_EQ(o.status, 1)
+        && ASSERT_EQ(o.out.n, 3) && ASSERT_STR_EQ(o.out.p, "out")
+        && ASSERT_EQ(o.err.n, 4) && ASSERT_STR_EQ(o.err.p, "err\n");
+    free(o.out.p);
+    free(o.err.p);
+    close(fds[0]);
+    close(fds[1]);
+    return ret;
+}
+
+static bool test_daemon_recv_timeout(void) {
+    int fds[2];
+    if(!ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0))
+        return false;
+    // The response starts in time, but is never finished.
+    const struct mtrix_daemon_resp resp = {.out_len = 8};
+    struct mtrix_daemon_output o = {0};
+    bool timed_out = false;
+    const bool ret = ASSERT(write_all(fds[1], &resp, sizeof(resp)))
+        && ASSERT(write_all(fds[1], "out", 3))
+        && ASSERT(mtrix_daemon_recv_timeout(fds[0], &o, 100, &timed_out))
+        && ASSERT(timed_out);
+    free(o.out.p);
+    free(o.err.p);
+    close(fds[0]);
+    close(fds[1]);
+    return ret;
+}
+
+static bool test_daemon_send_closed(void) {
+    int fds[2];
+    if(!ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0))
+        return false;
+    close(fds[1]);
+    // Would be killed by `SIGPIPE` otherwise.
+    log_set(tmpfile());
+    const bool ret = ASSERT(!mtrix_daemon_send(fds[0], "ping"));
+    log_set(stderr);
+    close(fds[0]);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_daemon_recv) && ret;
+    ret = RUN(test_daemon_recv_timeout) && ret;
+    ret = RUN(test_daemon_send_closed) && ret;
+    return !ret;
+}
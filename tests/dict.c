@@ -0,0 +1,270 @@
+#include "dict.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+/**
+ * Creates a temporary file with the given contents and opens it.
+ * \param expected Whether the file is expected to be opened successfully.
+ */
+static bool open_tmp_n(
+    struct mtrix_dict *d, const char *contents, size_t n, bool expected
+) {
+    char path[] = "/tmp/machinatrix_test_dict_XXXXXX";
+    const int fd = mkstemp(path);
+    if(!ASSERT_NE(fd, -1))
+        return false;
+    const bool ret = ASSERT(write_all(fd, contents, n))
+        && ASSERT_EQ(mtrix_dict_open(d, path), expected);
+    close(fd);
+    unlink(path);
+    return ret;
+}
+
+static bool open_tmp(
+    struct mtrix_dict *d, const char *contents, bool expected
+) {
+    return open_tmp_n(d, contents, strlen(contents), expected);
+}
+
+static bool check_word(const struct mtrix_dict *d, size_t i, const char *s) {
+    size_t len = 0;
+    const char *const w = mtrix_dict_word(d, i, &len);
+    return ASSERT_EQ(len, strlen(s)) && ASSERT_STR_EQ_N(w, s, len);
+}
+
+static bool test_dict_words(void) {
+    struct mtrix_dict d;
+    if(!open_tmp(&d, "a\nbc\n\ndef\n", true))
+        return false;
+    const bool ret = ASSERT_EQ(d.n, 4)
+        && check_word(&d, 0, "a")
+        && check_word(&d, 1, "bc")
+        && check_word(&d, 2, "")
+        && check_word(&d, 3, "def");
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+static bool test_dict_no_newline(void) {
+    struct mtrix_dict d;
+    if(!open_tmp(&d, "a\nbc", true))
+        return false;
+    const bool ret = ASSERT_EQ(d.n, 2)
+        && check_word(&d, 0, "a")
+        && check_word(&d, 1, "bc");
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+static bool test_dict_empty(void) {
+    struct mtrix_dict d;
+    if(!open_tmp(&d, "", true))
+        return false;
+    const bool ret = ASSERT_EQ(d.n, 0)
+        && ASSERT(mtrix_dict_sample(&d, NULL, 0, NULL));
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+static bool check_letter(
+    const struct mtrix_dict *d, char c, size_t n, const char *const *words
+) {
+    const uint32_t *v = NULL;
+    if(!ASSERT_EQ(mtrix_dict_letter(d, c, &v), n))
+        return false;
+    for(size_t i = 0; i != n; ++i)
+        if(!check_word(d, v[i], words[i]))
+            return false;
+    return true;
+}
+
+static bool test_dict_letter(void) {
+    struct mtrix_dict d;
+    if(!open_tmp(&d, "Abc\nb\n\nabd\nAaa\n0\n", true))
+        return false;
+    const bool ret =
+        check_letter(&d, 'a', 3, (const char *[]){"Abc", "abd", "Aaa"})
+        && check_letter(&d, 'A', 3, (const char *[]){"Abc", "abd", "Aaa"})
+        && check_letter(&d, 'b', 1, (const char *[]){"b"})
+        && check_letter(&d, '0', 1, (const char *[]){"0"})
+        && check_letter(&d, 'c', 0, NULL)
+        && check_letter(&d, '\n', 0, NULL);
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+static bool test_dict_binary(void) {
+    struct mtrix_dict d;
+    if(!open_tmp(&d, "Abc\nb\n\nabd\nAaa\n0", true))
+        return false;
+    char path[] = "/tmp/machinatrix_test_dict_XXXXXX";
+    const int fd = mkstemp(path);
+    if(!ASSERT_NE(fd, -1))
+        return mtrix_dict_close(&d), false;
+    close(fd);
+    struct mtrix_dict b = {0};
+    bool ret = ASSERT(mtrix_dict_save(&d, path))
+        && ASSERT(mtrix_dict_open(&b, path))
+        && ASSERT(!b.index)
+        && ASSERT_EQ(b.n, 6)
+        && ASSERT_EQ(b.size, d.size)
+        && ASSERT(!memcmp(b.p, d.p, d.size))
+        && check_word(&b, 0, "Abc")
+        && check_word(&b, 2, "")
+        && check_word(&b, 5, "0")
+        && check_letter(&b, 'a', 3, (const char *[]){"Abc", "abd", "Aaa"})
+        && check_letter(&b, 'c', 0, NULL);
+    unlink(path);
+    if(b.map)
+        ret = ASSERT(mtrix_dict_close(&b)) && ret;
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+static bool test_dict_binary_invalid(void) {
+    struct mtrix_dict d;
+    log_set(tmpfile());
+    // Header with a valid magic string, all other fields are zero.
+    char h[64] = "MTRXDICT";
+    const uint32_t version = MTRIX_DICT_VERSION;
+    const bool ret = open_tmp_n(&d, h, sizeof(h), false);
+    // Valid version, truncated index.
+    memcpy(h + 8, &version, sizeof(version));
+    return open_tmp_n(&d, h, sizeof(h), false) && ret;
+}
+
+/** Replaces an entry of a binary file, which must then fail to be opened. */
+static bool check_corrupt(char *f, size_t n, size_t pos, uint32_t v) {
+    uint32_t prev;
+    memcpy(&prev, f + pos, sizeof(prev));
+    memcpy(f + pos, &v, sizeof(v));
+    struct mtrix_dict d;
+    const bool ret = open_tmp_n(&d, f, n, false);
+    memcpy(f + pos, &prev, sizeof(prev));
+    return ret;
+}
+
+static bool test_dict_binary_corrupt(void) {
+    struct mtrix_dict d;
+    if(!open_tmp(&d, "Abc\nb\n\nabd\nAaa\n0", true))
+        return false;
+    char path[] = "/tmp/machinatrix_test_dict_XXXXXX";
+    const int fd = mkstemp(path);
+    if(!ASSERT_NE(fd, -1))
+        return mtrix_dict_close(&d), false;
+    close(fd);
+    struct mtrix_dict b = {0};
+    char *f = NULL;
+    size_t n = 0, offsets = 0, by_letter = 0;
+    bool ret = ASSERT(mtrix_dict_save(&d, path))
+        && ASSERT(mtrix_dict_open(&b, path))
+        && ASSERT(f = read_file(path, &n));
+    if(b.map) {
+        offsets = (size_t)((const char*)b.offsets - (const char*)b.map);
+        by_letter = (size_t)((const char*)b.by_letter - (const char*)b.map);
+        ret = ASSERT(mtrix_dict_close(&b)) && ret;
+    }
+    FILE *const log = tmpfile();
+    log_set(log);
+    const size_t o1 = offsets + sizeof(uint32_t);
+    ret = ret
+        // Offset past the end of the word list.
+        && check_corrupt(f, n, o1, 1000)
+        // Offsets which are not increasing.
+        && check_corrupt(f, n, o1, 0)
+        // Index of a word past the end.
+        && check_corrupt(f, n, by_letter, 1000);
+    log_set(stderr);
+    fclose(log);
+    free(f);
+    unlink(path);
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+static bool test_dict_fresh(void) {
+    char src[] = "/tmp/machinatrix_test_dict_XXXXXX";
+    char bin[] = "/tmp/machinatrix_test_dict_XXXXXX";
+    const int src_fd = mkstemp(src), bin_fd = mkstemp(bin);
+    if(!(ASSERT_NE(src_fd, -1) && ASSERT_NE(bin_fd, -1)))
+        return false;
+    close(bin_fd);
+    // A missing file is not an error.
+    unlink(bin);
+    FILE *const log = tmpfile();
+    log_set(log);
+    struct mtrix_dict d = {0}, b = {0};
+    struct mtrix_dict_source s0, s1;
+    bool ret = ASSERT(write_all(src_fd, "a\nb\n", 4))
+        && ASSERT(mtrix_dict_stat(src, &s0))
+        && ASSERT(!mtrix_dict_open_fresh(&b, bin, &s0))
+        && ASSERT_EQ(ftell(log), 0)
+        && ASSERT(mtrix_dict_open(&d, src))
+        && ASSERT(!memcmp(&d.source, &s0, sizeof(s0)))
+        && ASSERT(mtrix_dict_save(&d, bin))
+        && ASSERT(mtrix_dict_open_fresh(&b, bin, &s0))
+        && ASSERT_EQ(b.n, 2)
+        && ASSERT(mtrix_dict_close(&b))
+        // Modifying the word list invalidates the binary file.
+        && ASSERT(write_all(src_fd, "c\n", 2))
+        && ASSERT(mtrix_dict_stat(src, &s1))
+        && ASSERT(!mtrix_dict_open_fresh(&b, bin, &s1));
+    close(src_fd);
+    unlink(src);
+    unlink(bin);
+    if(d.map)
+        ret = ASSERT(mtrix_dict_close(&d)) && ret;
+    return ret;
+}
+
+enum { N = 100 };
+
+/** Checks that a sample of size `k` contains distinct, valid indices. */
+static bool check_sample(
+    const struct mtrix_dict *d, struct mtrix_rng *rng, size_t k
+) {
+    size_t v[N];
+    bool seen[N] = {0};
+    if(!ASSERT(mtrix_dict_sample(d, rng, k, v)))
+        return false;
+    for(size_t i = 0; i != k; ++i) {
+        if(!(ASSERT(v[i] < N) && ASSERT(!seen[v[i]])))
+            return false;
+        seen[v[i]] = true;
+    }
+    return true;
+}
+
+static bool test_dict_sample(void) {
+    char contents[4 * N + 1] = {0};
+    for(size_t i = 0; i != N; ++i)
+        sprintf(contents + 4 * i, "%03zu\n", i);
+    struct mtrix_dict d;
+    if(!open_tmp(&d, contents, true))
+        return false;
+    bool ret = ASSERT_EQ(d.n, N);
+    struct mtrix_rng rng;
+    mtrix_rng_seed(&rng, 0);
+    for(size_t k = 0; ret && k <= N; k += 7)
+        ret = check_sample(&d, &rng, k);
+    // The entire dictionary.
+    ret = ret && check_sample(&d, &rng, N);
+    return ASSERT(mtrix_dict_close(&d)) && ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_dict_words) && ret;
+    ret = RUN(test_dict_no_newline) && ret;
+    ret = RUN(test_dict_empty) && ret;
+    ret = RUN(test_dict_letter) && ret;
+    ret = RUN(test_dict_sample) && ret;
+    ret = RUN(test_dict_binary) && ret;
+    ret = RUN(test_dict_binary_invalid) && ret;
+    ret = RUN(test_dict_binary_corrupt) && ret;
+    ret = RUN(test_dict_fresh) && ret;
+    return !ret;
+}
@@ -0,0 +1,118 @@
+#include "dlpo.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tidybuffio.h>
+
+#include "html.h"
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+/** Reduced copy of a page, see \ref test_definitions. */
+#define PAGE "tests/pages/dlpo_cao.html"
+
+static const char DEFINITIONS[] =
+    "- latim canis, -is & cane.\n"
+    "- de cão (nome)\n";
+
+/**
+ * Extracts the etymologies in \ref PAGE both from a Tidy document and with
+ * \ref html_tokenizer, checking that the results are the same.
+ */
+static bool test_definitions(void) {
+    size_t n = 0;
+    char *const html = read_file(PAGE, &n);
+    if(!ASSERT(html))
+        return false;
+    const TidyDoc doc = parse_html(html);
+    if(!ASSERT(doc))
+        return free(html), false;
+    FILE *const tidy = tmpfile(), *const scan = tmpfile();
+    TidyBuffer buf = {0};
+    const struct html_index *const x = html_index_get(doc);
+    const TidyNode res =
+        find_node_by_id(x, tidyGetRoot(doc), "resultados", true);
+    const TidyNode def = res ? dlpo_find_definitions(x, res) : NULL;
+    bool found = false;
+    const bool ret = ASSERT(def)
+        && (dlpo_print_definitions(tidy, doc, def, &buf), true)
+        && ASSERT(dlpo_scan_definitions(scan, html, n, &found))
+        && ASSERT(found)
+        && CHECK_TEXT(tidy, DEFINITIONS)
+        && CHECK_TEXT(scan, DEFINITIONS);
+    if(buf.bp)
+        tidyBufFree(&buf);
+    fclose(scan);
+    fclose(tidy);
+    html_release(doc);
+    free(html);
+    return ret;
+}
+
+static bool test_definitions_nested(void) {
+    // The inner definition is part of the section of the outer one and is not
+    // printed separately.
+    const char html[] =
+        "<div id=\"resultados\">"
+        "<div class=\"dp-definicao\"><div>"
+        "<p><b>Origem etimológica:</b><span>a</span></p>"
+        "</div></div>"
+        "<div class=\"dp-definicao\"><div>"
+        "<div class=\"dp-definicao\"><div>"
+        "<p><b>Origem etimológica:</b><span>b</span></p>"
+        "</div></div>"
+        "</div></div>"
+        "</div>";
+    const TidyDoc doc = parse_html(html);
+    if(!ASSERT(doc))
+        return false;
+    FILE *const tidy = tmpfile(), *const scan = tmpfile();
+    TidyBuffer buf = {0};
+    const struct html_index *const x = html_index_get(doc);
+    const TidyNode def = dlpo_find_definitions(x, tidyGetRoot(doc));
+    bool found = false;
+    const bool ret = ASSERT(def)
+        && (dlpo_print_definitions(tidy, doc, def, &buf), true)
+        && ASSERT(dlpo_scan_definitions(
+            scan, html, sizeof(html) - 1, &found))
+        && ASSERT(found)
+        && CHECK_TEXT(tidy, "- a\n- b\n")
+        && CHECK_TEXT(scan, "- a\n- b\n");
+    if(buf.bp)
+        tidyBufFree(&buf);
+    fclose(scan);
+    fclose(tidy);
+    html_release(doc);
+    return ret;
+}
+
+static bool test_definitions_none(void) {
+    FILE *const log = tmpfile();
+    log_set(log);
+    const char none[] = "<div id=\"resultados\"><p>Palavra não encontrada</p>";
+    const char invalid[] = "<div id=\"resultado\"></div>";
+    bool found = true;
+    const bool ret =
+        ASSERT(dlpo_scan_definitions(stdout, none, sizeof(none) - 1, &found))
+        && ASSERT(!found)
+        && ASSERT_EQ(ftell(log), 0)
+        && ASSERT(!dlpo_scan_definitions(
+            stdout, invalid, sizeof(invalid) - 1, &found))
+        && CHECK_LOG("element '#resultados' not found\n");
+    log_set(stderr);
+    fclose(log);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_definitions) && ret;
+    ret = RUN(test_definitions_nested) && ret;
+    ret = RUN(test_definitions_none) && ret;
+    return !ret;
+}
@@ -51,8 +51,8 @@ static bool test_find_node_by_class(void) {
         "<div class=\"test\"/>");
     const TidyDoc doc = tidyCreate();
     tidyParseString(doc, html);
-    const TidyNode node =
-        find_node_by_class(tidyGetChild(tidyGetBody(doc)), "test", true);
+    const TidyNode node = find_node_by_class(
+        NULL, tidyGetChild(tidyGetBody(doc)), "test", true);
     bool ret = ASSERT(node);
     const ctmbstr name = node ? tidyNodeGetName(node) : "";
     ret = ASSERT_STR_EQ(name, "div") && ret;
@@ -70,7 +70,8 @@ static bool test_find_node_by_id(void) {
         "<div id=\"test\"/>");
     const TidyDoc doc = tidyCreate();
     tidyParseString(doc, html);
-    const TidyNode node = find_node_by_id(tidyGetBody(doc), "test", false);
+    const TidyNode node =
+        find_node_by_id(NULL, tidyGetBody(doc), "test", false);
     bool ret = ASSERT(node);
     const ctmbstr name = node ? tidyNodeGetName(node) : "";
     ret = ASSERT_STR_EQ(name, "div") && ret;
@@ -91,8 +92,8 @@ static bool test_find_node_by_id_rec(void) {
     const TidyDoc doc = tidyCreate();
     tidyParseString(doc, html);
     const TidyNode first = tidyGetBody(doc);
-    bool ret = ASSERT(!find_node_by_id(first, "test", false));
-    const TidyNode node = find_node_by_id(first, "test", true);
+    bool ret = ASSERT(!find_node_by_id(NULL, first, "test", false));
+    const TidyNode node = find_node_by_id(NULL, first, "test", true);
     ret = ASSERT(node) && ret;
     const ctmbstr name = node ? tidyNodeGetName(node) : "";
     ret = ASSERT_STR_EQ(name, "div") && ret;
@@ -196,6 +197,364 @@ static bool test_print_unescaped(void) {
     return ret;
 }
 
+/**
+ * Scans `s` for a region, as if it were received in chunks of `step` bytes.
+ * \param e Expected region, `NULL` if it is not found.
+ */
+static bool check_region(
+    const struct html_region *tmpl, const char *s, size_t step,
+    const char *e)
+{
+    struct html_region r = *tmpl;
+    html_region_init(&r);
+    const size_t n = strlen(s);
+    bool done = false;
+    size_t i = 0;
+    while(!done && i != n) {
+        i = n - i < step ? n : i + step;
+        done = html_region_scan(&r, s, i);
+    }
+    if(!e)
+        return ASSERT(!done);
+    return ASSERT(done)
+        && ASSERT_EQ(r.end - r.begin, strlen(e))
+        && ASSERT_STR_EQ_N(s + r.begin, e, strlen(e))
+        // Stopped as soon as possible.
+        && ASSERT(i < r.pos + step);
+}
+
+static bool test_html_region_element(void) {
+    const char region[] =
+        "<DIV id=\"r\" class=\"c\">"
+            "<div>a<br/>b</div><divx>c</divx><!-- </div> -->"
+            "<p id=\"x\">d</p>"
+        "</div >";
+    const char html[] = HTML(
+        "<div id=\"q\"><div>" "<p>id=\"r\"</p>" "</div>" "</div>"
+        "%s<div>e</div>");
+    char s[sizeof(html) + sizeof(region)];
+    snprintf(s, sizeof(s), html, region);
+    const struct html_region r = {.element = "id=\"r\""};
+    bool ret = true;
+    for(size_t step = 1; ret && step != sizeof(s); ++step)
+        ret = check_region(&r, s, step, region);
+    return ret;
+}
+
+static bool test_html_region_prefix(void) {
+    const char html[] = HTML(
+        "<p>\"h2\"</p>"
+        "<h2 id=\"A\">A</h2><p>\"h2\"</p><h3 id=\"B\">B</h3>"
+        "<div class=\"h2\"><h2 id=\"C\">C</h2></div>"
+        "<div class=\"h2\"><h2 id=\"D\">D</h2></div>");
+    char e[sizeof(html)] = {0};
+    memcpy(e, html, (size_t)(strstr(html, "<div") - html));
+    const struct html_region r = {.after = "id=\"A\"", .until = "\"h2\""};
+    const struct html_region none = {.after = "id=\"E\"", .until = "\"h2\""};
+    bool ret = true;
+    for(size_t step = 1; ret && step != sizeof(html); ++step)
+        ret = check_region(&r, html, step, e)
+            && check_region(&none, html, step, NULL);
+    return ret;
+}
+
+/** Appends all nodes of a tree to `v`, in document order. */
+static void collect_nodes(TidyNode node, TidyNode *v, size_t *n, size_t max) {
+    for(; node && *n != max; node = tidyGetNext(node)) {
+        v[(*n)++] = node;
+        collect_nodes(tidyGetChild(node), v, n, max);
+    }
+}
+
+/**
+ * Checks that searches from every node of a document have the same results
+ * with and without its index.
+ */
+static bool check_index(
+    TidyDoc doc, const char *const *ids, const char *const *classes)
+{
+    const struct html_index *const x = html_index_get(doc);
+    if(!ASSERT(x))
+        return false;
+    TidyNode v[256];
+    size_t n = 0;
+    collect_nodes(tidyGetRoot(doc), v, &n, sizeof(v) / sizeof(*v));
+    bool ret = ASSERT_EQ(n, x->n_nodes);
+    for(size_t i = 0; ret && i != n; ++i)
+        for(int rec = 0; ret && rec != 2; ++rec) {
+            for(const char *const *id = ids; ret && *id; ++id)
+                ret = ASSERT_EQ(
+                    find_node_by_id(x, v[i], *id, rec),
+                    find_node_by_id(NULL, v[i], *id, rec));
+            for(const char *const *c = classes; ret && *c; ++c)
+                ret = ASSERT_EQ(
+                    find_node_by_class(x, v[i], *c, rec),
+                    find_node_by_class(NULL, v[i], *c, rec));
+        }
+    return ret;
+}
+
+static bool test_html_index(void) {
+    const TidyDoc doc = parse_html(HTML(
+        "<div id=\"a\" class=\"x  y\">"
+            "<p class=\"y\">1<span class=\"x\" id=\"b\">2</span></p>"
+            "<p id=\"a\">3</p>text"
+            "<ul class=\"z\"><li class=\"x x\">4</li>"
+                "<li id=\"c\" class=\"y\"><b class=\"z\">5</b></li></ul>"
+        "</div>"
+        "<div class=\"y\"><p class=\"x\">6</p></div>"
+        "<p id=\"b\" class=\"z\">7</p>"));
+    const char *const ids[] = {"a", "b", "c", "d", "", NULL};
+    const char *const classes[] = {"x", "y", "z", "w", "x  y", "", NULL};
+    const bool ret = check_index(doc, ids, classes);
+    html_release(doc);
+    return ret;
+}
+
+static bool test_html_index_other(void) {
+    const char html[] = HTML("<div id=\"a\"><p class=\"x\">1</p></div>");
+    const TidyDoc doc = parse_html(html);
+    const TidyDoc other = tidyCreate();
+    tidyParseString(other, html);
+    // Nodes of other documents are searched without the index.
+    const struct html_index *const x = html_index_get(doc);
+    const TidyNode a = find_node_by_id(x, tidyGetRoot(other), "a", true);
+    const bool ret = ASSERT(x) && ASSERT(a) && ASSERT(!html_index_get(other))
+        && ASSERT_EQ(
+            find_node_by_class(x, a, "x", true),
+            find_node_by_class(NULL, a, "x", true))
+        && ASSERT(find_node_by_class(x, a, "x", true));
+    tidyRelease(other);
+    html_release(doc);
+    return ret;
+}
+
+/** Appends the ID (or the name) of an element, see \ref html_select_f. */
+static bool append_id(void *data, TidyNode node) {
+    char *const s = data;
+    const TidyAttr a = find_attr(node, "id");
+    if(*s)
+        strcat(s, " ");
+    strcat(s, a ? tidyAttrValue(a) : tidyNodeGetName(node));
+    return true;
+}
+
+/**
+ * Checks the IDs of the elements which match `sel` in a tree, both with and
+ * without the index of the document.
+ */
+static bool check_select(
+    const struct html_index *x, TidyNode node, const char *sel,
+    const char *expected)
+{
+    struct html_selector s;
+    char ids[256] = "", indexed[256] = "";
+    return ASSERT(html_selector_compile(&s, sel))
+        && ASSERT(html_select(NULL, &s, node, append_id, ids))
+        && ASSERT_STR_EQ(ids, expected)
+        && ASSERT(html_select(x, &s, node, append_id, indexed))
+        && ASSERT_STR_EQ(indexed, expected);
+}
+
+static bool test_html_selector_compile(void) {
+    FILE *const log = tmpfile();
+    log_set(log);
+    struct html_selector s;
+    bool ret = ASSERT(!html_selector_compile(&s, "> p"))
+        && CHECK_LOG("invalid selector: > p\n");
+    const char *const invalid[] = {
+        "", " ", "p >", "p > > a", "p >> a", "#", ".", "p.", "p#a#b",
+        ".a.b.c.d.e", "p,a", "p:first", "[id]", "[id=a]", "[id^=a", "[^=a]",
+        "[id^=\"a]", "[id^=a][id^=b][id^=c]", "a b c d e f g h i",
+    };
+    for(size_t i = 0; i != sizeof(invalid) / sizeof(*invalid); ++i)
+        ret = ASSERT(!html_selector_compile(&s, invalid[i])) && ret;
+    log_set(stderr);
+    fclose(log);
+    if(!(ret = ASSERT(html_selector_compile(
+            &s, "  DIV#a.b.c[id^=\"x y\"] >p [data-x^='']\n.d  "))))
+        return false;
+    const char *const str = s.strings;
+    const struct html_compound *const c = s.v;
+    return ASSERT_EQ(s.n, 4)
+        && ASSERT_STR_EQ(str + c[0].name, "div")
+        && ASSERT_STR_EQ(str + c[0].id, "a")
+        && ASSERT_EQ(c[0].n_classes, 2)
+        && ASSERT_STR_EQ(str + c[0].class_names[1], "c")
+        && ASSERT_EQ(c[0].classes[1], mtrix_hash_str("c"))
+        && ASSERT_EQ(c[0].n_attrs, 1)
+        && ASSERT_STR_EQ(str + c[0].attrs[0].name, "id")
+        && ASSERT_STR_EQ(str + c[0].attrs[0].prefix, "x y")
+        && ASSERT(!c[0].child)
+        && ASSERT(c[1].child) && ASSERT_STR_EQ(str + c[1].name, "p")
+        && ASSERT(!c[2].child) && ASSERT(!c[2].name)
+        && ASSERT_STR_EQ(str + c[2].attrs[0].prefix, "")
+        && ASSERT(!c[3].child) && ASSERT(!c[3].name)
+        && ASSERT_STR_EQ(str + c[3].class_names[0], "d");
+}
+
+static bool test_html_select(void) {
+    const TidyDoc doc = parse_html(HTML(
+        "<div id=\"d1\" class=\"x y\">"
+            "<p id=\"p1\" class=\"y\">1<span id=\"s1\" class=\"x\">2</span></p>"
+            "<ul id=\"u1\" class=\"z\"><li id=\"l1\" class=\"x\">3</li>"
+                "<li id=\"l2\" class=\"y\"><b id=\"b1\" class=\"z\">4</b></li>"
+            "</ul>"
+        "</div>"
+        "<div id=\"d2\" class=\"y\"><div id=\"d3\">"
+            "<p id=\"p2\" class=\"x\">5</p></div></div>"
+        "<p id=\"p3\" class=\" y  x \">6</p>"));
+    const struct html_index *const x = html_index_get(doc);
+    const TidyNode body = tidyGetBody(doc),
+        d2 = find_node_by_id(x, body, "d2", false);
+    struct html_selector s;
+    const bool ret = check_select(x, body, "p", "p1 p2 p3")
+        && check_select(x, body, "*", "body d1 p1 s1 u1 l1 l2 b1 d2 d3 p2 p3")
+        && check_select(x, body, "body > *", "d1 d2 p3")
+        && check_select(x, body, "div > p", "p1 p2")
+        && check_select(x, body, "div.y > p", "p1")
+        && check_select(x, body, "div.y p", "p1 p2")
+        && check_select(x, body, ".x.y", "d1 p3")
+        && check_select(x, body, ".y .x", "s1 l1 p2")
+        && check_select(x, body, "div div p", "p2")
+        && check_select(x, body, "div > div > p", "p2")
+        && check_select(x, body, "div > p span", "s1")
+        && check_select(x, body, "div > ul > li > b.z", "b1")
+        && check_select(x, body, "[id^=p]", "p1 p2 p3")
+        && check_select(x, body, "li[id^=l2]", "l2")
+        && check_select(x, body, ".y [id^=l][id^=l1]", "l1")
+        && check_select(x, body, "table", "")
+        && check_select(x, body, ".w", "")
+        && check_select(x, body, "#d2 p", "p2")
+        && check_select(x, body, "#d2 > p", "")
+        && check_select(x, body, ".x .x", "s1 l1")
+        && check_select(x, body, ".y .z", "u1 b1")
+        && check_select(x, body, ".y > .x", "s1")
+        && check_select(x, body, ".z > li > .z", "b1")
+        && check_select(x, body, "li .w", "")
+        // Only the tree of the node is searched.
+        && ASSERT(d2)
+        && check_select(x, d2, ".x", "p2")
+        && check_select(x, d2, "body p", "")
+        && ASSERT(html_selector_compile(&s, ".x"))
+        && ASSERT_EQ(html_select_first(x, &s, body), tidyGetChild(body))
+        && ASSERT_EQ(html_select_first(x, &s, tidyGetChild(d2)),
+            tidyGetChild(tidyGetChild(d2)))
+        && ASSERT(html_selector_compile(&s, "ol"))
+        && ASSERT(!html_select_first(x, &s, body));
+    html_release(doc);
+    return ret;
+}
+
+/** Writes the tokens of `html` in a compact form, see \ref check_tokens. */
+static void print_tokens(FILE *f, const char *html) {
+    struct html_tokenizer z;
+    html_tokenizer_init(&z, html, strlen(html));
+    for(struct html_token t; html_tokenizer_next(&z, &t);)
+        switch(t.type) {
+        case HTML_TOKEN_START: fprintf(f, "<%s>", t.name); break;
+        case HTML_TOKEN_END: fprintf(f, "</%s>", t.name); break;
+        case HTML_TOKEN_TEXT: fprintf(f, "%.*s", (int)t.text_len, t.text);
+        }
+}
+
+/**
+ * Checks the tokens of `html`.  Each start and end tag produced is written
+ * without attributes, so `expected` is the normalized document.
+ */
+static bool check_tokens(const char *html, const char *expected) {
+    FILE *const f = tmpfile();
+    print_tokens(f, html);
+    const bool ret = CHECK_TEXT(f, expected);
+    fclose(f);
+    return ret;
+}
+
+static bool test_html_tokenizer(void) {
+    return check_tokens(
+            HTML("<DIV><p>a<P>b<br>c<img src=x/></div>"),
+            "<html><head><title>title</title></head><body>"
+            "<div><p>a</p><p>b<br></br>c<img></img></p></div>"
+            "</body></html>")
+        && check_tokens(
+            "<ul><li>a<li>b<ul><li>c</ul><li>d</ul>"
+            "<dl><dt>t<dd>d<dt>u</dl>",
+            "<ul><li>a</li><li>b<ul><li>c</li></ul></li><li>d</li></ul>"
+            "<dl><dt>t</dt><dd>d</dd><dt>u</dt></dl>")
+        && check_tokens(
+            "<table><tr><td>1<td>2<tr><th>3</table><p>x<div>y</div>",
+            "<table><tr><td>1</td><td>2</td></tr><tr><th>3</th></tr></table>"
+            "<p>x</p><div>y</div>")
+        && check_tokens("<br/><span/>x", "<br></br><span></span>x");
+}
+
+static bool test_html_tokenizer_recovery(void) {
+    return check_tokens(
+            "<b><i>x</b>y</i></span><p>z",
+            "<b><i>x</i></b>y<p>z</p>")
+        && check_tokens(
+            "a <3 b</ c><!-- <p> --><!DOCTYPE x><?x?>d",
+            "a <3 bd")
+        && check_tokens(
+            "<script>if(a<b && \"</p>\")</script><title><b></title>"
+            "<style></style>",
+            "<script>if(a<b && \"</p>\")</script><title><b></title>"
+            "<style></style>")
+        && check_tokens("<div><p>x<span", "<div><p>x<span></span></p></div>");
+}
+
+static bool test_html_tokenizer_find(void) {
+    const char html[] = HTML(
+        "<div class=\"a\"><p id=x>1</p></div>"
+        "<div id='y' class=' b  c '><p class=c>2</p><p id=\"x\">3</p></div>"
+        "<p id=x class=c>4</p>");
+    struct html_tokenizer z;
+    struct html_token t;
+    struct mtrix_buffer b = {0};
+    html_tokenizer_init(&z, html, strlen(html));
+    bool ret = ASSERT(html_tokenizer_find(&z, &t, 0, "y", "c"))
+        && ASSERT_STR_EQ(t.name, "div")
+        && ASSERT(html_token_has_class(&t, "b"))
+        && ASSERT(!html_token_has_class(&t, "a"))
+        && ASSERT(html_token_has_id_prefix(&t, ""))
+        && ASSERT(!html_token_has_id_prefix(&t, "yy"));
+    const size_t d = t.depth;
+    ret = ret
+        && ASSERT(html_tokenizer_find(&z, &t, d, "x", NULL))
+        && ASSERT(html_tokenizer_text(&z, &t, &b))
+        && ASSERT_EQ(b.n, 1) && ASSERT_STR_EQ(b.p, "3")
+        // The search does not leave the element.
+        && ASSERT(!html_tokenizer_find(&z, &t, d, "x", NULL))
+        && ASSERT_EQ(z.depth, d - 1)
+        && ASSERT(html_tokenizer_find(&z, &t, 0, "x", "c"))
+        && ASSERT(html_tokenizer_next(&z, &t))
+        && ASSERT_EQ(t.type, HTML_TOKEN_TEXT)
+        && ASSERT_EQ(t.text_len, 1) && ASSERT_EQ(*t.text, '4');
+    html_tokenizer_skip(&z, 0);
+    ret = ret && ASSERT(!html_tokenizer_next(&z, &t));
+    free(b.p);
+    return ret;
+}
+
+static bool test_html_tokenizer_text(void) {
+    const char html[] = HTML(
+        "<div id=d>\n  <p>a &amp;\n b&#91;1&#x5d;&lt;&gt;</p>"
+        "<ul><li>c&nbsp;d\xc2\xa0" "e</li><li>&quot;&apos;&#233;&unk;&</li>"
+        "</ul><b>f</b>g\n</div>");
+    struct html_tokenizer z;
+    struct html_token t;
+    struct mtrix_buffer b = {0};
+    html_tokenizer_init(&z, html, strlen(html));
+    const bool ret = ASSERT(html_tokenizer_find(&z, &t, 0, "d", NULL))
+        && ASSERT(html_tokenizer_text(&z, &t, &b))
+        && ASSERT_STR_EQ(b.p, "a & b[1]<> c d e \"'\xc3\xa9&unk;& fg")
+        && ASSERT(html_tokenizer_next(&z, &t))
+        && ASSERT_EQ(t.type, HTML_TOKEN_END)
+        && ASSERT_STR_EQ(t.name, "body");
+    free(b.p);
+    return ret;
+}
+
 int main(void) {
     bool ret = true;
     ret = RUN(test_find_node_by_name) && ret;
@@ -207,5 +566,15 @@ int main(void) {
     ret = RUN(test_find_attr) && ret;
     ret = RUN(test_trim_tag) && ret;
     ret = RUN(test_print_unescaped) && ret;
+    ret = RUN(test_html_region_element) && ret;
+    ret = RUN(test_html_region_prefix) && ret;
+    ret = RUN(test_html_index) && ret;
+    ret = RUN(test_html_index_other) && ret;
+    ret = RUN(test_html_selector_compile) && ret;
+    ret = RUN(test_html_select) && ret;
+    ret = RUN(test_html_tokenizer) && ret;
+    ret = RUN(test_html_tokenizer_recovery) && ret;
+    ret = RUN(test_html_tokenizer_find) && ret;
+    ret = RUN(test_html_tokenizer_text) && ret;
     return !ret;
 }
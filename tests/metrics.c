@@ -0,0 +1,140 @@
+#include "metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "socket.h"
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+static bool print(const struct mtrix_metrics *m, char **out) {
+    size_t len = 0;
+    FILE *const f = open_memstream(out, &len);
+    return ASSERT(f)
+        && ASSERT(mtrix_metrics_print(m, f))
+        && ASSERT_EQ(fclose(f), 0);
+}
+
+static bool test_counter(void) {
+    struct mtrix_counter c = {.name = "test_total", .help = "Test counter."};
+    struct mtrix_counter g =
+        {.name = "test_peak", .help = "Test gauge.", .gauge = true};
+    mtrix_counter_inc(&c);
+    mtrix_counter_add(&c, 2);
+    const bool max =
+        ASSERT(mtrix_counter_max(&g, 5))
+        && ASSERT(!mtrix_counter_max(&g, 4))
+        && ASSERT_EQ(mtrix_counter_get(&g), 5);
+    struct mtrix_counter *const counters[] = {&c, &g, NULL};
+    struct mtrix_histogram *const histograms[] = {NULL};
+    const struct mtrix_metrics m = {counters, histograms};
+    char *s = NULL;
+    const bool ret = max && print(&m, &s) && ASSERT_STR_EQ(s,
+        "# HELP test_total Test counter.\n"
+        "# TYPE test_total counter\n"
+        "test_total 3\n"
+        "# HELP test_peak Test gauge.\n"
+        "# TYPE test_peak gauge\n"
+        "test_peak 5\n");
+    free(s);
+    return ret;
+}
+
+static bool test_histogram(void) {
+    struct mtrix_histogram h =
+        {.name = "test_seconds", .help = "Test histogram."};
+    mtrix_histogram_observe(&h, 0);
+    mtrix_histogram_observe(&h, 5);
+    mtrix_histogram_observe(&h, 6);
+    mtrix_histogram_observe(&h, 1500);
+    mtrix_histogram_observe(&h, 100000);
+    struct mtrix_counter *const counters[] = {NULL};
+    struct mtrix_histogram *const histograms[] = {&h, NULL};
+    const struct mtrix_metrics m = {counters, histograms};
+    char *s = NULL;
+    const bool ret = print(&m, &s) && ASSERT_STR_EQ(s,
+        "# HELP test_seconds Test histogram.\n"
+        "# TYPE test_seconds histogram\n"
+        "test_seconds_bucket{le=\"0.005\"} 2\n"
+        "test_seconds_bucket{le=\"0.01\"} 3\n"
+        "test_seconds_bucket{le=\"0.025\"} 3\n"
+        "test_seconds_bucket{le=\"0.05\"} 3\n"
+        "test_seconds_bucket{le=\"0.1\"} 3\n"
+        "test_seconds_bucket{le=\"0.25\"} 3\n"
+        "test_seconds_bucket{le=\"0.5\"} 3\n"
+        "test_seconds_bucket{le=\"1\"} 3\n"
+        "test_seconds_bucket{le=\"2.5\"} 4\n"
+        "test_seconds_bucket{le=\"5\"} 4\n"
+        "test_seconds_bucket{le=\"10\"} 4\n"
+        "test_seconds_bucket{le=\"30\"} 4\n"
+        "test_seconds_bucket{le=\"60\"} 4\n"
+        "test_seconds_bucket{le=\"+Inf\"} 5\n"
+        "test_seconds_sum 101.511\n"
+        "test_seconds_count 5\n");
+    free(s);
+    return ret;
+}
+
+static bool test_server(void) {
+    char path[] = "/tmp/machinatrix_test_metrics_XXXXXX";
+    const int tmp = mkstemp(path);
+    if(!ASSERT_NE(tmp, -1))
+        return false;
+    close(tmp);
+    unlink(path);
+    struct mtrix_counter c = {.name = "test_total", .help = "Test counter."};
+    mtrix_counter_add(&c, 42);
+    struct mtrix_counter *const counters[] = {&c, NULL};
+    struct mtrix_histogram *const histograms[] = {NULL};
+    const struct mtrix_metrics m = {counters, histograms};
+    struct mtrix_metrics_server s;
+    const int fd = mtrix_socket_listen_unix(path, 1);
+    if(!(ASSERT_NE(fd, -1) && ASSERT(mtrix_metrics_server_start(&s, &m, fd))))
+        return false;
+    bool ret = false;
+    const int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strcpy(addr.sun_path, path);
+    if(!ASSERT_NE(client, -1))
+        goto end;
+    if(!ASSERT_NE(
+            connect(client, (const struct sockaddr*)&addr, sizeof(addr)), -1))
+        goto end;
+    const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    if(!ASSERT_EQ(write(client, req, sizeof(req) - 1), sizeof(req) - 1))
+        goto end;
+    shutdown(client, SHUT_WR);
+    char buffer[1024] = {0};
+    size_t n = 0;
+    for(ssize_t r; (r = read(client, buffer + n, sizeof(buffer) - 1 - n)) > 0;)
+        n += (size_t)r;
+    const char expected[] =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: 72\r\n\r\n"
+        "# HELP test_total Test counter.\n"
+        "# TYPE test_total counter\n"
+        "test_total 42\n";
+    ret = ASSERT_STR_EQ(buffer, expected);
+end:
+    if(client != -1)
+        close(client);
+    ret = ASSERT(mtrix_metrics_server_stop(&s)) && ret;
+    unlink(path);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_counter) && ret;
+    ret = RUN(test_histogram) && ret;
+    ret = RUN(test_server) && ret;
+    return !ret;
+}
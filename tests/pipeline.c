@@ -0,0 +1,108 @@
+#include "pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+struct test_data {
+    /** Number of items to produce. */
+    size_t n;
+    /** Number of items produced so far. */
+    size_t read;
+    /** Number of items consumed so far. */
+    size_t written;
+    /** Index of the item for which the writer returns `false`. */
+    size_t stop_at;
+    /** Whether all items were consumed in order. */
+    bool ordered;
+};
+
+static enum mtrix_pipeline_read read_item(
+    void *data, struct mtrix_pipeline_item *item
+) {
+    struct test_data *const d = data;
+    if(d->read == d->n)
+        return MTRIX_PIPELINE_END;
+    free(item->in.p);
+    item->in = (struct mtrix_buffer){0};
+    const size_t i = d->read++;
+    mtrix_buffer_append((const char*)&i, sizeof(i), 1, &item->in);
+    return MTRIX_PIPELINE_ITEM;
+}
+
+static bool process_item(void *data, struct mtrix_pipeline_item *item) {
+    (void)data;
+    size_t i;
+    memcpy(&i, item->in.p, sizeof(i));
+    // Finish out of order.
+    nanosleep(&(struct timespec){.tv_nsec = (long)(i % 7) * 100000}, NULL);
+    i *= 2;
+    mtrix_buffer_append((const char*)&i, sizeof(i), 1, &item->out);
+    return true;
+}
+
+static bool write_item(void *data, struct mtrix_pipeline_item *item) {
+    struct test_data *const d = data;
+    size_t i;
+    memcpy(&i, item->out.p, sizeof(i));
+    d->ordered = d->ordered && item->ok
+        && item->seq == d->written && i == 2 * d->written;
+    return d->written++ != d->stop_at;
+}
+
+static bool test_pipeline_order(void) {
+    struct test_data d = {.n = 1000, .stop_at = SIZE_MAX, .ordered = true};
+    const struct mtrix_pipeline p = {
+        .n_workers = 8,
+        .data = &d,
+        .read = read_item,
+        .process = process_item,
+        .write = write_item,
+    };
+    return ASSERT(mtrix_pipeline_run(&p))
+        && ASSERT_EQ(d.read, d.n)
+        && ASSERT_EQ(d.written, d.n)
+        && ASSERT(d.ordered);
+}
+
+static bool test_pipeline_empty(void) {
+    struct test_data d = {.stop_at = SIZE_MAX, .ordered = true};
+    const struct mtrix_pipeline p = {
+        .n_workers = 2,
+        .data = &d,
+        .read = read_item,
+        .process = process_item,
+        .write = write_item,
+    };
+    return ASSERT(mtrix_pipeline_run(&p))
+        && ASSERT_EQ(d.written, 0);
+}
+
+static bool test_pipeline_stop(void) {
+    struct test_data d = {.n = 1000, .stop_at = 10, .ordered = true};
+    const struct mtrix_pipeline p = {
+        .n_workers = 4,
+        .data = &d,
+        .read = read_item,
+        .process = process_item,
+        .write = write_item,
+    };
+    return ASSERT(!mtrix_pipeline_run(&p))
+        && ASSERT_EQ(d.written, 11)
+        && ASSERT(d.read < d.n)
+        && ASSERT(d.ordered);
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_pipeline_order) && ret;
+    ret = RUN(test_pipeline_empty) && ret;
+    ret = RUN(test_pipeline_stop) && ret;
+    return !ret;
+}
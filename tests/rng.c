@@ -0,0 +1,68 @@
+#include "rng.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+static bool test_rng_seed(void) {
+    struct mtrix_rng r;
+    mtrix_rng_seed(&r, 0);
+    return ASSERT_EQ(mtrix_rng_next(&r), UINT64_C(0x99ec5f36cb75f2b4))
+        && ASSERT_EQ(mtrix_rng_next(&r), UINT64_C(0xbf6e1f784956452a))
+        && ASSERT_EQ(mtrix_rng_next(&r), UINT64_C(0x1a5f849d4933e6e0));
+}
+
+static bool test_rng_init(void) {
+    struct mtrix_rng r0, r1;
+    mtrix_rng_init(&r0);
+    mtrix_rng_init(&r1);
+    return ASSERT(memcmp(&r0, &r1, sizeof(r0)));
+}
+
+static bool test_rng_below(void) {
+    enum { N = 6, DRAWS = 60000 };
+    struct mtrix_rng r;
+    mtrix_rng_seed(&r, 1);
+    size_t count[N] = {0};
+    for(size_t i = 0; i != DRAWS; ++i) {
+        const uint64_t x = mtrix_rng_below(&r, N);
+        if(!ASSERT(x < N))
+            return false;
+        ++count[x];
+    }
+    // Very loose bounds, only meant to catch gross errors.
+    for(size_t i = 0; i != N; ++i)
+        if(!(ASSERT(count[i] > DRAWS / N * 9 / 10)
+                && ASSERT(count[i] < DRAWS / N * 11 / 10)))
+            return false;
+    return ASSERT_EQ(mtrix_rng_below(&r, 1), 0);
+}
+
+static bool test_rng_below_large(void) {
+    struct mtrix_rng r;
+    mtrix_rng_seed(&r, 2);
+    // Values close to the limit of the range exercise the rejection path.
+    const uint64_t n = UINT64_MAX / 2 + 2;
+    bool high = false;
+    for(size_t i = 0; i != 1000; ++i) {
+        const uint64_t x = mtrix_rng_below(&r, n);
+        if(!ASSERT(x < n))
+            return false;
+        high = high || x > n / 2;
+    }
+    return ASSERT(high);
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_rng_seed) && ret;
+    ret = RUN(test_rng_init) && ret;
+    ret = RUN(test_rng_below) && ret;
+    ret = RUN(test_rng_below_large) && ret;
+    return !ret;
+}
@@ -0,0 +1,185 @@
+/**
+ * \file
+ * Compares \ref html_select with the equivalent chain of `find_node_*` calls,
+ * for the items of the translation elements of a Wiktionary page (see
+ * \ref wikt_print_translation).
+ *
+ * Usage: `tests/select_bench [page.html]`.  Without a file, a page with
+ * \ref FRAMES translation elements is generated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tidybuffio.h>
+
+#include "html.h"
+#include "utils.h"
+
+const char *PROG_NAME = "select_bench";
+const char *CMD_NAME = NULL;
+
+enum {
+    /** Number of translation elements in the generated page. */
+    FRAMES = 400,
+    /** Number of items in each list of a translation element. */
+    ITEMS = 20,
+    /** Number of times each method is executed, the fastest is reported. */
+    REPS = 20,
+    /** Maximum number of translation elements. */
+    MAX_FRAMES = 4096,
+};
+
+/** Selector used by \ref wikt_print_translation. */
+#define ITEMS_SELECTOR \
+    "table.translations > tbody .translations-cell > ul > li"
+
+/** Translation elements of the page. */
+struct frames {
+    TidyNode v[MAX_FRAMES];
+    size_t n;
+};
+
+/** Generates a page similar to those of Wiktionary. */
+static void generate(struct mtrix_buffer *b) {
+#define APPEND(s) mtrix_buffer_append((s), 1, strlen(s), b)
+    char s[256];
+    APPEND("<html><body><div id=\"mw-content-text\">");
+    for(int i = 0; i != FRAMES; ++i) {
+        snprintf(
+            s, sizeof(s), "<div class=\"NavFrame\" id=\"Translations-%d\">"
+            "<div class=\"NavHead\">sense %d</div><div class=\"NavContent\">"
+            "<table class=\"translations\"><tbody><tr>", i, i);
+        APPEND(s);
+        for(int c = 0; c != 2; ++c) {
+            APPEND(
+                "<td class=\"translations-cell multicolumn-list\"><ul>");
+            for(int j = 0; j != ITEMS; ++j) {
+                snprintf(
+                    s, sizeof(s), "<li>Lang%d: <span class=\"Latn\">"
+                    "<a href=\"/wiki/w\">word%d</a></span> "
+                    "<span class=\"gender\"><abbr>m</abbr></span></li>",
+                    j, j);
+                APPEND(s);
+            }
+            APPEND("</ul></td><td class=\"translations-gap\"></td>");
+        }
+        APPEND("</tr></tbody></table></div></div>");
+    }
+    APPEND("</div></body></html>");
+#undef APPEND
+}
+
+/** Reads a page from a file. */
+static bool read_page(const char *path, struct mtrix_buffer *b) {
+    FILE *const f = fopen(path, "r");
+    if(!f)
+        return log_errno("fopen: %s", path), false;
+    char buffer[4096];
+    for(size_t n; (n = fread(buffer, 1, sizeof(buffer), f));)
+        mtrix_buffer_append(buffer, 1, n, b);
+    const bool ret = !ferror(f);
+    if(!ret)
+        log_errno("fread: %s", path);
+    fclose(f);
+    return ret;
+}
+
+/** Adds an element to a \ref frames object, see \ref html_select_f. */
+static bool add_frame(void *data, TidyNode node) {
+    struct frames *const v = data;
+    if(v->n == MAX_FRAMES)
+        return false;
+    v->v[v->n++] = node;
+    return true;
+}
+
+/** Counts the elements found, see \ref html_select_f. */
+static bool count(void *data, TidyNode node) {
+    (void)node;
+    ++*(size_t*)data;
+    return true;
+}
+
+/** Counts the items of a translation element with `find_node_*`. */
+static size_t chain(const struct html_index *x, TidyNode n) {
+    if(!((n = find_node_by_class(x, n, "translations", true))
+        && (n = find_node_by_name(n, "table"))
+        && (n = tidyGetChild(n))
+        && (n = find_node_by_name(n, "tbody"))
+    ))
+        return 0;
+    size_t ret = 0;
+    for(; (n = find_node_by_class(x, n, "translations-cell", true));
+            n = tidyGetNext(n)) {
+        TidyNode li = n;
+        if((li = tidyGetChild(li)) && (li = tidyGetChild(li)))
+            for(; li; li = tidyGetNext(li))
+                ++ret;
+    }
+    return ret;
+}
+
+/** Current time in milliseconds. */
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec * 1e3 + (double)t.tv_nsec * 1e-6;
+}
+
+/**
+ * Times one method.
+ * \param mode `0` for \ref chain, `1` for \ref html_select without the index,
+ *             `2` with the index.
+ */
+static void bench(
+    const char *name, int mode, const struct html_index *x,
+    const struct html_selector *s, const struct frames *frames)
+{
+    double best = 0;
+    size_t n = 0;
+    for(int r = 0; r != REPS; ++r) {
+        n = 0;
+        const double t0 = now();
+        for(size_t i = 0; i != frames->n; ++i) {
+            const TidyNode frame = frames->v[i];
+            if(!mode)
+                n += chain(x, frame);
+            else
+                html_select(mode == 2 ? x : NULL, s, frame, count, &n);
+        }
+        const double t = now() - t0;
+        if(!r || t < best)
+            best = t;
+    }
+    printf("%-18s %10.3f ms %8zu items\n", name, best, n);
+}
+
+int main(int argc, char **argv) {
+    log_set(stderr);
+    struct mtrix_buffer b = {0};
+    if(argc < 2)
+        generate(&b);
+    else if(!read_page(argv[1], &b))
+        return 1;
+    const TidyDoc doc = parse_html(b.p);
+    free(b.p);
+    const struct html_index *const x = html_index_get(doc);
+    struct html_selector frame, items;
+    struct frames *const frames = calloc(1, sizeof(*frames));
+    const bool ret = x && frames
+        && html_selector_compile(&frame, ".NavFrame")
+        && html_selector_compile(&items, ITEMS_SELECTOR);
+    if(ret) {
+        html_select(x, &frame, tidyGetBody(doc), add_frame, frames);
+        printf(
+            "%zu translation elements, %zu nodes\n", frames->n, x->n_nodes);
+        bench("find_node chain", 0, x, &items, frames);
+        bench("html_select", 1, x, &items, frames);
+        bench("html_select+index", 2, x, &items, frames);
+    }
+    free(frames);
+    html_release(doc);
+    return !ret;
+}
@@ -261,6 +261,24 @@ static bool test_mtrix_buffer_append(void) {
     return ret;
 }
 
+static bool test_mtrix_buffer_append_max(void) {
+    log_set(tmpfile());
+    struct mtrix_buffer b = {.max = 4};
+    bool ret = ASSERT_EQ(mtrix_buffer_append("01", 1, 2, &b), 2);
+    ret = ASSERT(!mtrix_buffer_full(&b)) && ret;
+    ret = ASSERT_EQ(mtrix_buffer_append("234", 1, 3, &b), 0) && ret;
+    ret = ASSERT_EQ(b.n, 4) && ret;
+    ret = ASSERT_STR_EQ(b.p, "0123") && ret;
+    ret = ASSERT(mtrix_buffer_full(&b)) && ret;
+    ret = ASSERT_EQ(mtrix_buffer_append("4", 1, 1, &b), 0) && ret;
+    ret = ASSERT_EQ(b.n, 4) && ret;
+    free(b.p);
+    return ret
+        && CHECK_LOG(
+            "buffer size limit reached (4)\n"
+            "buffer size limit reached (4)\n");
+}
+
 static bool test_build_url_too_long(void) {
     log_set(tmpfile());
     char buf[MTRIX_MAX_URL_LEN * 2], input[MTRIX_MAX_URL_LEN + 1];
@@ -282,6 +300,22 @@ static bool test_build_url(void) {
     return ASSERT_STR_EQ_N(buf, expected, sizeof(expected)) && ret;
 }
 
+static bool test_url_escape(void) {
+    char buf[MTRIX_MAX_URL_LEN];
+    return ASSERT(url_escape(buf, "C++ a&b#c%d/é-._~"))
+        && ASSERT_STR_EQ(buf, "C%2B%2B%20a%26b%23c%25d%2F%C3%A9-._~");
+}
+
+static bool test_url_escape_too_long(void) {
+    log_set(tmpfile());
+    char buf[MTRIX_MAX_URL_LEN], input[MTRIX_MAX_URL_LEN / 2];
+    memset(input, '&', sizeof(input) - 1);
+    input[sizeof(input) - 1] = 0;
+    const char expected[] = "url too long:";
+    return !url_escape(buf, input)
+        && CHECK_LOG_N(expected, sizeof(expected) - 1);
+}
+
 static bool test_open_or_create_open(void) {
     log_set(stderr);
     char filename[] = "machinatrix_XXXXXX";
@@ -314,6 +348,26 @@ static bool test_open_or_create_create(void) {
     return ret;
 }
 
+static bool test_mkdir_p(void) {
+    log_set(stderr);
+    char dir[] = "/tmp/machinatrix_XXXXXX";
+    if(!ASSERT(mkdtemp(dir)))
+        return false;
+    char path[MTRIX_MAX_PATH] = {0};
+    const bool ret = ASSERT(join_path(path, 2, dir, "/a/b//c/"))
+        && ASSERT(mkdir_p(path, 0700))
+        // Existing directories are not an error.
+        && ASSERT(mkdir_p(path, 0700))
+        && ASSERT(!access(path, W_OK));
+    const char *const dirs[] = {"/a/b/c", "/a/b", "/a", ""};
+    for(size_t i = 0; i != sizeof(dirs) / sizeof(*dirs); ++i) {
+        char p[MTRIX_MAX_PATH] = {0};
+        if(join_path(p, 2, dir, dirs[i]))
+            rmdir(p);
+    }
+    return ret;
+}
+
 int main(void) {
     bool ret = true;
     ret = RUN(test_log) && ret;
@@ -330,9 +384,13 @@ int main(void) {
     ret = RUN(test_wait_n) && ret;
     ret = RUN(test_join_lines) && ret;
     ret = RUN(test_mtrix_buffer_append) && ret;
+    ret = RUN(test_mtrix_buffer_append_max) && ret;
     ret = RUN(test_build_url_too_long) && ret;
     ret = RUN(test_build_url) && ret;
+    ret = RUN(test_url_escape) && ret;
+    ret = RUN(test_url_escape_too_long) && ret;
     ret = RUN(test_open_or_create_open) && ret;
     ret = RUN(test_open_or_create_create) && ret;
+    ret = RUN(test_mkdir_p) && ret;
     return !ret;
 }
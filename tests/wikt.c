@@ -0,0 +1,377 @@
+#include "wikt.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "html.h"
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+/** A response of the test server, see \ref server_start. */
+struct route {
+    /** Substring of the request line. */
+    const char *match;
+    const char *body;
+};
+
+/** Test HTTP server, running in a child process. */
+struct server {
+    pid_t pid;
+    /** Base URL of the API. */
+    char url[64];
+};
+
+static const char SECTIONS[] =
+    "{\"parse\":{\"title\":\"dog\",\"sections\":["
+        "{\"level\":\"2\",\"anchor\":\"English\",\"index\":\"1\"},"
+        "{\"level\":\"3\",\"anchor\":\"Etymology_1\",\"index\":\"2\"},"
+        "{\"level\":\"4\",\"anchor\":\"Noun\",\"index\":\"3\"},"
+        "{\"level\":\"5\",\"anchor\":\"Translations\",\"index\":\"4\"},"
+        "{\"level\":\"3\",\"anchor\":\"Etymology_2\",\"index\":\"T-1\"},"
+        "{\"level\":\"3\",\"anchor\":\"Etymology_3\",\"index\":\"5\"},"
+        "{\"level\":\"2\",\"anchor\":\"Dutch\",\"index\":\"6\"},"
+        "{\"level\":\"3\",\"anchor\":\"Etymology\",\"index\":\"7\"},"
+        "{\"level\":\"4\",\"anchor\":\"Translations\",\"index\":\"8\"}"
+    "]}}";
+
+#define TEXT(id) \
+    "{\"parse\":{\"title\":\"dog\",\"text\":" \
+        "\"<div class=\\\"mw-heading mw-heading3\\\">" \
+        "<h3 id=\\\"" id "\\\">" id "</h3></div>" \
+        "<p id=\\\"p\\\">text</p>\"}}"
+
+static const struct route ROUTES[] = {
+    // Only matched if the term is escaped, see test_request_sections_escape.
+    {"page=C%2B%2B%20a%26b%23c%25",
+        "{\"error\":{\"code\":\"missingtitle\"}}"},
+    {"page=missing", "{\"error\":{\"code\":\"missingtitle\"}}"},
+    {"page=invalid", "{\"error\":{\"code\":\"invalidtitle\"}}"},
+    {"prop=sections", SECTIONS},
+    {"section=2&", TEXT("Etymology_1")},
+    {"section=4&", TEXT("Translations")},
+    {"section=5&", TEXT("Etymology_3")},
+    {"section=7&", TEXT("Etymology")},
+    {"section=8&", TEXT("Translations")},
+};
+
+static void server_respond(int fd) {
+    char buf[4096];
+    size_t n = 0;
+    for(ssize_t r; n < sizeof(buf) - 1
+            && (r = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0;) {
+        buf[n += (size_t)r] = 0;
+        if(strstr(buf, "\r\n\r\n"))
+            break;
+    }
+    buf[n] = 0;
+    const char *const eol = strstr(buf, "\r\n");
+    if(eol)
+        buf[eol - buf] = 0;
+    const char *body = NULL;
+    for(size_t i = 0; !body && i != sizeof(ROUTES) / sizeof(*ROUTES); ++i)
+        if(strstr(buf, ROUTES[i].match))
+            body = ROUTES[i].body;
+    char head[128];
+    const int len = snprintf(
+        head, sizeof(head),
+        "HTTP/1.1 %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        body ? "200 OK" : "404 Not Found", body ? strlen(body) : 0);
+    write_all(fd, head, (size_t)len);
+    if(body)
+        write_all(fd, body, strlen(body));
+}
+
+/** Starts a server which replies with the first matching route. */
+static bool server_start(struct server *s) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(!ASSERT_NE(fd, -1))
+        return false;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    const bool ok =
+        ASSERT_NE(bind(fd, (const struct sockaddr*)&addr, sizeof(addr)), -1)
+        && ASSERT_NE(listen(fd, 16), -1)
+        && ASSERT_NE(getsockname(fd, (struct sockaddr*)&addr, &len), -1)
+        && ASSERT_NE(s->pid = fork(), -1);
+    if(ok && !s->pid) {
+        for(int c; (c = accept(fd, NULL, NULL)) != -1; close(c))
+            server_respond(c);
+        _exit(1);
+    }
+    close(fd);
+    snprintf(
+        s->url, sizeof(s->url), "http://127.0.0.1:%d/w/api.php",
+        ntohs(addr.sin_port));
+    return ok;
+}
+
+static void server_stop(struct server *s) {
+    kill(s->pid, SIGTERM);
+    waitpid(s->pid, NULL, 0);
+}
+
+/** Checks the heading of a section. */
+static bool check_section(
+    const wikt_section *s, const char *lang, const char *id)
+{
+    wikt_page p;
+    if(!(ASSERT_STR_EQ(s->lang, lang) && ASSERT(s->doc)
+            && ASSERT(wikt_parse_section(s->doc, &p))))
+        return false;
+    const TidyNode h = tidyGetChild(p.contents);
+    const TidyAttr a = h ? find_attr(h, "id") : NULL;
+    return ASSERT(a) && ASSERT_STR_EQ(tidyAttrValue(a), id)
+        && ASSERT(find_node_by_id(
+            html_index_get(s->doc), tidyGetBody(s->doc), "p", true));
+}
+
+static void release(wikt_section *v, size_t n) {
+    for(size_t i = 0; i != n; ++i)
+        html_release(v[i].doc);
+}
+
+static bool test_request_sections(void) {
+    struct server s;
+    if(!server_start(&s))
+        return false;
+    const struct mtrix_cache cache = {0};
+    wikt_section v[WIKT_MAX_SECTIONS];
+    size_t n = 0;
+    bool missing = true;
+    bool ret = ASSERT(wikt_request_sections(
+            s.url, "dog", NULL, "Etymology", 3, &cache, v, &n, &missing,
+            false))
+        && ASSERT(!missing)
+        && ASSERT_EQ(n, 3)
+        && check_section(v + 0, "English", "Etymology_1")
+        && check_section(v + 1, "English", "Etymology_3")
+        && check_section(v + 2, "Dutch", "Etymology");
+    release(v, n);
+    ret = ret
+        && ASSERT(wikt_request_sections(
+            s.url, "dog", "dutch", "Translations", 0, &cache, v, &n,
+            &missing, false))
+        && ASSERT_EQ(n, 1)
+        && check_section(v, "Dutch", "Translations");
+    release(v, n);
+    server_stop(&s);
+    return ret;
+}
+
+static bool test_request_sections_none(void) {
+    struct server s;
+    if(!server_start(&s))
+        return false;
+    const struct mtrix_cache cache = {0};
+    wikt_section v[WIKT_MAX_SECTIONS];
+    size_t n = 1;
+    bool missing = true;
+    const bool ret = ASSERT(wikt_request_sections(
+            s.url, "dog", "French", "Etymology", 3, &cache, v, &n, &missing,
+            false))
+        && ASSERT(!missing)
+        && ASSERT_EQ(n, 0)
+        // Only the headings at the requested level.
+        && ASSERT(wikt_request_sections(
+            s.url, "dog", NULL, "Etymology", 2, &cache, v, &n, &missing,
+            false))
+        && ASSERT_EQ(n, 0);
+    server_stop(&s);
+    return ret;
+}
+
+static bool test_request_sections_missing(void) {
+    struct server s;
+    if(!server_start(&s))
+        return false;
+    FILE *const log = tmpfile();
+    log_set(log);
+    const struct mtrix_cache cache = {0};
+    wikt_section v[WIKT_MAX_SECTIONS];
+    size_t n = 1;
+    bool missing = false;
+    const bool ret = ASSERT(wikt_request_sections(
+            s.url, "missing", NULL, "Etymology", 3, &cache, v, &n,
+            &missing, false))
+        && ASSERT(missing)
+        && ASSERT_EQ(n, 0)
+        && ASSERT_EQ(ftell(log), 0)
+        && ASSERT(!wikt_request_sections(
+            s.url, "invalid", NULL, "Etymology", 3, &cache, v, &n,
+            &missing, false))
+        && ASSERT(!missing)
+        && ASSERT_NE(ftell(log), 0);
+    log_set(stderr);
+    fclose(log);
+    server_stop(&s);
+    return ret;
+}
+
+static bool test_request_sections_escape(void) {
+    struct server s;
+    if(!server_start(&s))
+        return false;
+    const struct mtrix_cache cache = {0};
+    wikt_section v[WIKT_MAX_SECTIONS];
+    size_t n = 1;
+    bool missing = false;
+    const bool ret = ASSERT(wikt_request_sections(
+            s.url, "C++ a&b#c%", NULL, "Etymology", 3, &cache, v, &n,
+            &missing, false))
+        && ASSERT(missing)
+        && ASSERT_EQ(n, 0);
+    server_stop(&s);
+    return ret;
+}
+
+static bool test_section_urls(void) {
+    const char *const base = "http://localhost/w/api.php";
+    wikt_section v[WIKT_MAX_SECTIONS];
+    char urls[WIKT_MAX_SECTIONS][MTRIX_MAX_URL_LEN];
+    size_t n = 0;
+    bool missing = true;
+    char list[MTRIX_MAX_URL_LEN];
+    return ASSERT(wikt_sections_url(base, "a b", list))
+        && ASSERT_STR_EQ(
+            list,
+            "http://localhost/w/api.php?action=parse&format=json"
+            "&formatversion=2&redirects=1&prop=sections&page=a%20b")
+        && ASSERT(wikt_section_urls(
+            base, "a b", SECTIONS, "dutch", "Translations", 0, v, urls, &n,
+            &missing))
+        && ASSERT(!missing)
+        && ASSERT_EQ(n, 1)
+        && ASSERT_STR_EQ(v[0].lang, "Dutch")
+        && ASSERT_STR_EQ(
+            urls[0],
+            "http://localhost/w/api.php?action=parse&format=json"
+            "&formatversion=2&redirects=1&prop=text&disableeditsection=1"
+            "&disablelimitreport=1&section=8&page=a%20b")
+        && ASSERT(wikt_section_urls(
+            base, "a b", ROUTES[1].body, NULL, "Etymology", 3, v, urls, &n,
+            &missing))
+        && ASSERT(missing)
+        && ASSERT_EQ(n, 0);
+}
+
+/** Reduced copy of a page, see \ref check_page. */
+#define PAGE "tests/pages/wikt_dog.html"
+
+static const char ETYMOLOGIES[] =
+    "English\n"
+    "  From Middle English dogge, from Old English docga (“hound, powerful"
+    " breed of dog”), a pet-form diminutive of *docce & *dox.[1]\n"
+    "  The word is attested since the 11th century as a gloss for canis.\n"
+    "  Clipping of doggerel <short>.\n"
+    "Dutch\n"
+    "  Borrowed from English dog.\n"
+    "Swedish\n"
+    "  From Old Norse dó.\n";
+
+static const char TRANSLATIONS[] =
+    "English\n"
+    "  animal\n"
+    "    Arabic: كَلْب m\n"
+    "    Chinese: Cantonese: 狗 (gau2) Mandarin: 狗 (gǒu)\n"
+    "    Dutch: hond m\n"
+    "    French: chien m, chienne f\n"
+    "    Portuguese: cão m\n"
+    "  a dull, unattractive person\n"
+    "    Portuguese: bagulho\n"
+    "Swedish\n"
+    "  died\n"
+    "    English: died\n";
+
+static const char TRANSLATIONS_PT[] =
+    "English\n"
+    "  animal\n"
+    "    Portuguese: cão m\n"
+    "  a dull, unattractive person\n"
+    "    Portuguese: bagulho\n"
+    "Swedish\n"
+    "  died\n";
+
+/**
+ * Extracts the etymologies or translations in \ref PAGE both from a Tidy
+ * document and with \ref html_tokenizer, checking that the results are the
+ * same as `expected`.
+ */
+static bool check_page(bool tr, const char *lang, const char *expected) {
+    size_t n = 0;
+    char *const html = read_file(PAGE, &n);
+    if(!ASSERT(html))
+        return false;
+    const TidyDoc doc = parse_html(html);
+    if(!ASSERT(doc))
+        return free(html), false;
+    FILE *const tidy = tmpfile(), *const scan = tmpfile();
+    const bool ret =
+        ASSERT(tr
+            ? wikt_print_translations(tidy, doc, lang)
+            : wikt_print_etymologies(tidy, doc, lang))
+        && ASSERT(tr
+            ? wikt_scan_translations(scan, html, n, lang)
+            : wikt_scan_etymologies(scan, html, n, lang))
+        && CHECK_TEXT(tidy, expected)
+        && CHECK_TEXT(scan, expected);
+    fclose(scan);
+    fclose(tidy);
+    html_release(doc);
+    free(html);
+    return ret;
+}
+
+static bool test_etymologies(void) {
+    return check_page(false, NULL, ETYMOLOGIES)
+        && check_page(false, "dutch", "Dutch\n  Borrowed from English dog.\n")
+        && check_page(false, "french", "");
+}
+
+static bool test_translations(void) {
+    return check_page(true, NULL, TRANSLATIONS)
+        && check_page(true, "portuguese", TRANSLATIONS_PT);
+}
+
+static bool test_scan_invalid(void) {
+    FILE *const log = tmpfile();
+    log_set(log);
+    const char no_contents[] = "<div id=\"content\"><p>text</p></div>";
+    const char no_section[] = "<div id=\"mw-content-text\"><p>text</p></div>";
+    const bool ret =
+        ASSERT(!wikt_scan_etymologies(
+            stdout, no_contents, sizeof(no_contents) - 1, NULL))
+        && CHECK_LOG("contents not found\n")
+        && ASSERT(!wikt_scan_translations(
+            stdout, no_section, sizeof(no_section) - 1, NULL))
+        && CHECK_LOG("contents not found\nno section found\n");
+    log_set(stderr);
+    fclose(log);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_request_sections) && ret;
+    ret = RUN(test_request_sections_none) && ret;
+    ret = RUN(test_request_sections_missing) && ret;
+    ret = RUN(test_request_sections_escape) && ret;
+    ret = RUN(test_section_urls) && ret;
+    ret = RUN(test_etymologies) && ret;
+    ret = RUN(test_translations) && ret;
+    ret = RUN(test_scan_invalid) && ret;
+    return !ret;
+}
@@ -0,0 +1,131 @@
+#include "wiktidx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "tests/common.h"
+
+const char *PROG_NAME = NULL;
+const char *CMD_NAME = NULL;
+
+/** Saves the builder to a temporary file and opens it. */
+static bool save_and_open(
+    struct mtrix_wiktidx_builder *b, struct mtrix_wiktidx *x)
+{
+    char path[] = "/tmp/machinatrix_test_wiktidx_XXXXXX";
+    const int fd = mkstemp(path);
+    if(!ASSERT_NE(fd, -1))
+        return false;
+    close(fd);
+    const bool ret = ASSERT(mtrix_wiktidx_save(b, path))
+        && ASSERT(mtrix_wiktidx_open(x, path));
+    unlink(path);
+    mtrix_wiktidx_builder_destroy(b);
+    return ret;
+}
+
+static bool check_str(
+    const struct mtrix_wiktidx *x, struct mtrix_wiktidx_str s, const char *e)
+{
+    return ASSERT_EQ(s.len, strlen(e))
+        && ASSERT_STR_EQ(mtrix_wiktidx_str(x, s), e);
+}
+
+static bool test_wiktidx_empty(void) {
+    struct mtrix_wiktidx_builder b = {0};
+    struct mtrix_wiktidx x;
+    const struct mtrix_wiktidx_entry *v = NULL;
+    if(!save_and_open(&b, &x))
+        return false;
+    const bool ret = ASSERT_EQ(x.n_terms, 0)
+        && ASSERT_EQ(mtrix_wiktidx_find(&x, "a", &v), 0);
+    return ASSERT(mtrix_wiktidx_close(&x)) && ret;
+}
+
+static bool test_wiktidx_find(void) {
+    const char *const terms[] = {"pear", "apple", "Zebra", "fig", "banana"};
+    struct mtrix_wiktidx_builder b = {0};
+    for(size_t i = 0; i != 5; ++i)
+        if(!ASSERT(mtrix_wiktidx_add(&b, terms[i], "English", "", terms[i])))
+            return mtrix_wiktidx_builder_destroy(&b), false;
+    struct mtrix_wiktidx x;
+    if(!save_and_open(&b, &x))
+        return false;
+    bool ret = ASSERT_EQ(x.n_terms, 5);
+    for(size_t i = 0; ret && i != 5; ++i) {
+        const struct mtrix_wiktidx_entry *v = NULL;
+        ret = ASSERT_EQ(mtrix_wiktidx_find(&x, terms[i], &v), 1)
+            && check_str(&x, v->tr, terms[i]);
+    }
+    const struct mtrix_wiktidx_entry *v = NULL;
+    ret = ret
+        && ASSERT_EQ(mtrix_wiktidx_find(&x, "zebra", &v), 0)
+        && ASSERT_EQ(mtrix_wiktidx_find(&x, "app", &v), 0)
+        && ASSERT_EQ(mtrix_wiktidx_find(&x, "", &v), 0);
+    return ASSERT(mtrix_wiktidx_close(&x)) && ret;
+}
+
+static bool test_wiktidx_merge(void) {
+    struct mtrix_wiktidx_builder b = {0};
+    const bool added =
+        ASSERT(mtrix_wiktidx_add(
+            &b, "dog", "English", "From dogge.\n", "animal\n\tFrench: chien\n"))
+        && ASSERT(mtrix_wiktidx_add(&b, "cat", "English", "", ""))
+        // Same etymology, another part of speech.
+        && ASSERT(mtrix_wiktidx_add(
+            &b, "dog", "English", "From dogge.\n", "to follow\n"))
+        && ASSERT(mtrix_wiktidx_add(&b, "dog", "Dutch", "Unknown.\n", ""))
+        && ASSERT(mtrix_wiktidx_add(&b, "dog", "English", "Other.\n", ""));
+    if(!added)
+        return mtrix_wiktidx_builder_destroy(&b), false;
+    struct mtrix_wiktidx x;
+    if(!save_and_open(&b, &x))
+        return false;
+    const struct mtrix_wiktidx_entry *v = NULL;
+    const bool ret = ASSERT_EQ(mtrix_wiktidx_find(&x, "dog", &v), 3)
+        && check_str(&x, v[0].lang, "English")
+        && check_str(&x, v[0].etym, "From dogge.\n")
+        && check_str(&x, v[0].tr, "animal\n\tFrench: chien\nto follow\n")
+        && check_str(&x, v[1].lang, "Dutch")
+        && check_str(&x, v[1].etym, "Unknown.\n")
+        && check_str(&x, v[1].tr, "")
+        // Not consecutive, not merged.
+        && check_str(&x, v[2].lang, "English")
+        && check_str(&x, v[2].etym, "Other.\n")
+        && ASSERT_EQ(mtrix_wiktidx_find(&x, "cat", &v), 1)
+        && check_str(&x, v->etym, "");
+    return ASSERT(mtrix_wiktidx_close(&x)) && ret;
+}
+
+static bool test_wiktidx_invalid(void) {
+    char path[] = "/tmp/machinatrix_test_wiktidx_XXXXXX";
+    const int fd = mkstemp(path);
+    if(!ASSERT_NE(fd, -1))
+        return false;
+    FILE *const log = tmpfile();
+    log_set(log);
+    struct mtrix_wiktidx x;
+    const char data[64] = "MTRXWIKT";
+    const bool ret = ASSERT(!mtrix_wiktidx_open(&x, path))
+        && ASSERT(write_all(fd, data, sizeof(data)))
+        && ASSERT(!mtrix_wiktidx_open(&x, path))
+        && ASSERT_EQ(x.map, NULL)
+        && ASSERT_NE(ftell(log), 0);
+    log_set(stderr);
+    fclose(log);
+    close(fd);
+    unlink(path);
+    return ret;
+}
+
+int main(void) {
+    log_set(stderr);
+    bool ret = true;
+    ret = RUN(test_wiktidx_empty) && ret;
+    ret = RUN(test_wiktidx_find) && ret;
+    ret = RUN(test_wiktidx_merge) && ret;
+    ret = RUN(test_wiktidx_invalid) && ret;
+    return !ret;
+}
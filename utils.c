@@ -1,12 +1,15 @@
+#include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <curl/curl.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -19,6 +22,73 @@
 
 static FILE *LOG_OUT = NULL;
 
+enum {
+    /** Maximum number of hosts for which a handle is kept, see \ref HTTP. */
+    HTTP_MAX_HOSTS = 8,
+    /** Maximum length of the scheme, host, and port of a URL. */
+    HTTP_MAX_HOST = 256,
+    /** Time allowed to establish a connection. */
+    HTTP_CONNECT_TIMEOUT_S = 30,
+    /**
+     * Transfers slower than \ref HTTP_LOW_SPEED bytes per second for this
+     * long are aborted, so that a stalled server cannot block a command
+     * indefinitely.  Large pages may legitimately take longer than any fixed
+     * total timeout.
+     */
+    HTTP_LOW_SPEED_TIME_S = 60,
+    /** See \ref HTTP_LOW_SPEED_TIME_S. */
+    HTTP_LOW_SPEED = 1,
+};
+
+/**
+ * Process-wide state used by \ref request and \ref request_cond.
+ * Successive requests to the same host reuse the connection, and requests to
+ * any host reuse DNS results and TLS sessions.
+ */
+static struct {
+    /** DNS cache, TLS sessions, and connections shared by all handles. */
+    CURLSH *share;
+    /** Handle kept for each host, in the format of \ref url_host. */
+    struct {
+        char host[HTTP_MAX_HOST];
+        CURL *curl;
+    } hosts[HTTP_MAX_HOSTS];
+    /** Entry in \ref hosts replaced when a new host is used. */
+    size_t next;
+} HTTP;
+
+/** Extracts the `scheme://host[:port]` prefix of `url`, `false` if invalid. */
+static bool url_host(const char *url, char host[static HTTP_MAX_HOST]);
+
+/** Returns the share handle in \ref HTTP, creating it if necessary. */
+static CURLSH *http_share(void);
+
+/**
+ * Returns the handle kept for the host of `url`, creating it if necessary.
+ * All options from previous requests are reset.
+ */
+static CURL *http_handle(const char *url);
+
+/** Builds the headers sent by a conditional request, see \ref request_cond. */
+static struct curl_slist *cond_headers(const struct mtrix_validators *req);
+
+/** Configures `curl` for a conditional request, see \ref request_cond. */
+static void setup_cond(
+    CURL *curl, const char *url, struct mtrix_buffer *b,
+    struct curl_slist *headers, struct mtrix_validators *resp, bool verbose);
+
+/** Releases \ref HTTP, registered with `atexit`. */
+static void http_cleanup(void);
+
+/** `CURLOPT_WRITEFUNCTION` callback, see \ref mtrix_buffer::stop. */
+static size_t write_cb(char *p, size_t size, size_t n, void *data);
+
+/**
+ * Whether a transfer which ended with `r` was stopped by
+ * \ref mtrix_buffer::stop, filling in the rest of its fields in that case.
+ */
+static bool was_stopped(CURL *curl, CURLcode r, const struct mtrix_buffer *b);
+
 FILE *log_set(FILE *f) {
     FILE *ret = LOG_OUT;
     LOG_OUT = f;
@@ -112,6 +182,25 @@ err:
     return NULL;
 }
 
+bool mkdir_p(const char *path, mode_t mode) {
+    char v[MTRIX_MAX_PATH] = {0};
+    strlcpy(v, path, sizeof(v));
+    if(v[sizeof(v) - 1])
+        return log_err("%s: path too long: %s\n", __func__, path), false;
+    // Create each prefix ending before a separator, then the full path.
+    for(char *p = v + 1;; ++p) {
+        const char c = *p;
+        if(c && c != '/')
+            continue;
+        *p = 0;
+        if(mkdir(v, mode) == -1 && errno != EEXIST)
+            return log_errno("mkdir: %s", v), false;
+        if(!c)
+            return true;
+        *p = c;
+    }
+}
+
 FILE *open_or_create(const char *path, const char *flags) {
     FILE *ret;
     if(!(ret = fopen(path, "a")))
@@ -208,6 +297,12 @@ size_t mtrix_buffer_append(
     if(!size || !n)
         return 0;
     size_t r = size * n;
+    const bool full = b->max && b->max - b->n < r;
+    if(full) {
+        log_err("buffer size limit reached (%zu)\n", b->max);
+        if(!(r = b->max - b->n))
+            return 0;
+    }
     if(!b->p) {
         b->p = malloc(r + 1);
         memcpy(b->p, p, r);
@@ -223,7 +318,7 @@ size_t mtrix_buffer_append(
         b->n += r;
     }
     b->p[b->n] = 0;
-    return r;
+    return full ? 0 : r;
 }
 
 bool build_url(char *url, const char *const *v) {
@@ -246,33 +341,316 @@ bool build_url(char *url, const char *const *v) {
     return true;
 }
 
-static CURL *init_curl(const char *url, struct mtrix_buffer *b, bool verbose) {
-    CURL *curl = curl_easy_init();
+bool url_escape(char *dst, const char *s) {
+    static const char hex[] = "0123456789ABCDEF";
+    char *p = dst;
+    for(const char *c = s; *c; ++c) {
+        const unsigned char u = (unsigned char)*c;
+        const bool keep = isalnum(u) || strchr("-._~", u);
+        if((size_t)(p - dst) + (keep ? 1 : 3) >= MTRIX_MAX_URL_LEN)
+            return log_err("url too long: %s\n", s), false;
+        if(keep)
+            *p++ = *c;
+        else {
+            *p++ = '%';
+            *p++ = hex[u >> 4];
+            *p++ = hex[u & 0xf];
+        }
+    }
+    *p = 0;
+    return true;
+}
+
+static void setup_curl(
+    CURL *curl, const char *url, struct mtrix_buffer *b, bool verbose)
+{
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_USERAGENT, "machinatrix");
     curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, mtrix_buffer_append);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, b);
+    curl_easy_setopt(
+        curl, CURLOPT_CONNECTTIMEOUT, (long)HTTP_CONNECT_TIMEOUT_S);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)HTTP_LOW_SPEED);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)HTTP_LOW_SPEED_TIME_S);
     if(verbose)
         curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+}
+
+static CURL *init_curl(const char *url, struct mtrix_buffer *b, bool verbose) {
+    CURL *curl = curl_easy_init();
+    setup_curl(curl, url, b, verbose);
     return curl;
 }
 
-bool request(const char *url, struct mtrix_buffer *b, bool verbose) {
-    CURL *curl = init_curl(url, b, verbose);
-    char err[CURL_ERROR_SIZE];
+static bool perform_get(
+    CURL *curl, const char *url, struct mtrix_buffer *b, bool verbose)
+{
+    char err[CURL_ERROR_SIZE] = {0};
     curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, err);
     if(verbose)
         printf("Request: GET %s\n", url);
     CURLcode ret = curl_easy_perform(curl);
-    if(ret != CURLE_OK)
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, NULL);
+    if(was_stopped(curl, ret, b))
+        ret = CURLE_OK;
+    else if(ret != CURLE_OK)
         log_err("%d: %s: %s\n", ret, err, *err ? err : curl_easy_strerror(ret));
     else if(verbose)
-        printf("Response:\n%s\n", b->p);
-    curl_easy_cleanup(curl);
+        printf("Response:\n%s\n", b->p ? b->p : "");
     return ret == CURLE_OK;
 }
 
+size_t write_cb(char *p, size_t size, size_t n, void *data) {
+    struct mtrix_buffer *const b = data;
+    const size_t ret = mtrix_buffer_append(p, size, n, b);
+    struct mtrix_stop *const s = b->stop;
+    // Returning less than the size of the data aborts the transfer.
+    if(ret && s && (s->stopped = s->f(s, b)))
+        return 0;
+    return ret;
+}
+
+bool was_stopped(CURL *curl, CURLcode r, const struct mtrix_buffer *b) {
+    struct mtrix_stop *const s = b->stop;
+    if(r != CURLE_WRITE_ERROR || !s || !s->stopped)
+        return false;
+    curl_off_t len = -1, speed = 0;
+    curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+    curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+    const curl_off_t received = (curl_off_t)b->n;
+    s->skipped = len < received ? -1 : (int64_t)(len - received);
+    s->skipped_us =
+        0 < s->skipped && 0 < speed ? s->skipped * 1000000 / speed : 0;
+    return true;
+}
+
+bool url_host(const char *url, char host[static HTTP_MAX_HOST]) {
+    const char *const p = strstr(url, "://");
+    if(!p)
+        return false;
+    const size_t n = (size_t)(p + 3 - url) + strcspn(p + 3, "/?#");
+    if(n >= HTTP_MAX_HOST)
+        return false;
+    memcpy(host, url, n);
+    host[n] = 0;
+    return true;
+}
+
+CURLSH *http_share(void) {
+    if(HTTP.share)
+        return HTTP.share;
+    if(!(HTTP.share = curl_share_init()))
+        return log_err("%s: curl_share_init\n", __func__), NULL;
+    curl_share_setopt(HTTP.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(HTTP.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(HTTP.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    atexit(http_cleanup);
+    return HTTP.share;
+}
+
+CURL *http_handle(const char *url) {
+    if(!http_share())
+        return NULL;
+    // Malformed URLs share an entry, the request will fail anyway.
+    char host[HTTP_MAX_HOST] = {0};
+    url_host(url, host);
+    size_t i = 0;
+    while(i != HTTP_MAX_HOSTS && strcmp(HTTP.hosts[i].host, host))
+        ++i;
+    if(i == HTTP_MAX_HOSTS) {
+        i = HTTP.next;
+        HTTP.next = (HTTP.next + 1) % HTTP_MAX_HOSTS;
+        curl_easy_cleanup(HTTP.hosts[i].curl);
+        HTTP.hosts[i].curl = NULL;
+        memcpy(HTTP.hosts[i].host, host, sizeof(host));
+    }
+    CURL *curl = HTTP.hosts[i].curl;
+    if(curl)
+        curl_easy_reset(curl);
+    else if(!(curl = HTTP.hosts[i].curl = curl_easy_init()))
+        return log_err("%s: curl_easy_init\n", __func__), NULL;
+    curl_easy_setopt(curl, CURLOPT_SHARE, HTTP.share);
+    return curl;
+}
+
+void http_cleanup(void) {
+    for(size_t i = 0; i != HTTP_MAX_HOSTS; ++i)
+        curl_easy_cleanup(HTTP.hosts[i].curl);
+    curl_share_cleanup(HTTP.share);
+}
+
+bool request(const char *url, struct mtrix_buffer *b, bool verbose) {
+    CURL *const curl = http_handle(url);
+    if(!curl)
+        return false;
+    setup_curl(curl, url, b, verbose);
+    return perform_get(curl, url, b, verbose);
+}
+
+/** Copies the value of header `name` in `line` (if it matches) to `dst`. */
+static void copy_header(
+    const char *name, const char *line, size_t n, char *dst)
+{
+    const size_t len = strlen(name);
+    if(n <= len || strncasecmp(line, name, len) || line[len] != ':')
+        return;
+    const char *b = line + len + 1, *e = line + n;
+    while(b != e && (*b == ' ' || *b == '\t'))
+        ++b;
+    while(e != b && (e[-1] == '\r' || e[-1] == '\n' || e[-1] == ' '))
+        --e;
+    // Truncated values would not match, they are better discarded.
+    if((size_t)(e - b) >= MTRIX_MAX_HEADER)
+        return;
+    memcpy(dst, b, (size_t)(e - b));
+    dst[e - b] = 0;
+}
+
+/** `CURLOPT_HEADERFUNCTION` callback which extracts validators. */
+static size_t validators_cb(char *p, size_t size, size_t n, void *data) {
+    struct mtrix_validators *const v = data;
+    n *= size;
+    // Only the headers of the last response (e.g. after a `100 Continue`) are
+    // relevant.
+    if(n > 5 && !strncmp(p, "HTTP/", 5))
+        *v = (struct mtrix_validators){0};
+    copy_header("ETag", p, n, v->etag);
+    copy_header("Last-Modified", p, n, v->last_modified);
+    return n;
+}
+
+struct curl_slist *cond_headers(const struct mtrix_validators *req) {
+    struct curl_slist *ret = NULL;
+    char h[sizeof("If-Modified-Since: ") + MTRIX_MAX_HEADER];
+    if(*req->etag) {
+        snprintf(h, sizeof(h), "If-None-Match: %s", req->etag);
+        ret = curl_slist_append(ret, h);
+    }
+    if(*req->last_modified) {
+        snprintf(h, sizeof(h), "If-Modified-Since: %s", req->last_modified);
+        ret = curl_slist_append(ret, h);
+    }
+    return ret;
+}
+
+void setup_cond(
+    CURL *curl, const char *url, struct mtrix_buffer *b,
+    struct curl_slist *headers, struct mtrix_validators *resp, bool verbose)
+{
+    setup_curl(curl, url, b, verbose);
+    *resp = (struct mtrix_validators){0};
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, validators_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, resp);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+}
+
+bool request_cond(
+    const char *url, struct mtrix_buffer *b,
+    const struct mtrix_validators *req, struct mtrix_validators *resp,
+    long *status, bool verbose)
+{
+    CURL *const curl = http_handle(url);
+    if(!curl)
+        return false;
+    struct curl_slist *const headers = cond_headers(req);
+    setup_cond(curl, url, b, headers, resp, verbose);
+    const bool ret = perform_get(curl, url, b, verbose);
+    if(ret)
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+    // The handle keeps a pointer to the list until it is reset.
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+    curl_slist_free_all(headers);
+    return ret;
+}
+
+bool request_multi(size_t n, struct mtrix_transfer *v, bool verbose) {
+    static const struct mtrix_validators none = {0};
+    CURLSH *const share = http_share();
+    if(!share)
+        return false;
+    CURLM *const m = curl_multi_init();
+    if(!m)
+        return log_err("%s: curl_multi_init\n", __func__), false;
+    bool ret = false;
+    size_t i = 0;
+    for(; i != n; ++i) {
+        struct mtrix_transfer *const t = v + i;
+        t->status = 0;
+        CURL *const curl = curl_easy_init();
+        if(!curl) {
+            log_err("%s: curl_easy_init\n", __func__);
+            goto end;
+        }
+        t->headers = cond_headers(t->req ? t->req : &none);
+        setup_cond(curl, t->url, &t->body, t->headers, &t->resp, verbose);
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, t);
+        if(curl_multi_add_handle(m, curl) != CURLM_OK) {
+            log_err("%s: curl_multi_add_handle\n", __func__);
+            curl_easy_cleanup(curl);
+            curl_slist_free_all(t->headers);
+            t->headers = NULL;
+            goto end;
+        }
+        t->curl = curl;
+        if(verbose)
+            printf("Request: GET %s\n", t->url);
+    }
+    for(int running = 1; running;) {
+        CURLMcode r = curl_multi_perform(m, &running);
+        if(r == CURLM_OK && running)
+            r = curl_multi_poll(m, NULL, 0, 1000, NULL);
+        if(r != CURLM_OK) {
+            log_err("%s: %s\n", __func__, curl_multi_strerror(r));
+            goto end;
+        }
+    }
+    for(CURLMsg *msg; (msg = curl_multi_info_read(m, &(int){0}));) {
+        if(msg->msg != CURLMSG_DONE)
+            continue;
+        struct mtrix_transfer *t = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&t);
+        const CURLcode r = msg->data.result;
+        if(r != CURLE_OK && !was_stopped(msg->easy_handle, r, &t->body)) {
+            log_err("%d: %s: %s\n", r, t->url, curl_easy_strerror(r));
+            continue;
+        }
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &t->status);
+        if(verbose)
+            printf("Response:\n%s\n", t->body.p ? t->body.p : "");
+    }
+    ret = true;
+end:
+    while(i--) {
+        curl_multi_remove_handle(m, v[i].curl);
+        curl_easy_cleanup(v[i].curl);
+        curl_slist_free_all(v[i].headers);
+        v[i].curl = v[i].headers = NULL;
+    }
+    curl_multi_cleanup(m);
+    return ret;
+}
+
+bool http_status_usable(long status) {
+    return 0 < status && (status < 400 || status == 404);
+}
+
+bool request_keep(
+    struct mtrix_request *r, const char *url, struct mtrix_buffer *b,
+    bool verbose)
+{
+    if(!r->curl && !(r->curl = curl_easy_init()))
+        return log_err("%s: curl_easy_init\n", __func__), false;
+    setup_curl(r->curl, url, b, verbose);
+    return perform_get(r->curl, url, b, verbose);
+}
+
+void mtrix_request_destroy(struct mtrix_request *r) {
+    curl_easy_cleanup(r->curl);
+    r->curl = NULL;
+}
+
 bool post(post_request r, bool verbose, struct mtrix_buffer *b) {
     CURL *curl = init_curl(r.url, b, verbose);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, r.data_len);
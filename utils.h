@@ -1,3 +1,6 @@
+#ifndef MACHINATRIX_UTILS_H
+#define MACHINATRIX_UTILS_H
+
 /**
  * \file
  * Utility functions.
@@ -17,6 +20,9 @@
 /** Maximum length for URLs built by \ref build_url. */
 #define MTRIX_MAX_URL_LEN ((size_t)1024U)
 
+/** Maximum length of header values kept by \ref request_cond. */
+#define MTRIX_MAX_HEADER ((size_t)256U)
+
 /** Maximum number of command arguments (excluding the command name). */
 #define MTRIX_MAX_ARGS ((size_t)2U)
 
@@ -32,12 +38,46 @@ extern const char *CMD_NAME;
 /** Sets the output stream used by log functions and returns previous value. */
 FILE *log_set(FILE *f);
 
+struct mtrix_stop;
+
 /** Resizable buffer used by several functions. */
 struct mtrix_buffer {
     /** Owning pointer to the dynamically-allocated data. */
     char *p;
     /** Size of the buffer pointed to by \ref p. */
     size_t n;
+    /**
+     * Maximum value for \ref n when appending, `0` for no limit.
+     * \see mtrix_buffer_full
+     */
+    size_t max;
+    /** Optional, ends requests which write to the buffer, see \ref request. */
+    struct mtrix_stop *stop;
+};
+
+/**
+ * Condition which ends a transfer before the entire response is received.
+ * The request succeeds with the part received so far, the connection is
+ * closed.
+ */
+struct mtrix_stop {
+    /**
+     * Called each time data are appended to the body of the response.
+     * \return Whether the data received are sufficient.
+     */
+    bool (*f)(struct mtrix_stop *s, const struct mtrix_buffer *b);
+    /** Set if the transfer was ended by \ref f. */
+    bool stopped;
+    /**
+     * Size of the part of the body which was not received, `-1` if unknown
+     * (the server did not send `Content-Length`).
+     */
+    int64_t skipped;
+    /**
+     * Estimate of the time that would have been spent receiving \ref skipped
+     * bytes, in microseconds, based on the transfer rate until then.
+     */
+    int64_t skipped_us;
 };
 
 /**
@@ -79,6 +119,12 @@ bool copy_arg(const char *name, struct mtrix_buffer dst, const char *src);
 /** Concatenate \c n segments, with length checking. */
 char *join_path(char v[static MTRIX_MAX_PATH], int n, ...);
 
+/**
+ * Creates a directory and all its missing parents, like `mkdir -p`.
+ * \param mode Permissions for directories which are created.
+ */
+bool mkdir_p(const char *path, mode_t mode);
+
 /** Performs an \c open(2)s with \c O_CREAT followed by \c fopen. */
 FILE *open_or_create(const char *path, const char *flags);
 
@@ -111,21 +157,118 @@ bool wait_n(size_t n, const pid_t *p);
 /** Replaces new-line characters with spaces. */
 void join_lines(unsigned char *b, unsigned char *e);
 
-/** Copies data to the buffer, reallocating if necessary. */
+/**
+ * Copies data to the buffer, reallocating if necessary.
+ * If the data would exceed \ref mtrix_buffer::max, only the part that fits is
+ * copied and `0` is returned (which aborts `curl` transfers).
+ */
 size_t mtrix_buffer_append(
     const char *p, size_t size, size_t n, struct mtrix_buffer *b);
 
+/** Whether the buffer has reached its maximum size. */
+static inline bool mtrix_buffer_full(const struct mtrix_buffer *b);
+
 /** Joins several URL parts into one, limited to \ref MTRIX_MAX_URL_LEN. */
 bool build_url(char *url, const char *const *v);
 
+/**
+ * Percent-encodes `s` to be used as a URL part (e.g. a query parameter).
+ * All bytes except unreserved characters (RFC 3986) are encoded.
+ * \param dst Limited to \ref MTRIX_MAX_URL_LEN, like \ref build_url.
+ */
+bool url_escape(char *dst, const char *s);
+
 /**
  * Performs a `GET` request.
+ * Handles are kept between calls for each host, and connections, DNS results,
+ * and TLS sessions are shared by all of them, so that repeated requests avoid
+ * the cost of establishing new connections.  This state is process-wide and
+ * released at exit, which makes this function unsafe to call concurrently from
+ * multiple threads (see \ref request_keep for an alternative).
+ * The transfer is ended early if \ref mtrix_buffer::stop is set and indicates
+ * so, which also applies to all other functions which perform `GET` requests.
  * \param url Target RUL.
  * \param b Output buffer, resized as required.
  * \param verbose Emit debug output.
  */
 bool request(const char *url, struct mtrix_buffer *b, bool verbose);
 
+/** Headers used to validate cached responses, see \ref request_cond. */
+struct mtrix_validators {
+    /** `ETag` header, empty if not present. */
+    char etag[MTRIX_MAX_HEADER];
+    /** `Last-Modified` header, empty if not present. */
+    char last_modified[MTRIX_MAX_HEADER];
+};
+
+/**
+ * Performs a conditional `GET` request.
+ * Uses the same shared state as \ref request.
+ * \param req Validators of a cached response, sent as `If-None-Match` and
+ *            `If-Modified-Since` if not empty.
+ * \param resp Filled with the validators of the response.
+ * \param status HTTP status code of the response, `304` if the cached response
+ *               is still valid (in which case \p b is not modified).
+ */
+bool request_cond(
+    const char *url, struct mtrix_buffer *b,
+    const struct mtrix_validators *req, struct mtrix_validators *resp,
+    long *status, bool verbose);
+
+/** A conditional `GET` request performed by \ref request_multi. */
+struct mtrix_transfer {
+    /** Target URL. */
+    const char *url;
+    /** Optional, sent as in \ref request_cond. */
+    const struct mtrix_validators *req;
+    /** Output buffer, resized as required. */
+    struct mtrix_buffer body;
+    /** Filled with the validators of the response. */
+    struct mtrix_validators resp;
+    /** HTTP status code of the response, `0` if the transfer failed. */
+    long status;
+    /** Opaque handle, only used during the transfer. */
+    void *curl;
+    /** Opaque list of request headers, only used during the transfer. */
+    void *headers;
+};
+
+/**
+ * Performs several conditional requests concurrently.
+ * Each transfer is performed as in \ref request_cond, using a separate handle
+ * which shares DNS results, TLS sessions, and connections with it.  Total
+ * latency is close to that of the slowest request instead of the sum.
+ * \return `false` if the transfers could not be performed, individual failures
+ *         are indicated by \ref mtrix_transfer::status.
+ */
+bool request_multi(size_t n, struct mtrix_transfer *v, bool verbose);
+
+/**
+ * Whether the body of a response with HTTP status `status` can be used:
+ * successful and redirection responses, and `404 Not Found`, which describes
+ * a missing page.  Other client errors (e.g. `429 Too Many Requests`) and
+ * server errors are not mistaken for missing pages.
+ */
+bool http_status_usable(long status);
+
+/**
+ * State for repeated `GET` requests.
+ * Keeps the underlying handle (and its connection) alive between calls to
+ * \ref request_keep.  Can be safely zero-initialized.
+ */
+struct mtrix_request {
+    /** Opaque `CURL` handle, created on first use. */
+    void *curl;
+};
+
+/** Similar to \ref request, but reuses the handle in \p r. */
+bool request_keep(
+    struct mtrix_request *r, const char *url, struct mtrix_buffer *b,
+    bool verbose);
+
+/** Releases all resources held by \p r. */
+void mtrix_request_destroy(struct mtrix_request *r);
+
 /** Data used for `POST` requests. */
 typedef struct {
     /** Target URL. */
@@ -144,6 +287,10 @@ typedef struct {
  */
 bool post(post_request r, bool verbose, struct mtrix_buffer *b);
 
+bool mtrix_buffer_full(const struct mtrix_buffer *b) {
+    return b->max && b->n == b->max;
+}
+
 static inline const char *strchrnul(const char *s, int c) {
     while(*s && *s != c)
         ++s;
@@ -158,3 +305,5 @@ static inline size_t strlcpy(
         --n;
     return (size_t)(dst - p);
 }
+
+#endif
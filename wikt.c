@@ -1,55 +1,232 @@
 #include "wikt.h"
 
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
+#include <cjson/cJSON.h>
 #include <tidybuffio.h>
 
 #include "html.h"
 #include "utils.h"
 
 #define CONTENTS_ID "mw-content-text"
+/** Parameters common to all API requests, followed by those of each one. */
+#define API_QUERY "?action=parse&format=json&formatversion=2&redirects=1"
 
 bool wikt_parse_page(TidyDoc doc, wikt_page *p) {
+    const struct html_index *const x = html_index_get(doc);
     TidyNode node = tidyGetBody(doc);
-    if(!(node = find_node_by_id(node, CONTENTS_ID, true)))
+    if(!(node = find_node_by_id(x, node, CONTENTS_ID, true)))
         return log_err("contents not found\n"), false;
-    if(!(node = find_node_by_class(node, "mw-heading", true)))
+    if(!(node = find_node_by_class(x, node, "mw-heading", true)))
         return log_err("no section found\n"), false;
     p->contents = node;
     return true;
 }
 
-TidyNode wikt_translation_head(TidyNode n) {
-    return ((n = find_node_by_class(n, "NavHead", true))
-        && (n = tidyGetChild(n))
-    ) ? n : NULL;
+bool wikt_parse_section(TidyDoc doc, wikt_page *p) {
+    TidyNode node = tidyGetBody(doc);
+    if(!(node = find_node_by_class(
+            html_index_get(doc), node, "mw-heading", true)))
+        return log_err("no section found\n"), false;
+    p->contents = node;
+    return true;
+}
+
+static const cJSON *get_item(const cJSON *j, const char *k) {
+    return cJSON_GetObjectItemCaseSensitive(j, k);
+}
+
+/** Reads a non-negative integer, which the API encodes as a string. */
+static bool get_uint(const cJSON *j, const char *k, unsigned *v) {
+    const cJSON *const x = get_item(j, k);
+    if(!cJSON_IsString(x) || !isdigit((unsigned char)*x->valuestring))
+        return false;
+    char *e = NULL;
+    const unsigned long l = strtoul(x->valuestring, &e, 10);
+    if(*e || UINT_MAX < l)
+        return false;
+    *v = (unsigned)l;
+    return true;
+}
+
+/**
+ * Parses an API response, reporting errors.
+ * \param missing Set if the error indicates that the page does not exist.
+ */
+static cJSON *parse_response(const char *url, const char *s, bool *missing) {
+    cJSON *const j = s ? cJSON_Parse(s) : NULL;
+    if(!j)
+        return log_err("%s: invalid response\n", url), NULL;
+    const cJSON *const e = get_item(j, "error");
+    if(!e)
+        return j;
+    const cJSON *const code = get_item(e, "code");
+    const char *const c = cJSON_IsString(code) ? code->valuestring : "?";
+    if(!(*missing = strcmp(c, "missingtitle") == 0))
+        log_err("%s: API error: %s\n", url, c);
+    cJSON_Delete(j);
+    return NULL;
+}
+
+/** Creates a document from the response to a request for a section. */
+static TidyDoc parse_text(const char *url, const char *s) {
+    bool missing = false;
+    cJSON *const j = parse_response(url, s, &missing);
+    if(!j) {
+        if(missing)
+            log_err("%s: page not found\n", url);
+        return NULL;
+    }
+    const cJSON *const t = get_item(get_item(j, "parse"), "text");
+    TidyDoc ret = NULL;
+    if(cJSON_IsString(t))
+        ret = parse_html(t->valuestring);
+    else
+        log_err("%s: invalid response\n", url);
+    cJSON_Delete(j);
+    return ret;
+}
+
+/**
+ * Selects sections from the list returned by the API, see
+ * \ref wikt_request_sections.
+ * \param indices Filled with the index of each section in the page.
+ */
+static bool select_sections(
+    const cJSON *sections, const char *lang, const char *prefix,
+    unsigned level, wikt_section *v, unsigned *indices, size_t *n
+) {
+    if(!cJSON_IsArray(sections))
+        return log_err("invalid list of sections\n"), false;
+    const char *cur = NULL;
+    const cJSON *x = NULL;
+    cJSON_ArrayForEach(x, sections) {
+        const cJSON *const a = get_item(x, "anchor");
+        unsigned l = 0, i = 0;
+        if(!cJSON_IsString(a) || !get_uint(x, "level", &l))
+            continue;
+        if(l == 2) {
+            cur = a->valuestring;
+            continue;
+        }
+        // Sections transcluded from other pages have no numeric index.
+        if(!cur || (level && l != level) || !get_uint(x, "index", &i)
+                || !is_prefix(prefix, a->valuestring)
+                || (lang && strcasecmp(lang, cur) != 0))
+            continue;
+        if(*n == WIKT_MAX_SECTIONS) {
+            log_err("too many sections, ignoring the rest\n");
+            break;
+        }
+        snprintf(v[*n].lang, sizeof(v[*n].lang), "%s", cur);
+        v[*n].doc = NULL;
+        indices[(*n)++] = i;
+    }
+    return true;
 }
 
-TidyNode wikt_translation_body(TidyNode n) {
-    return ((n = find_node_by_class(n, "translations", true))
-        && (n = find_node_by_name(n, "table"))
-        && (n = tidyGetChild(n))
-        && (n = find_node_by_name(n, "tbody"))
-    ) ? n : NULL;
+bool wikt_request_sections(
+    const char *base, const char *term, const char *lang, const char *prefix,
+    unsigned level, const struct mtrix_cache *cache,
+    wikt_section v[static WIKT_MAX_SECTIONS], size_t *n, bool *missing,
+    bool verbose
+) {
+    *n = 0;
+    *missing = false;
+    char url[MTRIX_MAX_URL_LEN];
+    if(!wikt_sections_url(base, term, url))
+        return false;
+    const char *const p = url;
+    struct mtrix_buffer b = {0};
+    bool ok = false;
+    char urls[WIKT_MAX_SECTIONS][MTRIX_MAX_URL_LEN];
+    const bool listed =
+        request_bodies(1, &p, cache, &b, &ok, NULL, verbose) && ok
+        && wikt_section_urls(
+            base, term, b.p, lang, prefix, level, v, urls, n, missing);
+    free(b.p);
+    if(!listed || !*n)
+        return listed;
+    const char *pv[WIKT_MAX_SECTIONS];
+    for(size_t i = 0; i != *n; ++i)
+        pv[i] = urls[i];
+    struct mtrix_buffer bodies[WIKT_MAX_SECTIONS] = {0};
+    bool oks[WIKT_MAX_SECTIONS] = {0};
+    bool ret = request_bodies(*n, pv, cache, bodies, oks, NULL, verbose);
+    for(size_t i = 0; i != *n; ++i) {
+        if(ret && oks[i])
+            v[i].doc = parse_text(urls[i], bodies[i].p);
+        ret = ret && v[i].doc;
+        free(bodies[i].p);
+    }
+    if(!ret) {
+        for(size_t i = 0; i != *n; ++i)
+            if(v[i].doc)
+                html_release(v[i].doc);
+        *n = 0;
+    }
+    return ret;
+}
+
+bool wikt_sections_url(
+    const char *base, const char *term, char url[static MTRIX_MAX_URL_LEN]
+) {
+    char page[MTRIX_MAX_URL_LEN];
+    return url_escape(page, term)
+        && BUILD_URL(url, base, API_QUERY "&prop=sections&page=", page);
 }
 
-TidyNode wikt_next_translation_block(TidyNode node, TidyNode *list) {
-    for(;
-        (node = find_node_by_class(node, "translations-cell", true));
-        node = tidyGetNext(node)
-    ) {
-        TidyNode li = node;
-        if((li = tidyGetChild(li)) && (li = tidyGetChild(li)))
-            return *list = li, node;
+bool wikt_section_urls(
+    const char *base, const char *term, const char *list, const char *lang,
+    const char *prefix, unsigned level,
+    wikt_section v[static WIKT_MAX_SECTIONS],
+    char urls[static WIKT_MAX_SECTIONS][MTRIX_MAX_URL_LEN], size_t *n,
+    bool *missing
+) {
+    *n = 0;
+    *missing = false;
+    char url[MTRIX_MAX_URL_LEN], page[MTRIX_MAX_URL_LEN];
+    if(!(wikt_sections_url(base, term, url) && url_escape(page, term)))
+        return false;
+    cJSON *const j = parse_response(url, list, missing);
+    if(!j)
+        return *missing;
+    unsigned indices[WIKT_MAX_SECTIONS];
+    const bool selected = select_sections(
+        get_item(get_item(j, "parse"), "sections"), lang, prefix, level, v,
+        indices, n);
+    cJSON_Delete(j);
+    for(size_t i = 0; selected && i != *n; ++i) {
+        char index[16];
+        snprintf(index, sizeof(index), "%u", indices[i]);
+        if(!BUILD_URL(
+            urls[i], base,
+            API_QUERY "&prop=text&disableeditsection=1&disablelimitreport=1"
+                "&section=", index, "&page=", page
+        )) {
+            *n = 0;
+            return false;
+        }
     }
-    return *list = NULL;
+    return selected;
+}
+
+/** Checks whether the text of a translation item starts with a language. */
+static bool is_language(const char *s, const char *lang) {
+    const char *const colon = strchrnul(s, ':');
+    return strncasecmp(lang, s, (size_t)(colon - s)) == 0;
 }
 
 bool wikt_translation_is_language(TidyBuffer buf, const char *lang) {
     const char *const tag = strchrnul((char*)buf.bp, '>');
     const char *const base = tag ? tag + 1: (char*)buf.bp;
-    const char *const colon = strchrnul(base, ':');
-    return strncasecmp(lang, base, (size_t)(colon - base)) == 0;
+    return is_language(base, lang);
 }
 
 static bool node_has_id_prefix(TidyNode node, const char *p) {
@@ -92,3 +269,300 @@ bool wikt_next_section(const char *cls, const char *prefix, TidyNode *node) {
 bool wikt_next_subsection(const char *cls, const char *prefix, TidyNode *node) {
     return next_section(cls, prefix, node, true);
 }
+
+bool wikt_print_etymologies(FILE *f, TidyDoc doc, const char *lang) {
+    wikt_page page;
+    if(!wikt_parse_page(doc, &page))
+        return false;
+    TidyBuffer buf = {0};
+    TidyNode lang_sect = find_node_by_class(
+        html_index_get(doc), page.contents, WIKTIONARY_H2, true);
+    while(lang_sect) {
+        TidyNode sect = lang_sect;
+        TidyAttr lang_id = find_attr(tidyGetChild(lang_sect), "id");
+        const char *lang_text = lang_id ? tidyAttrValue(lang_id) : "?";
+        if(lang && strcasecmp(lang, lang_text) != 0) {
+            wikt_next_section(WIKTIONARY_H2, "", &lang_sect);
+            continue;
+        }
+        while(wikt_next_section(WIKTIONARY_H3, "Etymology", &sect)) {
+            if(lang_text) {
+                fprintf(f, "%s\n", lang_text);
+                lang_text = NULL;
+            }
+            wikt_print_etymology(f, doc, sect, &buf);
+        }
+        // Either the heading of the next language or `NULL`.
+        lang_sect = sect;
+    }
+    if(buf.bp)
+        tidyBufFree(&buf);
+    return true;
+}
+
+void wikt_print_etymology(
+    FILE *f, TidyDoc doc, TidyNode sect, TidyBuffer *buf
+) {
+    for(TidyNode etym = sect; (etym = tidyGetNext(etym));) {
+        if(node_has_class(etym, WIKTIONARY_HEADER))
+            break;
+        tidyNodeGetText(doc, etym, buf);
+        join_lines(buf->bp, buf->bp + buf->size);
+        fprintf(f, "  ");
+        print_unescaped(f, buf->bp);
+        fprintf(f, "\n");
+        tidyBufClear(buf);
+    }
+}
+
+bool wikt_print_translations(FILE *f, TidyDoc doc, const char *lang) {
+    wikt_page page;
+    if(!wikt_parse_page(doc, &page))
+        return false;
+    TidyBuffer buf = {0};
+    for(TidyNode lang_sect = page.contents; lang_sect;) {
+        TidyNode sect = lang_sect;
+        TidyAttr lang_id = find_attr(tidyGetChild(lang_sect), "id");
+        const char *lang_text = lang_id ? tidyAttrValue(lang_id) : "?";
+        while(wikt_next_subsection(NULL, "Translations-", &sect)) {
+            if(lang_text) {
+                fprintf(f, "%s\n", lang_text);
+                lang_text = NULL;
+            }
+            wikt_print_translation(f, doc, sect, lang, &buf);
+        }
+        lang_sect = sect;
+    }
+    if(buf.bp)
+        tidyBufFree(&buf);
+    return true;
+}
+
+/** Selectors of \ref wikt_print_translation, see \ref compile_selectors. */
+static struct {
+    /** Header of a translation element. */
+    struct html_selector head;
+    /** Items of the lists in the body of a translation element. */
+    struct html_selector items;
+    bool ok;
+} selectors;
+
+static pthread_once_t selectors_once = PTHREAD_ONCE_INIT;
+
+/** Compiles \ref selectors once, see `pthread_once`. */
+static void compile_selectors(void) {
+    selectors.ok = html_selector_compile(&selectors.head, ".NavHead")
+        && html_selector_compile(
+            &selectors.items,
+            "table.translations > tbody .translations-cell > ul > li");
+}
+
+/** Arguments of \ref print_translation_item. */
+struct translation_item {
+    FILE *f;
+    TidyDoc doc;
+    const char *lang;
+    TidyBuffer *buf;
+};
+
+/** Prints an item of a translation element, see \ref html_select_f. */
+static bool print_translation_item(void *data, TidyNode li) {
+    const struct translation_item *const d = data;
+    TidyBuffer *const buf = d->buf;
+    tidyNodeGetText(d->doc, li, buf);
+    join_lines(buf->bp, buf->bp + buf->size);
+    if(!d->lang || wikt_translation_is_language(*buf, d->lang)) {
+        fprintf(d->f, "    ");
+        print_unescaped(d->f, buf->bp);
+        fprintf(d->f, "\n");
+    }
+    tidyBufClear(buf);
+    return true;
+}
+
+void wikt_print_translation(
+    FILE *f, TidyDoc doc, TidyNode node, const char *lang, TidyBuffer *buf
+) {
+    pthread_once(&selectors_once, compile_selectors);
+    if(!selectors.ok)
+        return;
+    const struct html_index *const x = html_index_get(doc);
+    TidyNode head = html_select_first(x, &selectors.head, node);
+    if(!(head && (head = tidyGetChild(head))))
+        return;
+    tidyNodeGetText(doc, head, buf);
+    join_lines(buf->bp, buf->bp + buf->size);
+    fprintf(f, "  %s\n", buf->bp);
+    tidyBufClear(buf);
+    struct translation_item item = {
+        .f = f, .doc = doc, .lang = lang, .buf = buf,
+    };
+    html_select(x, &selectors.items, node, print_translation_item, &item);
+}
+
+/** Text accumulated in a buffer, which may not have been allocated. */
+static const char *text(const struct mtrix_buffer *b) {
+    return b->n ? b->p : "";
+}
+
+/**
+ * Advances to the first heading in a page, the equivalent of
+ * \ref wikt_parse_page.
+ */
+static bool scan_page(struct html_tokenizer *z, struct html_token *t) {
+    if(!html_tokenizer_find(z, t, 0, CONTENTS_ID, NULL))
+        return log_err("contents not found\n"), false;
+    if(!html_tokenizer_find(z, t, t->depth, NULL, WIKTIONARY_HEADER))
+        return log_err("no section found\n"), false;
+    return true;
+}
+
+/**
+ * Reads the ID of the first element in a heading, which identifies its
+ * section, and consumes the heading.
+ */
+static void scan_heading(
+    struct html_tokenizer *z, const struct html_token *h,
+    char id[static WIKT_MAX_LANG])
+{
+    struct html_token t;
+    snprintf(id, WIKT_MAX_LANG, "?");
+    if(html_tokenizer_find(z, &t, h->depth, NULL, NULL) && t.id)
+        snprintf(id, WIKT_MAX_LANG, "%.*s", (int)t.id_len, t.id);
+    html_tokenizer_skip(z, h->depth);
+}
+
+/**
+ * Prints the items in a cell of a translation table, see
+ * \ref wikt_print_translation.  The cell is consumed.
+ */
+static bool scan_translation_cell(
+    FILE *f, struct html_tokenizer *z, const struct html_token *cell,
+    const char *lang, struct mtrix_buffer *b)
+{
+    const size_t d = cell->depth;
+    struct html_token t;
+    // The list must be the first node in the cell.
+    do
+        if(!html_tokenizer_next(z, &t) || t.depth <= d)
+            return true;
+    while(html_token_is_space(&t));
+    bool ret = true;
+    const size_t list = t.depth;
+    if(t.type == HTML_TOKEN_START)
+        while(ret && html_tokenizer_next(z, &t) && list < t.depth) {
+            b->n = 0;
+            ret = html_tokenizer_text(z, &t, b);
+            if(b->n && (!lang || is_language(b->p, lang)))
+                fprintf(f, "    %s\n", b->p);
+        }
+    html_tokenizer_skip(z, d);
+    return ret;
+}
+
+/**
+ * Prints a translation element, see \ref wikt_print_translation.  The
+ * element is consumed.
+ */
+static bool scan_translation(
+    FILE *f, struct html_tokenizer *z, const struct html_token *node,
+    const char *lang, struct mtrix_buffer *b)
+{
+    const size_t d = node->depth;
+    struct html_token t;
+    // The head is the first node in the NavHead element.
+    if(!html_tokenizer_find(z, &t, d, NULL, "NavHead"))
+        return true;
+    const size_t head = t.depth;
+    if(!html_tokenizer_next(z, &t) || t.depth <= head)
+        return html_tokenizer_skip(z, d), true;
+    b->n = 0;
+    bool ret = html_tokenizer_text(z, &t, b);
+    fprintf(f, "  %s\n", text(b));
+    html_tokenizer_skip(z, head);
+    if(ret && html_tokenizer_find(z, &t, d, NULL, "translations")) {
+        const size_t table = t.depth;
+        while(ret && html_tokenizer_find(
+                z, &t, table, NULL, "translations-cell"))
+            ret = scan_translation_cell(f, z, &t, lang, b);
+    }
+    html_tokenizer_skip(z, d);
+    return ret;
+}
+
+bool wikt_scan_etymologies(
+    FILE *f, const char *html, size_t n, const char *lang
+) {
+    struct html_tokenizer z;
+    struct html_token t;
+    html_tokenizer_init(&z, html, n);
+    if(!scan_page(&z, &t))
+        return false;
+    struct mtrix_buffer b = {0};
+    char id[WIKT_MAX_LANG], cur[WIKT_MAX_LANG] = "";
+    // Whether the current language is selected and has been printed, and
+    // whether the current section is an etymology.
+    bool selected = false, printed = false, etym = false;
+    bool ret = true;
+    // Headings are siblings of the contents of their sections.
+    const size_t d = t.depth;
+    do {
+        if(t.type == HTML_TOKEN_START
+                && html_token_has_class(&t, WIKTIONARY_HEADER)) {
+            const bool h2 = html_token_has_class(&t, WIKTIONARY_H2);
+            const bool h3 = html_token_has_class(&t, WIKTIONARY_H3);
+            scan_heading(&z, &t, id);
+            if(h2) {
+                selected = !lang || strcasecmp(lang, id) == 0;
+                printed = false;
+                memcpy(cur, id, sizeof(cur));
+            }
+            etym = selected && h3 && is_prefix("Etymology", id);
+            if(etym && !printed) {
+                fprintf(f, "%s\n", cur);
+                printed = true;
+            }
+        } else if(etym) {
+            b.n = 0;
+            ret = html_tokenizer_text(&z, &t, &b);
+            if(b.n || t.type == HTML_TOKEN_START)
+                fprintf(f, "  %s\n", text(&b));
+        } else if(t.type == HTML_TOKEN_START) {
+            html_tokenizer_skip(&z, d);
+        }
+    } while(ret && html_tokenizer_next(&z, &t) && t.depth == d);
+    free(b.p);
+    return ret;
+}
+
+bool wikt_scan_translations(
+    FILE *f, const char *html, size_t n, const char *lang
+) {
+    struct html_tokenizer z;
+    struct html_token t;
+    html_tokenizer_init(&z, html, n);
+    if(!scan_page(&z, &t))
+        return false;
+    struct mtrix_buffer b = {0};
+    char cur[WIKT_MAX_LANG];
+    bool first = true, printed = false, ret = true;
+    const size_t d = t.depth;
+    do {
+        if(t.type != HTML_TOKEN_START)
+            continue;
+        if(first || html_token_has_class(&t, WIKTIONARY_H2)) {
+            scan_heading(&z, &t, cur);
+            first = printed = false;
+        } else if(t.cls && html_token_has_id_prefix(&t, "Translations-")) {
+            if(!printed) {
+                fprintf(f, "%s\n", cur);
+                printed = true;
+            }
+            ret = scan_translation(f, &z, &t, lang, &b);
+        } else {
+            html_tokenizer_skip(&z, d);
+        }
+    } while(ret && html_tokenizer_next(&z, &t) && t.depth == d);
+    free(b.p);
+    return ret;
+}
@@ -4,7 +4,10 @@
  * https://www.wiktionary.org
  */
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 
+#include "cache.h"
 #include "common.h"
 
 #include <tidy.h>
@@ -12,17 +15,34 @@
 
 /** Base URL for the service. */
 #define WIKTIONARY_BASE "https://en.wiktionary.org/wiki"
+/** URL of the MediaWiki API, see \ref wikt_request_sections. */
+#define WIKTIONARY_API "https://en.wiktionary.org/w/api.php"
 #define WIKTIONARY_HEADER "mw-heading"
 #define WIKTIONARY_H2 WIKTIONARY_HEADER "2"
 #define WIKTIONARY_H3 WIKTIONARY_HEADER "3"
 #define WIKTIONARY_H4 WIKTIONARY_HEADER "4"
 
+enum {
+    /** Maximum number of sections in \ref wikt_request_sections. */
+    WIKT_MAX_SECTIONS = 32,
+    /** Size of \ref wikt_section::lang. */
+    WIKT_MAX_LANG = 64,
+};
+
 /** Relevant elements of a page. */
 typedef struct {
     /** Main content element of the page. */
     TidyNode contents;
 } wikt_page;
 
+/** A section requested by \ref wikt_request_sections. */
+typedef struct {
+    /** Anchor of the language section which contains it, e.g. `English`. */
+    char lang[WIKT_MAX_LANG];
+    /** Contents of the section, including its heading and subsections. */
+    TidyDoc doc;
+} wikt_section;
+
 /**
  * Finds the page elements.
  * \param doc The root document.
@@ -30,14 +50,55 @@ typedef struct {
  */
 bool wikt_parse_page(TidyDoc doc, wikt_page *p);
 
-/** Finds the header of a translation element. */
-TidyNode wikt_translation_head(TidyNode node);
+/**
+ * Similar to \ref wikt_parse_page, for a document created by
+ * \ref wikt_request_sections.  `contents` is the heading of the section.
+ */
+bool wikt_parse_section(TidyDoc doc, wikt_page *p);
+
+/**
+ * Requests only some sections of a page, instead of the entire page.
+ * The list of sections is requested first, then those selected are requested
+ * concurrently, using the `parse` action of the MediaWiki API.  Selection is
+ * based on the anchors of the headings, which are the IDs used in the page.
+ * \param base URL of the API, usually \ref WIKTIONARY_API.
+ * \param lang Optional, selects only sections of this language.
+ * \param prefix Selects sections whose anchor starts with this prefix.
+ * \param level Selects only sections with this heading level, if not `0`.
+ * \param cache See \ref request_bodies.
+ * \param v Filled with the sections, in the order they appear in the page.
+ *          Their documents are released by the caller.
+ * \param n Set to the number of sections.
+ * \param missing Set if the page does not exist, in which case the function
+ *                succeeds with no sections.
+ */
+bool wikt_request_sections(
+    const char *base, const char *term, const char *lang, const char *prefix,
+    unsigned level, const struct mtrix_cache *cache,
+    wikt_section v[static WIKT_MAX_SECTIONS], size_t *n, bool *missing,
+    bool verbose);
 
-/** Finds the body of a translation element. */
-TidyNode wikt_translation_body(TidyNode node);
+/**
+ * Builds the URL of the list of sections of a page, the first request made by
+ * \ref wikt_request_sections.
+ */
+bool wikt_sections_url(
+    const char *base, const char *term, char url[static MTRIX_MAX_URL_LEN]);
 
-/** Moves forward to the next translation item. */
-TidyNode wikt_next_translation_block(TidyNode node, TidyNode *list);
+/**
+ * Selects sections from the list of sections of a page and builds their URLs,
+ * the second step of \ref wikt_request_sections.
+ * Parameters are as in \ref wikt_request_sections, but the documents in `v`
+ * are not created.
+ * \param list Response to the request for \ref wikt_sections_url.
+ * \param urls Filled with the URL of each section.
+ */
+bool wikt_section_urls(
+    const char *base, const char *term, const char *list, const char *lang,
+    const char *prefix, unsigned level,
+    wikt_section v[static WIKT_MAX_SECTIONS],
+    char urls[static WIKT_MAX_SECTIONS][MTRIX_MAX_URL_LEN], size_t *n,
+    bool *missing);
 
 /** Checks whether an item is a translation to a given language. */
 bool wikt_translation_is_language(TidyBuffer buf, const char *lang);
@@ -53,3 +114,46 @@ bool wikt_next_section(const char *cls, const char *prefix, TidyNode *node);
  * \return Whether a subsection was found.
  */
 bool wikt_next_subsection(const char *cls, const char *prefix, TidyNode *node);
+
+/**
+ * Prints the etymologies in a page, preceded by their language.
+ * \param lang Optional, only etymologies of this language are printed.
+ * \return `false` if the page elements were not found (see
+ *         \ref wikt_parse_page).
+ */
+bool wikt_print_etymologies(FILE *f, TidyDoc doc, const char *lang);
+
+/** Prints the paragraphs of an etymology section, given its heading. */
+void wikt_print_etymology(
+    FILE *f, TidyDoc doc, TidyNode sect, TidyBuffer *buf);
+
+/**
+ * Prints the translation elements in a page, preceded by the language of the
+ * entry.
+ * \param lang Optional, see \ref wikt_print_translation.
+ * \return `false` if the page elements were not found (see
+ *         \ref wikt_parse_page).
+ */
+bool wikt_print_translations(FILE *f, TidyDoc doc, const char *lang);
+
+/**
+ * Prints a translation element.
+ * Its header and items are found with \ref html_select.
+ * \param lang Optional, only translations to this language are printed.
+ */
+void wikt_print_translation(
+    FILE *f, TidyDoc doc, TidyNode node, const char *lang, TidyBuffer *buf);
+
+/**
+ * Similar to \ref wikt_print_etymologies, but reads the source of the page
+ * with \ref html_tokenizer instead of creating a document.
+ */
+bool wikt_scan_etymologies(
+    FILE *f, const char *html, size_t n, const char *lang);
+
+/**
+ * Similar to \ref wikt_print_translations, but reads the source of the page
+ * with \ref html_tokenizer instead of creating a document.
+ */
+bool wikt_scan_translations(
+    FILE *f, const char *html, size_t n, const char *lang);
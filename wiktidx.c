@@ -0,0 +1,335 @@
+#include "wiktidx.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Identifies index files. */
+static const char MAGIC[8] = "MTRXWIKT";
+
+/** Header of index files. */
+struct header {
+    char magic[sizeof(MAGIC)];
+    uint32_t version;
+    /** Unused, makes the padding explicit. */
+    uint32_t reserved;
+    /** \ref mtrix_wiktidx::n_terms */
+    uint64_t n_terms;
+    /** \ref mtrix_wiktidx::n_entries */
+    uint64_t n_entries;
+    /** \ref mtrix_wiktidx::strings_size */
+    uint64_t strings_size;
+};
+
+struct mtrix_wiktidx_record {
+    /** Offsets of the strings in \ref mtrix_wiktidx_builder::strings. */
+    size_t term, lang, etym, tr;
+};
+
+/** Element sorted by \ref mtrix_wiktidx_save. */
+struct sort_item {
+    const char *term;
+    /** Index of the record, which keeps the sort stable. */
+    size_t i;
+};
+
+/** Index being written by \ref mtrix_wiktidx_save. */
+struct output {
+    struct mtrix_wiktidx_term *terms;
+    size_t n_terms;
+    struct mtrix_wiktidx_entry *entries;
+    size_t n_entries;
+    struct mtrix_buffer strings;
+    /** Contents of the last entry, which can still be merged. */
+    struct mtrix_buffer etym, tr;
+};
+
+/** Appends `n` bytes, `false` if memory could not be allocated. */
+static bool append(struct mtrix_buffer *b, const char *p, size_t n);
+
+/** Appends a string and its null character, setting `s` to its location. */
+static bool append_str(
+    struct mtrix_buffer *b, const char *p, size_t n,
+    struct mtrix_wiktidx_str *s);
+
+/** Whether the buffer contains `n` bytes at `p` as a complete line. */
+static bool has_line(const struct mtrix_buffer *b, const char *p, size_t n);
+
+/** Orders items by term, then by index, as required by `qsort`. */
+static int cmp_item(const void *lhs, const void *rhs);
+
+/** Adds a record to the output, possibly merging it with the last entry. */
+static bool output_add(
+    struct output *o, const struct mtrix_wiktidx_builder *b,
+    const struct mtrix_wiktidx_record *r);
+
+/** Moves the contents of the last entry to the string table. */
+static bool output_flush(struct output *o);
+
+/** Writes the index to `fd`. */
+static bool output_write(const struct output *o, int fd);
+
+bool mtrix_wiktidx_open(struct mtrix_wiktidx *x, const char *path) {
+    *x = (struct mtrix_wiktidx){0};
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1)
+        return log_errno("open: %s", path), false;
+    bool ret = false;
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        log_errno("fstat: %s", path);
+        goto end;
+    }
+    struct header h;
+    if((size_t)st.st_size < sizeof(h)) {
+        log_err("%s: invalid index\n", path);
+        goto end;
+    }
+    x->map_size = (size_t)st.st_size;
+    void *const m = mmap(NULL, x->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(m == MAP_FAILED) {
+        log_errno("mmap: %s", path);
+        goto end;
+    }
+    x->map = m;
+    memcpy(&h, m, sizeof(h));
+    if(memcmp(h.magic, MAGIC, sizeof(MAGIC))) {
+        log_err("%s: invalid index\n", path);
+        goto end;
+    }
+    if(h.version != MTRIX_WIKTIDX_VERSION) {
+        log_err("%s: unsupported version\n", path);
+        goto end;
+    }
+    // The file is trusted to have been produced by mtrix_wiktidx_save, only
+    // inexpensive consistency checks are performed.
+    const uint64_t size = sizeof(h)
+        + h.n_terms * sizeof(*x->terms)
+        + h.n_entries * sizeof(*x->entries)
+        + h.strings_size;
+    if(size != x->map_size) {
+        log_err("%s: invalid size\n", path);
+        goto end;
+    }
+    x->n_terms = (size_t)h.n_terms;
+    x->n_entries = (size_t)h.n_entries;
+    x->strings_size = (size_t)h.strings_size;
+    x->terms = (const struct mtrix_wiktidx_term*)((const char*)m + sizeof(h));
+    x->entries = (const struct mtrix_wiktidx_entry*)(x->terms + x->n_terms);
+    x->strings = (const char*)(x->entries + x->n_entries);
+    if(x->strings_size && x->strings[x->strings_size - 1]) {
+        log_err("%s: invalid string table\n", path);
+        goto end;
+    }
+    // Lookups touch a few pages in each section.
+    posix_madvise(x->map, x->map_size, POSIX_MADV_RANDOM);
+    ret = true;
+end:
+    if(close(fd) == -1)
+        log_errno("close: %s", path), ret = false;
+    if(!ret)
+        mtrix_wiktidx_close(x);
+    return ret;
+}
+
+bool mtrix_wiktidx_close(struct mtrix_wiktidx *x) {
+    bool ret = true;
+    if(x->map && munmap(x->map, x->map_size) == -1)
+        log_errno("munmap"), ret = false;
+    *x = (struct mtrix_wiktidx){0};
+    return ret;
+}
+
+size_t mtrix_wiktidx_find(
+    const struct mtrix_wiktidx *x, const char *term,
+    const struct mtrix_wiktidx_entry **v
+) {
+    size_t b = 0, e = x->n_terms;
+    while(b != e) {
+        const size_t m = b + (e - b) / 2;
+        const struct mtrix_wiktidx_term *const t = x->terms + m;
+        const int c = strcmp(mtrix_wiktidx_str(x, t->term), term);
+        if(c < 0)
+            b = m + 1;
+        else if(c > 0)
+            e = m;
+        else
+            return *v = x->entries + t->first, (size_t)t->n;
+    }
+    return 0;
+}
+
+bool mtrix_wiktidx_add(
+    struct mtrix_wiktidx_builder *b, const char *term, const char *lang,
+    const char *etym, const char *tr
+) {
+    if(b->n == b->cap) {
+        const size_t cap = b->cap ? 2 * b->cap : 1024;
+        struct mtrix_wiktidx_record *const v =
+            realloc(b->v, cap * sizeof(*v));
+        if(!v)
+            return log_errno("realloc"), false;
+        b->v = v;
+        b->cap = cap;
+    }
+    const char *const s[] = {term, lang, etym, tr};
+    size_t off[4];
+    for(size_t i = 0; i != 4; ++i) {
+        off[i] = b->strings.n;
+        if(!append(&b->strings, s[i], strlen(s[i]) + 1))
+            return false;
+    }
+    b->v[b->n++] = (struct mtrix_wiktidx_record){
+        .term = off[0], .lang = off[1], .etym = off[2], .tr = off[3]};
+    return true;
+}
+
+bool mtrix_wiktidx_save(struct mtrix_wiktidx_builder *b, const char *path) {
+    struct sort_item *const v = calloc(b->n, sizeof(*v));
+    struct output o = {
+        .terms = calloc(b->n, sizeof(*o.terms)),
+        .entries = calloc(b->n, sizeof(*o.entries)),
+    };
+    char tmp[MTRIX_MAX_PATH] = {0};
+    bool ret = false;
+    if(b->n && !(v && o.terms && o.entries)) {
+        log_errno("calloc");
+        goto end;
+    }
+    for(size_t i = 0; i != b->n; ++i)
+        v[i] = (struct sort_item){.term = b->strings.p + b->v[i].term, .i = i};
+    if(b->n)
+        qsort(v, b->n, sizeof(*v), cmp_item);
+    for(size_t i = 0; i != b->n; ++i)
+        if(!output_add(&o, b, b->v + v[i].i))
+            goto end;
+    if(!(output_flush(&o) && join_path(tmp, 2, path, ".XXXXXX")))
+        goto end;
+    const int fd = mkstemp(tmp);
+    if(fd == -1) {
+        log_errno("mkstemp: %s", tmp);
+        goto end;
+    }
+    ret = fchmod(fd, 0644) != -1 || (log_errno("fchmod: %s", tmp), false);
+    ret = ret && output_write(&o, fd);
+    if(close(fd) == -1)
+        log_errno("close: %s", tmp), ret = false;
+    // Concurrent readers see either the previous file or the complete new one.
+    if(ret && rename(tmp, path) == -1)
+        log_errno("rename: %s", path), ret = false;
+    if(!ret && unlink(tmp) == -1)
+        log_errno("unlink: %s", tmp);
+end:
+    free(o.tr.p);
+    free(o.etym.p);
+    free(o.strings.p);
+    free(o.entries);
+    free(o.terms);
+    free(v);
+    return ret;
+}
+
+void mtrix_wiktidx_builder_destroy(struct mtrix_wiktidx_builder *b) {
+    free(b->strings.p);
+    free(b->v);
+    *b = (struct mtrix_wiktidx_builder){0};
+}
+
+bool append(struct mtrix_buffer *b, const char *p, size_t n) {
+    if(!n || mtrix_buffer_append(p, 1, n, b) == n)
+        return true;
+    return log_err("%s: failed to allocate memory\n", __func__), false;
+}
+
+bool append_str(
+    struct mtrix_buffer *b, const char *p, size_t n,
+    struct mtrix_wiktidx_str *s
+) {
+    *s = (struct mtrix_wiktidx_str){.off = b->n, .len = n};
+    return append(b, p, n) && append(b, "", 1);
+}
+
+bool has_line(const struct mtrix_buffer *b, const char *p, size_t n) {
+    if(!b->p)
+        return false;
+    for(const char *l = b->p, *const e = l + b->n; l != e;) {
+        const char *const nl = memchr(l, '\n', (size_t)(e - l));
+        const char *const le = nl ? nl : e;
+        if((size_t)(le - l) == n && !memcmp(l, p, n))
+            return true;
+        l = nl ? nl + 1 : e;
+    }
+    return false;
+}
+
+int cmp_item(const void *lhs, const void *rhs) {
+    const struct sort_item *const l = lhs, *const r = rhs;
+    const int c = strcmp(l->term, r->term);
+    return c ? c : (l->i > r->i) - (l->i < r->i);
+}
+
+bool output_add(
+    struct output *o, const struct mtrix_wiktidx_builder *b,
+    const struct mtrix_wiktidx_record *r
+) {
+    const char *const s = b->strings.p;
+    const char *const term = s + r->term, *const lang = s + r->lang;
+    struct mtrix_wiktidx_term *t =
+        o->n_terms ? o->terms + o->n_terms - 1 : NULL;
+    const bool same_term = t && !strcmp(o->strings.p + t->term.off, term);
+    const bool merge = same_term
+        && !strcmp(o->strings.p + o->entries[o->n_entries - 1].lang.off, lang);
+    if(!merge && !output_flush(o))
+        return false;
+    if(!same_term) {
+        t = o->terms + o->n_terms++;
+        *t = (struct mtrix_wiktidx_term){.first = o->n_entries};
+        if(!append_str(&o->strings, term, strlen(term), &t->term))
+            return false;
+    }
+    if(!merge) {
+        ++t->n;
+        struct mtrix_wiktidx_entry *const e = o->entries + o->n_entries++;
+        if(!append_str(&o->strings, lang, strlen(lang), &e->lang))
+            return false;
+    }
+    for(const char *p = s + r->etym; *p;) {
+        const size_t n = strcspn(p, "\n");
+        if(n && !has_line(&o->etym, p, n)
+                && !(append(&o->etym, p, n) && append(&o->etym, "\n", 1)))
+            return false;
+        p += n + !!p[n];
+    }
+    const char *const tr = s + r->tr;
+    return append(&o->tr, tr, strlen(tr));
+}
+
+bool output_flush(struct output *o) {
+    if(!o->n_entries)
+        return true;
+    struct mtrix_wiktidx_entry *const e = o->entries + o->n_entries - 1;
+    const bool ret =
+        append_str(&o->strings, o->etym.p ? o->etym.p : "", o->etym.n, &e->etym)
+        && append_str(&o->strings, o->tr.p ? o->tr.p : "", o->tr.n, &e->tr);
+    o->etym.n = o->tr.n = 0;
+    return ret;
+}
+
+bool output_write(const struct output *o, int fd) {
+    struct header h = {
+        .version = MTRIX_WIKTIDX_VERSION,
+        .n_terms = o->n_terms,
+        .n_entries = o->n_entries,
+        .strings_size = o->strings.n,
+    };
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    return write_all(fd, &h, sizeof(h))
+        && write_all(fd, o->terms, o->n_terms * sizeof(*o->terms))
+        && write_all(fd, o->entries, o->n_entries * sizeof(*o->entries))
+        && write_all(fd, o->strings.p, o->strings.n);
+}
@@ -0,0 +1,134 @@
+#ifndef MACHINATRIX_WIKTIDX_H
+#define MACHINATRIX_WIKTIDX_H
+
+/**
+ * \file
+ * Offline index of Wiktionary etymologies and translations.
+ * Built from a local extract of Wiktionary (see `mkwiktidx`) and used by the
+ * `wikt` and `tr` commands instead of requesting pages.
+ *
+ * The index is a binary file which is mapped into memory and used without any
+ * processing.  Its contents are:
+ *
+ * - a header: an 8-byte magic string and \ref MTRIX_WIKTIDX_VERSION, followed
+ *   by the number of terms and entries and the size of the string table (all
+ *   integers are in native byte order),
+ * - \ref mtrix_wiktidx::terms, sorted by term (compared as bytes),
+ * - \ref mtrix_wiktidx::entries, grouped by term,
+ * - the string table, where each string is followed by a null character.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils.h"
+
+/** Version of the binary format, incremented on incompatible changes. */
+#define MTRIX_WIKTIDX_VERSION 1
+
+/** A string in \ref mtrix_wiktidx::strings. */
+struct mtrix_wiktidx_str {
+    /** Offset of the first character. */
+    uint64_t off;
+    /** Length, excluding the null character. */
+    uint64_t len;
+};
+
+/** Information about a term in one language. */
+struct mtrix_wiktidx_entry {
+    /** Name of the language, e.g. `English`. */
+    struct mtrix_wiktidx_str lang;
+    /** Etymology paragraphs, each followed by a new-line character. */
+    struct mtrix_wiktidx_str etym;
+    /**
+     * Translations, grouped by sense.
+     * Each group is a line containing the sense, followed by one line for each
+     * language in the format `\t<language>: <translations>`.  All lines are
+     * followed by a new-line character.
+     */
+    struct mtrix_wiktidx_str tr;
+};
+
+/** A term and the location of its entries. */
+struct mtrix_wiktidx_term {
+    struct mtrix_wiktidx_str term;
+    /** Index of the first entry in \ref mtrix_wiktidx::entries. */
+    uint64_t first;
+    /** Number of entries, in the order they appear in the source. */
+    uint64_t n;
+};
+
+/** An index loaded from a file. */
+struct mtrix_wiktidx {
+    const struct mtrix_wiktidx_term *terms;
+    size_t n_terms;
+    const struct mtrix_wiktidx_entry *entries;
+    size_t n_entries;
+    /** String table. */
+    const char *strings;
+    size_t strings_size;
+    /** Mapping of the file. */
+    void *map;
+    /** Size of \ref map. */
+    size_t map_size;
+};
+
+/** An entry being built, see \ref mtrix_wiktidx_builder. */
+struct mtrix_wiktidx_record;
+
+/** Accumulates entries to create an index, see \ref mtrix_wiktidx_save. */
+struct mtrix_wiktidx_builder {
+    /** Strings of all records, each followed by a null character. */
+    struct mtrix_buffer strings;
+    struct mtrix_wiktidx_record *v;
+    size_t n, cap;
+};
+
+/** Maps the index file at `path`. */
+bool mtrix_wiktidx_open(struct mtrix_wiktidx *x, const char *path);
+
+/** Releases all resources associated with the index. */
+bool mtrix_wiktidx_close(struct mtrix_wiktidx *x);
+
+/**
+ * Finds the entries for a term, in `O(log n)` time.
+ * \param v Set to the first entry.
+ * \return The number of entries, `0` if the term is not in the index.
+ */
+size_t mtrix_wiktidx_find(
+    const struct mtrix_wiktidx *x, const char *term,
+    const struct mtrix_wiktidx_entry **v);
+
+/** Accesses a string, which is null-terminated. */
+static inline const char *mtrix_wiktidx_str(
+    const struct mtrix_wiktidx *x, struct mtrix_wiktidx_str s);
+
+/**
+ * Adds an entry, with the same format as \ref mtrix_wiktidx_entry.
+ * Etymologies can also contain empty lines, which are removed, and the last
+ * one can omit the new-line character.  Consecutive entries for the same term
+ * and language (e.g. for each part of speech of a word) are merged, omitting
+ * repeated etymologies.
+ */
+bool mtrix_wiktidx_add(
+    struct mtrix_wiktidx_builder *b, const char *term, const char *lang,
+    const char *etym, const char *tr);
+
+/**
+ * Writes all entries added to `b` as an index file.
+ * The file is written to a temporary location and renamed, so it is replaced
+ * atomically if it exists.
+ */
+bool mtrix_wiktidx_save(struct mtrix_wiktidx_builder *b, const char *path);
+
+/** Releases all resources associated with the builder. */
+void mtrix_wiktidx_builder_destroy(struct mtrix_wiktidx_builder *b);
+
+static inline const char *mtrix_wiktidx_str(
+    const struct mtrix_wiktidx *x, struct mtrix_wiktidx_str s
+) {
+    return x->strings + s.off;
+}
+
+#endif